@@ -172,7 +172,7 @@ namespace webserver {
 		{ SettingsManager::TLS_PORT, { 1, 65535 } },
 
 		{ SettingsManager::MAX_HASHING_THREADS, { 1, 100 } },
-		{ SettingsManager::HASHERS_PER_VOLUME, { 1, 100 } },
+		{ SettingsManager::HASHERS_PER_VOLUME, { 0, 100 } },
 
 		{ SettingsManager::MAX_COMPRESSION, { 0, 9 } },
 		{ SettingsManager::MINIMUM_SEARCH_INTERVAL, { 5, 1000 } },
@@ -115,7 +115,7 @@ tstring ADLSearch::SizeTypeToDisplayString(ADLSearch::SizeType t) {
 	}
 }
 
-int64_t ADLSearch::GetSizeBase() {
+int64_t ADLSearch::GetSizeBase() const {
 	switch(typeFileSize) {
 		default:
 		case SizeBytes:		return (int64_t)1;
@@ -126,7 +126,7 @@ int64_t ADLSearch::GetSizeBase() {
 	}
 }
 
-bool ADLSearch::searchAll(const string& s) {
+bool ADLSearch::searchAll(const string& s) const {
 	return match.match(s);
 }
 
@@ -156,14 +156,8 @@ void ADLSearch::setDestDir(const string& aDestDir) noexcept {
 	}
 }
 
-bool ADLSearch::matchesFile(const string& f, const string& fp, int64_t size) {
-	// Check status
-	if(!isActive) {
-		return false;
-	}
-
-	// Check size for files
-	if(size >= 0 && (sourceType == OnlyFile || sourceType == FullPath)) {
+bool ADLSearch::matchesSize(int64_t size) const noexcept {
+	if(size >= 0) {
 		if(minFileSize >= 0 && size < minFileSize * GetSizeBase()) {
 			// Too small
 			return false;
@@ -174,6 +168,20 @@ bool ADLSearch::matchesFile(const string& f, const string& fp, int64_t size) {
 		}
 	}
 
+	return true;
+}
+
+bool ADLSearch::matchesFile(const string& f, const string& fp, int64_t size) const {
+	// Check status
+	if(!isActive) {
+		return false;
+	}
+
+	// Check size for files
+	if((sourceType == OnlyFile || sourceType == FullPath) && !matchesSize(size)) {
+		return false;
+	}
+
 	// Do search
 	switch(sourceType) {
 	default:
@@ -183,7 +191,7 @@ bool ADLSearch::matchesFile(const string& f, const string& fp, int64_t size) {
 	}
 }
 
-bool ADLSearch::matchesDirectory(const string& d) {
+bool ADLSearch::matchesDirectory(const string& d) const {
 	// Check status
 	if(!isActive) {
 		return false;
@@ -196,6 +204,544 @@ bool ADLSearch::matchesDirectory(const string& d) {
 	return searchAll(d);
 }
 
+// Substring patterns and regular expressions of the searches matching the same text (file name, full path or directory name)
+class ADLSearchMatcher::Matcher {
+public:
+	Matcher(bool aCheckSize) : checkSize(aCheckSize) { }
+
+	void add(size_t aIndex, const ADLSearch& aSearch) noexcept {
+		if (aSearch.match.getMethod() == StringMatch::PARTIAL) {
+			addPartial(aIndex, aSearch);
+		} else {
+			addRegex(aIndex, aSearch);
+		}
+	}
+
+	void compile() noexcept {
+		lowerLiterals.compile();
+		exactLiterals.compile();
+	}
+
+	bool empty() const noexcept {
+		return partialSearches.empty() && regexSearches.empty();
+	}
+
+	void match(const string& aText, int64_t aSize, ResultList& results_) noexcept {
+		if (aText.empty()) {
+			return;
+		}
+
+		generation++;
+		for (auto s: patternlessSearches) {
+			if (!checkSize || partialSearches[s].search->matchesSize(aSize)) {
+				results_.push_back(partialSearches[s].index);
+			}
+		}
+
+		if (!lowerLiterals.empty()) {
+			lowerLiterals.scan(Text::toLower(aText), generation, [&](uint32_t aUser) {
+				onLiteralFound(aUser, aSize, results_);
+			});
+		}
+
+		if (!exactLiterals.empty()) {
+			exactLiterals.scan(aText, generation, [&](uint32_t aUser) {
+				onLiteralFound(aUser, aSize, results_);
+			});
+		}
+
+		// Evaluate the expressions whose literals were found (once per text)
+		for (const auto& r: regexSearches) {
+			auto& expression = expressions[r.expression];
+			if ((expression.filtered && expression.found != generation) || (checkSize && !r.search->matchesSize(aSize))) {
+				continue;
+			}
+
+			if (expression.evaluated != generation) {
+				expression.evaluated = generation;
+				expression.matched = expression.search->searchAll(aText);
+			}
+
+			if (expression.matched) {
+				results_.push_back(r.index);
+			}
+		}
+	}
+private:
+	// Aho-Corasick automaton without a limit for the number of patterns
+	class Automaton {
+	public:
+		explicit Automaton(const StringList& aPatterns) noexcept {
+			// Character classes
+			memset(charClasses, 0, sizeof(charClasses));
+			for (const auto& p: aPatterns) {
+				for (auto c: p) {
+					auto& charClass = charClasses[static_cast<uint8_t>(c)];
+					if (charClass == 0) {
+						charClass = static_cast<uint8_t>(classCount++);
+					}
+				}
+			}
+
+			// Build the trie (0 = no transition, the root state can't be a target)
+			vector<vector<uint32_t>> stateOutputs(1);
+			transitions.resize(classCount);
+			for (uint32_t i = 0; i < aPatterns.size(); ++i) {
+				uint32_t state = 0;
+				for (auto c: aPatterns[i]) {
+					auto pos = state * classCount + charClasses[static_cast<uint8_t>(c)];
+					if (transitions[pos] == 0) {
+						transitions[pos] = static_cast<uint32_t>(stateOutputs.size());
+						stateOutputs.emplace_back();
+						transitions.resize(stateOutputs.size() * classCount);
+					}
+
+					state = transitions[pos];
+				}
+
+				stateOutputs[state].push_back(i);
+			}
+
+			// Failure links (breadth-first), convert the trie into a complete transition table
+			vector<uint32_t> failures(stateOutputs.size());
+			deque<uint32_t> queue;
+			for (size_t c = 0; c < classCount; ++c) {
+				if (transitions[c] != 0) {
+					queue.push_back(transitions[c]);
+				}
+			}
+
+			while (!queue.empty()) {
+				auto state = queue.front();
+				queue.pop_front();
+
+				const auto& failureOutputs = stateOutputs[failures[state]];
+				stateOutputs[state].insert(stateOutputs[state].end(), failureOutputs.begin(), failureOutputs.end());
+				for (size_t c = 0; c < classCount; ++c) {
+					auto& next = transitions[state * classCount + c];
+					if (next != 0) {
+						failures[next] = transitions[failures[state] * classCount + c];
+						queue.push_back(next);
+					} else {
+						next = transitions[failures[state] * classCount + c];
+					}
+				}
+			}
+
+			// Flatten the outputs
+			outputStarts.reserve(stateOutputs.size() + 1);
+			for (const auto& o: stateOutputs) {
+				outputStarts.push_back(static_cast<uint32_t>(outputs.size()));
+				outputs.insert(outputs.end(), o.begin(), o.end());
+			}
+
+			outputStarts.push_back(static_cast<uint32_t>(outputs.size()));
+		}
+
+		// Call aF(patternIndex) for every occurrence
+		template<class F>
+		void scan(const string& aText, F&& aF) const noexcept {
+			uint32_t state = 0;
+			for (auto c: aText) {
+				state = transitions[state * classCount + charClasses[static_cast<uint8_t>(c)]];
+				for (auto i = outputStarts[state]; i < outputStarts[state + 1]; ++i) {
+					aF(outputs[i]);
+				}
+			}
+		}
+	private:
+		uint8_t charClasses[256];
+		size_t classCount = 1;
+
+		// state * classCount + charClass
+		vector<uint32_t> transitions;
+
+		// Patterns ending in each state
+		vector<uint32_t> outputStarts;
+		vector<uint32_t> outputs;
+	};
+
+	// Distinct literals and the searches requiring each of them
+	class Literals {
+	public:
+		void add(const string& aLiteral, uint32_t aUser) noexcept {
+			auto i = find(literals.begin(), literals.end(), aLiteral);
+			if (i == literals.end()) {
+				literals.push_back(aLiteral);
+				users.emplace_back();
+				i = literals.end() - 1;
+			}
+
+			users[distance(literals.begin(), i)].push_back(aUser);
+		}
+
+		void compile() noexcept {
+			if (!literals.empty()) {
+				automaton.reset(new Automaton(literals));
+				generations.resize(literals.size());
+			}
+		}
+
+		bool empty() const noexcept {
+			return literals.empty();
+		}
+
+		// Call aF(user) once for each user of the literals found from the text
+		template<class F>
+		void scan(const string& aText, uint32_t aGeneration, F&& aF) noexcept {
+			automaton->scan(aText, [&](uint32_t aLiteral) {
+				if (generations[aLiteral] == aGeneration) {
+					return;
+				}
+
+				generations[aLiteral] = aGeneration;
+				for (auto u: users[aLiteral]) {
+					aF(u);
+				}
+			});
+		}
+	private:
+		StringList literals;
+		vector<vector<uint32_t>> users;
+		unique_ptr<Automaton> automaton;
+
+		// Generation of the text where each literal was last found
+		vector<uint32_t> generations;
+	};
+
+	// Literal users with this flag are expressions, partial searches otherwise
+	static const uint32_t REGEX_USER = 0x80000000;
+
+	struct PartialSearch {
+		PartialSearch(size_t aIndex, const ADLSearch* aSearch) : index(aIndex), search(aSearch) { }
+
+		size_t index;
+		const ADLSearch* search;
+
+		uint32_t patterns = 0;
+
+		// Number of different patterns found from the current text
+		uint32_t found = 0;
+		uint32_t generation = 0;
+	};
+
+	// Distinct expression that may be used by multiple searches
+	struct Expression {
+		Expression(const ADLSearch* aSearch, bool aFiltered) : search(aSearch), filtered(aFiltered) { }
+
+		// The first search using the expression
+		const ADLSearch* search;
+
+		// The expression is evaluated only if its literal is found from the text
+		bool filtered;
+
+		// Generations of the text where the literal was found and where the expression was evaluated
+		uint32_t found = 0;
+		uint32_t evaluated = 0;
+		bool matched = false;
+	};
+
+	struct RegexSearch {
+		RegexSearch(size_t aIndex, const ADLSearch* aSearch, uint32_t aExpression) : index(aIndex), search(aSearch), expression(aExpression) { }
+
+		size_t index;
+		const ADLSearch* search;
+		uint32_t expression;
+	};
+
+	void addPartial(size_t aIndex, const ADLSearch& aSearch) noexcept {
+		auto user = static_cast<uint32_t>(partialSearches.size());
+		partialSearches.emplace_back(aIndex, &aSearch);
+
+		// The same pattern may be listed multiple times
+		StringList patterns;
+		for (const auto& p: aSearch.match.getStringSearch()->getPatterns()) {
+			if (find(patterns.begin(), patterns.end(), p.str()) == patterns.end()) {
+				patterns.push_back(p.str());
+				lowerLiterals.add(p.str(), user);
+			}
+		}
+
+		partialSearches.back().patterns = static_cast<uint32_t>(patterns.size());
+		if (patterns.empty()) {
+			// Matches everything
+			patternlessSearches.push_back(user);
+		}
+	}
+
+	void addRegex(size_t aIndex, const ADLSearch& aSearch) noexcept {
+		auto regex = aSearch.match.getRegex();
+		if (regex && regex->empty()) {
+			// Invalid expression, never matches
+			return;
+		}
+
+		auto expression = find_if(expressions.begin(), expressions.end(), [&](const Expression& e) { return e.search->match == aSearch.match; });
+		if (expression == expressions.end()) {
+			auto user = static_cast<uint32_t>(expressions.size()) | REGEX_USER;
+
+			string literal;
+			bool caseSensitive = true;
+			if (regex && getRequiredLiteral(*regex, literal, caseSensitive)) {
+				(caseSensitive ? exactLiterals : lowerLiterals).add(literal, user);
+			}
+
+			expressions.emplace_back(&aSearch, !literal.empty());
+			expression = expressions.end() - 1;
+		}
+
+		regexSearches.emplace_back(aIndex, &aSearch, static_cast<uint32_t>(distance(expressions.begin(), expression)));
+	}
+
+	// Finds the longest string that must be included in every match of the expression (only literal characters
+	// that aren't inside groups or followed by a quantifier are considered)
+	// Returns false if such string can't be determined
+	static bool getRequiredLiteral(const boost::regex& aRegex, string& literal_, bool& caseSensitive_) noexcept {
+		if (aRegex.flags() & boost::regex::mod_x) {
+			return false;
+		}
+
+		const auto& pattern = aRegex.str();
+		caseSensitive_ = (aRegex.flags() & boost::regex::icase) == 0;
+
+		string current;
+		auto endLiteral = [&] {
+			if (current.size() > literal_.size()) {
+				literal_ = current;
+			}
+
+			current.clear();
+		};
+
+		// Returns the position after the character class starting from aPos or string::npos
+		auto skipClass = [&pattern](size_t aPos) {
+			auto i = aPos + 1;
+			if (i < pattern.size() && pattern[i] == '^') {
+				i++;
+			}
+
+			if (i < pattern.size() && pattern[i] == ']') {
+				i++;
+			}
+
+			for (; i < pattern.size(); ++i) {
+				if (pattern[i] == '\\') {
+					i++;
+				} else if (pattern[i] == '[' && i + 1 < pattern.size() && (pattern[i + 1] == ':' || pattern[i + 1] == '=' || pattern[i + 1] == '.')) {
+					// [:alpha:]
+					i = pattern.find(string(1, pattern[i + 1]) + "]", i + 2);
+					if (i == string::npos) {
+						return i;
+					}
+
+					i++;
+				} else if (pattern[i] == ']') {
+					return i + 1;
+				}
+			}
+
+			return string::npos;
+		};
+
+		for (size_t i = 0; i < pattern.size();) {
+			auto c = pattern[i];
+			if (c == '|') {
+				// Alternatives at the top level
+				return false;
+			} else if (c == '\\') {
+				if (i + 1 == pattern.size()) {
+					return false;
+				}
+
+				auto escaped = pattern[i + 1];
+				i += 2;
+				if (escaped == 'Q') {
+					return false;
+				}
+
+				if (isalnum(static_cast<uint8_t>(escaped)) || escaped == '<' || escaped == '>' || escaped == '\'' || escaped == '`' || (escaped & 0x80)) {
+					// Character classes, anchors, backreferences and character codes
+					// Arguments in braces are skipped in the same way as quantifiers
+					endLiteral();
+					if (escaped == 'c' && i < pattern.size()) {
+						// Control character
+						i++;
+					} else if ((escaped == 'k' || escaped == 'g') && i < pattern.size() && (pattern[i] == '<' || pattern[i] == '\'')) {
+						// Named backreference
+						i = pattern.find(pattern[i] == '<' ? '>' : '\'', i + 1);
+						if (i == string::npos) {
+							return false;
+						}
+
+						i++;
+					} else if (escaped == 'g' && i < pattern.size() && pattern[i] == '-') {
+						i++;
+					}
+
+					while (i < pattern.size() && isalnum(static_cast<uint8_t>(pattern[i]))) {
+						i++;
+					}
+				} else {
+					current += escaped;
+				}
+			} else if (c == '[') {
+				endLiteral();
+				i = skipClass(i);
+				if (i == string::npos) {
+					return false;
+				}
+			} else if (c == '(') {
+				if (pattern.compare(i, 2, "(?") == 0) {
+					// Inline modifiers may be anywhere in the expression
+					auto flagsEnd = pattern.find_first_not_of("imsx-", i + 2);
+					if (flagsEnd != string::npos && (pattern[flagsEnd] == ':' || pattern[flagsEnd] == ')')) {
+						auto flags = pattern.substr(i + 2, flagsEnd - i - 2);
+						if (flags.find('x') != string::npos) {
+							// Whitespace isn't literal
+							return false;
+						}
+
+						if (flags.find('i') != string::npos) {
+							caseSensitive_ = false;
+						}
+					}
+				}
+
+				// Skip the group
+				endLiteral();
+				int depth = 0;
+				for (; i < pattern.size(); ++i) {
+					if (pattern[i] == '\\') {
+						i++;
+					} else if (pattern[i] == '[') {
+						i = skipClass(i);
+						if (i == string::npos) {
+							return false;
+						}
+
+						i--;
+					} else if (pattern[i] == '(') {
+						depth++;
+					} else if (pattern[i] == ')' && --depth == 0) {
+						break;
+					}
+				}
+
+				if (i >= pattern.size()) {
+					return false;
+				}
+
+				i++;
+			} else if (c == '*' || c == '+' || c == '?' || c == '{') {
+				// The previous character is optional or repeated
+				if (!current.empty()) {
+					current.pop_back();
+				}
+
+				endLiteral();
+				if (c == '{') {
+					i = pattern.find('}', i);
+					if (i == string::npos) {
+						return false;
+					}
+				}
+
+				i++;
+			} else if (c == '.' || c == '^' || c == '$' || (c & 0x80)) {
+				// Multibyte characters may be matched differently in case-insensitive mode
+				endLiteral();
+				i++;
+			} else {
+				current += c;
+				i++;
+			}
+		}
+
+		endLiteral();
+
+		if (!caseSensitive_) {
+			// The text is converted to lowercase in the same way
+			literal_ = Text::toLower(literal_);
+		}
+
+		return !literal_.empty();
+	}
+
+	void onLiteralFound(uint32_t aUser, int64_t aSize, ResultList& results_) noexcept {
+		if (aUser & REGEX_USER) {
+			expressions[aUser & ~REGEX_USER].found = generation;
+			return;
+		}
+
+		auto& partial = partialSearches[aUser];
+		if (partial.generation != generation) {
+			partial.generation = generation;
+			partial.found = 0;
+		}
+
+		if (++partial.found == partial.patterns && (!checkSize || partial.search->matchesSize(aSize))) {
+			results_.push_back(partial.index);
+		}
+	}
+
+	const bool checkSize;
+	uint32_t generation = 0;
+
+	// Patterns of the partial searches and the literals of case-insensitive expressions (matched against lowercase text)
+	Literals lowerLiterals;
+
+	// Literals of case-sensitive expressions
+	Literals exactLiterals;
+
+	vector<PartialSearch> partialSearches;
+	vector<uint32_t> patternlessSearches;
+
+	vector<Expression> expressions;
+	vector<RegexSearch> regexSearches;
+};
+
+ADLSearchMatcher::ADLSearchMatcher(const vector<ADLSearch>& aSearches) noexcept :
+	fileNames(new Matcher(true)), fullPaths(new Matcher(true)), directories(new Matcher(false)) {
+
+	for (size_t i = 0; i < aSearches.size(); ++i) {
+		const auto& search = aSearches[i];
+		if (!search.isActive) {
+			continue;
+		}
+
+		switch (search.sourceType) {
+			case ADLSearch::OnlyFile: fileNames->add(i, search); break;
+			case ADLSearch::FullPath: fullPaths->add(i, search); break;
+			case ADLSearch::OnlyDirectory: directories->add(i, search); break;
+			default: break;
+		}
+	}
+
+	fileNames->compile();
+	fullPaths->compile();
+	directories->compile();
+}
+
+ADLSearchMatcher::~ADLSearchMatcher() { }
+
+void ADLSearchMatcher::matchFile(const string& aName, const string& aAdcPath, int64_t aSize, ResultList& results_) noexcept {
+	results_.clear();
+	fileNames->match(aName, aSize, results_);
+
+	if (!fullPaths->empty()) {
+		// Use NMDC path for matching due to compatibility reasons
+		fullPaths->match(Util::toNmdcFile(aAdcPath + aName), aSize, results_);
+	}
+
+	sort(results_.begin(), results_.end());
+}
+
+void ADLSearchMatcher::matchDirectory(const string& aName, ResultList& results_) noexcept {
+	results_.clear();
+	directories->match(aName, -1, results_);
+	sort(results_.begin(), results_.end());
+}
+
 // Constructor/destructor
 ADLSearchManager::ADLSearchManager() : running(0), user(HintedUser()), dirty(false) {
 	load();
@@ -379,7 +925,7 @@ bool ADLSearchManager::updateCollection(ADLSearch& search, int index) noexcept {
 	}
 
 	collection[index] = search;
-	search.prepare();
+	collection[index].prepare();
 	dirty = true;
 	return true;
 }
@@ -426,11 +972,11 @@ void ADLSearchManager::save(bool force /*false*/) noexcept {
 	SettingsManager::saveSettingFile(xml, CONFIG_DIR, CONFIG_NAME);
 }
 
-void ADLSearchManager::MatchesFile(DestDirList& destDirVector, const DirectoryListing::File::Ptr& currentFile, const string& aAdcPath) noexcept {
+void ADLSearchManager::MatchesFile(DestDirList& destDirVector, const DirectoryListing::File::Ptr& currentFile, const string& aAdcPath, ADLSearchMatcher& aMatcher) noexcept {
 	// Add to any substructure being stored
 	for(auto& id: destDirVector) {
 		if(id.subdir != NULL) {
-			auto copyFile = make_shared<DirectoryListing::File>(*currentFile, true);
+			auto copyFile = DirectoryListing::File::createCopy(currentFile, true);
 			dcassert(id.subdir->getAdls());
 
 			id.subdir->files.push_back(copyFile);
@@ -445,35 +991,35 @@ void ADLSearchManager::MatchesFile(DestDirList& destDirVector, const DirectoryLi
 
 	dcassert(Util::isAdcPath(aAdcPath));
 
-	// Use NMDC path for matching due to compatibility reasons
-	const auto nmdcPath = Util::toNmdcFile(aAdcPath + currentFile->getName());
+	ADLSearchMatcher::ResultList matches;
+	aMatcher.matchFile(currentFile->getName(), aAdcPath, currentFile->getSize(), matches);
 
 	// Match searches
-	for(auto& is: collection) {
+	for(auto i: matches) {
+		auto& is = collection[i];
 		if(destDirVector[is.ddIndex].fileAdded) {
 			continue;
 		}
-		if(is.matchesFile(currentFile->getName(), nmdcPath, currentFile->getSize())) {
-			auto copyFile = make_shared<DirectoryListing::File>(*currentFile, true);
-			destDirVector[is.ddIndex].dir->files.push_back(copyFile);
-			destDirVector[is.ddIndex].fileAdded = true;
 
-			if(is.isAutoQueue){
-				try {
-					QueueManager::getInstance()->createFileBundle(SETTING(DOWNLOAD_DIRECTORY) + currentFile->getName(),
-						currentFile->getSize(), currentFile->getTTH(), getUser(), currentFile->getRemoteDate());
-				} catch(const Exception&) { }
-			}
+		auto copyFile = DirectoryListing::File::createCopy(currentFile, true);
+		destDirVector[is.ddIndex].dir->files.push_back(copyFile);
+		destDirVector[is.ddIndex].fileAdded = true;
 
-			if(breakOnFirst) {
-				// Found a match, search no more
-				break;
-			}
+		if(is.isAutoQueue){
+			try {
+				QueueManager::getInstance()->createFileBundle(SETTING(DOWNLOAD_DIRECTORY) + currentFile->getName(),
+					currentFile->getSize(), currentFile->getTTH(), getUser(), currentFile->getRemoteDate());
+			} catch(const Exception&) { }
+		}
+
+		if(breakOnFirst) {
+			// Found a match, search no more
+			break;
 		}
 	}
 }
 
-void ADLSearchManager::MatchesDirectory(DestDirList& destDirVector, const DirectoryListing::Directory::Ptr& currentDir, const string& aAdcPath) noexcept {
+void ADLSearchManager::MatchesDirectory(DestDirList& destDirVector, const DirectoryListing::Directory::Ptr& currentDir, const string& aAdcPath, ADLSearchMatcher& aMatcher) noexcept {
 	dcassert(Util::isAdcPath(aAdcPath));
 
 	// Add to any substructure being stored
@@ -489,18 +1035,20 @@ void ADLSearchManager::MatchesDirectory(DestDirList& destDirVector, const Direct
 		return;
 	}
 
-	for (auto& is: collection) {
+	ADLSearchMatcher::ResultList matches;
+	aMatcher.matchDirectory(currentDir->getName(), matches);
+
+	for (auto i: matches) {
+		auto& is = collection[i];
 		if(destDirVector[is.ddIndex].subdir) {
 			continue;
 		}
 
-		if(is.matchesDirectory(currentDir->getName())) {
-			auto newDir = DirectoryListing::AdlDirectory::create(aAdcPath, destDirVector[is.ddIndex].dir.get(), currentDir->getName());;
-			destDirVector[is.ddIndex].subdir = newDir.get();
-			if(breakOnFirst) {
-				// Found a match, search no more
-				break;
-			}
+		auto newDir = DirectoryListing::AdlDirectory::create(aAdcPath, destDirVector[is.ddIndex].dir.get(), currentDir->getName());;
+		destDirVector[is.ddIndex].subdir = newDir.get();
+		if(breakOnFirst) {
+			// Found a match, search no more
+			break;
 		}
 	}
 }
@@ -584,25 +1132,27 @@ void ADLSearchManager::matchListing(DirectoryListing& aDirList) {
 	PrepareDestinationDirectories(destDirs, root);
 	setBreakOnFirst(SETTING(ADLS_BREAK_ON_FIRST));
 
+	ADLSearchMatcher matcher(collection);
+
 	string path(aDirList.getRoot()->getName());
-	matchRecurse(destDirs, aDirList.getRoot(), path, aDirList);
+	matchRecurse(destDirs, aDirList.getRoot(), path, aDirList, matcher);
 
 	FinalizeDestinationDirectories(destDirs, root);
 }
 
-void ADLSearchManager::matchRecurse(DestDirList &aDestList, const DirectoryListing::Directory::Ptr& aDir, const string& aAdcPath, DirectoryListing& aDirList) {
+void ADLSearchManager::matchRecurse(DestDirList &aDestList, const DirectoryListing::Directory::Ptr& aDir, const string& aAdcPath, DirectoryListing& aDirList, ADLSearchMatcher& aMatcher) {
 	if (aDirList.getClosing()) {
 		throw AbortException();
 	}
 
 	for (const auto& dir: aDir->directories | map_values) {
 		auto subAdcPath = aAdcPath + dir->getName() + ADC_SEPARATOR_STR;
-		MatchesDirectory(aDestList, dir, subAdcPath);
-		matchRecurse(aDestList, dir, subAdcPath, aDirList);
+		MatchesDirectory(aDestList, dir, subAdcPath, aMatcher);
+		matchRecurse(aDestList, dir, subAdcPath, aDirList, aMatcher);
 	}
 
 	for (const auto& file: aDir->files) {
-		MatchesFile(aDestList, file, aAdcPath);
+		MatchesFile(aDestList, file, aAdcPath, aMatcher);
 	}
 
 	stepUpDirectory(aDestList);
@@ -81,7 +81,7 @@ public:
 	SizeType StringToSizeType(const string& s);
 	string SizeTypeToString(SizeType t);
 	tstring SizeTypeToDisplayString(SizeType t);
-	int64_t GetSizeBase();
+	int64_t GetSizeBase() const;
 
 	// Name of the destination directory (empty = 'ADLSearch') and its index
 	//string destDir;
@@ -94,22 +94,53 @@ public:
 
 	void setDestDir(const string& aDestDir) noexcept;
 	const string& getDestDir() const noexcept { return name; }
+
+	/// Prepare search
+	void prepare();
+
+	/// Search for file match
+	bool matchesFile(const string& f, const string& fp, int64_t size) const;
+	/// Search for directory match
+	bool matchesDirectory(const string& d) const;
 private:
 	string name;
 
 	friend class ADLSearchManager;
+	friend class ADLSearchMatcher;
 
 	StringMatch match;
 
-	/// Prepare search
-	void prepare();
+	bool searchAll(const string& s) const;
 
-	/// Search for file match
-	bool matchesFile(const string& f, const string& fp, int64_t size);
-	/// Search for directory match
-	bool matchesDirectory(const string& d);
+	// Whether a file of this size can match the search
+	bool matchesSize(int64_t aSize) const noexcept;
+};
+
+/**
+* Matches the items of a file list against a collection of searches by scanning each name only once
+*
+* The substring patterns of all searches are compiled into a single automaton. The same automaton is used
+* for finding the literal strings required by the regular expressions, an expression is evaluated only if its
+* literal is included in the text. The results are the same as when calling matchesFile and matchesDirectory
+* of each search.
+*/
+class ADLSearchMatcher : boost::noncopyable {
+public:
+	// Indexes of the matching searches in the collection order
+	typedef vector<size_t> ResultList;
+
+	explicit ADLSearchMatcher(const vector<ADLSearch>& aSearches) noexcept;
+	~ADLSearchMatcher();
+
+	// aAdcPath: ADC path of the parent directory
+	void matchFile(const string& aName, const string& aAdcPath, int64_t aSize, ResultList& results_) noexcept;
+	void matchDirectory(const string& aName, ResultList& results_) noexcept;
+private:
+	class Matcher;
 
-	bool searchAll(const string& s);
+	unique_ptr<Matcher> fileNames;
+	unique_ptr<Matcher> fullPaths;
+	unique_ptr<Matcher> directories;
 };
 
 
@@ -159,11 +190,11 @@ private:
 
 	// @internal
 	// Throws AbortException
-	void matchRecurse(DestDirList& /*aDestList*/, const DirectoryListing::Directory::Ptr& /*aDir*/, const string& aAdcPath, DirectoryListing& /*aDirList*/);
+	void matchRecurse(DestDirList& /*aDestList*/, const DirectoryListing::Directory::Ptr& /*aDir*/, const string& aAdcPath, DirectoryListing& /*aDirList*/, ADLSearchMatcher& aMatcher);
 	// Search for file match
-	void MatchesFile(DestDirList& destDirVector, const DirectoryListing::File::Ptr& currentFile, const string& aAdcPath) noexcept;
+	void MatchesFile(DestDirList& destDirVector, const DirectoryListing::File::Ptr& currentFile, const string& aAdcPath, ADLSearchMatcher& aMatcher) noexcept;
 	// Search for directory match
-	void MatchesDirectory(DestDirList& destDirVector, const DirectoryListing::Directory::Ptr& currentDir, const string& aAdcPath) noexcept;
+	void MatchesDirectory(DestDirList& destDirVector, const DirectoryListing::Directory::Ptr& currentDir, const string& aAdcPath, ADLSearchMatcher& aMatcher) noexcept;
 	// Step up directory
 	void stepUpDirectory(DestDirList& destDirVector) noexcept;
 
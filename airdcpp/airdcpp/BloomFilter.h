@@ -19,73 +19,170 @@
 #ifndef DCPLUSPLUS_DCPP_BLOOM_FILTER_H
 #define DCPLUSPLUS_DCPP_BLOOM_FILTER_H
 
+#include "debug.h"
 #include "typedefs.h"
 
+#include <bitset>
+#include <cmath>
+
 namespace dcpp {
 
-template<size_t N>
+/**
+* Blocked bloom filter for n-grams of strings
+*
+* All K probes of a single n-gram are placed inside the same 512-bit block (a single cache line)
+* and the number of blocks is always a power of two. Items may be added concurrently from multiple threads.
+*/
+template<size_t N, size_t K = 3>
 class BloomFilter {
 public:
-	BloomFilter(size_t tableSize) { table.resize(tableSize); }
+	// Table size is in bits and it will be rounded up to the next power of two
+	BloomFilter(size_t tableSize) : blockCount(getBlockCount(tableSize)), table(new atomic<uint64_t>[blockCount * BLOCK_WORDS]()) { }
 	~BloomFilter() { }
 
+	BloomFilter(BloomFilter&) = delete;
+	BloomFilter& operator=(BloomFilter&) = delete;
+
 	void add(const string& s) { xadd(s, N); }
 	bool match(const string& s) const {
 		if(s.length() >= N) {
 			string::size_type l = s.length() - N;
 			for(string::size_type i = 0; i <= l; ++i) {
-				if(!table[getPos(s, i, N)]) {
-					return false;
+				auto h = getHash(s, i, N);
+				auto block = getBlock(h);
+				for (size_t k = 0; k < K; ++k) {
+					auto bit = getBlockBit(h, k);
+					if (!(block[bit >> 6].load(memory_order_relaxed) & (1ULL << (bit & 63)))) {
+						return false;
+					}
 				}
 			}
 		}
 		return true;
 	}
 	void clear() {
-		size_t s = table.size();
-		table.clear();
-		table.resize(s);
+		for (size_t i = 0; i < blockCount * BLOCK_WORDS; ++i) {
+			table[i].store(0, memory_order_relaxed);
+		}
+	}
+
+	void merge(const BloomFilter<N, K>& aBloom) {
+		dcassert(aBloom.blockCount == blockCount);
+		for (size_t i = 0; i < blockCount * BLOCK_WORDS; ++i) {
+			table[i].fetch_or(aBloom.table[i].load(memory_order_relaxed), memory_order_relaxed);
+		}
+	}
+
+	// Size of the table in bits
+	size_t getSize() const noexcept {
+		return blockCount * BLOCK_BITS;
 	}
 
-	void merge(const BloomFilter<N>& aBloom) {
-		for (size_t i = 0; i < table.size(); ++i) {
-			if (aBloom.table[i] == true) {
-				table[i] = true;
+	// Share of set bits in the table
+	double getFillRate() const noexcept {
+		size_t setBits = 0;
+		for (size_t i = 0; i < blockCount * BLOCK_WORDS; ++i) {
+			setBits += bitset<64>(table[i].load(memory_order_relaxed)).count();
+		}
+
+		return static_cast<double>(setBits) / static_cast<double>(getSize());
+	}
+
+	// Probability for a single n-gram that hasn't been added to match, measured from the fill rates of individual blocks
+	double getFalsePositiveRate() const noexcept {
+		double total = 0;
+		for (size_t b = 0; b < blockCount; ++b) {
+			size_t setBits = 0;
+			for (size_t i = 0; i < BLOCK_WORDS; ++i) {
+				setBits += bitset<64>(table[b * BLOCK_WORDS + i].load(memory_order_relaxed)).count();
 			}
+
+			total += pow(static_cast<double>(setBits) / BLOCK_BITS, static_cast<double>(K));
+		}
+
+		return total / blockCount;
+	}
+
+	// Table size for the current content that would keep the false positive rate reasonable
+	size_t getRecommendedSize(size_t aMinSize, size_t aMaxSize) const noexcept {
+		auto fillRate = getFillRate();
+		size_t ret;
+		if (fillRate >= 0.99) {
+			// Saturated, the item count can't be estimated
+			ret = getSize() * 4;
+		} else {
+			// Estimate the number of unique n-grams and aim for 50% fill rate
+			auto items = -(static_cast<double>(getSize()) / K) * log(1 - fillRate);
+			ret = static_cast<size_t>(items * K / log(2.));
 		}
+
+		return min(max(ret, aMinSize), aMaxSize);
 	}
 #ifdef TESTER
 	void print_table_status() {
-		int tot = 0;
-		for (unsigned int i = 0; i < table.size(); ++i) if (table[i] == true) ++tot;
-
-		std::cout << "table status: " << tot << " of " << table.size()
-			<< " filled, for an occupancy percentage of " << (100.*tot)/table.size()
-			<< "%" << std::endl;
+		std::cout << "table status: " << (100.*getFillRate()) << "% of " << getSize()
+			<< " filled, false positive rate " << getFalsePositiveRate() << std::endl;
 	}
 #endif
 private:
+	enum : size_t {
+		BLOCK_BITS_LOG = 9,
+		BLOCK_BITS = 1 << BLOCK_BITS_LOG,
+		BLOCK_WORDS = BLOCK_BITS / 64
+	};
+
+	static_assert(K > 0 && K * BLOCK_BITS_LOG <= 32, "Too many probes");
+
+	static size_t getBlockCount(size_t aTableSize) {
+		size_t ret = 1;
+		while (ret * BLOCK_BITS < aTableSize) {
+			ret <<= 1;
+		}
+		return ret;
+	}
+
 	void xadd(const string& s, size_t n) {
 		if(s.length() >= n) {
 			string::size_type l = s.length() - n;
 			for(string::size_type i = 0; i <= l; ++i) {
-				table[getPos(s, i, n)] = true;
+				auto h = getHash(s, i, n);
+				auto block = getBlock(h);
+				for (size_t k = 0; k < K; ++k) {
+					auto bit = getBlockBit(h, k);
+					block[bit >> 6].fetch_or(1ULL << (bit & 63), memory_order_relaxed);
+				}
 			}
 		} 
 	}
 
-	/* This is roughly how boost::hash does it */
-	size_t getPos(const string& s, size_t i, size_t l) const {
-		size_t h = 0;
+	// Block index is taken from the lowest bits and the probes from the highest ones
+	atomic<uint64_t>* getBlock(uint64_t h) const {
+		return &table[(h & (blockCount - 1)) * BLOCK_WORDS];
+	}
+
+	static size_t getBlockBit(uint64_t h, size_t k) {
+		return static_cast<size_t>(h >> (64 - (k + 1) * BLOCK_BITS_LOG)) & (BLOCK_BITS - 1);
+	}
+
+	/* This is roughly how boost::hash does it, mixed with the MurmurHash3 finalizer to get enough usable bits */
+	static uint64_t getHash(const string& s, size_t i, size_t l) {
+		uint64_t h = 0;
 		const char* c = s.data() + i;
 		const char* end = s.data() + i + l;
 		for(; c < end; ++c) {
-			h ^= *c + 0x9e3779b9 + (h<<6) + (h>>2);
+			h ^= static_cast<uint8_t>(*c) + 0x9e3779b97f4a7c15ULL + (h<<6) + (h>>2);
 		}
-		return (h % table.size());
+
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return h;
 	}
 	
-	vector<bool> table;
+	const size_t blockCount;
+	unique_ptr<atomic<uint64_t>[]> table;
 };
 
 } // namespace dcpp
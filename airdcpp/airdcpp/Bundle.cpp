@@ -29,7 +29,6 @@
 #include "LogManager.h"
 #include "QueueItem.h"
 #include "SearchResult.h"
-#include "SimpleXML.h"
 #include "TimerManager.h"
 #include "UserConnection.h"
 
@@ -168,7 +167,6 @@ void Bundle::addFinishedSegment(int64_t aSize) noexcept {
 	dcassert(currentDownloaded >= 0);
 	dcassert(currentDownloaded <= size);
 	dcassert(finishedSegments <= size);
-	setDirty();
 }
 
 void Bundle::removeFinishedSegment(int64_t aSize) noexcept{
@@ -213,24 +211,11 @@ QueueItemPtr Bundle::findQI(const string& aTarget) const noexcept {
 	return p != queueItems.end() ? *p : nullptr;
 }
 
-string Bundle::getXmlFilePath() const noexcept {
-	return Util::getPath(Util::PATH_BUNDLES) + "Bundle" + getStringToken() + ".xml";
-}
-
-void Bundle::deleteXmlFile() noexcept {
-	try {
-		File::deleteFile(getXmlFilePath() + ".bak");
-		File::deleteFile(getXmlFilePath());
-	} catch(const FileException& /*e1*/) {
-		//..
-	}
-}
-
 void Bundle::getItems(const UserPtr& aUser, QueueItemList& ql) const noexcept {
 	for(int i = static_cast<int>(Priority::PAUSED_FORCE); i < static_cast<int>(Priority::LAST); ++i) {
 		auto j = userQueue[i].find(aUser);
 		if(j != userQueue[i].end()) {
-			copy(j->second, back_inserter(ql));
+			copy(j->second.items, back_inserter(ql));
 		}
 	}
 }
@@ -319,7 +304,8 @@ void Bundle::addUserQueue(const QueueItemPtr& qi) noexcept {
 }
 
 bool Bundle::addUserQueue(const QueueItemPtr& qi, const HintedUser& aUser, bool isBad /*false*/) noexcept {
-	auto& l = userQueue[static_cast<int>(qi->getPriority())][aUser.user];
+	auto& q = userQueue[static_cast<int>(qi->getPriority())][aUser.user];
+	auto& l = q.items;
 	dcassert(find(l, qi) == l.end());
 
 	if (l.size() > 1) {
@@ -335,6 +321,14 @@ bool Bundle::addUserQueue(const QueueItemPtr& qi, const HintedUser& aUser, bool
 		l.push_back(qi);
 	}
 
+	if (qi->usesSmallSlot()) {
+		q.smallItems++;
+	}
+
+	if (qi->isRunning()) {
+		q.running.push_back(qi);
+	}
+
 	if (isBad) {
 		auto i = find(badSources, aUser);
 		dcassert(i != badSources.end());
@@ -360,19 +354,48 @@ bool Bundle::addUserQueue(const QueueItemPtr& qi, const HintedUser& aUser, bool
 }
 
 QueueItemPtr Bundle::getNextQI(const UserPtr& aUser, const OrderedStringSet& aOnlineHubs, string& aLastError, Priority aMinPrio, int64_t aWantedSize, int64_t aLastSpeed, QueueItemBase::DownloadType aType, bool aAllowOverlap) noexcept {
-	int p = static_cast<int>(Priority::LAST) - 1;
-	do {
+	for (int p = static_cast<int>(Priority::LAST) - 1; p >= static_cast<int>(aMinPrio); p--) {
 		auto i = userQueue[p].find(aUser);
-		if(i != userQueue[p].end()) {
-			dcassert(!i->second.empty());
-			for(auto& qi: i->second) {
-				if (qi->hasSegment(aUser, aOnlineHubs, aLastError, aWantedSize, aLastSpeed, aType, aAllowOverlap)) {
-					return qi;
+		if (i == userQueue[p].end()) {
+			continue;
+		}
+
+		const auto& q = i->second;
+		dcassert(!q.items.empty());
+
+		// Items using the wrong slot type would be rejected
+		if ((aType == QueueItem::TYPE_SMALL && q.smallItems == 0) || (aType == QueueItem::TYPE_MCN_NORMAL && q.smallItems == q.items.size())) {
+			continue;
+		}
+
+		if (aAllowOverlap) {
+			// Overlapping doesn't affect the waiting items
+			QueueItemList matches;
+			copy_if(q.running.begin(), q.running.end(), back_inserter(matches), [&](const QueueItemPtr& qi) {
+				return qi->hasSegment(aUser, aOnlineHubs, aLastError, aWantedSize, aLastSpeed, aType, aAllowOverlap);
+			});
+
+			if (matches.size() > 1) {
+				// Use the download order
+				auto m = find_first_of(q.items.begin(), q.items.end(), matches.begin(), matches.end());
+				if (m != q.items.end()) {
+					return *m;
 				}
 			}
+
+			if (!matches.empty()) {
+				return matches.front();
+			}
+
+			continue;
 		}
-		p--;
-	} while(p >= static_cast<int>(aMinPrio));
+
+		for (auto& qi: q.items) {
+			if (qi->hasSegment(aUser, aOnlineHubs, aLastError, aWantedSize, aLastSpeed, aType, aAllowOverlap)) {
+				return qi;
+			}
+		}
+	}
 
 	return nullptr;
 }
@@ -429,7 +452,7 @@ void Bundle::rotateUserQueue(QueueItemPtr& qi, const UserPtr& aUser) noexcept {
 	if (j == ulm.end()) {
 		return;
 	}
-	auto& l = j->second;
+	auto& l = j->second.items;
 	if (l.size() > 1) {
 		auto s = find(l, qi);
 		if (s != l.end()) {
@@ -439,6 +462,24 @@ void Bundle::rotateUserQueue(QueueItemPtr& qi, const UserPtr& aUser) noexcept {
 	}
 }
 
+void Bundle::setUserQueueRunning(const QueueItemPtr& qi, bool aRunning) noexcept {
+	auto& ulm = userQueue[static_cast<int>(qi->getPriority())];
+	for (const auto& s: qi->getSources()) {
+		auto j = ulm.find(s.getUser().user);
+		if (j == ulm.end()) {
+			continue;
+		}
+
+		auto& running = j->second.running;
+		auto r = find(running, qi);
+		if (aRunning && r == running.end()) {
+			running.push_back(qi);
+		} else if (!aRunning && r != running.end()) {
+			running.erase(r);
+		}
+	}
+}
+
 void Bundle::removeUserQueue(QueueItemPtr& qi) noexcept {
 	for(auto& s: qi->getSources())
 		removeUserQueue(qi, s.getUser(), 0);
@@ -454,13 +495,22 @@ bool Bundle::removeUserQueue(QueueItemPtr& qi, const UserPtr& aUser, Flags::Mask
 	if (j == ulm.end()) {
 		return false;
 	}
-	auto& l = j->second;
-	auto s = find(l, qi);
-	if (s != l.end()) {
-		l.erase(s);
+	auto& q = j->second;
+	auto s = find(q.items, qi);
+	if (s != q.items.end()) {
+		q.items.erase(s);
+
+		if (qi->usesSmallSlot()) {
+			q.smallItems--;
+		}
+
+		auto r = find(q.running, qi);
+		if (r != q.running.end()) {
+			q.running.erase(r);
+		}
 	}
 
-	if(l.empty()) {
+	if(q.items.empty()) {
 		ulm.erase(j);
 	}
 
@@ -805,78 +855,4 @@ void Bundle::sendSizeUpdate() noexcept {
 
 /* ONLY CALLED FROM DOWNLOADMANAGER END */
 
-
-void Bundle::save() {
-	{
-		File ff(getXmlFilePath() + ".tmp", File::WRITE, File::CREATE | File::TRUNCATE);
-		BufferedOutputStream<false> f(&ff);
-		f.write(SimpleXML::utf8Header);
-		string tmp;
-		string b32tmp;
-
-		auto saveFiles = [&] {
-			for (const auto& q : finishedFiles) {
-				q->save(f, tmp, b32tmp);
-			}
-
-			for (const auto& q : queueItems) {
-				q->save(f, tmp, b32tmp);
-			}
-		};
-
-		if (isFileBundle()) {
-			f.write(LIT("<File Version=\"" FILE_BUNDLE_VERSION));
-			f.write(LIT("\" Token=\""));
-			f.write(getStringToken());
-			f.write(LIT("\" Date=\""));
-			f.write(Util::toString(bundleDate));
-			f.write(LIT("\" AddedByAutoSearch=\""));
-			f.write(Util::toString(getAddedByAutoSearch()));
-
-			if (resumeTime > 0) {
-				f.write(LIT("\" ResumeTime=\""));
-				f.write(Util::toString(resumeTime));
-			}
-			f.write(LIT("\">\r\n"));
-			saveFiles();
-			f.write(LIT("</File>\r\n"));
-		} else {
-			f.write(LIT("<Bundle Version=\"" DIR_BUNDLE_VERSION));
-			f.write(LIT("\" Target=\""));
-			f.write(SimpleXML::escape(target, tmp, true));
-			f.write(LIT("\" Token=\""));
-			f.write(getStringToken());
-			f.write(LIT("\" Added=\""));
-			f.write(Util::toString(getTimeAdded()));
-			f.write(LIT("\" Date=\""));
-			f.write(Util::toString(bundleDate));
-			f.write(LIT("\" AddedByAutoSearch=\""));
-			f.write(Util::toString(getAddedByAutoSearch()));
-			if (!getAutoPriority()) {
-				f.write(LIT("\" Priority=\""));
-				f.write(Util::toString((int)getPriority()));
-			}
-			if (timeFinished > 0) {
-				f.write(LIT("\" TimeFinished=\""));
-				f.write(Util::toString(timeFinished));
-			}
-			if (resumeTime > 0) {
-				f.write(LIT("\" ResumeTime=\""));
-				f.write(Util::toString(resumeTime));
-			}
-
-			f.write(LIT("\">\r\n"));
-
-			saveFiles();
-
-			f.write(LIT("</Bundle>\r\n"));
-		}
-	}
-
-	File::deleteFile(getXmlFilePath());
-	File::renameFile(getXmlFilePath() + ".tmp", getXmlFilePath());
-	
-	dirty = false;
-}
-
 }
@@ -151,11 +151,10 @@ public:
 	const string& getTarget() const noexcept { return target; }
 	string getName() const noexcept;
 
-	string getXmlFilePath() const noexcept;
-	void deleteXmlFile() noexcept;
-
+	// The whole bundle is written in the queue journal when it's saved the next time
 	void setDirty() noexcept;
 	bool getDirty() const noexcept;
+	void resetDirty() noexcept { dirty = false; }
 	bool checkRecent() noexcept;
 	bool isRecent() const noexcept { return recent; }
 
@@ -163,9 +162,6 @@ public:
 	static bool isFailedStatus(Status aStatus) noexcept;
 	bool isFailed() const noexcept;
 
-	// Throws on errors
-	void save();
-
 	void addQueue(QueueItemPtr& qi) noexcept;
 	void removeQueue(QueueItemPtr& qi, bool aFinished) noexcept;
 
@@ -234,6 +230,7 @@ public:
 	/** All queue items indexed by user */
 	void addUserQueue(const QueueItemPtr& qi) noexcept;
 	bool addUserQueue(const QueueItemPtr& qi, const HintedUser& aUser, bool isBad = false) noexcept;
+	// Only the running items are checked when overlapping is allowed (the waiting items should have been checked without it already)
 	QueueItemPtr getNextQI(const UserPtr& aUser, const OrderedStringSet& onlineHubs, string& aLastError, Priority minPrio, int64_t wantedSize, int64_t lastSpeed, QueueItemBase::DownloadType aType, bool allowOverlap) noexcept;
 	void getItems(const UserPtr& aUser, QueueItemList& ql) const noexcept;
 
@@ -244,6 +241,9 @@ public:
 
 	//moves the file back in userqueue for the given user (only within the same priority)
 	void rotateUserQueue(QueueItemPtr& qi, const UserPtr& aUser) noexcept;
+
+	// Update the running state of the item in the user queues of its sources (call when the first download is added or the last one is removed)
+	void setUserQueueRunning(const QueueItemPtr& qi, bool aRunning) noexcept;
 	bool isEmpty() const noexcept { return queueItems.empty() && finishedFiles.empty(); }
 private:
 	ActionHookRejectionPtr hookError = nullptr;
@@ -257,8 +257,19 @@ private:
 	bool dirty = false;
 	bool recent = false;
 
+	/** Queued items of a user with the same priority */
+	struct UserItems {
+		deque<QueueItemPtr> items;
+
+		// Items with running downloads (in any order)
+		QueueItemList running;
+
+		// Number of items using the small slot
+		size_t smallItems = 0;
+	};
+
 	/** QueueItems by priority and user (this is where the download order is determined) */
-	unordered_map<UserPtr, deque<QueueItemPtr>, User::Hash> userQueue[static_cast<int>(Priority::LAST)];
+	unordered_map<UserPtr, UserItems, User::Hash> userQueue[static_cast<int>(Priority::LAST)];
 	/** Currently running downloads, a QueueItem is always either here or in the userQueue */
 	unordered_map<UserPtr, QueueItemList, User::Hash> runningItems;
 
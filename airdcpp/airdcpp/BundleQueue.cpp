@@ -23,6 +23,7 @@
 
 #include "AirUtil.h"
 #include "BundleQueue.h"
+#include "ClientManager.h"
 #include "LogManager.h"
 #include "QueueItem.h"
 #include "SettingsManager.h"
@@ -32,7 +33,7 @@ namespace dcpp {
 
 using boost::range::find_if;
 
-BundleQueue::BundleQueue() : PrioritySearchQueue(SettingsManager::BUNDLE_SEARCH_TIME) { }
+BundleQueue::BundleQueue() : PrioritySearchQueue(SettingsManager::BUNDLE_SEARCH_TIME), journal(Util::getPath(Util::PATH_BUNDLES)) { }
 
 BundleQueue::~BundleQueue() { }
 
@@ -409,18 +410,151 @@ void BundleQueue::removeBundle(BundlePtr& aBundle) noexcept{
 
 	dcassert(bundlePaths.size() == static_cast<size_t>(boost::count_if(bundles | map_values, [](const BundlePtr& b) { return !b->isFileBundle(); })));
 
-	aBundle->deleteXmlFile();
+	journal.removeBundle(aBundle->getToken());
 }
 
-void BundleQueue::saveQueue(bool aForce) noexcept {
-	for(auto& b: bundles | map_values) {
-		if (b->getDirty() || aForce) {
-			try {
-				b->save();
-			} catch(FileException& e) {
-				LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, b->getName() % e.getError()), LogMessage::SEV_ERROR);
+static QueueJournal::SourceInfo toSourceInfo(const HintedUser& aUser) noexcept {
+	QueueJournal::SourceInfo info;
+	info.cid = aUser.user->getCID();
+	info.nick = ClientManager::getInstance()->getNick(aUser.user, aUser.hint);
+	info.hubHint = aUser.hint;
+	return info;
+}
+
+static QueueJournal::FileInfo toFileInfo(const QueueItemPtr& qi) noexcept {
+	QueueJournal::FileInfo info;
+	info.size = qi->getSize();
+	info.added = qi->getTimeAdded();
+	info.tth = qi->getTTH();
+	info.priority = qi->getPriority();
+	info.autoPriority = qi->getAutoPriority();
+	info.maxSegments = qi->getMaxSegments();
+	info.done = qi->getDone();
+
+	if (qi->segmentsDone()) {
+		info.timeFinished = qi->getTimeFinished();
+		info.lastSource = qi->getLastSource();
+		return info;
+	}
+
+	if (!info.done.empty()) {
+		info.tempTarget = qi->getTempTarget();
+	}
+
+	for (const auto& s: qi->getSources()) {
+		if (!s.isSet(QueueItem::Source::FLAG_PARTIAL)) {
+			info.sources.push_back(toSourceInfo(s.getUser()));
+		}
+	}
+
+	return info;
+}
+
+static QueueJournal::BundleInfo toBundleInfo(const BundlePtr& aBundle, bool aFiles) noexcept {
+	QueueJournal::BundleInfo info;
+	info.token = aBundle->getToken();
+	info.target = aBundle->getTarget();
+	info.fileBundle = aBundle->isFileBundle();
+	info.added = aBundle->getTimeAdded();
+	info.date = aBundle->getBundleDate();
+	info.timeFinished = aBundle->getTimeFinished();
+	info.resumeTime = aBundle->getResumeTime();
+	info.priority = aBundle->getPriority();
+	info.autoPriority = aBundle->getAutoPriority();
+	info.addedByAutoSearch = aBundle->getAddedByAutoSearch();
+
+	if (aFiles) {
+		for (const auto& q: aBundle->getFinishedFiles()) {
+			info.files[q->getTarget()] = toFileInfo(q);
+		}
+
+		for (const auto& q: aBundle->getQueueItems()) {
+			info.files[q->getTarget()] = toFileInfo(q);
+		}
+	}
+
+	return info;
+}
+
+static bool isSaved(const BundlePtr& aBundle) noexcept {
+	return aBundle && aBundle->getStatus() != Bundle::STATUS_NEW;
+}
+
+bool BundleQueue::saveQueue(bool aForce) noexcept {
+	try {
+		if (aForce || journal.needsCompaction()) {
+			journal.compact([this](const QueueJournal::BundleInfoF& aAddBundle) {
+				for (auto& b: bundles | map_values) {
+					if (isSaved(b)) {
+						aAddBundle(toBundleInfo(b, true));
+						b->resetDirty();
+					}
+				}
+			});
+		} else {
+			for (auto& b: bundles | map_values) {
+				if (b->getDirty()) {
+					journal.addBundle(toBundleInfo(b, true));
+					b->resetDirty();
+				}
 			}
 		}
+
+		journal.flush();
+	} catch (const FileException& e) {
+		LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, journal.getJournalPath() % e.getError()), LogMessage::SEV_ERROR);
+		return false;
+	}
+
+	return true;
+}
+
+void BundleQueue::journalBundle(const BundlePtr& aBundle) noexcept {
+	if (isSaved(aBundle)) {
+		journal.updateBundle(toBundleInfo(aBundle, false));
+	}
+}
+
+void BundleQueue::journalFile(const QueueItemPtr& qi) noexcept {
+	if (isSaved(qi->getBundle())) {
+		journal.addFile(qi->getBundle()->getToken(), qi->getTarget(), toFileInfo(qi));
+	}
+}
+
+void BundleQueue::journalFileRemoved(const QueueItemPtr& qi) noexcept {
+	if (isSaved(qi->getBundle())) {
+		journal.removeFile(qi->getBundle()->getToken(), qi->getTarget());
+	}
+}
+
+void BundleQueue::journalFilePriority(const QueueItemPtr& qi) noexcept {
+	if (isSaved(qi->getBundle())) {
+		journal.setFilePriority(qi->getBundle()->getToken(), qi->getTarget(), qi->getPriority(), qi->getAutoPriority());
+	}
+}
+
+void BundleQueue::journalSourceAdded(const QueueItemPtr& qi, const HintedUser& aUser) noexcept {
+	if (isSaved(qi->getBundle())) {
+		journal.addSource(qi->getBundle()->getToken(), qi->getTarget(), toSourceInfo(aUser));
+	}
+}
+
+void BundleQueue::journalSourceRemoved(const QueueItemPtr& qi, const UserPtr& aUser) noexcept {
+	if (isSaved(qi->getBundle())) {
+		journal.removeSource(qi->getBundle()->getToken(), qi->getTarget(), aUser->getCID());
+	}
+}
+
+void BundleQueue::journalSegment(const QueueItemPtr& qi, const Segment& aSegment) noexcept {
+	if (!isSaved(qi->getBundle())) {
+		return;
+	}
+
+	if (qi->getDone().getBytes() <= aSegment.getSize()) {
+		// First finished segment, the temp target must be saved as well
+		journalFile(qi);
+	} else {
+		journal.addSegment(qi->getBundle()->getToken(), qi->getTarget(), aSegment);
 	}
 }
 
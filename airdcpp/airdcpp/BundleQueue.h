@@ -26,6 +26,7 @@
 #include "DupeType.h"
 #include "HintedUser.h"
 #include "PrioritySearchQueue.h"
+#include "QueueJournal.h"
 #include "SortedVector.h"
 
 namespace dcpp {
@@ -76,7 +77,21 @@ public:
 
 	void removeBundle(BundlePtr& aBundle) noexcept;
 
-	void saveQueue(bool force) noexcept;
+	// Writes the changed bundles and the pending changes in the journal (the journal is compacted when needed or when forced)
+	// Returns false if the changes couldn't be written
+	bool saveQueue(bool aForce) noexcept;
+
+	// Changes that don't need the whole bundle to be saved (the bundles that haven't been added yet are skipped)
+	void journalBundle(const BundlePtr& aBundle) noexcept;
+	void journalFile(const QueueItemPtr& qi) noexcept;
+	void journalFileRemoved(const QueueItemPtr& qi) noexcept;
+	void journalFilePriority(const QueueItemPtr& qi) noexcept;
+	void journalSourceAdded(const QueueItemPtr& qi, const HintedUser& aUser) noexcept;
+	void journalSourceRemoved(const QueueItemPtr& qi, const UserPtr& aUser) noexcept;
+	void journalSegment(const QueueItemPtr& qi, const Segment& aSegment) noexcept;
+
+	QueueJournal& getJournal() noexcept { return journal; }
+
 	QueueItemList getSearchItems(const BundlePtr& aBundle) const noexcept;
 
 	DupeType isAdcDirectoryQueued(const string& aPath, int64_t aSize) const noexcept;
@@ -115,6 +130,8 @@ private:
 	Bundle::TokenMap bundles;
 
 	int64_t queueSize = 0;
+
+	QueueJournal journal;
 };
 
 } // namespace dcpp
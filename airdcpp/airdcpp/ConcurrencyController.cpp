@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "ConcurrencyController.h"
+
+namespace dcpp {
+
+const int ConcurrencyController::SAMPLES_PER_LEVEL = 3;
+const double ConcurrencyController::MIN_GAIN = 0.1;
+const uint64_t ConcurrencyController::RETRY_INTERVAL = 60 * 1000;
+
+ConcurrencyController::ConcurrencyController(int aMaxLimit) noexcept : maxLimit(max(aMaxLimit, 1)) {
+	levels.resize(maxLimit + 2);
+}
+
+void ConcurrencyController::setMaxLimit(int aMaxLimit) noexcept {
+	maxLimit = max(aMaxLimit, 1);
+	if (static_cast<int>(levels.size()) < maxLimit + 2) {
+		levels.resize(maxLimit + 2);
+	}
+
+	if (limit > maxLimit) {
+		setLimit(maxLimit);
+	}
+}
+
+int64_t ConcurrencyController::getThroughput(int aLevel) const noexcept {
+	if (aLevel < 0 || aLevel >= static_cast<int>(levels.size()) || !levels[aLevel].valid) {
+		return 0;
+	}
+
+	return static_cast<int64_t>(levels[aLevel].throughput);
+}
+
+void ConcurrencyController::setLimit(int aLimit) noexcept {
+	limit = aLimit;
+	samples = 0;
+	current = Sample();
+}
+
+bool ConcurrencyController::isBetter(const Level& aHigher, const Level& aLower) const noexcept {
+	auto requiredGain = MIN_GAIN;
+	if (aLower.latency > 0 && aHigher.latency > aLower.latency * 2) {
+		requiredGain *= 2;
+	}
+
+	return aHigher.throughput > aLower.throughput * (1 + requiredGain);
+}
+
+bool ConcurrencyController::addSample(const Sample& aSample) noexcept {
+	time += aSample.duration;
+
+	// Not all allowed readers were busy, the throughput doesn't tell anything about this level
+	if (aSample.active < limit || aSample.duration == 0) {
+		return false;
+	}
+
+	current.bytes += aSample.bytes;
+	current.waitTime += aSample.waitTime;
+	current.reads += aSample.reads;
+	current.duration += aSample.duration;
+	current.demand = max(current.demand, aSample.demand);
+
+	if (++samples < SAMPLES_PER_LEVEL) {
+		return false;
+	}
+
+	auto& level = levels[limit];
+	level.throughput = static_cast<double>(current.bytes) * 1000 / current.duration;
+	level.latency = current.reads > 0 ? static_cast<double>(current.waitTime) / current.reads : 0;
+	level.measured = time;
+	level.valid = true;
+
+	auto demand = current.demand;
+	samples = 0;
+	current = Sample();
+
+	// Is the higher concurrency worth it?
+	if (limit > 1 && levels[limit - 1].valid && !isBetter(level, levels[limit - 1])) {
+		setLimit(limit - 1);
+		return true;
+	}
+
+	// Try a higher concurrency if there are readers waiting
+	if (limit < maxLimit && demand > limit) {
+		const auto& higher = levels[limit + 1];
+		if (!higher.valid || time > higher.measured + RETRY_INTERVAL || isBetter(higher, level)) {
+			setLimit(limit + 1);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+} // namespace dcpp
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_CONCURRENCY_CONTROLLER_H
+#define DCPLUSPLUS_DCPP_CONCURRENCY_CONTROLLER_H
+
+#include "typedefs.h"
+
+namespace dcpp {
+
+/**
+* Finds the number of concurrent readers that gives the best throughput for a device
+*
+* Each concurrency level is measured for a few sampling periods while all allowed readers are busy.
+* The concurrency is increased as long as it improves the throughput enough and reverted when it doesn't
+* (or when the throughput drops). Higher levels that didn't help are retried after a while in case the
+* conditions have changed.
+*/
+class ConcurrencyController {
+public:
+	struct Sample {
+		// Bytes read during the period
+		int64_t bytes = 0;
+
+		// Time spent waiting for the reads to complete (microseconds) and number of reads
+		int64_t waitTime = 0;
+		int64_t reads = 0;
+
+		// Length of the period (milliseconds)
+		uint64_t duration = 0;
+
+		// Number of readers that were allowed to read and number of readers that had data to read
+		int active = 0;
+		int demand = 0;
+	};
+
+	// Saturated samples required for measuring a single concurrency level
+	static const int SAMPLES_PER_LEVEL;
+
+	// Required throughput improvement for keeping a higher concurrency (doubled if the read latency also doubles)
+	static const double MIN_GAIN;
+
+	// Time before a higher concurrency that didn't help is tried again (milliseconds)
+	static const uint64_t RETRY_INTERVAL;
+
+	ConcurrencyController(int aMaxLimit = 1) noexcept;
+
+	// Returns true if the limit was changed
+	bool addSample(const Sample& aSample) noexcept;
+
+	int getLimit() const noexcept { return limit; }
+
+	void setMaxLimit(int aMaxLimit) noexcept;
+	int getMaxLimit() const noexcept { return maxLimit; }
+
+	// Measured throughput for the concurrency level (bytes/s, 0 if not measured)
+	int64_t getThroughput(int aLevel) const noexcept;
+private:
+	struct Level {
+		double throughput = 0;
+
+		// Average wait per read (microseconds)
+		double latency = 0;
+
+		// Time of the measurement
+		uint64_t measured = 0;
+		bool valid = false;
+	};
+
+	vector<Level> levels;
+	int limit = 1;
+	int maxLimit;
+
+	// Sample time elapsed in total (milliseconds)
+	uint64_t time = 0;
+
+	// Measurements for the current level
+	int samples = 0;
+	Sample current;
+
+	void setLimit(int aLimit) noexcept;
+	bool isBetter(const Level& aHigher, const Level& aLower) const noexcept;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_CONCURRENCY_CONTROLLER_H)
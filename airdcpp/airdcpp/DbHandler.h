@@ -35,6 +35,41 @@ class DbSnapshot {
 
 };
 
+// Changes that are written in the database at once
+class DbBatch {
+public:
+	struct Operation {
+		Operation(const void* aKey, size_t aKeyLen, const void* aValue, size_t aValueLen, bool aRemove) : 
+			key(static_cast<const char*>(aKey), aKeyLen), value(aValue ? string(static_cast<const char*>(aValue), aValueLen) : string()), remove(aRemove) { }
+
+		const string key;
+		const string value;
+		const bool remove;
+	};
+
+	void put(const void* aKey, size_t aKeyLen, const void* aValue, size_t aValueLen) {
+		operations.emplace_back(aKey, aKeyLen, aValue, aValueLen, false);
+	}
+
+	void remove(const void* aKey, size_t aKeyLen) {
+		operations.emplace_back(aKey, aKeyLen, nullptr, 0, true);
+	}
+
+	const vector<Operation>& getOperations() const noexcept { return operations; }
+	size_t size() const noexcept { return operations.size(); }
+	bool empty() const noexcept { return operations.empty(); }
+	void clear() noexcept { operations.clear(); }
+private:
+	vector<Operation> operations;
+};
+
+struct DbKey {
+	DbKey(const void* aData, size_t aLen) : data(aData), len(aLen) { }
+
+	const void* data;
+	size_t len;
+};
+
 // Most methods throw DbException in case of errors
 class DbHandler : boost::noncopyable {
 public:
@@ -47,6 +82,19 @@ public:
 	virtual bool get(void* key, size_t keyLen, size_t initialValueLen, std::function<bool(void* aValue, size_t aValueLen)> loadF, DbSnapshot* aSnapshot = nullptr) = 0;
 	virtual void remove(void* aKey, size_t keyLen, DbSnapshot* aSnapshot = nullptr) = 0;
 
+	// Applies all changes in the batch atomically
+	virtual void write(const DbBatch& aBatch) = 0;
+
+	// Loads multiple values, loadF is called with the index of each key that was found
+	// All values are read from the same state of the database
+	virtual void get(const vector<DbKey>& aKeys, std::function<void(size_t aIndex, void* aValue, size_t aValueLen)> loadF, DbSnapshot* aSnapshot = nullptr) = 0;
+
+	// Iterates over all keys starting with the prefix in key order, return false from the callback to stop
+	virtual void forEach(std::function<bool(void* aKey, size_t keyLen, void* aValue, size_t valueLen)> f, const void* aPrefix = nullptr, size_t aPrefixLen = 0, DbSnapshot* aSnapshot = nullptr) = 0;
+
+	// Iterates over the keys starting from the first key that is equal or greater than aStartKey, return false from the callback to stop
+	virtual void forEachFrom(std::function<bool(void* aKey, size_t keyLen, void* aValue, size_t valueLen)> f, const void* aStartKey, size_t aStartKeyLen, DbSnapshot* aSnapshot = nullptr) = 0;
+
 	virtual bool hasKey(void* key, size_t keyLen, DbSnapshot* aSnapshot = nullptr) = 0;
 
 	virtual size_t size(bool thorough, DbSnapshot* aSnapshot = nullptr) = 0;
@@ -26,6 +26,8 @@
 #include "ClientManager.h"
 #include "FilteredFile.h"
 #include "LogManager.h"
+#include "NGramIndex.h"
+#include "ParallelBZInputStream.h"
 #include "QueueManager.h"
 #include "ResourceManager.h"
 #include "ShareManager.h"
@@ -57,6 +59,8 @@ DirectoryListing::DirectoryListing(const HintedUser& aUser, bool aPartial, const
 
 DirectoryListing::~DirectoryListing() {
 	dcdebug("Filelist deleted\n");
+	removeSearchIndex();
+
 	ClientManager::getInstance()->removeListener(this);
 	ShareManager::getInstance()->removeListener(this);
 
@@ -245,7 +249,7 @@ void DirectoryListing::loadFile() {
 		dcpp::File ff(fileName, dcpp::File::READ, dcpp::File::OPEN, dcpp::File::BUFFER_AUTO);
 		root->setLastUpdateDate(ff.getLastModified());
 		if(Util::stricmp(ext, ".bz2") == 0) {
-			FilteredInputStream<UnBZFilter, false> f(&ff);
+			ParallelBZInputStream f(&ff, getLoadingThreads());
 			loadXML(f, false, ADC_ROOT_STR, ff.getLastModified());
 		} else if(Util::stricmp(ext, ".xml") == 0) {
 			loadXML(ff, false, ADC_ROOT_STR, ff.getLastModified());
@@ -256,18 +260,30 @@ void DirectoryListing::loadFile() {
 class ListLoader : public SimpleXMLReader::CallBack {
 public:
 	ListLoader(DirectoryListing* aList, DirectoryListing::Directory* root, const string& aBase, bool aUpdating, const UserPtr& aUser, bool aCheckDupe, bool aPartialList, time_t aListDownloadDate) : 
-	  list(aList), cur(root), base(aBase), inListing(false), updating(aUpdating), user(aUser), checkDupe(aCheckDupe), partialList(aPartialList), dirsLoaded(0), listDownloadDate(aListDownloadDate) {
+	  list(aList), cur(root), base(aBase), inListing(false), updating(aUpdating), user(aUser), checkDupe(aCheckDupe), partialList(aPartialList), dirsLoaded(0), listDownloadDate(aListDownloadDate),
+	  pool(make_shared<DirectoryListing::FilePool>()) {
+	}
+
+	// Loader for a top-level directory of a full list that is parsed separately (the directory is added under aRoot)
+	ListLoader(const ListLoader& aParent, DirectoryListing::Directory* aRoot, const shared_ptr<DirectoryListing::FilePool>& aPool) :
+	  list(aParent.list), cur(aRoot), user(aParent.user), base(ADC_ROOT_STR), inListing(false), updating(false), checkDupe(aParent.checkDupe), partialList(aParent.partialList), dirsLoaded(0),
+	  listDownloadDate(aParent.listDownloadDate), pool(aPool) {
 	}
 
 	virtual ~ListLoader() { }
 
-	void startTag(const string& name, StringPairList& attribs, bool simple);
+	void startTagView(const string& name, const SimpleXMLReader::Attribs& attribs, bool simple);
 	void endTag(const string& name);
 
 	//const string& getBase() const { return base; }
 	int getLoadedDirs() { return dirsLoaded; }
 private:
-	void validateName(const string& aName);
+	void validateName(const boost::string_ref& aName);
+
+	// Attribute values that need to be passed as strings (reused to avoid allocations)
+	string nameStr;
+	string valueStr;
+	static const string& toString(const boost::string_ref& aValue, string& str_);
 
 	DirectoryListing* list;
 	DirectoryListing::Directory* cur;
@@ -280,17 +296,925 @@ private:
 	bool partialList;
 	int dirsLoaded;
 	time_t listDownloadDate;
+
+	// Files of this list are kept in the pool
+	shared_ptr<DirectoryListing::FilePool> pool;
+};
+
+class DirectoryListing::FilePool : boost::noncopyable {
+public:
+	// Files are trivially destructible so they don't need to be destructed separately
+	DirectoryListing::File* createFile(Directory* aDir, const boost::string_ref& aName, int64_t aSize, const TTHValue& aTTH, bool aCheckDupe, time_t aRemoteDate) {
+		auto name = static_cast<char*>(allocate(aName.size(), 1));
+		memcpy(name, aName.data(), aName.size());
+
+		return new (allocate(sizeof(File), alignof(File))) File(aDir, boost::string_ref(name, aName.size()), aSize, aTTH, aCheckDupe, aRemoteDate);
+	}
+private:
+	void* allocate(size_t aSize, size_t aAlignment) {
+		auto p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(pos) + aAlignment - 1) & ~(aAlignment - 1));
+		if (!pos || p + aSize > end) {
+			// Small lists are common with partial loading, increase the block size gradually
+			auto size = max(blockSize, aSize + aAlignment);
+			blocks.emplace_back(new char[size]);
+			blockSize = min(blockSize * 2, MAX_BLOCK_SIZE);
+
+			pos = blocks.back().get();
+			end = pos + size;
+			p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(pos) + aAlignment - 1) & ~(aAlignment - 1));
+		}
+
+		pos = p + aSize;
+		return p;
+	}
+
+	static const size_t MAX_BLOCK_SIZE;
+
+	vector<unique_ptr<char[]>> blocks;
+	size_t blockSize = 4096;
+	char* pos = nullptr;
+	char* end = nullptr;
+};
+
+const size_t DirectoryListing::FilePool::MAX_BLOCK_SIZE = 1024 * 1024;
+
+static_assert(std::is_trivially_destructible<DirectoryListing::File>::value, "Pooled files aren't destructed");
+
+class DirectoryListing::SearchCandidates {
+public:
+	typedef unordered_set<const Directory*> DirectorySet;
+
+	SearchCandidates(DirectorySet&& aDirectories) noexcept : directories(move(aDirectories)) {
+		// Parents must be searched as well
+		for (auto d : directories) {
+			while (d && tree.insert(d).second) {
+				d = d->getParent();
+			}
+		}
+	}
+
+	// Check whether the directory name or the files directly inside the directory may match
+	bool matches(const Directory* aDir) const noexcept { return directories.find(aDir) != directories.end(); }
+
+	// Check whether anything inside the directory tree may match
+	bool matchesTree(const Directory* aDir) const noexcept { return tree.find(aDir) != tree.end(); }
+private:
+	DirectorySet directories;
+
+	// Candidates and their parents
+	DirectorySet tree;
+};
+
+// Directories are referred by 32-bit ids in the index to save memory (ids of removed directories aren't reused)
+class DirectoryListing::SearchIndex : boost::noncopyable {
+public:
+	// Add a directory tree (returns false if the stop flag was set)
+	// ADL directories aren't searched and they are skipped
+	bool addTree(const Directory* aDir, const atomic<bool>& aStop) noexcept {
+		auto sorted = tths.size();
+		auto ret = addTreeImpl(aDir, aStop);
+
+		// Merge the new TTHs
+		sort(tths.begin() + sorted, tths.end());
+		inplace_merge(tths.begin(), tths.begin() + sorted, tths.end());
+		return ret;
+	}
+
+	// Release the memory reserved for new entries after the initial content has been added
+	void shrink() noexcept {
+		names.shrink();
+		tths.shrink_to_fit();
+		directories.shrink_to_fit();
+	}
+
+	// Add a reloaded directory tree of a partial list and its parents that haven't been indexed yet
+	void update(const Directory* aDir) noexcept {
+		atomic<bool> stop { false };
+		addTree(aDir, stop);
+
+		for (auto d = aDir->getParent(); d && ids.find(d) == ids.end(); d = d->getParent()) {
+			addDirectory(d);
+		}
+	}
+
+	// Remove a directory tree (must be called before the directories are modified)
+	// The entries of removed directories are ignored and they are cleaned up only after there are enough of them
+	void removeTree(const Directory* aDir) noexcept {
+		removeTreeImpl(aDir);
+		if (removed.size() <= ids.size()) {
+			return;
+		}
+
+		names.remove(removed);
+		tths.erase(remove_if(tths.begin(), tths.end(), [this](const TTHEntry& aEntry) {
+			return removed.find(aEntry.second) != removed.end();
+		}), tths.end());
+
+		removed.clear();
+	}
+
+	// Returns null if the search can't be filtered based on the index
+	unique_ptr<SearchCandidates> getCandidates(const SearchQuery& aSearch) const noexcept {
+		optional<IdSet> candidates;
+		auto filter = [&](IdSet&& aIds) {
+			if (!candidates) {
+				candidates = move(aIds);
+				return;
+			}
+
+			for (auto i = candidates->begin(); i != candidates->end();) {
+				if (aIds.find(*i) == aIds.end()) {
+					i = candidates->erase(i);
+				} else {
+					i++;
+				}
+			}
+		};
+
+		if (aSearch.root) {
+			// Directory names aren't matched with TTH searches
+			IdSet found;
+			auto range = equal_range(tths.begin(), tths.end(), TTHEntry(getTTHKey(*aSearch.root), 0), [](const TTHEntry& a, const TTHEntry& b) {
+				return a.first < b.first;
+			});
+
+			for (auto i = range.first; i != range.second; ++i) {
+				found.insert(i->second);
+			}
+
+			filter(move(found));
+		} else {
+			for (const auto& p : aSearch.include.getPatterns()) {
+				IdSet found;
+				if (names.getCandidates(p.str(), found)) {
+					filter(move(found));
+				}
+			}
+
+			// Extensions and sizes apply only to files
+			if (aSearch.itemType == SearchQuery::TYPE_FILE) {
+				if (!aSearch.ext.empty()) {
+					IdSet found;
+					if (all_of(aSearch.ext.begin(), aSearch.ext.end(), [&](const string& aExt) { return names.getCandidates(aExt, found); })) {
+						filter(move(found));
+					}
+				}
+
+				if (aSearch.gt > 0) {
+					IdSet found;
+					if (candidates) {
+						for (auto id : *candidates) {
+							if (directories[id].largestFile >= aSearch.gt) {
+								found.insert(id);
+							}
+						}
+					} else {
+						for (DirectoryId id = 0; id < directories.size(); ++id) {
+							if (directories[id].directory && directories[id].largestFile >= aSearch.gt) {
+								found.insert(id);
+							}
+						}
+					}
+
+					filter(move(found));
+				}
+			}
+		}
+
+		if (!candidates) {
+			return nullptr;
+		}
+
+		SearchCandidates::DirectorySet ret;
+		for (auto id : *candidates) {
+			if (directories[id].directory) {
+				ret.insert(directories[id].directory);
+			}
+		}
+
+		return make_unique<SearchCandidates>(move(ret));
+	}
+
+	size_t getDirectoryCount() const noexcept { return ids.size(); }
+	size_t getFileCount() const noexcept { return files; }
+
+	// Approximate, the allocator overhead isn't included
+	size_t getMemoryUsage() const noexcept {
+		return names.getKeyCount() * (sizeof(uint32_t) + sizeof(vector<DirectoryId>) + 2 * sizeof(void*)) + names.getEntryCount() * sizeof(DirectoryId) +
+			tths.capacity() * sizeof(TTHEntry) + directories.capacity() * sizeof(IndexedDirectory) +
+			ids.size() * (sizeof(pair<const Directory*, DirectoryId>) + 2 * sizeof(void*));
+	}
+
+	IGETSET(uint64_t, buildTime, BuildTime, 0);
+private:
+	typedef uint32_t DirectoryId;
+	typedef NGramIndex<DirectoryId>::ItemSet IdSet;
+
+	// The beginning of the TTH is enough for finding the candidates
+	typedef pair<uint32_t, DirectoryId> TTHEntry;
+
+	static uint32_t getTTHKey(const TTHValue& aTTH) noexcept {
+		uint32_t ret;
+		memcpy(&ret, aTTH.data, sizeof(ret));
+		return ret;
+	}
+
+	bool addTreeImpl(const Directory* aDir, const atomic<bool>& aStop) noexcept {
+		if (aDir->getAdls()) {
+			return true;
+		}
+
+		if (aStop) {
+			return false;
+		}
+
+		addDirectory(aDir);
+		for (const auto& d : aDir->directories | map_values) {
+			if (!addTreeImpl(d.get(), aStop)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// Unsorted TTHs are appended
+	void addDirectory(const Directory* aDir) noexcept {
+		auto id = static_cast<DirectoryId>(directories.size());
+		names.add(id, Text::toLower(aDir->getName()));
+
+		int64_t largestFile = -1;
+		for (const auto& f : aDir->files) {
+			names.add(id, Text::toLower(f->getName()));
+			tths.emplace_back(getTTHKey(f->getTTH()), id);
+			largestFile = max(largestFile, f->getSize());
+		}
+
+		files += aDir->files.size();
+		directories.push_back({ aDir, largestFile });
+		ids.emplace(aDir, id);
+	}
+
+	void removeTreeImpl(const Directory* aDir) noexcept {
+		auto i = ids.find(aDir);
+		if (i != ids.end()) {
+			removed.insert(i->second);
+			directories[i->second].directory = nullptr;
+			files -= aDir->files.size();
+			ids.erase(i);
+		}
+
+		for (const auto& d : aDir->directories | map_values) {
+			removeTreeImpl(d.get());
+		}
+	}
+
+	// Directory names and the file names inside them
+	NGramIndex<DirectoryId> names;
+
+	// Sorted by key
+	vector<TTHEntry> tths;
+
+	struct IndexedDirectory {
+		// Null for removed directories
+		const Directory* directory;
+		int64_t largestFile;
+	};
+
+	// By id
+	vector<IndexedDirectory> directories;
+	unordered_map<const Directory*, DirectoryId> ids;
+
+	// Directories with entries that haven't been cleaned up yet
+	IdSet removed;
+
+	size_t files = 0;
 };
 
+static const string sFileListing = "FileListing";
+static const string sBase = "Base";
+static const string sBaseDate = "BaseDate";
+static const string sGenerator = "Generator";
+static const string sDirectory = "Directory";
+static const string sIncomplete = "Incomplete";
+static const string sDirectories = "Directories";
+static const string sFiles = "Files";
+static const string sChildren = "Children"; // DEPRECATED
+static const string sFile = "File";
+static const string sName = "Name";
+static const string sSize = "Size";
+static const string sTTH = "TTH";
+static const string sDate = "Date";
+
+// Throws AbortException if the parent contains a directory with the same name
+static void insertDirectory(DirectoryListing::Directory* aParent, const DirectoryListing::Directory::Ptr& aDir) {
+	dcassert(aParent->directories.find(&aDir->getName()) == aParent->directories.end());
+	auto res = aParent->directories.emplace(&aDir->getName(), aDir);
+	if (!res.second) {
+		throw AbortException("The directory " + aDir->getAdcPath() + " contains items with duplicate names (" + aDir->getName() + ", " + *(*res.first).first + ")");
+	}
+}
+
+// Passes a full file list to the parser, except for the top-level directories that are cut out and
+// parsed by worker threads into separate subtrees. The subtrees are added in the list in document order
+// before the end of the listing is passed to the parser, so that the loaded tree and the reported errors
+// are the same as when the list is parsed sequentially.
+class ListSplitter : public InputStream {
+public:
+	ListSplitter(InputStream& aStream, SimpleXMLReader& aReader, const ListLoader& aLoader, DirectoryListing::Directory* aRoot, size_t aThreads) :
+		is(aStream), reader(aReader), loader(aLoader), root(aRoot), maxThreads(aThreads) {
+	}
+
+	~ListSplitter() {
+		{
+			std::lock_guard<std::mutex> l(cs);
+			stopping = true;
+		}
+
+		workerCond.notify_all();
+		for (auto& t: threads) {
+			t.join();
+		}
+	}
+
+	size_t read(void* aBuf, size_t& aLen) override;
+
+	// Waits until the queued directories have been parsed and adds them in the list
+	// Throws the first error (in document order) that occurred while parsing them
+	void finish();
+private:
+	struct Chunk {
+		Chunk(uint64_t aOffset) : offset(aOffset) { }
+
+		// Position of the directory in the document
+		const uint64_t offset;
+
+		// Data that hasn't been passed to the parser yet
+		string data;
+
+		// All data has been added
+		bool complete = false;
+
+		// The document ended before the directory
+		bool truncated = false;
+
+		// Reading of the document failed inside the directory (the data that was read is still parsed for earlier errors)
+		bool cancelled = false;
+
+		bool done = false;
+
+		// Temporary parent for the parsed directory
+		DirectoryListing::Directory::Ptr root;
+		std::exception_ptr error;
+	};
+
+	enum State {
+		// Before the root element
+		STATE_PROLOG,
+
+		// Between the top-level items
+		STATE_LISTING,
+
+		// Inside a top-level directory that is passed to a worker
+		STATE_DIRECTORY,
+
+		// Everything is passed to the parser
+		STATE_PASSTHROUGH
+	};
+
+	enum TagType {
+		TAG_INCOMPLETE,
+		TAG_START,
+		TAG_EMPTY,
+		TAG_END,
+
+		// Comments, CDATA sections, declarations and processing instructions
+		TAG_OTHER
+	};
+
+	// Finds the end of the tag starting at aPos
+	TagType parseTag(size_t aPos, size_t& end_) const noexcept;
+	bool hasName(size_t aPos, const string& aName) const noexcept;
+
+	// Processes the buffered tags until the parser needs to be synchronized
+	// Returns false if more data is needed
+	bool scan();
+	bool readInput();
+
+	// Passes everything from aPos to the parser after the queued directories have been added
+	void stopSplitting(size_t aPos) noexcept;
+
+	void startChunk();
+	void addChunkData(bool aComplete);
+
+	InputStream& is;
+	SimpleXMLReader& reader;
+	const ListLoader& loader;
+	DirectoryListing::Directory* const root;
+
+	string buf;
+
+	// Position of the buffer in the document
+	uint64_t bufOffset = 0;
+
+	// Data before this position has been processed
+	size_t bufPos = 0;
+
+	// Data that should be returned to the parser
+	size_t outPos = 0;
+	size_t outEnd = 0;
+
+	State state = STATE_PROLOG;
+
+	// Element depth inside the current top-level directory
+	size_t depth = 0;
+
+	// Start of the data that hasn't been added in the current directory chunk
+	size_t chunkPos = 0;
+
+	// Data that has been passed to the workers since the parser was synchronized
+	uint64_t skipped = 0;
+
+	bool checkEncoding = false;
+	bool finishPending = false;
+	bool failed = false;
+
+	// Directories in document order
+	std::deque<unique_ptr<Chunk>> chunks;
+
+	// Directories waiting for a worker
+	std::deque<Chunk*> queue;
+
+	// Size of the directory data that hasn't been passed to the worker parsers
+	size_t pendingBytes = 0;
+
+	std::mutex cs;
+	std::condition_variable workerCond;
+	std::condition_variable readerCond;
+	vector<std::thread> threads;
+	const size_t maxThreads;
+	bool stopping = false;
+
+	void runWorker() noexcept;
+	void parseChunk(Chunk& aChunk, const shared_ptr<DirectoryListing::FilePool>& aPool);
+
+	static const string listingStart;
+	static const size_t READ_SIZE;
+	static const size_t MAX_PENDING_BYTES;
+};
+
+const string ListSplitter::listingStart = "<FileListing>";
+const size_t ListSplitter::READ_SIZE = 256 * 1024;
+const size_t ListSplitter::MAX_PENDING_BYTES = 16 * 1024 * 1024;
+
+size_t ListSplitter::read(void* aBuf, size_t& aLen) {
+	for (;;) {
+		if (outPos < outEnd) {
+			auto len = min(aLen, outEnd - outPos);
+			memcpy(aBuf, &buf[outPos], len);
+			outPos += len;
+
+			aLen = len;
+			return len;
+		}
+
+		// The parser has processed everything that was returned earlier
+		if (skipped > 0) {
+			reader.skipInput(skipped);
+			skipped = 0;
+		}
+
+		if (checkEncoding) {
+			checkEncoding = false;
+			if (!reader.isUTF8()) {
+				// The workers would need to convert the data
+				stopSplitting(bufPos);
+			}
+		}
+
+		if (finishPending) {
+			finishPending = false;
+			finish();
+		}
+
+		if (state == STATE_PASSTHROUGH) {
+			if (bufPos < buf.size()) {
+				outPos = bufPos;
+				outEnd = bufPos = buf.size();
+				continue;
+			}
+
+			return is.read(aBuf, aLen);
+		}
+
+		if (!scan() && !readInput()) {
+			// End of the document, let the parser report possible errors
+			if (state == STATE_DIRECTORY) {
+				bufPos = buf.size();
+				chunks.back()->truncated = true;
+				addChunkData(true);
+			}
+
+			stopSplitting(bufPos);
+		}
+	}
+}
+
+bool ListSplitter::readInput() {
+	// Remove the processed data
+	dcassert(state != STATE_DIRECTORY || chunkPos == bufPos);
+	buf.erase(0, bufPos);
+	bufOffset += bufPos;
+	bufPos = outPos = outEnd = chunkPos = 0;
+
+	auto oldSize = buf.size();
+	size_t len = READ_SIZE;
+	buf.resize(oldSize + len);
+	len = is.read(&buf[oldSize], len);
+	buf.resize(oldSize + len);
+	return len > 0;
+}
+
+ListSplitter::TagType ListSplitter::parseTag(size_t aPos, size_t& end_) const noexcept {
+	auto findEnd = [&](const char* aEnd, TagType aType) {
+		auto p = buf.find(aEnd, aPos + 2);
+		if (p == string::npos) {
+			return TAG_INCOMPLETE;
+		}
+
+		end_ = p + strlen(aEnd);
+		return aType;
+	};
+
+	if (buf.size() - aPos < 2) {
+		return TAG_INCOMPLETE;
+	}
+
+	switch (buf[aPos + 1]) {
+		case '/': return findEnd(">", TAG_END);
+		case '?': return findEnd("?>", TAG_OTHER);
+		case '!': {
+			if (buf.size() - aPos < 9) {
+				return TAG_INCOMPLETE;
+			}
+
+			if (buf.compare(aPos, 4, "<!--") == 0) {
+				return findEnd("-->", TAG_OTHER);
+			}
+
+			if (buf.compare(aPos, 9, "<![CDATA[") == 0) {
+				return findEnd("]]>", TAG_OTHER);
+			}
+
+			return findEnd(">", TAG_OTHER);
+		}
+		default: break;
+	}
+
+	// Start tag, attribute values may contain '>'
+	char quote = 0;
+	for (auto i = aPos + 1; i < buf.size(); ++i) {
+		auto c = buf[i];
+		if (quote) {
+			if (c == quote) {
+				quote = 0;
+			}
+		} else if (c == '"' || c == '\'') {
+			quote = c;
+		} else if (c == '>') {
+			end_ = i + 1;
+			return buf[i - 1] == '/' ? TAG_EMPTY : TAG_START;
+		}
+	}
+
+	return TAG_INCOMPLETE;
+}
+
+bool ListSplitter::hasName(size_t aPos, const string& aName) const noexcept {
+	if (buf.compare(aPos + 1, aName.size(), aName) != 0) {
+		return false;
+	}
+
+	// The tag is complete so there is at least one more character
+	auto c = buf[aPos + 1 + aName.size()];
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '/' || c == '>';
+}
+
+bool ListSplitter::scan() {
+	auto outStart = bufPos;
+	for (;;) {
+		auto p = static_cast<const char*>(memchr(buf.data() + bufPos, '<', buf.size() - bufPos));
+		if (!p) {
+			bufPos = buf.size();
+			break;
+		}
+
+		bufPos = p - buf.data();
+
+		size_t tagEnd = 0;
+		auto type = parseTag(bufPos, tagEnd);
+		if (type == TAG_INCOMPLETE) {
+			break;
+		}
+
+		if (state == STATE_DIRECTORY) {
+			if (type == TAG_START) {
+				depth++;
+			} else if (type == TAG_END && --depth == 0) {
+				bufPos = tagEnd;
+				addChunkData(true);
+				state = STATE_LISTING;
+				return true;
+			}
+
+			bufPos = tagEnd;
+			continue;
+		}
+
+		if (type == TAG_OTHER) {
+			bufPos = tagEnd;
+			continue;
+		}
+
+		if (state == STATE_PROLOG) {
+			// Root element, wait until the parser has read the encoding
+			if (type == TAG_START && hasName(bufPos, sFileListing)) {
+				state = STATE_LISTING;
+				checkEncoding = true;
+			} else {
+				state = STATE_PASSTHROUGH;
+			}
+
+			bufPos = tagEnd;
+			outPos = outStart;
+			outEnd = bufPos;
+			return true;
+		}
+
+		if (type == TAG_EMPTY && !hasName(bufPos, sDirectory)) {
+			// Files are added by the parser
+			bufPos = tagEnd;
+			continue;
+		}
+
+		// Let the parser process the preceding data first
+		if (bufPos > outStart) {
+			outPos = outStart;
+			outEnd = bufPos;
+			return true;
+		}
+
+		if (type == TAG_END || !hasName(bufPos, sDirectory)) {
+			// End of the listing (or an unknown element with content)
+			stopSplitting(bufPos);
+			return true;
+		}
+
+		startChunk();
+		bufPos = tagEnd;
+		if (type == TAG_EMPTY) {
+			addChunkData(true);
+			return true;
+		}
+
+		state = STATE_DIRECTORY;
+		depth = 1;
+	}
+
+	if (state == STATE_DIRECTORY) {
+		if (bufPos > chunkPos) {
+			addChunkData(false);
+		}
+
+		return false;
+	}
+
+	if (bufPos > outStart) {
+		outPos = outStart;
+		outEnd = bufPos;
+		return true;
+	}
+
+	return false;
+}
+
+void ListSplitter::stopSplitting(size_t aPos) noexcept {
+	state = STATE_PASSTHROUGH;
+	bufPos = aPos;
+	finishPending = !chunks.empty();
+}
+
+void ListSplitter::startChunk() {
+	chunkPos = bufPos;
+
+	{
+		std::lock_guard<std::mutex> l(cs);
+		chunks.emplace_back(new Chunk(bufOffset + bufPos));
+		queue.push_back(chunks.back().get());
+	}
+
+	if (threads.size() < maxThreads) {
+		threads.emplace_back([this] { runWorker(); });
+	}
+
+	workerCond.notify_all();
+}
+
+void ListSplitter::addChunkData(bool aComplete) {
+	auto& chunk = *chunks.back();
+	auto len = bufPos - chunkPos;
+
+	{
+		std::unique_lock<std::mutex> l(cs);
+
+		// Don't buffer too much if the workers can't keep up
+		readerCond.wait(l, [&] { return pendingBytes < MAX_PENDING_BYTES || chunk.done; });
+
+		if (!chunk.done) {
+			chunk.data.append(buf, chunkPos, len);
+			pendingBytes += len;
+		}
+
+		chunk.complete = aComplete;
+	}
+
+	skipped += len;
+	chunkPos = bufPos;
+	workerCond.notify_all();
+}
+
+void ListSplitter::runWorker() noexcept {
+	// Each thread allocates the files from a separate pool
+	auto pool = make_shared<DirectoryListing::FilePool>();
+
+	for (;;) {
+		Chunk* chunk = nullptr;
+
+		{
+			std::unique_lock<std::mutex> l(cs);
+			workerCond.wait(l, [this] { return stopping || !queue.empty(); });
+			if (stopping) {
+				return;
+			}
+
+			chunk = queue.front();
+			queue.pop_front();
+		}
+
+		std::exception_ptr error;
+		try {
+			parseChunk(*chunk, pool);
+		} catch (...) {
+			error = std::current_exception();
+		}
+
+		{
+			std::lock_guard<std::mutex> l(cs);
+			chunk->error = error;
+			chunk->done = true;
+
+			pendingBytes -= chunk->data.size();
+			string().swap(chunk->data);
+		}
+
+		readerCond.notify_all();
+	}
+}
+
+void ListSplitter::parseChunk(Chunk& aChunk, const shared_ptr<DirectoryListing::FilePool>& aPool) {
+	aChunk.root = DirectoryListing::Directory::create(nullptr, ADC_ROOT_STR, DirectoryListing::Directory::TYPE_INCOMPLETE_NOCHILD, 0);
+
+	ListLoader ll(loader, aChunk.root.get(), aPool);
+	SimpleXMLReader xml(&ll);
+
+	// Use the same nesting level and input position as in the original document
+	xml.parse(listingStart);
+	xml.skipInput(aChunk.offset - listingStart.size());
+
+	string data;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> l(cs);
+			workerCond.wait(l, [&] { return stopping || aChunk.complete || !aChunk.data.empty(); });
+			if (stopping) {
+				return;
+			}
+
+			if (aChunk.data.empty()) {
+				break;
+			}
+
+			data.clear();
+			data.swap(aChunk.data);
+			pendingBytes -= data.size();
+		}
+
+		readerCond.notify_all();
+		xml.parse(data);
+	}
+
+	if (aChunk.truncated) {
+		// Report the end of the document
+		MemoryInputStream mis(Util::emptyString);
+		xml.parse(mis);
+	}
+}
+
+void ListSplitter::finish() {
+	{
+		// Directories that haven't been read completely can't be added
+		std::lock_guard<std::mutex> l(cs);
+		if (!chunks.empty() && !chunks.back()->complete) {
+			chunks.back()->cancelled = true;
+			chunks.back()->complete = true;
+		}
+	}
+
+	workerCond.notify_all();
+
+	// Only the first error is reported
+	if (failed) {
+		return;
+	}
+
+	try {
+		while (!chunks.empty()) {
+			{
+				std::unique_lock<std::mutex> l(cs);
+				readerCond.wait(l, [this] { return chunks.front()->done; });
+			}
+
+			auto chunk = move(chunks.front());
+			chunks.pop_front();
+
+			if (chunk->error) {
+				std::rethrow_exception(chunk->error);
+			}
+
+			if (chunk->cancelled) {
+				continue;
+			}
+
+			for (const auto& d: chunk->root->directories | map_values) {
+				d->setParent(root);
+				insertDirectory(root, d);
+			}
+		}
+	} catch (...) {
+		failed = true;
+		throw;
+	}
+}
+
 int DirectoryListing::loadPartialXml(const string& aXml, const string& aBase) {
+	// The loaded directories are indexed again
+	auto index = getSearchIndex();
+	if (index) {
+		auto base = findDirectory(aBase);
+		if (base) {
+			index->removeTree(base.get());
+		}
+	}
+
 	MemoryInputStream mis(aXml);
-	return loadXML(mis, true, aBase);
+
+	int dirsLoaded = 0;
+	try {
+		dirsLoaded = loadXML(mis, true, aBase);
+	} catch (...) {
+		// Don't leave partially loaded content unindexed
+		removeSearchIndex();
+		throw;
+	}
+
+	if (index) {
+		auto base = findDirectory(aBase);
+		if (base) {
+			index->update(base.get());
+		}
+	}
+
+	return dirsLoaded;
 }
 
 int DirectoryListing::loadXML(InputStream& is, bool aUpdating, const string& aBase, time_t aListDate) {
 	ListLoader ll(this, root.get(), aBase, aUpdating, getUser(), !isOwnList && isClientView && SETTING(DUPES_IN_FILELIST), partialList, aListDate);
 	try {
-		dcpp::SimpleXMLReader(&ll).parse(is);
+		dcpp::SimpleXMLReader reader(&ll);
+
+		auto threads = getLoadingThreads() > 0 ? getLoadingThreads() : static_cast<int>(std::thread::hardware_concurrency());
+		if (!aUpdating && threads > 1) {
+			ListSplitter splitter(is, reader, ll, root.get(), threads);
+			try {
+				reader.parse(splitter);
+			} catch (...) {
+				// Errors in the preceding directories are reported first
+				splitter.finish();
+				throw;
+			}
+		} else {
+			reader.parse(is);
+		}
 	} catch(SimpleXMLException& e) {
 		throw AbortException(e.getError());
 	}
@@ -298,7 +1222,7 @@ int DirectoryListing::loadXML(InputStream& is, bool aUpdating, const string& aBa
 	return ll.getLoadedDirs();
 }
 
-void ListLoader::validateName(const string& aName) {
+void ListLoader::validateName(const boost::string_ref& aName) {
 	if (aName.empty()) {
 		throw SimpleXMLException("Name attribute missing");
 	}
@@ -312,46 +1236,38 @@ void ListLoader::validateName(const string& aName) {
 	}
 }
 
-static const string sFileListing = "FileListing";
-static const string sBase = "Base";
-static const string sBaseDate = "BaseDate";
-static const string sGenerator = "Generator";
-static const string sDirectory = "Directory";
-static const string sIncomplete = "Incomplete";
-static const string sDirectories = "Directories";
-static const string sFiles = "Files";
-static const string sChildren = "Children"; // DEPRECATED
-static const string sFile = "File";
-static const string sName = "Name";
-static const string sSize = "Size";
-static const string sTTH = "TTH";
-static const string sDate = "Date";
-void ListLoader::startTag(const string& name, StringPairList& attribs, bool simple) {
+const string& ListLoader::toString(const boost::string_ref& aValue, string& str_) {
+	str_.assign(aValue.data(), aValue.size());
+	return str_;
+}
+
+void ListLoader::startTagView(const string& name, const SimpleXMLReader::Attribs& attribs, bool simple) {
 	if(list->getClosing()) {
 		throw AbortException();
 	}
 
 	if(inListing) {
 		if(name == sFile) {
-			const string& n = getAttrib(attribs, sName, 0);
+			auto n = getAttrib(attribs, sName, 0);
 			validateName(n);
 
-			const string& s = getAttrib(attribs, sSize, 1);
+			auto s = getAttrib(attribs, sSize, 1);
 			if(s.empty())
 				return;
 
-			auto size = Util::toInt64(s);
+			auto size = Util::toInt64(toString(s, valueStr));
 
-			const string& h = getAttrib(attribs, sTTH, 2);
+			auto h = getAttrib(attribs, sTTH, 2);
 			if(h.empty() && !SettingsManager::lanMode)
 				return;		
 
-			TTHValue tth(h); /// @todo verify validity?
+			TTHValue tth(toString(h, valueStr)); /// @todo verify validity?
+			auto date = Util::toTimeT(toString(getAttrib(attribs, sDate, 3), valueStr));
 
-			auto f = make_shared<DirectoryListing::File>(cur, n, size, tth, checkDupe, Util::toTimeT(getAttrib(attribs, sDate, 3)));
-			cur->files.push_back(f);
+			// Aliasing pointer, the pool is released after all files have been removed
+			cur->files.emplace_back(pool, pool->createFile(cur, n, size, tth, checkDupe, date));
 		} else if(name == sDirectory) {
-			const string& n = getAttrib(attribs, sName, 0);
+			auto n = getAttrib(attribs, sName, 0);
 			validateName(n);
 
 			bool incomp = getAttrib(attribs, sIncomplete, 1) == "1";
@@ -360,19 +1276,21 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 
 			DirectoryContentInfo contentInfo;
 			if (!incomp || !filesStr.empty() || !directoriesStr.empty()) {
-				contentInfo = DirectoryContentInfo(Util::toInt(directoriesStr), Util::toInt(filesStr));
+				contentInfo = DirectoryContentInfo(Util::toInt(directoriesStr.to_string()), Util::toInt(filesStr.to_string()));
 			}
 
 			bool children = getAttrib(attribs, sChildren, 2) == "1" || contentInfo.directories > 0; // DEPRECATED
 
-			const string& size = getAttrib(attribs, sSize, 2);
-			const string& date = getAttrib(attribs, sDate, 3);
+			auto size = getAttrib(attribs, sSize, 2);
+			auto date = Util::toTimeT(toString(getAttrib(attribs, sDate, 3), valueStr));
+
+			toString(n, nameStr);
 
 			DirectoryListing::Directory::Ptr d = nullptr;
 			if(updating) {
 				dirsLoaded++;
 
-				auto i = cur->directories.find(&n);
+				auto i = cur->directories.find(&nameStr);
 				if (i != cur->directories.end()) {
 					d = i->second;
 				}
@@ -382,12 +1300,12 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 				auto type = incomp ? (children ? DirectoryListing::Directory::TYPE_INCOMPLETE_CHILD : DirectoryListing::Directory::TYPE_INCOMPLETE_NOCHILD) :
 					DirectoryListing::Directory::TYPE_NORMAL;
 
-				d = DirectoryListing::Directory::create(cur, n, type, listDownloadDate, (partialList && checkDupe), contentInfo, size, Util::toTimeT(date));
+				d = DirectoryListing::Directory::create(cur, nameStr, type, listDownloadDate, (partialList && checkDupe), contentInfo, toString(size, valueStr), date);
 			} else {
 				if(!incomp) {
 					d->setComplete();
 				}
-				d->setRemoteDate(Util::toTimeT(date));
+				d->setRemoteDate(date);
 			}
 			cur = d.get();
 
@@ -398,7 +1316,7 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 		}
 	} else if(name == sFileListing) {
 		if (updating) {
-			const string& b = getAttrib(attribs, sBase, 2);
+			const auto& b = toString(getAttrib(attribs, sBase, 2), valueStr);
 			dcassert(Util::isAdcPath(base));
 
 			// Validate the parsed base path
@@ -412,8 +1330,8 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 
 			dcassert(list->findDirectory(base));
 
-			const string& baseDate = getAttrib(attribs, sBaseDate, 3);
-			cur->setRemoteDate(Util::toTimeT(baseDate));
+			auto baseDate = getAttrib(attribs, sBaseDate, 3);
+			cur->setRemoteDate(Util::toTimeT(baseDate.to_string()));
 		}
 
 		// Set the root complete only after we have finished loading 
@@ -445,8 +1363,8 @@ void ListLoader::endTag(const string& name) {
 	}
 }
 
-DirectoryListing::File::File(Directory* aDir, const string& aName, int64_t aSize, const TTHValue& aTTH, bool checkDupe, time_t aRemoteDate) noexcept : 
-	name(aName), size(aSize), parent(aDir), tthRoot(aTTH), remoteDate(aRemoteDate) {
+DirectoryListing::File::File(Directory* aDir, const boost::string_ref& aName, int64_t aSize, const TTHValue& aTTH, bool checkDupe, time_t aRemoteDate) noexcept : 
+	size(aSize), parent(aDir), tthRoot(aTTH), remoteDate(aRemoteDate), name(aName.data()), nameLength(static_cast<uint32_t>(aName.size())) {
 
 	if (checkDupe && size > 0) {
 		dupe = AirUtil::checkFileDupe(tthRoot);
@@ -455,19 +1373,30 @@ DirectoryListing::File::File(Directory* aDir, const string& aName, int64_t aSize
 	//dcdebug("DirectoryListing::File (copy) %s was created\n", aName.c_str());
 }
 
-DirectoryListing::File::File(const File& rhs, bool _adls) noexcept : name(rhs.name), size(rhs.size), parent(rhs.parent), tthRoot(rhs.tthRoot), adls(_adls), dupe(rhs.dupe), remoteDate(rhs.remoteDate)
+DirectoryListing::File::File(const File& rhs, bool _adls) noexcept : size(rhs.size), parent(rhs.parent), tthRoot(rhs.tthRoot), remoteDate(rhs.remoteDate), 
+	name(rhs.name), nameLength(rhs.nameLength), dupe(rhs.dupe), adls(_adls)
 {
 	//dcdebug("DirectoryListing::File (copy) %s was created\n", rhs.getName().c_str());
 }
 
+struct DirectoryListing::File::Copy {
+	Copy(const Ptr& aFile, bool aAdls) noexcept : file(*aFile, aAdls), source(aFile) { }
+
+	File file;
+
+	// The name is owned by the pool of the original file
+	const Ptr source;
+};
+
+DirectoryListing::File::Ptr DirectoryListing::File::createCopy(const Ptr& aFile, bool aAdls) noexcept {
+	auto copy = make_shared<Copy>(aFile, aAdls);
+	return Ptr(copy, &copy->file);
+}
+
 DirectoryListing::Directory::Ptr DirectoryListing::Directory::create(Directory* aParent, const string& aName, DirType aType, time_t aUpdateDate, bool aCheckDupe, const DirectoryContentInfo& aContentInfo, const string& aSize, time_t aRemoteDate) {
 	auto dir = Ptr(new Directory(aParent, aName, aType, aUpdateDate, aCheckDupe, aContentInfo, aSize, aRemoteDate));
 	if (aParent && aType != TYPE_ADLS) { // This would cause an infinite recursion in ADL search
-		dcassert(aParent->directories.find(&dir->getName()) == aParent->directories.end());
-		auto res = aParent->directories.emplace(&dir->getName(), dir);
-		if (!res.second) {
-			throw AbortException("The directory " + dir->getAdcPath() + " contains items with duplicate names (" + dir->getName() + ", " + *(*res.first).first + ")");
-		}
+		insertDirectory(aParent, dir);
 	}
 
 	return dir;
@@ -515,27 +1444,36 @@ DirectoryListing::Directory::Directory(Directory* aParent, const string& aName,
 	//dcdebug("DirectoryListing::Directory %s was created\n", aName.c_str());
 }
 
-void DirectoryListing::Directory::search(OrderedStringSet& aResults, SearchQuery& aStrings) const noexcept {
+void DirectoryListing::Directory::search(OrderedStringSet& aResults, SearchQuery& aStrings, const SearchCandidates* aCandidates) const noexcept {
 	if (getAdls())
 		return;
 
-	if (aStrings.matchesDirectory(name)) {
-		auto path = parent ? parent->getAdcPath() : ADC_ROOT_STR;
-		auto res = find(aResults, path);
-		if (res == aResults.end() && aStrings.matchesSize(getTotalSize(false))) {
-			aResults.insert(path);
+	if (!aCandidates || aCandidates->matches(this)) {
+		// TTH searches match files only
+		if (!aStrings.root && aStrings.matchesDirectory(name)) {
+			auto path = parent ? parent->getAdcPath() : ADC_ROOT_STR;
+			auto res = find(aResults, path);
+			if (res == aResults.end() && aStrings.matchesSize(getTotalSize(false))) {
+				aResults.insert(path);
+			}
 		}
-	}
 
-	for (auto& f: files) {
-		if (aStrings.matchesFile(f->getName(), f->getSize(), f->getRemoteDate(), f->getTTH())) {
-			aResults.insert(getAdcPath());
-			break;
+		string fileName;
+		for (auto& f: files) {
+			const auto n = f->getNameRef();
+			fileName.assign(n.data(), n.size());
+			if (aStrings.matchesFile(fileName, f->getSize(), f->getRemoteDate(), f->getTTH())) {
+				aResults.insert(getAdcPath());
+				break;
+			}
 		}
 	}
 
 	for (const auto& d: directories | map_values) {
-		d->search(aResults, aStrings);
+		if (!aCandidates || aCandidates->matchesTree(d.get())) {
+			d->search(aResults, aStrings, aCandidates);
+		}
+
 		if (aResults.size() >= aStrings.maxResults) return;
 	}
 }
@@ -649,7 +1587,10 @@ DirectoryListing::Directory::Ptr DirectoryListing::findDirectory(const string& a
 }
 
 void DirectoryListing::Directory::findFiles(const boost::regex& aReg, File::List& aResults) const noexcept {
-	copy_if(files.begin(), files.end(), back_inserter(aResults), [&aReg](const File::Ptr& df) { return boost::regex_match(df->getName(), aReg); });
+	copy_if(files.begin(), files.end(), back_inserter(aResults), [&aReg](const File::Ptr& df) { 
+		const auto n = df->getNameRef();
+		return boost::regex_match(n.begin(), n.end(), aReg); 
+	});
 
 	for (const auto& d : directories | map_values) {
 		d->findFiles(aReg, aResults);
@@ -694,18 +1635,15 @@ void DirectoryListing::Directory::filterList(DirectoryListing& dirList) noexcept
 }
 
 void DirectoryListing::Directory::filterList(DirectoryListing::Directory::TTHSet& l) noexcept {
-	for (auto i = directories.begin(); i != directories.end();) {
-		auto d = i->second.get();
-
+	for (const auto& d: directories | map_values) {
 		d->filterList(l);
-
-		if (d->directories.empty() && d->files.empty()) {
-			i = directories.erase(i);
-		} else {
-			++i;
-		}
 	}
 
+	// Erasing the items one by one would move the remaining directories every time
+	directories.erase(remove_if(directories.begin(), directories.end(), [](const Map::value_type& i) { 
+		return i.second->directories.empty() && i.second->files.empty(); 
+	}), directories.end());
+
 	files.erase(remove_if(files.begin(), files.end(), HashContained(l)), files.end());
 
 	if((SETTING(SKIP_SUBTRACT) > 0) && (files.size() < 2)) {   //setting for only skip if folder filecount under x ?
@@ -783,13 +1721,9 @@ size_t DirectoryListing::Directory::getTotalFileCount(bool aCountAdls) const noe
 }
 
 void DirectoryListing::Directory::clearAdls() noexcept {
-	for (auto i = directories.begin(); i != directories.end();) {
-		if (i->second->getAdls()) {
-			i = directories.erase(i);
-		} else {
-			++i;
-		}
-	}
+	directories.erase(remove_if(directories.begin(), directories.end(), [](const Map::value_type& i) { 
+		return i.second->getAdls(); 
+	}), directories.end());
 }
 
 string DirectoryListing::Directory::getAdcPath() const noexcept {
@@ -811,7 +1745,7 @@ int64_t DirectoryListing::Directory::getFilesSize() const noexcept {
 }
 
 bool DirectoryListing::File::isInQueue() const noexcept {
-	return AirUtil::isQueueDupe(dupe) || AirUtil::isFinishedDupe(dupe);
+	return AirUtil::isQueueDupe(getDupe()) || AirUtil::isFinishedDupe(getDupe());
 }
 
 uint8_t DirectoryListing::Directory::checkShareDupes() noexcept {
@@ -965,14 +1899,20 @@ void DirectoryListing::listDiffImpl(const string& aFile, bool aOwnList) {
 	DirectoryListing dirList(hintedUser, false, aFile, false, aOwnList);
 	dirList.loadFile();
 
+	removeSearchIndex();
 	root->filterList(dirList);
 	fire(DirectoryListingListener::LoadingFinished(), start, ADC_ROOT_STR, false);
+
+	startSearchIndexing();
 }
 
 void DirectoryListing::matchAdlImpl() {
 	fire(DirectoryListingListener::LoadingStarted(), false);
 
 	int64_t start = GET_TICK();
+
+	// ADL directories aren't indexed
+	waitSearchIndexing();
 	root->clearAdls();
 
 	if (isOwnList) {
@@ -993,6 +1933,7 @@ void DirectoryListing::loadFileImpl(const string& aInitialDir) {
 	fire(DirectoryListingListener::LoadingStarted(), false);
 
 	// In case we are reloading...
+	removeSearchIndex();
 	root->clearAll();
 
 	loadFile();
@@ -1003,6 +1944,7 @@ void DirectoryListing::loadFileImpl(const string& aInitialDir) {
 	}
 
 	onLoadingFinished(start, aInitialDir, false);
+	startSearchIndexing();
 }
 
 void DirectoryListing::onLoadingFinished(int64_t aStartTime, const string& aBasePath, bool aBackgroundTask) noexcept {
@@ -1055,13 +1997,100 @@ void DirectoryListing::searchImpl(const SearchPtr& aSearch) noexcept {
 	} else {
 		const auto dir = findDirectory(aSearch->path);
 		if (dir) {
-			dir->search(searchResults, *curSearch);
+			if (!searchIndexThread.joinable() && !searchIndex) {
+				// Partial lists are indexed when they are searched for the first time
+				createSearchIndex();
+			}
+
+			search(*dir, searchResults, *curSearch);
 		}
 
 		endSearch(false);
 	}
 }
 
+void DirectoryListing::search(const Directory& aDir, OrderedStringSet& results_, SearchQuery& aSearch) const noexcept {
+	unique_ptr<SearchCandidates> candidates;
+
+	// Searches are performed by walking the whole tree while the index is being created
+	auto index = getSearchIndex();
+	if (index) {
+		candidates = index->getCandidates(aSearch);
+	}
+
+	aDir.search(results_, aSearch, candidates.get());
+}
+
+DirectoryListing::SearchIndex* DirectoryListing::getSearchIndex() const noexcept {
+	return searchIndexReady ? searchIndex.get() : nullptr;
+}
+
+bool DirectoryListing::isLocalSearch() const noexcept {
+	return !partialList || (!isOwnList && hintedUser.user->isNMDC());
+}
+
+void DirectoryListing::createSearchIndex() noexcept {
+	removeSearchIndex();
+	buildSearchIndex();
+}
+
+void DirectoryListing::startSearchIndexing() noexcept {
+	removeSearchIndex();
+	if (!isClientView || !isLocalSearch()) {
+		return;
+	}
+
+	searchIndexThread = std::thread([this] {
+		buildSearchIndex();
+	});
+}
+
+void DirectoryListing::waitSearchIndexing() noexcept {
+	if (searchIndexThread.joinable()) {
+		searchIndexThread.join();
+	}
+}
+
+void DirectoryListing::removeSearchIndex() noexcept {
+	searchIndexStopping = true;
+	waitSearchIndexing();
+	searchIndexStopping = false;
+
+	searchIndexReady = false;
+	searchIndex.reset();
+}
+
+void DirectoryListing::buildSearchIndex() noexcept {
+	auto start = GET_TICK();
+
+	auto index = make_unique<SearchIndex>();
+	if (!index->addTree(root.get(), searchIndexStopping)) {
+		return;
+	}
+
+	index->shrink();
+	index->setBuildTime(GET_TICK() - start);
+	dcdebug("Search index for the list of %s created in " U64_FMT " ms (%d directories, %d files, %d KiB)\n", getNick(false).c_str(), index->getBuildTime(),
+		static_cast<int>(index->getDirectoryCount()), static_cast<int>(index->getFileCount()), static_cast<int>(index->getMemoryUsage() / 1024));
+
+	searchIndex = move(index);
+	searchIndexReady = true;
+}
+
+optional<DirectoryListing::SearchIndexInfo> DirectoryListing::getSearchIndexInfo() const noexcept {
+	auto index = getSearchIndex();
+	if (!index) {
+		return nullopt;
+	}
+
+	SearchIndexInfo info;
+	info.directories = index->getDirectoryCount();
+	info.files = index->getFileCount();
+	info.memoryUsage = index->getMemoryUsage();
+	info.buildTime = index->getBuildTime();
+	return info;
+}
+
 void DirectoryListing::loadPartialImpl(const string& aXml, const string& aBasePath, bool aBackgroundTask, const AsyncF& aCompletionF) {
 	if (!partialList)
 		return;
@@ -1080,6 +2109,11 @@ void DirectoryListing::loadPartialImpl(const string& aXml, const string& aBasePa
 		fire(DirectoryListingListener::LoadingStarted(), !reloading);
 
 		if (reloading) {
+			auto index = getSearchIndex();
+			if (index) {
+				index->removeTree(d.get());
+			}
+
 			// Remove all existing directories inside this path
 			d->clearAll();
 		}
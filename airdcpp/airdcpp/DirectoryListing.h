@@ -40,9 +40,15 @@
 #include "Streams.h"
 #include "TrackableDownloadItem.h"
 
+#include <boost/container/flat_map.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include <thread>
+
 namespace dcpp {
 
 class ListLoader;
+class ListSplitter;
 typedef uint32_t DirectoryListingToken;
 
 class DirectoryListing : public UserInfoBase, public TrackableDownloadItem,
@@ -51,6 +57,10 @@ class DirectoryListing : public UserInfoBase, public TrackableDownloadItem,
 {
 public:
 	class Directory;
+
+	// Directories that may contain matches for a single search (based on the search index)
+	class SearchCandidates;
+
 	class File : boost::noncopyable {
 
 	public:
@@ -61,25 +71,45 @@ public:
 		typedef std::vector<Ptr> List;
 		typedef List::const_iterator Iter;
 		
-		File(Directory* aDir, const string& aName, int64_t aSize, const TTHValue& aTTH, bool checkDupe, time_t aRemoteDate) noexcept;
-		File(const File& rhs, bool _adls = false) noexcept;
-
-		~File() { }
+		// The name isn't copied and it must remain valid for the lifetime of the file
+		// (files loaded from lists store their names in the same pool with the file)
+		File(Directory* aDir, const boost::string_ref& aName, int64_t aSize, const TTHValue& aTTH, bool checkDupe, time_t aRemoteDate) noexcept;
 
+		// The copy will hold a reference to the original file
+		static Ptr createCopy(const Ptr& aFile, bool aAdls) noexcept;
 
 		string getAdcPath() const noexcept {
-			return parent->getAdcPath() + name;
+			return parent->getAdcPath() + getName();
+		}
+
+		string getName() const noexcept {
+			return string(name, nameLength);
 		}
 
-		GETSET(string, name, Name);
+		boost::string_ref getNameRef() const noexcept {
+			return boost::string_ref(name, nameLength);
+		}
+
+		DupeType getDupe() const noexcept { return static_cast<DupeType>(dupe); }
+		void setDupe(DupeType aDupe) noexcept { dupe = static_cast<uint8_t>(aDupe); }
+
+		bool getAdls() const noexcept { return adls; }
+
 		GETSET(int64_t, size, Size);
 		GETSET(Directory*, parent, Parent);
 		GETSET(TTHValue, tthRoot, TTH);
-		IGETSET(bool, adls, Adls, false);
-		IGETSET(DupeType, dupe, Dupe, DUPE_NONE);
 		IGETSET(time_t, remoteDate, RemoteDate, 0);
 
 		bool isInQueue() const noexcept;
+	private:
+		struct Copy;
+		File(const File& rhs, bool aAdls) noexcept;
+
+		// Keep the small fields last to avoid padding (there can be millions of files in memory)
+		const char* name;
+		uint32_t nameLength;
+		uint8_t dupe = DUPE_NONE;
+		bool adls = false;
 	};
 
 	class Directory : boost::noncopyable {
@@ -97,7 +127,7 @@ public:
 
 		typedef std::vector<Ptr> List;
 		typedef unordered_set<TTHValue> TTHSet;
-		typedef map<const string*, Ptr, noCaseStringLess> Map;
+		typedef boost::container::flat_map<const string*, Ptr, noCaseStringLess> Map;
 		
 		Map directories;
 		File::List files;
@@ -117,7 +147,9 @@ public:
 		void clearAll() noexcept;
 
 		bool findIncomplete() const noexcept;
-		void search(OrderedStringSet& aResults, SearchQuery& aStrings) const noexcept;
+
+		// Directories that aren't included in the candidates (if given) are skipped
+		void search(OrderedStringSet& aResults, SearchQuery& aStrings, const SearchCandidates* aCandidates = nullptr) const noexcept;
 		void findFiles(const boost::regex& aReg, File::List& aResults) const noexcept;
 		
 		int64_t getFilesSize() const noexcept;
@@ -226,6 +258,9 @@ public:
 	GETSET(bool, matchADL, MatchADL);
 	IGETSET(bool, closing, Closing, false);
 
+	// Number of threads used for decompressing and parsing full lists (0 = number of cores)
+	IGETSET(int, loadingThreads, LoadingThreads, 0);
+
 	void addMatchADLTask() noexcept;
 	void addListDiffTask(const string& aFile, bool aOwnList) noexcept;
 
@@ -245,6 +280,28 @@ public:
 	bool isCurrentSearchPath(const string& path) const noexcept;
 	size_t getResultCount() const noexcept { return searchResults.size(); }
 
+	// Search from the loaded directories (the search index is used if it has been created)
+	void search(const Directory& aDir, OrderedStringSet& results_, SearchQuery& aSearch) const noexcept;
+
+	// Create the search index synchronously
+	// Lists that are searched locally are indexed automatically in the background after they have been loaded
+	void createSearchIndex() noexcept;
+
+	struct SearchIndexInfo {
+		size_t directories = 0;
+		size_t files = 0;
+
+		// Estimated memory usage in bytes
+		size_t memoryUsage = 0;
+
+		// Time spent for creating the index in milliseconds (updates of partial lists aren't included)
+		uint64_t buildTime = 0;
+	};
+
+	// Returns an empty value if the index hasn't been created yet
+	// Not thread safe (the index may be removed while reading the information)
+	optional<SearchIndexInfo> getSearchIndexInfo() const noexcept;
+
 	Directory::Ptr findDirectory(const string& aName) const noexcept { return findDirectory(aName, root.get()); }
 	Directory::Ptr findDirectory(const string& aName, const Directory* current) const noexcept;
 	
@@ -293,6 +350,35 @@ private:
 	void updateCurrentLocation(const Directory::Ptr& aCurrentDirectory) noexcept;
 
 	friend class ListLoader;
+	friend class ListSplitter;
+
+	// Allocates the files of a loaded list (and their names) from larger memory blocks
+	class FilePool;
+
+	// Index of the names, sizes and TTHs of the loaded directories
+	class SearchIndex;
+
+	// The index is accessed only from the list thread (or from the indexer thread before it has been marked as ready)
+	unique_ptr<SearchIndex> searchIndex;
+	atomic<bool> searchIndexReady { false };
+	atomic<bool> searchIndexStopping { false };
+	std::thread searchIndexThread;
+
+	// Returns null if the index isn't ready
+	SearchIndex* getSearchIndex() const noexcept;
+
+	// Returns false for lists that are searched from the share or remotely
+	bool isLocalSearch() const noexcept;
+
+	// Index the current content in a background thread
+	void startSearchIndexing() noexcept;
+
+	// Wait for the indexer thread to finish (must be called before the list is modified)
+	void waitSearchIndexing() noexcept;
+
+	// Stop the indexer thread and remove the index (must be called before the indexed directories are removed)
+	void removeSearchIndex() noexcept;
+	void buildSearchIndex() noexcept;
 
 	Directory::Ptr root;
 
@@ -28,6 +28,14 @@ using std::string;
 // Text::toLower should be used for initial conversion due to UTF-16 surrogate handling
 // Text::utf8ToWc should be sufficient for equality checks
 DualString::DualString(const string& aStr) : string(dcpp::Text::toLower(aStr)) {
+	inlineMask[0] = inlineMask[1] = 0;
+	if (!isInline()) {
+		charSizes = nullptr;
+	}
+
+	// The lowercase string may be shorter in rare cases (the positions after it are never read)
+	const int maxArrayPos = isInline() ? 2 : -1;
+
 	int arrayPos = 0, bitPos = 0;
 	auto a = aStr.c_str();
 	auto b = this->c_str();
@@ -36,10 +44,16 @@ DualString::DualString(const string& aStr) : string(dcpp::Text::toLower(aStr)) {
 		int na = dcpp::Text::utf8ToWc(a, ca);
 		int nb = dcpp::Text::utf8ToWc(b, cb);
 		if (ca != cb) {
-			if (!charSizes) {
-				initSizeArray(aStr.size());
+			if (maxArrayPos != -1) {
+				if (arrayPos < maxArrayPos) {
+					inlineMask[arrayPos] |= (1 << bitPos);
+				}
+			} else {
+				if (!charSizes) {
+					initSizeArray(std::max(aStr.size(), string::size()));
+				}
+				charSizes[arrayPos] |= (1 << bitPos);
 			}
-			charSizes[arrayPos] |= (1 << bitPos);
 		}
 
 		a += abs(na);
@@ -66,27 +80,50 @@ size_t DualString::initSizeArray(size_t strLen) {
 	return arrSize;
 }
 
+void DualString::moveMask(DualString& rhs) noexcept {
+	if (rhs.isInline()) {
+		inlineMask[0] = rhs.inlineMask[0];
+		inlineMask[1] = rhs.inlineMask[1];
+	} else {
+		charSizes = rhs.charSizes;
+	}
+
+	string::operator=(std::move(static_cast<string&>(rhs)));
+
+	// The moved string is inline now
+	rhs.string::clear();
+	rhs.inlineMask[0] = rhs.inlineMask[1] = 0;
+}
+
+void DualString::freeMask() noexcept {
+	if (!isInline() && charSizes) {
+		delete[] charSizes;
+	}
+}
+
 DualString& DualString::operator=(DualString&& rhs) {
-	assign(rhs.begin(), rhs.end());
-	charSizes = rhs.charSizes;
-	rhs.charSizes = nullptr;
+	if (this != &rhs) {
+		freeMask();
+		moveMask(rhs);
+	}
+
 	return *this; 
 }
 
-DualString::DualString(DualString&& rhs) : charSizes(rhs.charSizes) {
-	assign(rhs.begin(), rhs.end());
-	rhs.charSizes = nullptr;
+DualString::DualString(DualString&& rhs) {
+	moveMask(rhs);
 }
 
 DualString::~DualString() { 
-	if (charSizes)
-		delete[] charSizes; 
+	freeMask();
 }
 
 string DualString::getNormal() const {
-	if (!charSizes)
+	if (lowerCaseOnly())
 		return *this;
 
+	auto charSizes = getMask();
+
 	string ret;
 	ret.reserve(size());
 
@@ -117,5 +154,9 @@ string DualString::getNormal() const {
 }
 
 bool DualString::lowerCaseOnly() const noexcept {
+	if (isInline()) {
+		return inlineMask[0] == 0 && inlineMask[1] == 0;
+	}
+
 	return !charSizes; 
 }
\ No newline at end of file
@@ -47,7 +47,18 @@ public:
 	DualString& operator= (const DualString& other) = delete;
 private:
 	size_t initSizeArray(size_t strLen);
-	MaskType* charSizes = nullptr;
+
+	// Masks of short strings are stored inline without a separate allocation
+	bool isInline() const noexcept { return std::string::size() <= sizeof(inlineMask) * 8; }
+	const MaskType* getMask() const noexcept { return isInline() ? inlineMask : charSizes; }
+
+	void moveMask(DualString& rhs) noexcept;
+	void freeMask() noexcept;
+
+	union {
+		MaskType* charSizes;
+		MaskType inlineMask[2];
+	};
 };
 
 #endif
\ No newline at end of file
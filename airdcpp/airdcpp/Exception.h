@@ -74,7 +74,9 @@ STANDARD_EXCEPTION(HashException);
 STANDARD_EXCEPTION(MonitorException);
 STANDARD_EXCEPTION(ParseException);
 STANDARD_EXCEPTION(QueueException);
+STANDARD_EXCEPTION(QueueJournalException);
 STANDARD_EXCEPTION(SearchTypeException);
+STANDARD_EXCEPTION(ShareCacheException);
 STANDARD_EXCEPTION(ShareException);
 STANDARD_EXCEPTION(SimpleXMLException);
 STANDARD_EXCEPTION(ThreadException);
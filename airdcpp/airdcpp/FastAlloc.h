@@ -139,7 +139,7 @@ class FastAlloc : public FastAllocBase  {
 		}
 
 	protected:
-		~FastAlloc() { }
+		~FastAlloc() = default;
 
 	private:
 		static boost::pool< > pool;
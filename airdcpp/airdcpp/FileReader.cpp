@@ -26,8 +26,13 @@
 #include "Util.h"
 
 #ifndef _WIN32
+#include "ScopedFunctor.h"
 #include "TimerManager.h"
 #include <fcntl.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #endif
 
 namespace dcpp {
@@ -273,8 +278,163 @@ size_t FileReader::readMapped(const string& /*file*/, const DataCallback& /*call
 #include <unistd.h>
 
 
-size_t FileReader::readDirect(const string& file, const DataCallback& callback) {
-	return READ_FAILED;
+// Fill the buffer unless the file ends, returns the number of bytes read
+static size_t readBlock(int fd, uint8_t* buf, size_t aLen, int64_t aPos, int& error_) {
+	size_t len = 0;
+	while(len < aLen) {
+		auto n = ::pread(fd, buf + len, aLen - len, aPos + len);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		} else if(n < 0) {
+			error_ = errno;
+			break;
+		} else if(n == 0) {
+			break;
+		}
+
+		len += n;
+	}
+
+	return len;
+}
+
+// Larger files are read in a separate thread, which keeps up to READ_AHEAD_BLOCKS blocks
+// read ahead while the previous ones are being processed by the callback
+size_t FileReader::readDirect(const string& aPath, const DataCallback& callback) {
+	int fd = open(aPath.c_str(), O_RDONLY);
+	if(fd == -1) {
+		dcdebug("Error opening file %s: %s\n", aPath.c_str(), Util::translateError(errno).c_str());
+		return READ_FAILED;
+	}
+
+	ScopedFunctor([fd] { ::close(fd); });
+
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	struct stat statbuf;
+	if(fstat(fd, &statbuf) == -1) {
+		dcdebug("Error opening file %s: %s\n", aPath.c_str(), Util::translateError(errno).c_str());
+		return READ_FAILED;
+	}
+
+	auto bufSize = max(getBlockSize(getpagesize()), READ_AHEAD_BLOCK_SIZE);
+	if(statbuf.st_size < static_cast<int64_t>(bufSize)) {
+		// Read at once (the file size may still change)
+		buffer.resize(static_cast<size_t>(statbuf.st_size) + 1);
+
+		int error = 0;
+		auto len = readBlock(fd, &buffer[0], buffer.size(), 0, error);
+		if(error != 0) {
+			dcdebug("Error reading file %s: %s\n", aPath.c_str(), Util::translateError(error).c_str());
+			return READ_FAILED;
+		}
+
+		if(len == buffer.size()) {
+			// Grew
+			return READ_FAILED;
+		}
+
+		if(len > 0) {
+			callback(&buffer[0], len);
+		}
+
+		return len;
+	}
+
+	buffer.resize(bufSize * READ_AHEAD_BLOCKS);
+
+	struct Block {
+		size_t len = 0;
+		int error = 0;
+	};
+
+	Block blocks[READ_AHEAD_BLOCKS];
+	size_t blocksRead = 0, blocksProcessed = 0;
+	bool stop = false;
+
+	std::mutex cs;
+	std::condition_variable cond;
+
+	std::thread reader([&] {
+		int64_t pos = 0;
+		for(size_t i = 0; ; ++i) {
+			{
+				std::unique_lock<std::mutex> l(cs);
+				cond.wait(l, [&] { return stop || i - blocksProcessed < READ_AHEAD_BLOCKS; });
+				if(stop) {
+					return;
+				}
+			}
+
+			Block block;
+			block.len = readBlock(fd, &buffer[(i % READ_AHEAD_BLOCKS) * bufSize], bufSize, pos, block.error);
+			pos += block.len;
+
+			{
+				std::lock_guard<std::mutex> l(cs);
+				blocks[i % READ_AHEAD_BLOCKS] = block;
+				blocksRead = i + 1;
+			}
+
+			cond.notify_all();
+			if(block.error != 0 || block.len < bufSize) {
+				return;
+			}
+		}
+	});
+
+	ScopedFunctor([&] {
+		{
+			std::lock_guard<std::mutex> l(cs);
+			stop = true;
+		}
+
+		cond.notify_all();
+		reader.join();
+	});
+
+	size_t total = 0;
+	for(size_t i = 0; ; ++i) {
+		Block block;
+
+		{
+			std::unique_lock<std::mutex> l(cs);
+			cond.wait(l, [&] { return blocksRead > i; });
+			block = blocks[i % READ_AHEAD_BLOCKS];
+		}
+
+		if(block.error != 0) {
+			if(i == 0) {
+				dcdebug("Error reading file %s: %s\n", aPath.c_str(), Util::translateError(block.error).c_str());
+				return READ_FAILED;
+			}
+
+			throw FileException(Util::translateError(block.error));
+		}
+
+		auto go = block.len == 0 || callback(&buffer[(i % READ_AHEAD_BLOCKS) * bufSize], block.len);
+
+#ifdef HAVE_POSIX_FADVISE
+		// Bypass the cache as far as possible
+		posix_fadvise(fd, total, block.len, POSIX_FADV_DONTNEED);
+#endif
+
+		total += block.len;
+
+		{
+			std::lock_guard<std::mutex> l(cs);
+			blocksProcessed = i + 1;
+		}
+
+		cond.notify_all();
+		if(!go || block.len < bufSize) {
+			break;
+		}
+	}
+
+	return total;
 }
 
 static const int64_t BUF_SIZE = 0x1000000 - (0x1000000 % getpagesize());
@@ -65,6 +65,10 @@ private:
 	static const size_t DEFAULT_BLOCK_SIZE = 256*1024;
 	static const size_t DEFAULT_MMAP_SIZE = 64*1024*1024;
 
+	/** Direct reads on other platforms than Windows: size of a single read and the maximum number of reads done ahead */
+	static const size_t READ_AHEAD_BLOCK_SIZE = 1024*1024;
+	static const size_t READ_AHEAD_BLOCKS = 4;
+
 	string file;
 	bool direct;
 	size_t blockSize;
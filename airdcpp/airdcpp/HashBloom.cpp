@@ -43,16 +43,16 @@ uint64_t HashBloom::get_m(size_t n, size_t k) {
 
 void HashBloom::add(const TTHValue& tth) {
 	for(size_t i = 0; i < k; ++i) {
-		bloom[pos(tth, i)] = true;
+		setBit(pos(tth, i));
 	}
 }
 
 bool HashBloom::match(const TTHValue& tth) const {
-	if(bloom.empty()) {
+	if(m == 0) {
 		return false;
 	}
 	for(size_t i = 0; i < k; ++i) {
-		if(!bloom[pos(tth, i)]) {
+		if(!getBit(pos(tth, i))) {
 			return false;
 		}
 	}
@@ -60,13 +60,22 @@ bool HashBloom::match(const TTHValue& tth) const {
 }
 
 void HashBloom::push_back(bool v) {
-	bloom.push_back(v);
+	if (m % 64 == 0) {
+		bloom.push_back(0);
+	}
+
+	if (v) {
+		setBit(m);
+	}
+
+	m++;
 }
 
-void HashBloom::reset(size_t k_, size_t m, size_t h_) {
-	bloom.resize(m);
+void HashBloom::reset(size_t k_, size_t m_, size_t h_) {
+	bloom.assign((m_ + 63) / 64, 0);
 	k = k_;
 	h = h_;
+	m = m_;
 }
 
 size_t HashBloom::pos(const TTHValue& tth, size_t n) const {
@@ -75,24 +84,29 @@ size_t HashBloom::pos(const TTHValue& tth, size_t n) const {
 	}
 	
 	uint64_t x = 0;
-	
-	size_t start = n * h;
-	for(size_t i = 0; i < h; ++i) {
-		size_t bit = start + i;
-		size_t byte = bit / 8;
-		size_t pos = bit % 8;
-		
-		if(tth.data[byte] & (1 << pos)) {
-			x |= (1LL << i);
-		}
+
+	// Copy the bits byte by byte (least significant bit first)
+	size_t bit = n * h;
+	for(size_t i = 0; i < h;) {
+		size_t count = min(8 - bit % 8, h - i);
+		uint64_t bits = (tth.data[bit / 8] >> (bit % 8)) & ((1U << count) - 1);
+
+		x |= bits << i;
+		i += count;
+		bit += count;
 	}
-	return x % bloom.size();
+
+	if ((m & (m - 1)) == 0) {
+		return static_cast<size_t>(x & (m - 1));
+	}
+
+	return static_cast<size_t>(x % m);
 }
 
 void HashBloom::copy_to(ByteVector& v) const {
-	v.resize(bloom.size() / 8);
-	for(size_t i = 0; i < bloom.size(); ++i) {
-		v[i/8] |= bloom[i] << (i % 8);
+	v.assign(m / 8, 0);
+	for(size_t i = 0; i < v.size(); ++i) {
+		v[i] = static_cast<uint8_t>(bloom[i / 8] >> (8 * (i % 8)));
 	}
 }
 
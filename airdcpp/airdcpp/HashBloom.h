@@ -31,10 +31,13 @@ namespace dcpp {
  * files in share since each file is identified by one TTH value. We try that for each even dividend 
  * of the key size (2, 3, 4, 6, 8, 12) and if m fits within the bits we're able to address (2^(keysize/k)), 
  * we can use that value when requesting the bloom filter.
+ *
+ * The bit layout is defined by the ADC BLOM extension so the probes can't be grouped by cache lines
+ * as with BloomFilter; the bits are kept in 64-bit words and power-of-two sizes avoid the modulo.
  */
 class HashBloom {
 public:
-	HashBloom() : k(0), h(0) { }
+	HashBloom() : k(0), h(0), m(0) { }
 
 	/** Return a suitable value for k based on n */
 	static size_t get_k(size_t n, size_t h);
@@ -50,10 +53,17 @@ public:
 private:	
 	
 	size_t pos(const TTHValue& tth, size_t n) const;
+
+	inline bool getBit(size_t aPos) const noexcept { return (bloom[aPos / 64] & (1ULL << (aPos % 64))) != 0; }
+	inline void setBit(size_t aPos) noexcept { bloom[aPos / 64] |= 1ULL << (aPos % 64); }
 	
-	std::vector<bool> bloom;
+	std::vector<uint64_t> bloom;
 	size_t k;
 	size_t h;
+
+	// Number of bits
+	size_t m;
+
 };
 
 }
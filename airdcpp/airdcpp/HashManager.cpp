@@ -23,11 +23,13 @@
 #include "File.h"
 #include "FileReader.h"
 #include "LogManager.h"
+#include "ParallelTreeHasher.h"
 #include "QueueManager.h"
 #include "ShareManager.h"
 #include "ResourceManager.h"
 #include "ScopedFunctor.h"
 #include "SimpleXMLReader.h"
+#include "TimerManager.h"
 #include "Util.h"
 #include "version.h"
 #include "ZUtils.h"
@@ -61,6 +63,25 @@ bool HashManager::checkTTH(const string& aFileLower, const string& aFileName, Ha
 	return true;
 }
 
+vector<bool> HashManager::checkTTHs(const string& aDirLower, const string& aDir, const StringList& aNamesLower, const StringList& aNames, vector<HashedFile>& fi_) {
+	dcassert(Text::isLower(aDirLower));
+
+	StringList pathsLower;
+	pathsLower.reserve(aNamesLower.size());
+	for (const auto& n: aNamesLower) {
+		pathsLower.push_back(aDirLower + n);
+	}
+
+	auto ret = store.checkTTHs(pathsLower, fi_);
+	for (size_t i = 0; i < ret.size(); ++i) {
+		if (!ret[i]) {
+			hashFile(aDir + aNames[i], pathsLower[i], fi_[i].getSize());
+		}
+	}
+
+	return ret;
+}
+
 void HashManager::getFileInfo(const string& aFileLower, const string& aFileName, HashedFile& fi_) {
 	dcassert(Text::isLower(aFileLower));
 	auto found = store.getFileInfo(aFileLower, fi_);
@@ -173,13 +194,14 @@ void HashManager::getFileTTH(const string& aFile, int64_t aSize, bool addStore,
 		}
 
 		TigerTree tt(bs);
+		ParallelTreeHasher treeHasher(tt, aSize);
 
 		auto start = GET_TICK();
 		int64_t tickHashed = 0;
 
 		FileReader fr(true);
 		fr.read(aFile, [&](const void* buf, size_t n) -> bool {
-			tt.update(buf, n);
+			treeHasher.update(buf, n);
 
 			if (updateF) {
 				tickHashed += n;
@@ -198,7 +220,7 @@ void HashManager::getFileTTH(const string& aFile, int64_t aSize, bool addStore,
 			return !aCancel;
 		});
 
-		tt.finalize();
+		treeHasher.finalize();
 		tth_ = tt.getRoot();
 
 		if (addStore && !aCancel) {
@@ -212,7 +234,7 @@ void HashManager::getFileTTH(const string& aFile, int64_t aSize, bool addStore,
 
 void HashManager::hashDone(const string& aFileName, const string& pathLower, const TigerTree& tt, int64_t speed, HashedFile& aFileInfo, int hasherID /*0*/) noexcept {
 	try {
-		store.addHashedFile(pathLower, tt, aFileInfo);
+		store.queueHashedFile(pathLower, tt, aFileInfo);
 	} catch (const Exception& e) {
 		log(STRING_F(HASHING_FAILED_X, e.getError()), hasherID, true, true);
 	}
@@ -252,26 +274,104 @@ bool HashManager::addFile(const string& aPath, const HashedFile& fi_) {
 	return true;
 }
 
+const size_t HashManager::HashStore::MAX_PENDING_FILES = 256;
+const uint64_t HashManager::HashStore::MAX_PENDING_TIME = 3000;
+
 void HashManager::HashStore::addHashedFile(const string& aFileLower, const TigerTree& tt, const HashedFile& fi_) {
 	addTree(tt);
 	addFile(aFileLower, fi_);
 }
 
+void HashManager::HashStore::queueHashedFile(const string& aFileLower, const TigerTree& tt, const HashedFile& fi_) {
+	bool flush = false;
+
+	{
+		Lock l(pendingCs);
+		if (pendingFiles.empty()) {
+			pendingTick = GET_TICK();
+		}
+
+		pendingTrees[string((const char*)tt.getRoot().data, sizeof(TTHValue))] = serializeTree(tt);
+		pendingFiles[aFileLower] = serializeFileInfo(fi_);
+
+		flush = pendingFiles.size() >= MAX_PENDING_FILES || GET_TICK() > pendingTick + MAX_PENDING_TIME;
+	}
+
+	markUsedRoot(tt.getRoot());
+
+	if (flush) {
+		flushPending();
+	}
+}
+
+void HashManager::HashStore::flushPending() {
+	Lock l(pendingCs);
+	if (pendingFiles.empty() && pendingTrees.empty()) {
+		return;
+	}
+
+	// Keep the queued information available until the writes have completed
+	// The trees are written first so that there won't be file entries without a tree
+	ScopedFunctor([this] { 
+		pendingTrees.clear();
+		pendingFiles.clear();
+	});
+
+	writeBatch(*hashDb, pendingTrees);
+	writeBatch(*fileDb, pendingFiles);
+}
+
+void HashManager::HashStore::writeBatch(DbHandler& aDb, const PendingMap& aMap) {
+	DbBatch batch;
+	for (const auto& p: aMap) {
+		batch.put(p.first.data(), p.first.size(), p.second.data(), p.second.size());
+	}
+
+	try {
+		aDb.write(batch);
+	} catch (DbException& e) {
+		throw HashException(STRING_F(WRITE_FAILED_X, aDb.getNameLower() % e.getError()));
+	}
+}
+
+bool HashManager::HashStore::getPending(const PendingMap& aMap, const void* aKey, size_t aKeyLen, string& value_) const noexcept {
+	Lock l(pendingCs);
+	if (aMap.empty()) {
+		return false;
+	}
+
+	auto i = aMap.find(string((const char*)aKey, aKeyLen));
+	if (i == aMap.end()) {
+		return false;
+	}
+
+	value_ = i->second;
+	return true;
+}
+
+string HashManager::HashStore::serializeFileInfo(const HashedFile& aFile) noexcept {
+	string ret(getFileInfoSize(aFile), 0);
+	saveFileInfo(&ret[0], aFile);
+	return ret;
+}
+
 void HashManager::HashStore::addFile(const string& aFileLower, const HashedFile& fi_) {
-	auto sz = getFileInfoSize(fi_);
-	void* buf = malloc(sz);
-	saveFileInfo(buf, fi_);
+	markUsedRoot(fi_.getRoot());
+	auto value = serializeFileInfo(fi_);
 
 	try {
-		fileDb->put((void*)aFileLower.c_str(), aFileLower.length(), (void*)buf, sz);
+		fileDb->put((void*)aFileLower.c_str(), aFileLower.length(), (void*)value.data(), value.size());
 	} catch(DbException& e) {
 		throw HashException(STRING_F(WRITE_FAILED_X, fileDb->getNameLower() % e.getError()));
 	}
-
-	free(buf);
 }
 
 void HashManager::HashStore::removeFile(const string& aFilePathLower) {
+	{
+		Lock l(pendingCs);
+		pendingFiles.erase(aFilePathLower);
+	}
+
 	try {
 		fileDb->remove((void*) aFilePathLower.c_str(), aFilePathLower.length());
 	} catch (DbException& e) {
@@ -279,16 +379,14 @@ void HashManager::HashStore::removeFile(const string& aFilePathLower) {
 	}
 }
 
-void HashManager::HashStore::addTree(const TigerTree& tt) {
+string HashManager::HashStore::serializeTree(const TigerTree& tt) noexcept {
 	size_t treelen = tt.getLeaves().size() == 1 ? 0 : tt.getLeaves().size() * TTHValue::BYTES;
 	auto sz = sizeof(uint8_t) + sizeof(int64_t) + sizeof(int64_t) + treelen;
 
-	//allocate the memory
-	void* buf = malloc(sz);
-
+	string ret(sz, 0);
 
 	//set the data
-	char *p = (char *)buf;
+	char *p = &ret[0];
 
 	uint8_t version = HASHDATA_VERSION;
 	memcpy(p, &version, sizeof(uint8_t));
@@ -305,18 +403,26 @@ void HashManager::HashStore::addTree(const TigerTree& tt) {
 	if (treelen > 0)
 		memcpy(p, tt.getLeaves()[0].data, treelen);
 
-	//throw HashException(STRING_F(WRITE_FAILED_X, hashDb->getNameLower() % "TEST"));
+	return ret;
+}
+
+void HashManager::HashStore::addTree(const TigerTree& tt) {
+	markUsedRoot(tt.getRoot());
+	auto value = serializeTree(tt);
+
 	try {
-		hashDb->put((void*)tt.getRoot().data, sizeof(TTHValue), buf, sz);
+		hashDb->put((void*)tt.getRoot().data, sizeof(TTHValue), (void*)value.data(), value.size());
 	} catch(DbException& e) {
-		free(buf);
 		throw HashException(STRING_F(WRITE_FAILED_X, hashDb->getNameLower() % e.getError()));
 	}
-
-	free(buf);
 }
 
 bool HashManager::HashStore::getTree(const TTHValue& aRoot, TigerTree& tt) {
+	string pending;
+	if (getPending(pendingTrees, aRoot.data, sizeof(TTHValue), pending)) {
+		return loadTree(pending.data(), pending.size(), aRoot, tt, true);
+	}
+
 	try {
 		return hashDb->get((void*)aRoot.data, sizeof(TTHValue), 100*1024, [&](void* aValue, size_t valueLen) {
 			return loadTree(aValue, valueLen, aRoot, tt, true);
@@ -329,6 +435,11 @@ bool HashManager::HashStore::getTree(const TTHValue& aRoot, TigerTree& tt) {
 }
 
 bool HashManager::HashStore::hasTree(const TTHValue& aRoot) {
+	string pending;
+	if (getPending(pendingTrees, aRoot.data, sizeof(TTHValue), pending)) {
+		return true;
+	}
+
 	bool ret = false;
 	try {
 		ret = hashDb->hasKey((void*)aRoot.data, sizeof(TTHValue));
@@ -447,23 +558,31 @@ void HashManager::HashStore::loadLegacyTree(File& f, int64_t aSize, int64_t aInd
 
 int64_t HashManager::HashStore::getRootInfo(const TTHValue& root, InfoType aType) noexcept {
 	int64_t ret = 0;
-	try {
-		hashDb->get((void*)root.data, sizeof(TTHValue), 100*1024, [&](void* aValue, size_t /*valueLen*/) {
-			char* p = (char*)aValue;
+	auto loadInfo = [&](void* aValue, size_t /*valueLen*/) {
+		char* p = (char*)aValue;
 
-			uint8_t version;
-			memcpy(&version, p, sizeof(uint8_t));
-			p += sizeof(uint8_t);
+		uint8_t version;
+		memcpy(&version, p, sizeof(uint8_t));
+		p += sizeof(uint8_t);
 
-			if (version > FILEINDEX_VERSION) {
-				return false;
-			}
+		if (version > FILEINDEX_VERSION) {
+			return false;
+		}
 
-			p += (aType == TYPE_FILESIZE ? 0 : sizeof(int64_t));
+		p += (aType == TYPE_FILESIZE ? 0 : sizeof(int64_t));
 
-			memcpy(&ret, p, sizeof(ret));
-			return true;
-		});
+		memcpy(&ret, p, sizeof(ret));
+		return true;
+	};
+
+	string pending;
+	if (getPending(pendingTrees, root.data, sizeof(TTHValue), pending)) {
+		loadInfo(&pending[0], pending.size());
+		return ret;
+	}
+
+	try {
+		hashDb->get((void*)root.data, sizeof(TTHValue), 100*1024, loadInfo);
 	} catch(DbException& e) {
 		LogManager::getInstance()->message(STRING_F(READ_FAILED_X, hashDb->getNameLower() % e.getError()), LogMessage::SEV_ERROR);
 	}
@@ -483,7 +602,50 @@ bool HashManager::HashStore::checkTTH(const string& aFileLower, HashedFile& fi_)
 	return false;
 }
 
+vector<bool> HashManager::HashStore::checkTTHs(const StringList& aFilesLower, vector<HashedFile>& fi_) noexcept {
+	dcassert(aFilesLower.size() == fi_.size());
+	vector<bool> ret(aFilesLower.size(), false);
+
+	// The file information is left untouched for outdated files
+	auto checkFile = [&](size_t aIndex, void* aValue, size_t aValueLen) {
+		HashedFile stored;
+		if (loadFileInfo(aValue, aValueLen, stored) && stored.getTimeStamp() == fi_[aIndex].getTimeStamp() && stored.getSize() == fi_[aIndex].getSize()) {
+			fi_[aIndex] = stored;
+			ret[aIndex] = true;
+		}
+	};
+
+	vector<DbKey> keys;
+	vector<size_t> indexes;
+	keys.reserve(aFilesLower.size());
+
+	for (size_t i = 0; i < aFilesLower.size(); ++i) {
+		string pending;
+		if (getPending(pendingFiles, aFilesLower[i].c_str(), aFilesLower[i].length(), pending)) {
+			checkFile(i, &pending[0], pending.size());
+		} else {
+			keys.emplace_back(aFilesLower[i].c_str(), aFilesLower[i].length());
+			indexes.push_back(i);
+		}
+	}
+
+	try {
+		fileDb->get(keys, [&](size_t aIndex, void* aValue, size_t aValueLen) {
+			checkFile(indexes[aIndex], aValue, aValueLen);
+		});
+	} catch(const DbException& e) {
+		LogManager::getInstance()->message(STRING_F(READ_FAILED_X, fileDb->getNameLower() % e.getError()), LogMessage::SEV_ERROR);
+	}
+
+	return ret;
+}
+
 bool HashManager::HashStore::getFileInfo(const string& aFileLower, HashedFile& fi_) noexcept {
+	string pending;
+	if (getPending(pendingFiles, aFileLower.c_str(), aFileLower.length(), pending)) {
+		return loadFileInfo(&pending[0], pending.size(), fi_);
+	}
+
 	try {
 		return fileDb->get((void*)aFileLower.c_str(), aFileLower.length(), sizeof(HashedFile), [&](void* aValue, size_t valueLen) {
 			return loadFileInfo(aValue, valueLen, fi_);
@@ -508,6 +670,13 @@ void HashManager::HashStore::optimize(bool doVerify) noexcept {
 	int64_t failedSize = 0;
 
 	LogManager::getInstance()->message(STRING(HASHDB_MAINTENANCE_STARTED), LogMessage::SEV_INFO);
+
+	try {
+		flushPending();
+	} catch (const HashException& e) {
+		LogManager::getInstance()->message(e.getError(), LogMessage::SEV_ERROR);
+	}
+
 	{
 		unordered_set<TTHValue> usedRoots;
 
@@ -597,6 +766,10 @@ void HashManager::HashStore::optimize(bool doVerify) noexcept {
 		}
 	}
 
+	finishMaintenance(validFiles, unusedFiles, missingTrees, failedSize, validTrees, unusedTrees, failedTrees, doVerify);
+}
+
+void HashManager::HashStore::finishMaintenance(int validFiles, int unusedFiles, int missingTrees, int64_t failedSize, int validTrees, int unusedTrees, int failedTrees, bool doVerify) noexcept {
 	SettingsManager::getInstance()->set(SettingsManager::CUR_REMOVED_FILES, SETTING(CUR_REMOVED_FILES) + unusedFiles + missingTrees);
 	if (validFiles == 0 || (static_cast<double>(SETTING(CUR_REMOVED_FILES)) / static_cast<double>(validFiles)) > 0.05) {
 		LogManager::getInstance()->message(STRING_F(COMPACTING_X, fileDb->getNameLower()), LogMessage::SEV_INFO);
@@ -634,6 +807,197 @@ void HashManager::HashStore::optimize(bool doVerify) noexcept {
 	getInstance()->fire(HashManagerListener::MaintananceFinished());
 }
 
+const uint64_t HashManager::HashStore::MAINTENANCE_SLICE_TIME = 100;
+const size_t HashManager::HashStore::MAINTENANCE_SLICE_ENTRIES = 20000;
+
+bool HashManager::HashStore::startIncrementalMaintenance() noexcept {
+	{
+		Lock l(maintenanceCs);
+		if (maintenance.phase != MAINTENANCE_IDLE) {
+			return false;
+		}
+
+		// The entry count isn't known without iterating through the whole database so it's estimated from the size on disk
+		// (an overestimate only increases the size of the filter)
+		maintenance.expectedEntries = max(maintenance.expectedEntries, max(fileDb->getSizeOnDisk() / 32, static_cast<int64_t>(1024)));
+
+		// A separate 32-bit part of the root is used for each hash
+		const size_t k = 6;
+		maintenance.usedRoots.reset(k, static_cast<size_t>(HashBloom::get_m(static_cast<size_t>(maintenance.expectedEntries), k)), 32);
+
+		maintenance.lastKey.clear();
+		maintenance.started = GET_TICK();
+		maintenance.processedEntries = 0;
+		maintenance.validFiles = maintenance.unusedFiles = maintenance.validTrees = maintenance.unusedTrees = 0;
+		maintenance.phase = MAINTENANCE_FILES;
+	}
+
+	getInstance()->fire(HashManagerListener::MaintananceStarted());
+	LogManager::getInstance()->message(STRING(HASHDB_MAINTENANCE_STARTED), LogMessage::SEV_INFO);
+	return true;
+}
+
+bool HashManager::HashStore::isIncrementalMaintenanceRunning() const noexcept {
+	return maintenance.phase != MAINTENANCE_IDLE;
+}
+
+void HashManager::HashStore::markUsedRoot(const TTHValue& aRoot) noexcept {
+	if (maintenance.phase == MAINTENANCE_IDLE) {
+		return;
+	}
+
+	Lock l(maintenanceCs);
+	if (maintenance.phase != MAINTENANCE_IDLE) {
+		maintenance.usedRoots.add(aRoot);
+	}
+}
+
+void HashManager::HashStore::runMaintenanceSlice() noexcept {
+	if (maintenance.phase == MAINTENANCE_FILES) {
+		if (runFileSlice()) {
+			maintenance.lastKey.clear();
+			maintenance.expectedEntries = maintenance.validFiles;
+			maintenance.phase = MAINTENANCE_TREES;
+		}
+	} else if (maintenance.phase == MAINTENANCE_TREES) {
+		if (runTreeSlice()) {
+			// Compacting may take a while
+			maintenance.phase = MAINTENANCE_FINISHING;
+			getInstance()->optimizer.startFinishing();
+		}
+	}
+}
+
+void HashManager::HashStore::finishIncrementalMaintenance() noexcept {
+	finishMaintenance(maintenance.validFiles, maintenance.unusedFiles, 0, 0, maintenance.validTrees, maintenance.unusedTrees, 0, false);
+
+	Lock l(maintenanceCs);
+	maintenance.usedRoots.reset(0, 0, 0);
+	maintenance.phase = MAINTENANCE_IDLE;
+}
+
+bool HashManager::HashStore::runFileSlice() noexcept {
+	auto start = GET_TICK();
+	size_t processed = 0;
+	bool finished = true;
+
+	int validFiles = 0, unusedFiles = 0;
+	vector<TTHValue> usedRoots;
+	DbBatch unused;
+	HashedFile fi;
+
+	try {
+		fileDb->forEachFrom([&](void* aKey, size_t aKeyLen, void* aValue, size_t aValueLen) {
+			string path((const char*)aKey, aKeyLen);
+			// The last key was processed by the previous slice
+			if (processed > 0 || path != maintenance.lastKey) {
+				if (processed == MAINTENANCE_SLICE_ENTRIES || GET_TICK() > start + MAINTENANCE_SLICE_TIME) {
+					finished = false;
+					return false;
+				}
+
+				processed++;
+				if (ShareManager::getInstance()->isRealPathShared(path) && loadFileInfo(aValue, aValueLen, fi)) {
+					usedRoots.push_back(fi.getRoot());
+					validFiles++;
+				} else {
+					unused.remove(aKey, aKeyLen);
+					unusedFiles++;
+				}
+			}
+
+			maintenance.lastKey = move(path);
+			return true;
+		}, maintenance.lastKey.data(), maintenance.lastKey.size());
+
+		fileDb->write(unused);
+	} catch (const DbException& e) {
+		LogManager::getInstance()->message(STRING_F(READ_FAILED_X, fileDb->getNameLower() % e.getError()), LogMessage::SEV_ERROR);
+
+		// Try again later
+		return false;
+	}
+
+	Lock l(maintenanceCs);
+	for (const auto& root: usedRoots) {
+		maintenance.usedRoots.add(root);
+	}
+
+	maintenance.validFiles += validFiles;
+	maintenance.unusedFiles += unusedFiles;
+	maintenance.processedEntries += processed;
+	return finished;
+}
+
+bool HashManager::HashStore::runTreeSlice() noexcept {
+	auto start = GET_TICK();
+	size_t processed = 0;
+	bool finished = true;
+
+	vector<TTHValue> roots;
+	try {
+		hashDb->forEachFrom([&](void* aKey, size_t aKeyLen, void* /*aValue*/, size_t /*aValueLen*/) {
+			string key((const char*)aKey, aKeyLen);
+			if (processed > 0 || key != maintenance.lastKey) {
+				if (processed == MAINTENANCE_SLICE_ENTRIES || GET_TICK() > start + MAINTENANCE_SLICE_TIME) {
+					finished = false;
+					return false;
+				}
+
+				processed++;
+				if (aKeyLen == sizeof(TTHValue)) {
+					roots.emplace_back(static_cast<const uint8_t*>(aKey));
+				}
+			}
+
+			maintenance.lastKey = move(key);
+			return true;
+		}, maintenance.lastKey.data(), maintenance.lastKey.size());
+	} catch (const DbException& e) {
+		LogManager::getInstance()->message(STRING_F(READ_FAILED_X, hashDb->getNameLower() % e.getError()), LogMessage::SEV_ERROR);
+		return false;
+	}
+
+	// Trees of queued files
+	roots.erase(remove_if(roots.begin(), roots.end(), [](const TTHValue& aRoot) { 
+		return QueueManager::getInstance()->isFileQueued(aRoot); 
+	}), roots.end());
+
+	// Keep the lock while writing so that the trees can't be marked as used before they are removed
+	Lock l(maintenanceCs);
+	DbBatch unused;
+	for (const auto& root: roots) {
+		if (!maintenance.usedRoots.match(root)) {
+			unused.remove(root.data, sizeof(TTHValue));
+		}
+	}
+
+	try {
+		hashDb->write(unused);
+	} catch (const DbException& e) {
+		LogManager::getInstance()->message(STRING_F(WRITE_FAILED_X, hashDb->getNameLower() % e.getError()), LogMessage::SEV_ERROR);
+		return false;
+	}
+
+	maintenance.validTrees += static_cast<int>(processed - unused.size());
+	maintenance.unusedTrees += static_cast<int>(unused.size());
+	maintenance.processedEntries += processed;
+	return finished;
+}
+
+string HashManager::HashStore::getMaintenanceStats() const noexcept {
+	Lock l(maintenanceCs);
+	if (maintenance.phase == MAINTENANCE_IDLE) {
+		return "Incremental maintenance: not running";
+	}
+
+	string ret = "Incremental maintenance: ";
+	ret += maintenance.phase == MAINTENANCE_FILES ? "checking files" : maintenance.phase == MAINTENANCE_TREES ? "checking trees" : "finishing";
+	ret += " (" + Util::toString(maintenance.processedEntries) + " entries processed in " + Util::formatTime((GET_TICK() - maintenance.started) / 1000, false) + ")";
+	ret += "\r\nUnused files removed: " + Util::toString(maintenance.unusedFiles) + ", unused trees removed: " + Util::toString(maintenance.unusedTrees);
+	return ret;
+}
+
 void HashManager::HashStore::compact() noexcept {
 	LogManager::getInstance()->message(STRING_F(COMPACTING_X, fileDb->getNameLower()), LogMessage::SEV_INFO);
 	fileDb->compact();
@@ -653,6 +1017,7 @@ string HashManager::HashStore::getDbStats() noexcept {
 	statMsg += "Deleted entries since last compaction: " + Util::toString(SETTING(CUR_REMOVED_TREES)) + " (" + Util::toString(((double)SETTING(CUR_REMOVED_TREES) / (double)hashDb->size(false))*100) + "%)";
 	statMsg += "\r\n\r\n";
 	statMsg += "\n\nDisk block size: " + Util::formatBytes(File::getBlockSize(hashDb->getPath())) + "\n\n";
+	statMsg += getMaintenanceStats() + "\r\n";
 	return statMsg;
 }
 
@@ -900,6 +1265,14 @@ HashManager::HashStore::HashStore() {
 }
 
 void HashManager::HashStore::closeDb() noexcept {
+	if (fileDb && hashDb) {
+		try {
+			flushPending();
+		} catch (const HashException& e) {
+			LogManager::getInstance()->message(e.getError(), LogMessage::SEV_ERROR);
+		}
+	}
+
 	hashDb.reset(nullptr);
 	fileDb.reset(nullptr);
 }
@@ -969,15 +1342,108 @@ void HashManager::setPriority(Thread::Priority p) noexcept {
 		h->setThreadPriority(p); 
 }
 
-void HashManager::getStats(string& curFile, int64_t& bytesLeft, size_t& filesLeft, int64_t& speed, int& hasherCount) const noexcept {
+void HashManager::getStats(string& curFile, int64_t& bytesLeft, size_t& filesLeft, int64_t& speed, int& hasherCount, DeviceStatsMap* deviceStats_) const noexcept {
 	RLock l(Hasher::hcs);
 	hasherCount = hashers.size();
 	for (auto i: hashers)
-		i->getStats(curFile, bytesLeft, filesLeft, speed);
+		i->getStats(curFile, bytesLeft, filesLeft, speed, deviceStats_);
+
+	if (deviceStats_) {
+		for (auto& d: *deviceStats_) {
+			auto device = hashDevices.find(d.first);
+			if (SETTING(HASHERS_PER_VOLUME) > 0 || device == hashDevices.end()) {
+				d.second.maxHashers = SETTING(HASHERS_PER_VOLUME);
+			} else {
+				d.second.maxHashers = device->second.concurrency.getLimit();
+			}
+		}
+	}
 }
 
 void HashManager::startMaintenance(bool verify){
-	optimizer.startMaintenance(verify); 
+	if (maintenanceRunning()) {
+		return;
+	}
+
+	if (verify) {
+		// Each tree needs to be loaded anyway
+		optimizer.startMaintenance(verify);
+	} else {
+		store.startIncrementalMaintenance();
+	}
+}
+
+void HashManager::on(TimerManagerListener::Second, uint64_t aTick) noexcept {
+	store.runMaintenanceSlice();
+	updateDevices(aTick);
+}
+
+HashManager::HashDevice* HashManager::acquireDevice(devid aDeviceId) noexcept {
+	WLock l(Hasher::hcs);
+	auto& device = hashDevices[aDeviceId];
+	if (SETTING(HASHERS_PER_VOLUME) == 0 && device.active >= device.concurrency.getLimit()) {
+		return nullptr;
+	}
+
+	device.active++;
+	return &device;
+}
+
+void HashManager::releaseDevice(HashDevice* aDevice) noexcept {
+	WLock l(Hasher::hcs);
+	aDevice->active--;
+}
+
+void HashManager::updateDevices(uint64_t aTick) noexcept {
+	auto adaptive = SETTING(HASHERS_PER_VOLUME) == 0;
+
+	WLock l(Hasher::hcs);
+	for (auto& p: hashDevices) {
+		auto& device = p.second;
+
+		ConcurrencyController::Sample sample;
+		sample.bytes = device.bytesRead.exchange(0);
+		sample.waitTime = device.waitTime.exchange(0);
+		sample.reads = device.reads.exchange(0);
+		sample.duration = device.lastSample > 0 ? aTick - device.lastSample : 0;
+		device.lastSample = aTick;
+
+		if (!adaptive) {
+			continue;
+		}
+
+		sample.active = device.active;
+		sample.demand = static_cast<int>(count_if(hashers.begin(), hashers.end(), [&p](const Hasher* aHasher) { return aHasher->hasDevice(p.first); }));
+
+		device.concurrency.setMaxLimit(SETTING(MAX_HASHING_THREADS));
+		if (device.concurrency.addSample(sample)) {
+			dcdebug("HashManager: %d concurrent hashers for device " I64_FMT " (%s/s with the previous limit)\n", device.concurrency.getLimit(), p.first, 
+				Util::formatBytes(sample.duration > 0 ? sample.bytes * 1000 / static_cast<int64_t>(sample.duration) : 0).c_str());
+		}
+	}
+}
+
+void HashManager::throttle(size_t aBytes) noexcept {
+	auto limit = SETTING(MAX_HASH_SPEED);
+	if (limit <= 0) {
+		return;
+	}
+
+	uint64_t minTime = aBytes * 1000LL / Util::convertSize(limit, Util::MB);
+	uint64_t waitTime = 0;
+
+	{
+		// Reserve the next free period of the shared budget
+		FastLock l(throttleCs);
+		auto now = GET_TICK();
+		auto readStart = max(nextReadTick, now);
+		nextReadTick = readStart + minTime;
+		waitTime = readStart - now;
+	}
+
+	if (waitTime > 0) {
+		Thread::sleep(waitTime);
+	}
 }
 
 HashManager::Optimizer::Optimizer() {
@@ -992,12 +1458,27 @@ void HashManager::Optimizer::startMaintenance(bool aVerify) {
 		return;
 
 	verify = aVerify;
+	finishIncremental = false;
+	running = true;
+	start();
+}
+
+void HashManager::Optimizer::startFinishing() {
+	if (running)
+		return;
+
+	finishIncremental = true;
 	running = true;
 	start();
 }
 
 int HashManager::Optimizer::run() {
-	HashManager::getInstance()->optimize(verify);
+	if (finishIncremental) {
+		HashManager::getInstance()->store.finishIncrementalMaintenance();
+	} else {
+		HashManager::getInstance()->optimize(verify);
+	}
+
 	running = false;
 	return 0;
 }
@@ -1005,6 +1486,8 @@ int HashManager::Optimizer::run() {
 void HashManager::startup(StepFunction stepF, ProgressFunction progressF, MessageFunction messageF) {
 	hashers.push_back(new Hasher(false, 0));
 	store.load(stepF, progressF, messageF); 
+
+	TimerManager::getInstance()->addListener(this);
 }
 
 void HashManager::stop() noexcept {
@@ -1023,6 +1506,7 @@ void HashManager::Hasher::shutdown() {
 
 void HashManager::shutdown(ProgressFunction progressF) noexcept {
 	aShutdown = true;
+	TimerManager::getInstance()->removeListener(this);
 
 	{
 		WLock l(Hasher::hcs);
@@ -1049,13 +1533,26 @@ void HashManager::Hasher::clear() noexcept {
 	totalBytesLeft = 0;
 }
 
-void HashManager::Hasher::getStats(string& curFile, int64_t& bytesLeft, size_t& filesLeft, int64_t& speed) const noexcept {
+void HashManager::Hasher::getStats(string& curFile, int64_t& bytesLeft, size_t& filesLeft, int64_t& speed, DeviceStatsMap* deviceStats_) const noexcept {
 	curFile = currentFile;
 	filesLeft += w.size();
 	if (running)
 		filesLeft++;
 	bytesLeft += totalBytesLeft;
 	speed += lastSpeed;
+
+	if (deviceStats_) {
+		for (const auto& d : deviceBytesRead) {
+			(*deviceStats_)[d.first].bytesRead += d.second;
+		}
+
+		if (currentDevice != -1) {
+			auto& stats = (*deviceStats_)[currentDevice];
+			stats.bytesRead += currentBytesRead;
+			stats.speed += lastSpeed;
+			stats.hashers++;
+		}
+	}
 }
 
 void HashManager::Hasher::instantPause() {
@@ -1102,6 +1599,9 @@ int HashManager::Hasher::run() {
 				originalSize = wi.fileSize;
 				dcassert(curDevID >= 0);
 				w.pop_front();
+
+				currentDevice = curDevID;
+				currentBytesRead = 0;
 			} else {
 				fname.clear();
 			}
@@ -1110,6 +1610,19 @@ int HashManager::Hasher::run() {
 
 		HashedFile fi;
 		if(!fname.empty()) {
+			// Wait until the device accepts another reader
+			auto device = getInstance()->acquireDevice(curDevID);
+			while (!device && !closing) {
+				Thread::sleep(50);
+				device = getInstance()->acquireDevice(curDevID);
+			}
+
+			ScopedFunctor([&] {
+				if (device) {
+					getInstance()->releaseDevice(device);
+				}
+			});
+
 			int64_t sizeLeft = originalSize;
 			try {
 				if (initialDir.empty()) {
@@ -1135,32 +1648,31 @@ int HashManager::Hasher::run() {
 				}
 
 				TigerTree tt(bs);
+				ParallelTreeHasher treeHasher(tt, size);
 
 				CRC32Filter crc32;
 
 				auto fileCRC = sfv.hasFile(Text::toLower(Util::getFileName(fname)));
 
-				uint64_t lastRead = GET_TICK();
+				auto readStart = std::chrono::steady_clock::now();
  
                 FileReader fr(true);
 				fr.read(fname, [&](const void* buf, size_t n) -> bool {
-					if(SETTING(MAX_HASH_SPEED)> 0) {
-						uint64_t now = GET_TICK();
-						uint64_t minTime = n * 1000LL / Util::convertSize(SETTING(MAX_HASH_SPEED), Util::MB);
- 
-						if(lastRead + minTime > now) {
-							Thread::sleep(minTime - (now - lastRead));
-						}
-						lastRead = lastRead + minTime;
-					} else {
-						lastRead = GET_TICK();
+					if (device) {
+						// Time spent waiting for the data
+						device->waitTime += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - readStart).count();
+						device->reads++;
+						device->bytesRead += n;
 					}
-					tt.update(buf, n);
+
+					getInstance()->throttle(n);
+					treeHasher.update(buf, n);
 				
 					if(fileCRC)
 						crc32(buf, n);
 
 					sizeLeft -= n;
+					currentBytesRead += n;
 					uint64_t end = GET_TICK();
 
 					if(totalBytesLeft > 0)
@@ -1168,10 +1680,11 @@ int HashManager::Hasher::run() {
 					if(end > start)
 						lastSpeed = (size - sizeLeft)*1000 / (end -start);
 
+					readStart = std::chrono::steady_clock::now();
 					return !closing;
 				});
 
-				tt.finalize();
+				treeHasher.finalize();
 
 				failed = fileCRC && crc32.getValue() != *fileCRC;
 
@@ -1233,12 +1746,19 @@ int HashManager::Hasher::run() {
 		};
 
 		bool deleteThis = false;
+		bool flushPending = false;
 		{
 			WLock l(hcs);
-			if (!fname.empty())
+			if (!fname.empty()) {
 				removeDevice(curDevID);
 
+				deviceBytesRead[curDevID] += currentBytesRead;
+				currentBytesRead = 0;
+				currentDevice = -1;
+			}
+
 			if (w.empty()) {
+				flushPending = true;
 				getInstance()->fire(HashManagerListener::HasherFinished(), totalDirsHashed, totalFilesHashed, totalSizeHashed, totalHashTime, hasherID);
 				if (totalSizeHashed > 0) {
 					if (totalDirsHashed == 0) {
@@ -1275,6 +1795,15 @@ int HashManager::Hasher::run() {
 		if (!failed && !fname.empty())
 			getInstance()->fire(HashManagerListener::FileHashed(), fname, fi);
 
+		if (flushPending) {
+			// The queue is empty, write the remaining files in the database
+			try {
+				getInstance()->store.flushPending();
+			} catch (const HashException& e) {
+				getInstance()->log(STRING_F(HASHING_FAILED_X, e.getError()), hasherID, true, true);
+			}
+		}
+
 		if (deleteThis) {
 			//check again if we have added new items while this was unlocked
 
@@ -22,7 +22,9 @@
 #include <functional>
 #include "typedefs.h"
 
+#include "ConcurrencyController.h"
 #include "DbHandler.h"
+#include "HashBloom.h"
 #include "HashedFile.h"
 #include "HashManagerListener.h"
 #include "MerkleTree.h"
@@ -32,6 +34,7 @@
 #include "SortedVector.h"
 #include "Speaker.h"
 #include "Thread.h"
+#include "TimerManagerListener.h"
 
 namespace dcpp {
 
@@ -39,7 +42,7 @@ class File;
 class HashLoader;
 class FileException;
 
-class HashManager : public Singleton<HashManager>, public Speaker<HashManagerListener> {
+class HashManager : public Singleton<HashManager>, public Speaker<HashManagerListener>, private TimerManagerListener {
 
 public:
 
@@ -54,6 +57,12 @@ public:
 	 */
 	bool checkTTH(const string& fileLower, const string& aFileName, HashedFile& fi_);
 
+	/**
+	 * Check multiple files in the same directory with a single database lookup
+	 * Returns whether each file is current, the other files are queued for hashing
+	 */
+	vector<bool> checkTTHs(const string& aDirLower, const string& aDir, const StringList& aNamesLower, const StringList& aNames, vector<HashedFile>& fi_);
+
 	void stopHashing(const string& baseDir) noexcept;
 	void setPriority(Thread::Priority p) noexcept;
 
@@ -69,7 +78,23 @@ public:
 	// Throws HashException
 	void addTree(const TigerTree& tree) { store.addTree(tree); }
 
-	void getStats(string& curFile, int64_t& bytesLeft, size_t& filesLeft, int64_t& speed, int& hashers) const noexcept;
+	typedef int64_t devid;
+
+	struct DeviceStats {
+		// Bytes read from the device by the hashers
+		int64_t bytesRead = 0;
+
+		// Combined speed of the hashers currently reading from the device (bytes/s)
+		int64_t speed = 0;
+		int hashers = 0;
+
+		// Number of hashers allowed to read from the device concurrently
+		int maxHashers = 0;
+	};
+
+	typedef map<devid, DeviceStats> DeviceStatsMap;
+
+	void getStats(string& curFile, int64_t& bytesLeft, size_t& filesLeft, int64_t& speed, int& hashers, DeviceStatsMap* deviceStats_ = nullptr) const noexcept;
 
 	// Get TTH for a file synchronously (and optionally stores the hash information)
 	// Throws HashException/FileException
@@ -77,6 +102,7 @@ public:
 
 	/**
 	 * Rebuild hash data file
+	 * Unused entries are removed incrementally in the background unless the trees are also verified
 	 */
 	void startMaintenance(bool verify);
 
@@ -102,13 +128,11 @@ public:
 	void onScheduleRepair(bool schedule) noexcept { store.onScheduleRepair(schedule); }
 	bool isRepairScheduled() const noexcept { return store.isRepairScheduled(); }
 	void getDbSizes(int64_t& fileDbSize_, int64_t& hashDbSize_) const noexcept { return store.getDbSizes(fileDbSize_, hashDbSize_); }
-	bool maintenanceRunning() const noexcept { return optimizer.isRunning(); }
+	bool maintenanceRunning() const noexcept { return optimizer.isRunning() || store.isIncrementalMaintenanceRunning(); }
 
 	// Throws HashException
 	bool addFile(const string& aFilePathLower, const HashedFile& fi_);
 private:
-	typedef int64_t devid;
-
 	int pausers = 0;
 	class Hasher : public Thread {
 	public:
@@ -125,7 +149,7 @@ private:
 
 		void stopHashing(const string& baseDir) noexcept;
 		int run();
-		void getStats(string& curFile, int64_t& bytesLeft, size_t& filesLeft, int64_t& speed) const noexcept;
+		void getStats(string& curFile, int64_t& bytesLeft, size_t& filesLeft, int64_t& speed, DeviceStatsMap* deviceStats_) const noexcept;
 		void shutdown();
 
 		bool hasFile(const string& aPath) const noexcept;
@@ -185,10 +209,45 @@ private:
 		DirSFVReader sfv;
 
 		map<devid, int> devices;
+
+		// Bytes read from each device (excluding the file being hashed)
+		map<devid, int64_t> deviceBytesRead;
+		devid currentDevice = -1;
+		atomic<int64_t> currentBytesRead { 0 };
 	};
 
 	friend class Hasher;
 	void removeHasher(Hasher* aHasher);
+
+	// Concurrency control for a device, the number of concurrent readers is adjusted
+	// based on the measured throughput when HASHERS_PER_VOLUME is 0
+	class HashDevice {
+	public:
+		ConcurrencyController concurrency;
+
+		// Hashers currently reading from the device
+		int active = 0;
+
+		// Statistics for the current sampling period
+		atomic<int64_t> bytesRead { 0 };
+		atomic<int64_t> waitTime { 0 };
+		atomic<int64_t> reads { 0 };
+		uint64_t lastSample = 0;
+	};
+
+	// Protected by Hasher::hcs
+	map<devid, HashDevice> hashDevices;
+
+	// Returns nullptr if the maximum number of hashers are reading from the device already
+	HashDevice* acquireDevice(devid aDeviceId) noexcept;
+	void releaseDevice(HashDevice* aDevice) noexcept;
+	void updateDevices(uint64_t aTick) noexcept;
+
+	// Apply the global speed limit (MAX_HASH_SPEED) that is shared by all hashers
+	void throttle(size_t aBytes) noexcept;
+	uint64_t nextReadTick = 0;
+	FastCriticalSection throttleCs;
+
 	void log(const string& aMessage, int hasherID, bool isError, bool lock);
 
 	void optimize(bool doVerify) noexcept { store.optimize(doVerify); }
@@ -199,13 +258,31 @@ private:
 		~HashStore();
 
 		void addHashedFile(const string& aFilePathLower, const TigerTree& tt, const HashedFile& fi_);
+
+		// Add a file from the hashers, the information is written in the database in batches (but it's available for lookups immediately)
+		// Throws HashException if the batch was written and it failed
+		void queueHashedFile(const string& aFilePathLower, const TigerTree& tt, const HashedFile& fi_);
+
+		// Write all queued files in the database
+		// Throws HashException
+		void flushPending();
 		void addFile(const string& aFilePathLower, const HashedFile& fi_);
 		void removeFile(const string& aFilePathLower);
 		void load(StepFunction stepF, ProgressFunction progressF, MessageFunction messageF);
 
 		void optimize(bool doVerify) noexcept;
 
+		// Remove unused entries in small slices (without blocking the databases)
+		// Returns false if the maintenance is running already
+		bool startIncrementalMaintenance() noexcept;
+		bool isIncrementalMaintenanceRunning() const noexcept;
+
+		// Process the next slice of the incremental maintenance, should be called periodically
+		void runMaintenanceSlice() noexcept;
+		void finishIncrementalMaintenance() noexcept;
+
 		bool checkTTH(const string& aFileNameLower, HashedFile& fi_) noexcept;
+		vector<bool> checkTTHs(const StringList& aFileNamesLower, vector<HashedFile>& fi_) noexcept;
 
 		void addTree(const TigerTree& tt);
 		bool getFileInfo(const string& aFileLower, HashedFile& aFile) noexcept;
@@ -232,6 +309,22 @@ private:
 		std::unique_ptr<DbHandler> fileDb;
 		std::unique_ptr<DbHandler> hashDb;
 
+		// Database key -> value for the queued files that haven't been written in the database yet
+		typedef unordered_map<string, string> PendingMap;
+		PendingMap pendingFiles;
+		PendingMap pendingTrees;
+		uint64_t pendingTick = 0;
+		mutable CriticalSection pendingCs;
+
+		// Limits for writing the queued files
+		static const size_t MAX_PENDING_FILES;
+		static const uint64_t MAX_PENDING_TIME;
+
+		bool getPending(const PendingMap& aMap, const void* aKey, size_t aKeyLen, string& value_) const noexcept;
+		void writeBatch(DbHandler& aDb, const PendingMap& aMap);
+
+		static string serializeTree(const TigerTree& aTree) noexcept;
+		static string serializeFileInfo(const HashedFile& aFile) noexcept;
 
 		friend class HashLoader;
 
@@ -242,6 +335,55 @@ private:
 
 		static bool loadTree(const void* src, size_t len, const TTHValue& aRoot, TigerTree& aTree, bool aReportCorruption);
 
+		enum MaintenancePhase {
+			MAINTENANCE_IDLE,
+
+			// Remove files that aren't shared or that don't have a tree, mark the roots of other files as used
+			MAINTENANCE_FILES,
+
+			// Remove trees that weren't marked as used
+			MAINTENANCE_TREES,
+
+			// Compact the databases and report the results
+			MAINTENANCE_FINISHING
+		};
+
+		struct MaintenanceState {
+			atomic<MaintenancePhase> phase = { MAINTENANCE_IDLE };
+
+			// Key of the last processed entry in the current database
+			string lastKey;
+
+			// Roots of the shared files and all trees/files added since the maintenance was started
+			// Unused trees may still match (they will be removed by a later run)
+			HashBloom usedRoots;
+
+			uint64_t started = 0;
+			int64_t processedEntries = 0;
+			int64_t expectedEntries = 0;
+
+			int validFiles = 0;
+			int unusedFiles = 0;
+			int missingTrees = 0;
+			int64_t failedSize = 0;
+			int validTrees = 0;
+			int unusedTrees = 0;
+		};
+
+		MaintenanceState maintenance;
+		mutable CriticalSection maintenanceCs;
+
+		// Maximum duration and number of entries for a single slice
+		static const uint64_t MAINTENANCE_SLICE_TIME;
+		static const size_t MAINTENANCE_SLICE_ENTRIES;
+
+		void markUsedRoot(const TTHValue& aRoot) noexcept;
+		bool runFileSlice() noexcept;
+		bool runTreeSlice() noexcept;
+
+		void finishMaintenance(int validFiles, int unusedFiles, int missingTrees, int64_t failedSize, int validTrees, int unusedTrees, int failedTrees, bool doVerify) noexcept;
+		string getMaintenanceStats() const noexcept;
+
 		static bool loadFileInfo(const void* src, size_t len, HashedFile& aFile);
 		static void saveFileInfo(void *dest, const HashedFile& aTree);
 		static uint32_t getFileInfoSize(const HashedFile& aTree);
@@ -268,14 +410,20 @@ private:
 		~Optimizer();
 
 		void startMaintenance(bool verify);
+
+		// Finish the incremental maintenance
+		void startFinishing();
 		bool isRunning() const noexcept { return running; }
 	private:
 		bool verify = true;
+		bool finishIncremental = false;
 		atomic<bool> running = { false };
 		virtual int run();
 	};
 
 	Optimizer optimizer;
+
+	void on(TimerManagerListener::Second, uint64_t aTick) noexcept override;
 };
 
 } // namespace dcpp
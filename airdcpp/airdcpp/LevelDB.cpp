@@ -175,6 +175,91 @@ void LevelDB::remove(void* aKey, size_t keyLen, DbSnapshot* /*aSnapshot*/ /*null
 	DBACTION(db->Delete(writeoptions, key));
 }
 
+void LevelDB::write(const DbBatch& aBatch) {
+	leveldb::WriteBatch wb;
+	for (const auto& op: aBatch.getOperations()) {
+		if (op.remove) {
+			wb.Delete(op.key);
+		} else {
+			totalWrites++;
+			wb.Put(op.key, op.value);
+		}
+	}
+
+	// a single synced write for the whole batch
+	DBACTION(db->Write(writeoptions, &wb));
+}
+
+void LevelDB::get(const vector<DbKey>& aKeys, std::function<void(size_t aIndex, void* aValue, size_t aValueLen)> loadF, DbSnapshot* aSnapshot /*nullptr*/) {
+	if (aKeys.empty())
+		return;
+
+	totalReads += aKeys.size();
+
+	// Read the keys in the database order so that the adjacent keys are loaded from the same blocks
+	vector<size_t> order(aKeys.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+
+	sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return leveldb::Slice((const char*)aKeys[a].data, aKeys[a].len).compare(leveldb::Slice((const char*)aKeys[b].data, aKeys[b].len)) < 0;
+	});
+
+	// The iterator uses an implicit snapshot if none was given
+	auto options = readoptions;
+	if (aSnapshot)
+		options.snapshot = static_cast<LevelSnapshot*>(aSnapshot)->snapshot;
+
+	auto it = unique_ptr<leveldb::Iterator>(db->NewIterator(options));
+	for (auto i: order) {
+		leveldb::Slice key((const char*)aKeys[i].data, aKeys[i].len);
+
+		// The next key in the database is often the one that we are looking for
+		if (it->Valid() && it->key().compare(key) < 0) {
+			it->Next();
+		}
+
+		if (!it->Valid() || it->key().compare(key) != 0) {
+			it->Seek(key);
+		}
+
+		checkDbError(it->status());
+		if (it->Valid() && it->key().compare(key) == 0) {
+			loadF(i, (void*)it->value().data(), it->value().size());
+		}
+	}
+}
+
+void LevelDB::forEach(std::function<bool(void* aKey, size_t keyLen, void* aValue, size_t valueLen)> f, const void* aPrefix /*nullptr*/, size_t aPrefixLen /*0*/, DbSnapshot* aSnapshot /*nullptr*/) {
+	leveldb::Slice prefix((const char*)aPrefix, aPrefixLen);
+	iterate(f, prefix, prefix, aSnapshot);
+}
+
+void LevelDB::forEachFrom(std::function<bool(void* aKey, size_t keyLen, void* aValue, size_t valueLen)> f, const void* aStartKey, size_t aStartKeyLen, DbSnapshot* aSnapshot /*nullptr*/) {
+	iterate(f, leveldb::Slice((const char*)aStartKey, aStartKeyLen), leveldb::Slice(), aSnapshot);
+}
+
+void LevelDB::iterate(std::function<bool(void* aKey, size_t keyLen, void* aValue, size_t valueLen)>& f, const leveldb::Slice& aStartKey, const leveldb::Slice& aPrefix, DbSnapshot* aSnapshot) {
+	auto it = unique_ptr<leveldb::Iterator>(db->NewIterator(getIterOptions(aSnapshot)));
+	for (it->Seek(aStartKey); it->Valid() && it->key().starts_with(aPrefix); it->Next()) {
+		checkDbError(it->status());
+
+		if (!f((void*)it->key().data(), it->key().size(), (void*)it->value().data(), it->value().size())) {
+			break;
+		}
+	}
+
+	checkDbError(it->status());
+}
+
+leveldb::ReadOptions LevelDB::getIterOptions(DbSnapshot* aSnapshot) const noexcept {
+	auto options = iteroptions;
+	if (aSnapshot)
+		options.snapshot = static_cast<LevelSnapshot*>(aSnapshot)->snapshot;
+	return options;
+}
+
 int64_t LevelDB::getSizeOnDisk() {
 	return File::getDirSize(getPath(), false);
 }
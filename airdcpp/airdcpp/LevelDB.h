@@ -41,6 +41,11 @@ public:
 	void remove(void* aKey, size_t keyLen, DbSnapshot* aSnapshot /*nullptr*/);
 	bool hasKey(void* aKey, size_t keyLen, DbSnapshot* aSnapshot /*nullptr*/);
 
+	void write(const DbBatch& aBatch);
+	void get(const vector<DbKey>& aKeys, std::function<void(size_t aIndex, void* aValue, size_t aValueLen)> loadF, DbSnapshot* aSnapshot /*nullptr*/);
+	void forEach(std::function<bool(void* aKey, size_t keyLen, void* aValue, size_t valueLen)> f, const void* aPrefix /*nullptr*/, size_t aPrefixLen /*0*/, DbSnapshot* aSnapshot /*nullptr*/);
+	void forEachFrom(std::function<bool(void* aKey, size_t keyLen, void* aValue, size_t valueLen)> f, const void* aStartKey, size_t aStartKeyLen, DbSnapshot* aSnapshot /*nullptr*/);
+
 	string getStats();
 
 	size_t size(bool /*thorough*/, DbSnapshot* aSnapshot /*nullptr*/);
@@ -66,6 +71,8 @@ private:
 	};
 
 	string getRepairFlag() const;
+	leveldb::ReadOptions getIterOptions(DbSnapshot* aSnapshot) const noexcept;
+	void iterate(std::function<bool(void* aKey, size_t keyLen, void* aValue, size_t valueLen)>& f, const leveldb::Slice& aStartKey, const leveldb::Slice& aPrefix, DbSnapshot* aSnapshot);
 	leveldb::Status performDbOperation(function<leveldb::Status()> f);
 	void checkDbError(leveldb::Status aStatus);
 
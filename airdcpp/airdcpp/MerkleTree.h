@@ -106,21 +106,47 @@ public:
 			return;
 		
 		do {
+			// Hash multiple full leaves at once when possible
+			size_t count = min((len - i) / baseBlockSize, LEAF_BATCH);
+			if(count >= Hasher::LEAF_LANES) {
+				uint8_t results[LEAF_BATCH * BYTES];
+				Hasher::hashLeaves(buf + i, baseBlockSize, count, zero, results);
+				for(size_t j = 0; j < count; j++) {
+					addLeaf(MerkleValue(results + j * BYTES));
+				}
+
+				i += count * baseBlockSize;
+				continue;
+			}
+
 			size_t n = min(baseBlockSize, len-i);
 			Hasher h;
 			h.update(&zero, 1);
 			h.update(buf + i, n);
-			if((int64_t)baseBlockSize < blockSize) {
-				blocks.emplace_back(MerkleValue(h.finalize()), baseBlockSize);
-				reduceBlocks();
-			} else {
-				leaves.emplace_back(h.finalize());
-			}
+			addLeaf(MerkleValue(h.finalize()));
 			i += n;
 		} while(i < len);
 		fileSize += len;
 	}
 
+	/**
+	 * Add the root of a subtree that has been calculated separately (e.g. in a different thread).
+	 * @param aSize Length of the subtree data, must be baseBlockSize multiplied by a power of two
+	 *              and not larger than the block size. The data added earlier must be aligned by aSize.
+	 */
+	void addSubtree(const MerkleValue& aRoot, int64_t aSize) {
+		dcassert(aSize <= blockSize && (fileSize % aSize) == 0);
+		if(aSize == blockSize) {
+			dcassert(blocks.empty());
+			leaves.push_back(aRoot);
+		} else {
+			blocks.emplace_back(aRoot, aSize);
+			reduceBlocks();
+		}
+
+		fileSize += aSize;
+	}
+
 	uint8_t* finalize() {
 		// No updates yet, make sure we have at least one leaf for 0-length files...
 		if(leaves.empty() && blocks.empty()) {
@@ -170,6 +196,9 @@ public:
 
 
 private:	
+	/** Maximum number of leaves passed to Hasher::hashLeaves at once */
+	static const size_t LEAF_BATCH = Hasher::LEAF_LANES * 4;
+
 	typedef pair<MerkleValue, int64_t> MerkleBlock;
 	typedef vector<MerkleBlock> MBList;
 
@@ -205,6 +234,15 @@ private:
 		return MerkleValue(h.finalize());
 	}
 
+	void addLeaf(const MerkleValue& aHash) {
+		if((int64_t)baseBlockSize < blockSize) {
+			blocks.emplace_back(aHash, baseBlockSize);
+			reduceBlocks();
+		} else {
+			leaves.push_back(aHash);
+		}
+	}
+
 	void reduceBlocks() {
 		while(blocks.size() > 1) {
 			MerkleBlock& a = blocks[blocks.size()-2];
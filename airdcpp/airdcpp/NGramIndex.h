@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_NGRAM_INDEX_H
+#define DCPLUSPLUS_DCPP_NGRAM_INDEX_H
+
+#include "typedefs.h"
+
+namespace dcpp {
+
+/**
+* Inverted index mapping each n-gram of the added (lowercase) strings to the items containing it.
+*
+* Lookups return a superset of the items that may contain the pattern: n-grams of all strings
+* added for the same item are combined and stale entries are allowed to exist. The caller is
+* expected to verify the candidates with the actual matcher.
+*
+* Items are stored by value (e.g. pointers or ids). Pointers must be removed from the index before
+* the items are deleted.
+*/
+template<class T, size_t N = 3>
+class NGramIndex {
+public:
+	static_assert(N > 0 && N <= sizeof(uint32_t), "Unsupported n-gram length");
+
+	typedef unordered_set<T> ItemSet;
+
+	NGramIndex() { }
+	NGramIndex(NGramIndex&) = delete;
+	NGramIndex& operator=(NGramIndex&) = delete;
+
+	// Add all n-grams of the string for the item
+	void add(T aItem, const string& aStrLower) noexcept {
+		forEachKey(aStrLower, [&](Key aKey) {
+			auto& items = index[aKey];
+
+			// Strings of the same item are usually added in a row
+			if (items.empty() || items.back() != aItem) {
+				items.push_back(aItem);
+				entries++;
+			}
+		});
+	}
+
+	// Remove a single item with the strings that were added for it
+	// Fast for items that have been added recently
+	void remove(T aItem, const string& aStrLower) noexcept {
+		forEachKey(aStrLower, [&](Key aKey) {
+			auto i = index.find(aKey);
+			if (i == index.end()) {
+				return;
+			}
+
+			auto& items = i->second;
+			auto p = std::find(items.rbegin(), items.rend(), aItem);
+			if (p != items.rend()) {
+				items.erase(std::next(p).base());
+				entries--;
+			}
+
+			if (items.empty()) {
+				index.erase(i);
+			}
+		});
+	}
+
+	// Remove all entries of the items
+	// Iterates through the whole index
+	void remove(const ItemSet& aItems) noexcept {
+		if (aItems.empty()) {
+			return;
+		}
+
+		for (auto i = index.begin(); i != index.end();) {
+			auto& items = i->second;
+			auto oldSize = items.size();
+			items.erase(std::remove_if(items.begin(), items.end(), [&](T aItem) {
+				return aItems.find(aItem) != aItems.end();
+			}), items.end());
+
+			entries -= oldSize - items.size();
+			if (items.empty()) {
+				i = index.erase(i);
+			} else {
+				i++;
+			}
+		}
+	}
+
+	// Move all entries from another index
+	void merge(NGramIndex& aIndex) noexcept {
+		if (index.empty()) {
+			index.swap(aIndex.index);
+		} else {
+			for (auto& i : aIndex.index) {
+				auto& items = index[i.first];
+				items.insert(items.end(), i.second.begin(), i.second.end());
+			}
+		}
+
+		entries += aIndex.entries;
+		aIndex.clear();
+	}
+
+	// Collect the items that may contain the pattern
+	// Returns false if the pattern is too short to be looked up from the index (any item may match it)
+	bool getCandidates(const string& aPatternLower, ItemSet& candidates_) const noexcept {
+		if (aPatternLower.size() < N) {
+			return false;
+		}
+
+		// Get the item lists for all unique keys, shortest first
+		vector<const vector<T>*> lists;
+		{
+			vector<Key> keys;
+			forEachKey(aPatternLower, [&](Key aKey) {
+				keys.push_back(aKey);
+			});
+
+			sort(keys.begin(), keys.end());
+			keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+			for (auto k : keys) {
+				auto i = index.find(k);
+				if (i == index.end()) {
+					// Nothing can match
+					return true;
+				}
+
+				lists.push_back(&i->second);
+			}
+
+			sort(lists.begin(), lists.end(), [](const vector<T>* a, const vector<T>* b) { return a->size() < b->size(); });
+		}
+
+		// Intersect (the items are counted per matching key)
+		unordered_map<T, size_t> counts;
+		counts.reserve(lists.front()->size());
+		for (auto i : *lists.front()) {
+			counts.emplace(i, 1);
+		}
+
+		for (size_t pos = 1; pos < lists.size(); ++pos) {
+			for (auto i : *lists[pos]) {
+				auto p = counts.find(i);
+				if (p != counts.end() && p->second == pos) {
+					p->second++;
+				}
+			}
+		}
+
+		for (const auto& c : counts) {
+			if (c.second == lists.size()) {
+				candidates_.insert(c.first);
+			}
+		}
+
+		return true;
+	}
+
+	void clear() noexcept {
+		index.clear();
+		entries = 0;
+	}
+
+	// Release the memory reserved for new entries (e.g. after a large number of items has been added)
+	void shrink() noexcept {
+		for (auto& i : index) {
+			i.second.shrink_to_fit();
+		}
+	}
+
+	size_t getKeyCount() const noexcept { return index.size(); }
+	size_t getEntryCount() const noexcept { return entries; }
+private:
+	typedef uint32_t Key;
+
+	template<class F>
+	static void forEachKey(const string& aStr, F aF) noexcept {
+		if (aStr.size() < N) {
+			return;
+		}
+
+		auto c = reinterpret_cast<const uint8_t*>(aStr.data());
+		auto end = c + aStr.size() - N + 1;
+		for (; c < end; ++c) {
+			Key k = 0;
+			for (size_t i = 0; i < N; ++i) {
+				k = (k << 8) | c[i];
+			}
+
+			aF(k);
+		}
+	}
+
+	unordered_map<Key, vector<T>> index;
+	size_t entries = 0;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_NGRAM_INDEX_H)
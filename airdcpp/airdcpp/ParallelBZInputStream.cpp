@@ -0,0 +1,430 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "ParallelBZInputStream.h"
+
+#include "Exception.h"
+#include "ResourceManager.h"
+
+#include <array>
+#include <bzlib.h>
+
+namespace dcpp {
+
+// Stream header ("BZh" + level)
+#define HEADER_SIZE 4
+
+#define MARKER_BITS 48
+#define MARKER_MASK 0xFFFFFFFFFFFFULL
+#define BLOCK_MAGIC 0x314159265359ULL
+#define END_MAGIC 0x177245385090ULL
+
+#define CRC_BITS 32
+
+#define READ_SIZE (256 * 1024)
+
+// Read up to 32 bits starting from the bit position
+static uint32_t getBits(const ByteVector& aData, size_t aPos, int aBits) noexcept {
+	uint64_t value = 0;
+	for (auto i = aPos / 8; i <= (aPos + aBits - 1) / 8; ++i) {
+		value = (value << 8) | aData[i];
+	}
+
+	auto trailing = 7 - (aPos + aBits - 1) % 8;
+	return static_cast<uint32_t>((value >> trailing) & ((1ULL << aBits) - 1));
+}
+
+// Markers at bit offsets 0-7 (the second lowest byte of the search window is always fully inside the marker)
+// Bits 0-7: block marker at the offset, bits 8-15: end-of-stream marker at the offset
+typedef std::array<uint16_t, 256> MarkerTable;
+static MarkerTable createMarkerTable() noexcept {
+	MarkerTable table;
+	table.fill(0);
+
+	for (int shift = 0; shift < 8; ++shift) {
+		table[(BLOCK_MAGIC >> (8 - shift)) & 0xFF] |= 1 << shift;
+		table[(END_MAGIC >> (8 - shift)) & 0xFF] |= 1 << (8 + shift);
+	}
+
+	return table;
+}
+
+static const MarkerTable markerTable = createMarkerTable();
+
+ParallelBZInputStream::ParallelBZInputStream(InputStream* aStream, int aThreads) : s(aStream) {
+	auto threadCount = aThreads > 0 ? static_cast<size_t>(aThreads) : static_cast<size_t>(std::thread::hardware_concurrency());
+
+	// Keep a few blocks decompressed ahead for each thread
+	maxBlocks = max(threadCount, static_cast<size_t>(1)) * 2;
+
+	if (threadCount > 1) {
+		for (size_t i = 0; i < threadCount; ++i) {
+			threads.emplace_back([this] { runWorker(); });
+		}
+	} else {
+		sequential.reset(new FilteredInputStream<UnBZFilter, false>(s));
+	}
+}
+
+ParallelBZInputStream::~ParallelBZInputStream() {
+	stopThreads();
+}
+
+void ParallelBZInputStream::stopThreads() noexcept {
+	{
+		std::lock_guard<std::mutex> l(cs);
+		stopping = true;
+	}
+
+	workerCond.notify_all();
+	for (auto& t: threads) {
+		t.join();
+	}
+
+	threads.clear();
+}
+
+void ParallelBZInputStream::runWorker() noexcept {
+	for (;;) {
+		Block* block = nullptr;
+
+		{
+			std::unique_lock<std::mutex> l(cs);
+			workerCond.wait(l, [this] { return stopping || !queue.empty(); });
+			if (stopping) {
+				return;
+			}
+
+			block = queue.front();
+			queue.pop_front();
+		}
+
+		decompressBlock(*block);
+
+		{
+			std::lock_guard<std::mutex> l(cs);
+			block->decompressed = true;
+		}
+
+		readerCond.notify_one();
+	}
+}
+
+void ParallelBZInputStream::decompressBlock(Block& aBlock) noexcept {
+	bz_stream zs;
+	memzero(&zs, sizeof(zs));
+	if (BZ2_bzDecompressInit(&zs, 0, 0) != BZ_OK) {
+		aBlock.failed = true;
+		return;
+	}
+
+	auto& data = aBlock.data;
+	zs.next_in = reinterpret_cast<char*>(&data[0]);
+	zs.avail_in = static_cast<unsigned int>(data.size());
+
+	// Blocks are at most 900 kB before the initial run-length encoding is reverted
+	ByteVector out(1024 * 1024);
+	size_t outPos = 0;
+	for (;;) {
+		if (outPos == out.size()) {
+			out.resize(out.size() * 2);
+		}
+
+		zs.next_out = reinterpret_cast<char*>(&out[outPos]);
+		zs.avail_out = static_cast<unsigned int>(out.size() - outPos);
+
+		auto ret = BZ2_bzDecompress(&zs);
+		outPos = out.size() - zs.avail_out;
+
+		if (ret == BZ_STREAM_END) {
+			break;
+		}
+
+		// Errors and truncated blocks (the block CRC is validated by the decoder)
+		if (ret != BZ_OK || (zs.avail_in == 0 && zs.avail_out != 0)) {
+			aBlock.failed = true;
+			break;
+		}
+	}
+
+	BZ2_bzDecompressEnd(&zs);
+
+	out.resize(outPos);
+	data.swap(out);
+}
+
+bool ParallelBZInputStream::readInput() {
+	auto oldSize = input.size();
+	size_t len = READ_SIZE;
+	input.resize(oldSize + len);
+	len = s->read(&input[oldSize], len);
+	input.resize(oldSize + len);
+	return len > 0;
+}
+
+size_t ParallelBZInputStream::findMarker(bool& isEnd_) noexcept {
+	const auto size = input.size();
+
+	// Search window containing the last 8 bytes, markers are matched in the order of their positions
+	uint64_t window = 0;
+	for (auto i = scanPos / 8; i < size; ++i) {
+		window = (window << 8) | input[i];
+
+		auto candidates = markerTable[(window >> 8) & 0xFF];
+		if (candidates == 0) {
+			continue;
+		}
+
+		for (int shift = 7; shift >= 0; --shift) {
+			auto end = (i + 1) * 8 - shift;
+			if (end < scanPos + MARKER_BITS) {
+				continue;
+			}
+
+			auto value = (window >> shift) & MARKER_MASK;
+			if (((candidates >> shift) & 1) && value == BLOCK_MAGIC) {
+				isEnd_ = false;
+				return end - MARKER_BITS;
+			}
+
+			if (((candidates >> (8 + shift)) & 1) && value == END_MAGIC) {
+				isEnd_ = true;
+				return end - MARKER_BITS;
+			}
+		}
+	}
+
+	// Continue from the first position that hasn't been checked yet
+	if (size * 8 >= MARKER_BITS) {
+		scanPos = max(scanPos, size * 8 - MARKER_BITS + 1);
+	}
+
+	return string::npos;
+}
+
+bool ParallelBZInputStream::readHeader() {
+	while (input.size() < HEADER_SIZE + (MARKER_BITS + CRC_BITS) / 8) {
+		if (!readInput()) {
+			return false;
+		}
+	}
+
+	if (input[0] != 'B' || input[1] != 'Z' || input[2] != 'h' || input[3] < '1' || input[3] > '9') {
+		return false;
+	}
+
+	level = input[3];
+
+	blockStart = HEADER_SIZE * 8;
+	scanPos = blockStart + MARKER_BITS;
+
+	auto marker = (static_cast<uint64_t>(getBits(input, blockStart, 24)) << 24) | getBits(input, blockStart + 24, 24);
+	if (marker == END_MAGIC) {
+		// Empty stream
+		expectedCrc = getBits(input, blockStart + MARKER_BITS, CRC_BITS);
+		scanFinished = true;
+		return true;
+	}
+
+	return marker == BLOCK_MAGIC;
+}
+
+bool ParallelBZInputStream::queueBlock() {
+	bool isEnd = false;
+	size_t next = string::npos;
+	while ((next = findMarker(isEnd)) == string::npos) {
+		if (!readInput()) {
+			return false;
+		}
+	}
+
+	if (isEnd) {
+		while (input.size() * 8 < next + MARKER_BITS + CRC_BITS) {
+			if (!readInput()) {
+				return false;
+			}
+		}
+
+		expectedCrc = getBits(input, next + MARKER_BITS, CRC_BITS);
+		scanFinished = true;
+	}
+
+	// The block marker is followed by the block CRC
+	const auto bits = next - blockStart;
+	if (bits <= MARKER_BITS + CRC_BITS) {
+		return false;
+	}
+
+	unique_ptr<Block> block(new Block);
+	block->crc = getBits(input, blockStart + MARKER_BITS, CRC_BITS);
+
+	// Create a standalone stream with the header of the original stream
+	auto& data = block->data;
+	data.reserve(HEADER_SIZE + bits / 8 + (MARKER_BITS + CRC_BITS) / 8 + 2);
+	data.push_back('B');
+	data.push_back('Z');
+	data.push_back('h');
+	data.push_back(level);
+
+	const auto shift = blockStart % 8;
+	const auto first = blockStart / 8;
+	const auto fullBytes = bits / 8;
+	for (size_t i = first; i < first + fullBytes; ++i) {
+		data.push_back(shift == 0 ? input[i] : static_cast<uint8_t>((input[i] << shift) | (input[i + 1] >> (8 - shift))));
+	}
+
+	uint64_t bitBuffer = 0;
+	int bitCount = 0;
+	auto writeBits = [&](uint32_t aValue, int aBits) {
+		bitBuffer = (bitBuffer << aBits) | aValue;
+		bitCount += aBits;
+
+		while (bitCount >= 8) {
+			bitCount -= 8;
+			data.push_back(static_cast<uint8_t>(bitBuffer >> bitCount));
+		}
+	};
+
+	auto remainingBits = static_cast<int>(bits % 8);
+	if (remainingBits > 0) {
+		writeBits(getBits(input, blockStart + fullBytes * 8, remainingBits), remainingBits);
+	}
+
+	// With a single block, the combined CRC equals the block CRC
+	writeBits(END_MAGIC >> 24, 24);
+	writeBits(END_MAGIC & 0xFFFFFF, 24);
+	writeBits(block->crc, CRC_BITS);
+	if (bitCount > 0) {
+		writeBits(0, 8 - bitCount);
+	}
+
+	// Remove the data before the next marker
+	auto consumed = next / 8;
+	input.erase(input.begin(), input.begin() + consumed);
+	blockStart = next - consumed * 8;
+	scanPos = blockStart + MARKER_BITS;
+
+	{
+		std::lock_guard<std::mutex> l(cs);
+		queue.push_back(block.get());
+		blocks.push_back(move(block));
+	}
+
+	workerCond.notify_one();
+	return true;
+}
+
+bool ParallelBZInputStream::nextBlock() {
+	if (level == 0 && !scanFinished && !readHeader()) {
+		startSequential();
+		return true;
+	}
+
+	while (!scanFinished && blocks.size() < maxBlocks) {
+		if (!queueBlock()) {
+			startSequential();
+			return true;
+		}
+	}
+
+	if (blocks.empty()) {
+		if (streamCrc != expectedCrc) {
+			startSequential();
+			return true;
+		}
+
+		return false;
+	}
+
+	unique_ptr<Block> block;
+
+	{
+		std::unique_lock<std::mutex> l(cs);
+		readerCond.wait(l, [this] { return blocks.front()->decompressed; });
+
+		block = move(blocks.front());
+		blocks.pop_front();
+	}
+
+	if (block->failed) {
+		startSequential();
+		return true;
+	}
+
+	streamCrc = ((streamCrc << 1) | (streamCrc >> 31)) ^ block->crc;
+
+	output.swap(block->data);
+	outputPos = 0;
+	return true;
+}
+
+void ParallelBZInputStream::startSequential() {
+	dcdebug("ParallelBZInputStream: decompressing sequentially after " I64_FMT " bytes\n", outputSize);
+
+	stopThreads();
+
+	blocks.clear();
+	queue.clear();
+	ByteVector().swap(input);
+	ByteVector().swap(output);
+	outputPos = 0;
+
+	s->setPos(0);
+	sequential.reset(new FilteredInputStream<UnBZFilter, false>(s));
+
+	// Skip the data that has been read already
+	ByteVector buf(64 * 1024);
+	for (auto remaining = outputSize; remaining > 0;) {
+		size_t len = static_cast<size_t>(min(remaining, static_cast<int64_t>(buf.size())));
+		len = sequential->read(&buf[0], len);
+		if (len == 0) {
+			throw Exception(STRING(DECOMPRESSION_ERROR));
+		}
+
+		remaining -= len;
+	}
+}
+
+size_t ParallelBZInputStream::read(void* aBuf, size_t& aLen) {
+	for (;;) {
+		if (sequential) {
+			auto len = sequential->read(aBuf, aLen);
+			outputSize += len;
+			return len;
+		}
+
+		if (outputPos < output.size()) {
+			auto len = min(aLen, output.size() - outputPos);
+			memcpy(aBuf, &output[outputPos], len);
+
+			outputPos += len;
+			outputSize += len;
+
+			aLen = len;
+			return len;
+		}
+
+		if (!nextBlock()) {
+			aLen = 0;
+			return 0;
+		}
+	}
+}
+
+} // namespace dcpp
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_PARALLEL_BZ_INPUT_STREAM_H
+#define DCPLUSPLUS_DCPP_PARALLEL_BZ_INPUT_STREAM_H
+
+#include "typedefs.h"
+
+#include "BZUtils.h"
+#include "FilteredFile.h"
+#include "Streams.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace dcpp {
+
+/**
+* Decompresses a bzip2 stream on multiple cores
+*
+* The blocks are located by their (bit-aligned) block markers and decompressed independently while
+* the previous blocks are being read. If the stream can't be split or a block fails to decompress
+* (e.g. because a marker sequence occurred inside compressed data), the stream is decompressed again
+* sequentially from the beginning, so the output and the errors are the same as with UnBZFilter.
+* The source stream must support setPos for that.
+*
+* Only the first bzip2 stream is read (as with UnBZFilter).
+*/
+class ParallelBZInputStream : public InputStream {
+public:
+	// aThreads: number of decompression threads (0 = number of cores)
+	// The source stream isn't deleted
+	ParallelBZInputStream(InputStream* aStream, int aThreads = 0);
+	~ParallelBZInputStream();
+
+	size_t read(void* aBuf, size_t& aLen) override;
+
+	// Returns true if the data had to be decompressed sequentially
+	bool isSequential() const noexcept { return !!sequential; }
+private:
+	struct Block {
+		// Standalone bzip2 stream containing only this block, replaced with the decompressed data
+		ByteVector data;
+		uint32_t crc = 0;
+
+		bool decompressed = false;
+		bool failed = false;
+	};
+
+	static void decompressBlock(Block& aBlock) noexcept;
+
+	InputStream* s;
+
+	// Compressed data that hasn't been split into blocks yet
+	ByteVector input;
+
+	// Bit position of the current block marker in the input buffer
+	size_t blockStart = 0;
+
+	// Next bit position that should be checked for markers
+	size_t scanPos = 0;
+
+	uint8_t level = 0;
+	bool scanFinished = false;
+	uint32_t expectedCrc = 0;
+
+	// Reads more input, returns false if the end of the source stream was reached
+	bool readInput();
+
+	// Returns the bit position of the next block or end-of-stream marker (or string::npos if the end of the input was reached)
+	size_t findMarker(bool& isEnd_) noexcept;
+
+	// Reads the stream header and checks that the first block starts after it
+	// Returns false if the data can't be split
+	bool readHeader();
+
+	// Splits the next block from the input and queues it for decompression
+	// Returns false if the data can't be split
+	bool queueBlock();
+
+	// Blocks in the original order
+	std::deque<unique_ptr<Block>> blocks;
+
+	// Blocks waiting for decompression
+	std::deque<Block*> queue;
+	size_t maxBlocks;
+
+	std::mutex cs;
+	std::condition_variable workerCond;
+	std::condition_variable readerCond;
+	vector<std::thread> threads;
+	bool stopping = false;
+
+	void runWorker() noexcept;
+
+	// Waits until the next block has been decompressed and moves it to the output buffer
+	// Returns false when there is no more data
+	bool nextBlock();
+
+	// Combined CRC of the blocks that have been read
+	uint32_t streamCrc = 0;
+
+	ByteVector output;
+	size_t outputPos = 0;
+
+	// Total number of decompressed bytes returned
+	int64_t outputSize = 0;
+
+	unique_ptr<FilteredInputStream<UnBZFilter, false>> sequential;
+
+	// Stops the parallel decompression and continues from the current position with UnBZFilter
+	void startSequential();
+	void stopThreads() noexcept;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_PARALLEL_BZ_INPUT_STREAM_H)
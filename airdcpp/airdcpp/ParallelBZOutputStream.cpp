@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "ParallelBZOutputStream.h"
+
+#include "Exception.h"
+#include "ResourceManager.h"
+
+#include <bzlib.h>
+
+namespace dcpp {
+
+// Blocks are 900 kB (the same level is used as with BZFilter)
+#define BZ_LEVEL 9
+
+// Run-length encoding may expand the data by 25% before it's placed in the block
+const size_t ParallelBZOutputStream::BLOCK_SIZE = 700 * 1024;
+
+// Output is passed on in chunks of this size (filters such as TTFilter require aligned data)
+#define OUTPUT_CHUNK_SIZE (64 * 1024)
+
+// Stream header ("BZh" + level)
+#define HEADER_BITS 32
+
+#define BLOCK_MAGIC_HI 0x314159
+#define BLOCK_MAGIC_LO 0x265359
+#define END_MAGIC_HI 0x177245
+#define END_MAGIC_LO 0x385090
+
+// Read up to 32 bits starting from the bit position
+static uint32_t getBits(const ByteVector& aData, size_t aPos, int aBits) noexcept {
+	uint64_t value = 0;
+	for (auto i = aPos / 8; i <= (aPos + aBits - 1) / 8; ++i) {
+		value = (value << 8) | aData[i];
+	}
+
+	auto trailing = 7 - (aPos + aBits - 1) % 8;
+	return static_cast<uint32_t>((value >> trailing) & ((1ULL << aBits) - 1));
+}
+
+ParallelBZOutputStream::ParallelBZOutputStream(OutputStream* aStream, int aThreads) : s(aStream) {
+	auto threadCount = aThreads > 0 ? static_cast<size_t>(aThreads) : static_cast<size_t>(std::thread::hardware_concurrency());
+
+	// Keep a few blocks queued for each thread while the previous ones are being written
+	maxBlocks = max(threadCount, static_cast<size_t>(1)) * 3;
+
+	if (threadCount > 1) {
+		for (size_t i = 0; i < threadCount; ++i) {
+			threads.emplace_back([this] { runWorker(); });
+		}
+	}
+
+	input.reserve(BLOCK_SIZE);
+
+	output.push_back('B');
+	output.push_back('Z');
+	output.push_back('h');
+	output.push_back('0' + BZ_LEVEL);
+}
+
+ParallelBZOutputStream::~ParallelBZOutputStream() {
+	{
+		std::lock_guard<std::mutex> l(cs);
+		stopping = true;
+	}
+
+	workerCond.notify_all();
+	for (auto& t: threads) {
+		t.join();
+	}
+}
+
+void ParallelBZOutputStream::runWorker() noexcept {
+	for (;;) {
+		Block* block = nullptr;
+
+		{
+			std::unique_lock<std::mutex> l(cs);
+			workerCond.wait(l, [this] { return stopping || !queue.empty(); });
+			if (stopping) {
+				return;
+			}
+
+			block = queue.front();
+			queue.pop_front();
+		}
+
+		compressBlock(*block);
+
+		{
+			std::lock_guard<std::mutex> l(cs);
+			block->compressed = true;
+		}
+
+		writerCond.notify_one();
+	}
+}
+
+void ParallelBZOutputStream::compressBlock(Block& aBlock) noexcept {
+	auto& data = aBlock.data;
+
+	auto outLen = static_cast<unsigned int>(data.size() + data.size() / 100 + 600);
+	ByteVector out(outLen);
+	if (BZ2_bzBuffToBuffCompress(reinterpret_cast<char*>(&out[0]), &outLen, reinterpret_cast<char*>(&data[0]), static_cast<unsigned int>(data.size()), BZ_LEVEL, 0, 30) != BZ_OK) {
+		aBlock.failed = true;
+		return;
+	}
+
+	out.resize(outLen);
+
+	// Header, block magic and the block CRC
+	if (outLen < 14 || getBits(out, HEADER_BITS, 24) != BLOCK_MAGIC_HI || getBits(out, HEADER_BITS + 24, 24) != BLOCK_MAGIC_LO) {
+		aBlock.failed = true;
+		return;
+	}
+
+	aBlock.crc = getBits(out, HEADER_BITS + 48, 32);
+
+	// The stream ends with the end-of-stream magic and the combined CRC, followed by zero padding
+	// With a single block, the combined CRC equals the block CRC
+	auto totalBits = static_cast<size_t>(outLen) * 8;
+	for (int padding = 0; padding < 8; ++padding) {
+		auto pos = totalBits - padding - 80;
+		if (getBits(out, pos, 24) == END_MAGIC_HI && getBits(out, pos + 24, 24) == END_MAGIC_LO &&
+			getBits(out, pos + 48, 32) == aBlock.crc && (padding == 0 || getBits(out, pos + 80, padding) == 0)) {
+
+			aBlock.endBits = pos;
+			aBlock.data.swap(out);
+			return;
+		}
+	}
+
+	// More than one block?
+	aBlock.failed = true;
+}
+
+size_t ParallelBZOutputStream::write(const void* aBuf, size_t aLen) {
+	dcassert(!finished);
+
+	auto p = static_cast<const uint8_t*>(aBuf);
+	inputSize += aLen;
+
+	while (aLen > 0) {
+		auto n = min(aLen, BLOCK_SIZE - input.size());
+		input.insert(input.end(), p, p + n);
+
+		p += n;
+		aLen -= n;
+
+		if (input.size() == BLOCK_SIZE) {
+			queueBlock();
+		}
+	}
+
+	return 0;
+}
+
+void ParallelBZOutputStream::queueBlock() {
+	unique_ptr<Block> block(new Block);
+	block->data.swap(input);
+	input.reserve(BLOCK_SIZE);
+
+	if (threads.empty()) {
+		compressBlock(*block);
+		appendBlock(*block);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> l(cs);
+		queue.push_back(block.get());
+		blocks.push_back(move(block));
+	}
+
+	workerCond.notify_one();
+	writeBlocks(false);
+}
+
+void ParallelBZOutputStream::writeBlocks(bool aAll) {
+	for (;;) {
+		unique_ptr<Block> block;
+
+		{
+			std::unique_lock<std::mutex> l(cs);
+			if (blocks.empty()) {
+				return;
+			}
+
+			if (!blocks.front()->compressed) {
+				if (!aAll && blocks.size() < maxBlocks) {
+					return;
+				}
+
+				writerCond.wait(l, [this] { return blocks.front()->compressed; });
+			}
+
+			block = move(blocks.front());
+			blocks.pop_front();
+		}
+
+		appendBlock(*block);
+	}
+}
+
+void ParallelBZOutputStream::appendBlock(const Block& aBlock) {
+	if (aBlock.failed) {
+		throw Exception(STRING(COMPRESSION_ERROR));
+	}
+
+	// Skip the stream header of the block
+	const auto& data = aBlock.data;
+	auto fullBytes = aBlock.endBits / 8;
+	for (size_t i = HEADER_BITS / 8; i < fullBytes; ++i) {
+		writeBits(data[i], 8);
+	}
+
+	auto remainingBits = static_cast<int>(aBlock.endBits % 8);
+	if (remainingBits > 0) {
+		writeBits(data[fullBytes] >> (8 - remainingBits), remainingBits);
+	}
+
+	streamCrc = ((streamCrc << 1) | (streamCrc >> 31)) ^ aBlock.crc;
+	writeOutput(false);
+}
+
+void ParallelBZOutputStream::writeBits(uint32_t aValue, int aBits) noexcept {
+	bitBuffer = (bitBuffer << aBits) | aValue;
+	bitCount += aBits;
+
+	while (bitCount >= 8) {
+		bitCount -= 8;
+		output.push_back(static_cast<uint8_t>(bitBuffer >> bitCount));
+	}
+}
+
+void ParallelBZOutputStream::writeOutput(bool aAll) {
+	auto len = aAll ? output.size() : output.size() - output.size() % OUTPUT_CHUNK_SIZE;
+	if (len > 0) {
+		s->write(&output[0], len);
+		output.erase(output.begin(), output.begin() + len);
+	}
+}
+
+size_t ParallelBZOutputStream::flushBuffers(bool aForce) {
+	if (!finished) {
+		if (!input.empty()) {
+			queueBlock();
+		}
+
+		writeBlocks(true);
+
+		writeBits(END_MAGIC_HI, 24);
+		writeBits(END_MAGIC_LO, 24);
+		writeBits(streamCrc, 32);
+		if (bitCount > 0) {
+			writeBits(0, 8 - bitCount);
+		}
+
+		writeOutput(true);
+		finished = true;
+	}
+
+	return s->flushBuffers(aForce);
+}
+
+} // namespace dcpp
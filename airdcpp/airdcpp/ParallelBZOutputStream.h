@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_PARALLEL_BZ_OUTPUT_STREAM_H
+#define DCPLUSPLUS_DCPP_PARALLEL_BZ_OUTPUT_STREAM_H
+
+#include "typedefs.h"
+
+#include "Streams.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace dcpp {
+
+/**
+* Compresses the written data with bzip2 on multiple cores
+*
+* The input is split into blocks that are compressed independently. The compressed blocks are then
+* joined into a single bzip2 stream, so the result can be read with any bzip2 decoder (including
+* the ones that stop after the first stream). The amount of buffered data is limited by the number of threads.
+*/
+class ParallelBZOutputStream : public OutputStream {
+public:
+	using OutputStream::write;
+
+	// Maximum amount of input data in a single block
+	// The data must fit in one bzip2 block even if the initial run-length encoding expands it
+	static const size_t BLOCK_SIZE;
+
+	// aThreads: number of compression threads (0 = number of cores)
+	ParallelBZOutputStream(OutputStream* aStream, int aThreads = 0);
+	~ParallelBZOutputStream();
+
+	size_t write(const void* aBuf, size_t aLen) override;
+
+	// Compresses the remaining data and ends the bzip2 stream (nothing can be written after this)
+	size_t flushBuffers(bool aForce) override;
+
+	int64_t getInputSize() const noexcept { return inputSize; }
+private:
+	struct Block {
+		// Input data, replaced with the compressed bzip2 stream
+		ByteVector data;
+
+		// Position of the end-of-stream marker
+		size_t endBits = 0;
+		uint32_t crc = 0;
+
+		bool compressed = false;
+		bool failed = false;
+	};
+
+	static void compressBlock(Block& aBlock) noexcept;
+
+	OutputStream* s;
+
+	ByteVector input;
+	int64_t inputSize = 0;
+
+	// Blocks in the original order
+	std::deque<unique_ptr<Block>> blocks;
+
+	// Blocks waiting for compression
+	std::deque<Block*> queue;
+	size_t maxBlocks;
+
+	std::mutex cs;
+	std::condition_variable workerCond;
+	std::condition_variable writerCond;
+	vector<std::thread> threads;
+	bool stopping = false;
+
+	void runWorker() noexcept;
+
+	void queueBlock();
+
+	// Appends the compressed blocks to the output in the original order
+	// aAll: wait for all queued blocks (otherwise only when the queue is full)
+	void writeBlocks(bool aAll);
+	void appendBlock(const Block& aBlock);
+
+	// Combined stream CRC
+	uint32_t streamCrc = 0;
+	bool finished = false;
+
+	ByteVector output;
+	uint64_t bitBuffer = 0;
+	int bitCount = 0;
+
+	void writeBits(uint32_t aValue, int aBits) noexcept;
+	void writeOutput(bool aAll);
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_PARALLEL_BZ_OUTPUT_STREAM_H)
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "ParallelTreeHasher.h"
+
+#include "concurrency.h"
+
+#include <thread>
+
+namespace dcpp {
+
+const int64_t ParallelTreeHasher::MIN_PARALLEL_SIZE = 32 * 1024 * 1024;
+const int64_t ParallelTreeHasher::MAX_SUBTREE_SIZE = 1024 * 1024;
+
+ParallelTreeHasher::ParallelTreeHasher(TigerTree& aTree, int64_t aFileSize, int aThreads) noexcept : tree(aTree) {
+	auto threads = aThreads > 0 ? static_cast<size_t>(aThreads) : static_cast<size_t>(std::thread::hardware_concurrency());
+	if (threads <= 1 || aFileSize < MIN_PARALLEL_SIZE) {
+		return;
+	}
+
+	// Subtrees can't be larger than the leaves (the block size is always baseBlockSize multiplied by a power of two)
+	subtreeSize = min(tree.getBlockSize(), MAX_SUBTREE_SIZE);
+
+	// Give each thread a few subtrees per window so that the threads don't need to wait for each other that often
+	window.resize(static_cast<size_t>(subtreeSize) * threads * 4);
+}
+
+void ParallelTreeHasher::update(const void* aData, size_t aLen) {
+	if (window.empty()) {
+		tree.update(aData, aLen);
+		return;
+	}
+
+	auto p = static_cast<const uint8_t*>(aData);
+	while (aLen > 0) {
+		auto n = min(aLen, window.size() - windowPos);
+		memcpy(&window[windowPos], p, n);
+
+		windowPos += n;
+		p += n;
+		aLen -= n;
+
+		if (windowPos == window.size()) {
+			hashWindow();
+		}
+	}
+}
+
+void ParallelTreeHasher::hashWindow() {
+	auto subtrees = windowPos / static_cast<size_t>(subtreeSize);
+	if (subtrees == 0) {
+		return;
+	}
+
+	vector<size_t> indexes(subtrees);
+	for (size_t i = 0; i < subtrees; ++i) {
+		indexes[i] = i;
+	}
+
+	vector<TTHValue> roots(subtrees);
+	parallel_for_each(indexes.begin(), indexes.end(), [&](size_t i) {
+		TigerTree subtree(subtreeSize);
+		subtree.update(&window[i * subtreeSize], static_cast<size_t>(subtreeSize));
+		subtree.finalize();
+		roots[i] = subtree.getRoot();
+	});
+
+	for (const auto& root : roots) {
+		tree.addSubtree(root, subtreeSize);
+	}
+
+	// Move the remaining partial subtree to the beginning
+	auto hashed = subtrees * static_cast<size_t>(subtreeSize);
+	memmove(&window[0], &window[hashed], windowPos - hashed);
+	windowPos -= hashed;
+}
+
+void ParallelTreeHasher::finalize() {
+	if (!window.empty()) {
+		hashWindow();
+		if (windowPos > 0) {
+			tree.update(&window[0], windowPos);
+			windowPos = 0;
+		}
+	}
+
+	tree.finalize();
+}
+
+} // namespace dcpp
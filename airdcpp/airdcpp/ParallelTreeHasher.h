@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_PARALLEL_TREE_HASHER_H
+#define DCPLUSPLUS_DCPP_PARALLEL_TREE_HASHER_H
+
+#include "typedefs.h"
+
+#include "MerkleTree.h"
+
+#include <boost/noncopyable.hpp>
+
+namespace dcpp {
+
+/**
+* Calculates the Tiger tree of a large file by hashing independent subtrees of the data on multiple cores
+*
+* The data is collected in a window that is split into aligned subtrees, which are then added in the original order.
+* The resulting tree (root and leaves) is identical to the one produced by TigerTree::update.
+* Small files (or systems with a single core) are passed directly to the tree.
+*/
+class ParallelTreeHasher : boost::noncopyable {
+public:
+	// Files smaller than this are hashed sequentially
+	static const int64_t MIN_PARALLEL_SIZE;
+
+	// Maximum length of data in a single subtree
+	static const int64_t MAX_SUBTREE_SIZE;
+
+	// aThreads: maximum number of concurrently hashed subtrees (0 = number of cores)
+	ParallelTreeHasher(TigerTree& aTree, int64_t aFileSize, int aThreads = 0) noexcept;
+
+	// Same rules as with TigerTree::update
+	void update(const void* aData, size_t aLen);
+
+	// Hashes the remaining data and finalizes the tree
+	void finalize();
+
+	bool isParallel() const noexcept { return !window.empty(); }
+private:
+	TigerTree& tree;
+	int64_t subtreeSize = 0;
+
+	ByteVector window;
+	size_t windowPos = 0;
+
+	// Hash and add all full subtrees from the window
+	void hashWindow();
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_PARALLEL_TREE_HASHER_H)
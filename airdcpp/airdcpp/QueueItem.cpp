@@ -21,12 +21,10 @@
 
 #include "ActionHook.h"
 #include "Bundle.h"
-#include "ClientManager.h"
 #include "Download.h"
 #include "File.h"
 #include "HashManager.h"
 #include "Util.h"
-#include "SimpleXML.h"
 
 namespace dcpp {
 
@@ -175,17 +173,13 @@ bool QueueItem::isBadSourceExcept(const UserPtr& aUser, Flags::MaskType exceptio
 bool QueueItem::isChunkDownloaded(int64_t startPos, int64_t& len) const noexcept {
 	if(len <= 0) return false;
 
-	for(auto& i: done) {
-		int64_t first  = i.getStart();
-		int64_t second = i.getEnd();
-
-		if(first <= startPos && startPos < second){
-			len = min(len, second - startPos);
-			return true;
-		}
+	auto i = done.find(startPos);
+	if(i == done.end()) {
+		return false;
 	}
 
-	return false;
+	len = min(len, i->getEnd() - startPos);
+	return true;
 }
 
 string QueueItem::getStatusString(int64_t aDownloadedBytes, bool aIsWaiting) const noexcept {
@@ -412,15 +406,19 @@ Segment QueueItem::getNextSegment(int64_t aBlockSize, int64_t aWantedSize, int64
 	}
 
 	/* added for PFS */
-	vector<int64_t> posArray;
+	SegmentSet partialParts;
 	vector<Segment> neededParts;
 
 	if(aPartialSource) {
-		posArray.reserve(aPartialSource->getPartialInfo().size());
-
-		// Convert block index to file position
-		for(auto index: aPartialSource->getPartialInfo())
-			posArray.push_back(min(size, (int64_t)(index) * aBlockSize));
+		// Convert block indexes to file positions
+		const auto& partialInfo = aPartialSource->getPartialInfo();
+		for(size_t j = 0; j + 1 < partialInfo.size(); j += 2) {
+			auto start = min(size, static_cast<int64_t>(partialInfo[j]) * aBlockSize);
+			auto end = min(size, static_cast<int64_t>(partialInfo[j + 1]) * aBlockSize);
+			if(start < end) {
+				partialParts.add(Segment(start, end - start));
+			}
+		}
 	}
 
 	/***************************/
@@ -437,70 +435,89 @@ Segment QueueItem::getNextSegment(int64_t aBlockSize, int64_t aWantedSize, int64
 		targetSize = aBlockSize;
 	}		
 
+	SegmentSet running;
+	for(auto d: downloads) {
+		running.add(d->getSegment());
+	}
+
+	Segment block;
+	if(findFreeBlock(done, running, aPartialSource ? &partialParts : nullptr, size, aBlockSize, targetSize, block, neededParts)) {
+		//dcassert(find_if(downloads.begin(), downloads.end(), [&block](const Download* d) { return block.getEnd() == d->getSegment().getEnd(); }) == downloads.end());
+		return block;
+	}
+
+	if(!neededParts.empty()) {
+		// select random chunk for download
+		dcdebug("Found chunks: " SIZET_FMT "\n", neededParts.size());
+		
+		Segment& selected = neededParts[Util::rand(0, neededParts.size())];
+		selected.setSize(std::min(selected.getSize(), targetSize));	// request only wanted size
+		
+		return selected;
+	}
+
+	return checkOverlaps(aBlockSize, aLastSpeed, aPartialSource, aAllowOverlap);
+}
+
+bool QueueItem::findFreeBlock(const SegmentSet& aDone, const SegmentSet& aRunning, const SegmentSet* aPartialParts, int64_t aFileSize, int64_t aBlockSize, int64_t aTargetSize, Segment& block_, vector<Segment>& neededParts_) noexcept {
+	dcassert(aTargetSize % aBlockSize == 0);
+
 	int64_t start = 0;
-	int64_t curSize = targetSize;
+	int64_t curSize = aTargetSize;
+
+	while(start < aFileSize) {
+		if(curSize == aTargetSize) {
+			// Skip the blocks inside done and running segments directly (all block sizes would overlap in here)
+			auto d = aDone.find(start);
+			if(d != aDone.end() && min(aFileSize, start + aBlockSize) <= d->getEnd()) {
+				start = aFileSize <= d->getEnd() ? aFileSize : start + (d->getEnd() - start) / aBlockSize * aBlockSize;
+				continue;
+			}
 
-	while(start < size) {
-		int64_t end = std::min(size, start + curSize);
-		Segment block(start, end - start);
-		bool overlaps = false;
-		for(auto i = done.begin(); !overlaps && i != done.end(); ++i) {
-			if(curSize <= aBlockSize) {
-				int64_t dstart = i->getStart();
-				int64_t dend = i->getEnd();
-				// We accept partial overlaps, only consider the block done if it is fully consumed by the done block
-				if(dstart <= start && dend >= end) {
-					overlaps = true;
-				}
-			} else {
-				overlaps = block.overlaps(*i);
+			auto r = aRunning.find(start);
+			if(r != aRunning.end()) {
+				start = min(aFileSize, start + Util::roundUp(r->getEnd() - start, aBlockSize));
+				continue;
 			}
 		}
-		
-		for(auto i = downloads.begin(); !overlaps && i != downloads.end(); ++i) {
-			overlaps = block.overlaps((*i)->getSegment());
+
+		int64_t end = std::min(aFileSize, start + curSize);
+		Segment block(start, end - start);
+
+		// We accept partial overlaps, only consider the block done if it is fully consumed by the done block
+		bool overlaps = curSize <= aBlockSize ? aDone.contains(block) : aDone.overlaps(block);
+		if(!overlaps) {
+			overlaps = aRunning.overlaps(block);
 		}
-		
+
 		if(!overlaps) {
-			if(aPartialSource) {
+			if(aPartialParts) {
 				// store all chunks we could need
-				for(auto j = posArray.begin(); j < posArray.end(); j += 2){
-					if( (*j <= start && start < *(j+1)) || (start <= *j && *j < end) ) {
-						int64_t b = max(start, *j);
-						int64_t e = min(end, *(j+1));
+				for(auto i = aPartialParts->firstEndingAfter(start); i != aPartialParts->end() && i->getStart() < end; ++i) {
+					int64_t b = max(start, i->getStart());
+					int64_t e = min(end, i->getEnd());
 
-						// segment must be blockSize aligned
-						dcassert(b % aBlockSize == 0);
-						dcassert(e % aBlockSize == 0 || e == size);
+					// segment must be blockSize aligned
+					dcassert(b % aBlockSize == 0);
+					dcassert(e % aBlockSize == 0 || e == aFileSize);
 
-						neededParts.emplace_back(b, e - b);
-					}
+					neededParts_.emplace_back(b, e - b);
 				}
 			} else {
-				//dcassert(find_if(downloads.begin(), downloads.end(), [&block](const Download* d) { return block.getEnd() == d->getSegment().getEnd(); }) == downloads.end());
-				return block;
+				block_ = block;
+				return true;
 			}
 		}
-		
+
 		if(overlaps && (curSize > aBlockSize)) {
 			curSize -= aBlockSize;
 		} else {
 			start = end;
-			curSize = targetSize;
+			curSize = aTargetSize;
 		}
 	}
 
-	if(!neededParts.empty()) {
-		// select random chunk for download
-		dcdebug("Found chunks: " SIZET_FMT "\n", neededParts.size());
-		
-		Segment& selected = neededParts[Util::rand(0, neededParts.size())];
-		selected.setSize(std::min(selected.getSize(), targetSize));	// request only wanted size
-		
-		return selected;
-	}
-
-	return checkOverlaps(aBlockSize, aLastSpeed, aPartialSource, aAllowOverlap);
+	return false;
 }
 
 Segment QueueItem::checkOverlaps(int64_t aBlockSize, int64_t aLastSpeed, const PartialSource::Ptr& aPartialSource, bool aAllowOverlap) const noexcept {
@@ -535,21 +552,12 @@ Segment QueueItem::checkOverlaps(int64_t aBlockSize, int64_t aLastSpeed, const P
 }
 
 uint64_t QueueItem::getDownloadedSegments() const noexcept {
-	uint64_t total = 0;
-	// count done segments
-	for(auto& i: done) {
-		total += i.getSize();
-	}
-	return total;
+	return done.getBytes();
 }
 
 uint64_t QueueItem::getDownloadedBytes() const noexcept {
-	uint64_t total = 0;
-
 	// count done segments
-	for(auto& i: done) {
-		total += i.getSize();
-	}
+	uint64_t total = done.getBytes();
 
 	// count running segments
 	for(auto d: downloads) {
@@ -566,36 +574,12 @@ void QueueItem::addFinishedSegment(const Segment& segment) noexcept {
 #endif
 
 	dcassert(segment.getOverlapped() == false);
-	done.insert(segment);
-
-	// Consolidate segments
-
-	bool added = false;
-	if(done.size() != 1) {
-		for(auto i = ++done.begin() ; i != done.end(); ) {
-			auto prev = i;
-			prev--;
-			if(prev->getEnd() >= i->getStart()) {
-				Segment big(prev->getStart(), i->getEnd() - prev->getStart());
-				auto newBytes = big.getSize() - (*prev == segment ? i->getSize() : prev->getSize()); //minus the part that has been counted before...
-
-				done.erase(prev);
-				done.erase(i++);
-				done.insert(big);
-				if (bundle && !added) {
-					dcdebug("added " I64_FMT " for the bundle (segments merged)\n", newBytes);
-					bundle->addFinishedSegment(newBytes);
-				}
-				added = true;
-			} else {
-				++i;
-			}
-		}
-	}
 
-	if (!added && bundle) {
-		dcdebug("added " I64_FMT " for the bundle (no merging)\n", segment.getSize());
-		bundle->addFinishedSegment(segment.getSize());
+	// Merges the segment with the overlapping and adjacent segments
+	auto newBytes = done.add(segment);
+	if (bundle) {
+		dcdebug("added " I64_FMT " for the bundle\n", newBytes);
+		bundle->addFinishedSegment(newBytes);
 	}
 }
 
@@ -757,86 +741,6 @@ void QueueItem::removeDownloads(const UserPtr& aUser) noexcept {
 }
 
 
-void QueueItem::save(OutputStream &f, string tmp, string b32tmp) {
-	string indent = "\t";
-
-	if (segmentsDone()) {
-		f.write(LIT("\t<Finished"));
-	} else {
-		f.write(LIT("\t<Download"));
-	}
-
-	f.write(indent);
-	f.write(LIT(" Target=\""));
-	f.write(SimpleXML::escape(target, tmp, true));
-	f.write(LIT("\" Size=\""));
-	f.write(Util::toString(size));
-	f.write(LIT("\" Added=\""));
-	f.write(Util::toString(timeAdded));
-
-	b32tmp.clear();
-	f.write(LIT("\" TTH=\""));
-	f.write(tthRoot.toBase32(b32tmp));
-
-	if (segmentsDone()) {
-		f.write(LIT("\" TimeFinished=\""));
-		f.write(Util::toString(timeFinished));
-		f.write(LIT("\" LastSource=\""));
-		f.write(lastSource);
-		f.write(LIT("\"/>\r\n"));
-		return;
-	}
-
-	f.write(LIT("\" Priority=\""));
-	f.write(Util::toString((int) getPriority()));
-
-	if(!done.empty()) {
-		f.write(LIT("\" TempTarget=\""));
-		f.write(SimpleXML::escape(tempTarget, tmp, true));
-	}
-	f.write(LIT("\" AutoPriority=\""));
-	f.write(Util::toString(getAutoPriority()));
-	f.write(LIT("\" MaxSegments=\""));
-	f.write(Util::toString(maxSegments));
-
-	f.write(LIT("\">\r\n"));
-
-	for(const auto& s: done) {
-		f.write(indent);
-		f.write(LIT("\t<Segment Start=\""));
-		f.write(Util::toString(s.getStart()));
-		f.write(LIT("\" Size=\""));
-		f.write(Util::toString(s.getSize()));
-		f.write(LIT("\"/>\r\n"));
-	}
-
-	for(const auto& j: sources) {
-		if(j.isSet(QueueItem::Source::FLAG_PARTIAL)) continue;
-					
-		const CID& cid = j.getUser().user->getCID();
-		const string& hint = j.getUser().hint;
-
-		f.write(indent);
-		f.write(LIT("\t<Source CID=\""));
-		f.write(cid.toBase32());
-		f.write(LIT("\" Nick=\""));
-		f.write(SimpleXML::escape(ClientManager::getInstance()->getNick(j.getUser(), hint), tmp, true));
-		if(!hint.empty()) {
-			f.write(LIT("\" HubHint=\""));
-			f.write(hint);
-		}
-
-		/*if (SettingsManager::lanMode) {
-			f.write(LIT("\" RemotePath=\""));
-			f.write(j.getRemotePath());
-		}*/
-		f.write(LIT("\"/>\r\n"));
-	}
-
-	f.write(indent);
-	f.write(LIT("</Download>\r\n"));
-}
-
 bool QueueItem::Source::updateHubUrl(const OrderedStringSet& aOnlineHubs, string& hubUrl_, bool aIsFileList) noexcept {
 	if (aIsFileList) {
 		//we already know that the hub is online
@@ -25,6 +25,7 @@
 #include "HintedUser.h"
 #include "MerkleTree.h"
 #include "Segment.h"
+#include "SegmentSet.h"
 #include "Util.h"
 
 namespace dcpp {
@@ -156,7 +157,6 @@ public:
 
 	typedef SourceList::const_iterator SourceConstIter;
 
-	typedef set<Segment> SegmentSet;
 	typedef SegmentSet::const_iterator SegmentConstIter;
 	
 	QueueItem(const string& aTarget, int64_t aSize, Priority aPriority, Flags::MaskType aFlag, time_t aAdded, const TTHValue& tth, const string& aTempTarget);
@@ -168,7 +168,6 @@ public:
 	// Select a random item from the list to search for alternates
 	static QueueItemPtr pickSearchItem(const QueueItemList& aItems) noexcept;
 
-	void save(OutputStream &save, string tmp, string b32tmp);
 	int countOnlineUsers() const noexcept;
 	void getOnlineUsers(HintedUserList& l) const noexcept;
 	bool hasSegment(const UserPtr& aUser, const OrderedStringSet& onlineHubs, string& lastError, int64_t wantedSize, int64_t lastSpeed, DownloadType aType, bool allowOverlap) noexcept;
@@ -220,7 +219,11 @@ public:
 	/** Next segment that is not done and not being downloaded, zero-sized segment returned if there is none is found */
 	Segment getNextSegment(int64_t blockSize, int64_t wantedSize, int64_t aLastSpeed, const PartialSource::Ptr& aPartialSource, bool allowOverlap) const noexcept;
 	Segment checkOverlaps(int64_t blockSize, int64_t aLastSpeed, const PartialSource::Ptr& aPartialSource, bool allowOverlap) const noexcept;
-	
+
+	// Block selection of getNextSegment for multiple segments (aTargetSize must be a multiple of the block size)
+	// Returns the first free block without a partial source, otherwise the free blocks included in the partial parts are added in neededParts_
+	static bool findFreeBlock(const SegmentSet& aDone, const SegmentSet& aRunning, const SegmentSet* aPartialParts, int64_t aFileSize, int64_t aBlockSize, int64_t aTargetSize, Segment& block_, vector<Segment>& neededParts_) noexcept;
+
 	void addFinishedSegment(const Segment& segment) noexcept;
 	void resetDownloaded() noexcept;
 	
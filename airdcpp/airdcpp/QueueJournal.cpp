@@ -0,0 +1,689 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "QueueJournal.h"
+
+#include "File.h"
+#include "ZUtils.h"
+
+namespace dcpp {
+
+#define SNAPSHOT_MAGIC "AQSN"
+#define JOURNAL_MAGIC "AQJL"
+#define MAGIC_SIZE 4
+#define HEADER_SIZE (MAGIC_SIZE + 4 + 8)
+
+#define RECORD_BUNDLE 'B'
+#define RECORD_BUNDLE_UPDATE 'U'
+#define RECORD_BUNDLE_REMOVE 'b'
+#define RECORD_FILE 'F'
+#define RECORD_FILE_REMOVE 'f'
+#define RECORD_FILE_PRIORITY 'P'
+#define RECORD_SOURCE 'S'
+#define RECORD_SOURCE_REMOVE 's'
+#define RECORD_SEGMENT 'G'
+
+// Type and payload length
+#define RECORD_HEADER_SIZE 5
+#define RECORD_CHECKSUM_SIZE 4
+
+#define BUNDLE_FLAG_FILE_BUNDLE 0x01
+#define BUNDLE_FLAG_AUTO_PRIORITY 0x02
+#define BUNDLE_FLAG_AUTO_SEARCH 0x04
+
+#define FILE_FLAG_AUTO_PRIORITY 0x01
+
+#define BUFFER_SIZE (256 * 1024)
+
+// Small queues don't need to be compacted as often
+#define MIN_COMPACTION_SIZE (4 * 1024 * 1024)
+
+const uint32_t QueueJournal::VERSION = 1;
+
+static uint32_t updateCrc(uint32_t aCrc, const uint8_t* aData, size_t aLen) noexcept {
+	if (aLen == 0) {
+		return aCrc;
+	}
+
+	return static_cast<uint32_t>(crc32(aCrc, aData, static_cast<uInt>(aLen)));
+}
+
+static void writeInt(ByteVector& buf_, uint64_t aValue, int aBytes) noexcept {
+	for (int i = 0; i < aBytes; ++i) {
+		buf_.push_back(static_cast<uint8_t>(aValue >> (i * 8)));
+	}
+}
+
+static void writeBytes(ByteVector& buf_, const void* aData, size_t aLen) noexcept {
+	auto p = static_cast<const uint8_t*>(aData);
+	buf_.insert(buf_.end(), p, p + aLen);
+}
+
+static void writeString(ByteVector& buf_, const string& aStr) noexcept {
+	writeInt(buf_, aStr.size(), 4);
+	writeBytes(buf_, aStr.data(), aStr.size());
+}
+
+static void writeHeader(ByteVector& buf_, const char* aMagic, uint64_t aGeneration) noexcept {
+	writeBytes(buf_, aMagic, MAGIC_SIZE);
+	writeInt(buf_, QueueJournal::VERSION, 4);
+	writeInt(buf_, aGeneration, 8);
+}
+
+// The payload is added by the callback
+template<class F>
+static void writeRecord(ByteVector& buf_, uint8_t aType, F&& aWritePayload) noexcept {
+	auto start = buf_.size();
+	buf_.push_back(aType);
+	writeInt(buf_, 0, 4);
+
+	aWritePayload();
+
+	auto len = buf_.size() - start - RECORD_HEADER_SIZE;
+	for (int i = 0; i < 4; ++i) {
+		buf_[start + 1 + i] = static_cast<uint8_t>(len >> (i * 8));
+	}
+
+	writeInt(buf_, updateCrc(0, &buf_[start], buf_.size() - start), 4);
+}
+
+static void writeSource(ByteVector& buf_, const QueueJournal::SourceInfo& aSource) noexcept {
+	writeBytes(buf_, aSource.cid.data(), CID::SIZE);
+	writeString(buf_, aSource.nick);
+	writeString(buf_, aSource.hubHint);
+}
+
+static void writeFile(ByteVector& buf_, const QueueJournal::FileInfo& aFile) noexcept {
+	writeInt(buf_, aFile.size, 8);
+	writeInt(buf_, aFile.added, 8);
+	writeInt(buf_, aFile.timeFinished, 8);
+	writeBytes(buf_, aFile.tth.data, TTHValue::BYTES);
+	writeInt(buf_, static_cast<uint8_t>(aFile.priority), 1);
+	writeInt(buf_, aFile.autoPriority ? FILE_FLAG_AUTO_PRIORITY : 0, 1);
+	writeInt(buf_, aFile.maxSegments, 1);
+	writeString(buf_, aFile.tempTarget);
+	writeString(buf_, aFile.lastSource);
+
+	writeInt(buf_, aFile.done.size(), 4);
+	for (const auto& s: aFile.done) {
+		writeInt(buf_, s.getStart(), 8);
+		writeInt(buf_, s.getSize(), 8);
+	}
+
+	writeInt(buf_, aFile.sources.size(), 4);
+	for (const auto& s: aFile.sources) {
+		writeSource(buf_, s);
+	}
+}
+
+static void writeBundleHeader(ByteVector& buf_, const QueueJournal::BundleInfo& aBundle) noexcept {
+	uint8_t flags = 0;
+	if (aBundle.fileBundle)
+		flags |= BUNDLE_FLAG_FILE_BUNDLE;
+	if (aBundle.autoPriority)
+		flags |= BUNDLE_FLAG_AUTO_PRIORITY;
+	if (aBundle.addedByAutoSearch)
+		flags |= BUNDLE_FLAG_AUTO_SEARCH;
+
+	writeInt(buf_, aBundle.token, 4);
+	writeInt(buf_, flags, 1);
+	writeString(buf_, aBundle.target);
+	writeInt(buf_, aBundle.added, 8);
+	writeInt(buf_, aBundle.date, 8);
+	writeInt(buf_, aBundle.timeFinished, 8);
+	writeInt(buf_, aBundle.resumeTime, 8);
+	writeInt(buf_, static_cast<uint8_t>(aBundle.priority), 1);
+}
+
+static void writeBundle(ByteVector& buf_, const QueueJournal::BundleInfo& aBundle) noexcept {
+	writeBundleHeader(buf_, aBundle);
+
+	writeInt(buf_, aBundle.files.size(), 4);
+	for (const auto& f: aBundle.files) {
+		writeString(buf_, f.first);
+		writeFile(buf_, f.second);
+	}
+}
+
+
+// Reads the payload of a single record
+class PayloadReader {
+public:
+	PayloadReader(const uint8_t* aData, size_t aLen) noexcept : data(aData), len(aLen) { }
+
+	uint64_t readInt(int aBytes) {
+		ensure(aBytes);
+
+		uint64_t ret = 0;
+		for (int i = 0; i < aBytes; ++i) {
+			ret |= static_cast<uint64_t>(data[pos + i]) << (i * 8);
+		}
+
+		pos += aBytes;
+		return ret;
+	}
+
+	void readBytes(void* aBuf, size_t aLen) {
+		ensure(aLen);
+		memcpy(aBuf, data + pos, aLen);
+		pos += aLen;
+	}
+
+	void readString(string& str_) {
+		auto strLen = static_cast<size_t>(readInt(4));
+		ensure(strLen);
+		str_.assign(reinterpret_cast<const char*>(data + pos), strLen);
+		pos += strLen;
+	}
+
+	string readString() {
+		string ret;
+		readString(ret);
+		return ret;
+	}
+
+	CID readCID() {
+		uint8_t cid[CID::SIZE];
+		readBytes(cid, CID::SIZE);
+		return CID(cid);
+	}
+
+	Priority readPriority() {
+		auto prio = static_cast<int8_t>(readInt(1));
+		if (prio < static_cast<int8_t>(Priority::DEFAULT) || prio >= static_cast<int8_t>(Priority::LAST)) {
+			throw QueueJournalException("Invalid priority");
+		}
+
+		return static_cast<Priority>(prio);
+	}
+
+	// Whether the whole payload was read
+	bool isEnd() const noexcept { return pos == len; }
+private:
+	const uint8_t* data;
+	const size_t len;
+	size_t pos = 0;
+
+	void ensure(size_t aLen) {
+		if (len - pos < aLen) {
+			throw QueueJournalException("Unexpected end of record");
+		}
+	}
+};
+
+static void readSource(PayloadReader& aReader, QueueJournal::SourceInfo& source_) {
+	source_.cid = aReader.readCID();
+	aReader.readString(source_.nick);
+	aReader.readString(source_.hubHint);
+}
+
+static void readFile(PayloadReader& aReader, QueueJournal::FileInfo& file_) {
+	file_.size = static_cast<int64_t>(aReader.readInt(8));
+	file_.added = static_cast<time_t>(aReader.readInt(8));
+	file_.timeFinished = static_cast<time_t>(aReader.readInt(8));
+	aReader.readBytes(file_.tth.data, TTHValue::BYTES);
+	file_.priority = aReader.readPriority();
+	file_.autoPriority = (aReader.readInt(1) & FILE_FLAG_AUTO_PRIORITY) > 0;
+	file_.maxSegments = static_cast<uint8_t>(aReader.readInt(1));
+	aReader.readString(file_.tempTarget);
+	aReader.readString(file_.lastSource);
+
+	auto segments = aReader.readInt(4);
+	for (uint64_t i = 0; i < segments; ++i) {
+		auto start = static_cast<int64_t>(aReader.readInt(8));
+		auto size = static_cast<int64_t>(aReader.readInt(8));
+		if (start < 0 || size <= 0 || start + size > file_.size) {
+			throw QueueJournalException("Invalid segment");
+		}
+
+		file_.done.add(Segment(start, size));
+	}
+
+	auto sources = aReader.readInt(4);
+	for (uint64_t i = 0; i < sources; ++i) {
+		QueueJournal::SourceInfo source;
+		readSource(aReader, source);
+		file_.sources.push_back(move(source));
+	}
+}
+
+static void readBundleHeader(PayloadReader& aReader, QueueJournal::BundleInfo& bundle_) {
+	bundle_.token = static_cast<QueueToken>(aReader.readInt(4));
+
+	auto flags = aReader.readInt(1);
+	bundle_.fileBundle = (flags & BUNDLE_FLAG_FILE_BUNDLE) > 0;
+	bundle_.autoPriority = (flags & BUNDLE_FLAG_AUTO_PRIORITY) > 0;
+	bundle_.addedByAutoSearch = (flags & BUNDLE_FLAG_AUTO_SEARCH) > 0;
+
+	aReader.readString(bundle_.target);
+	bundle_.added = static_cast<time_t>(aReader.readInt(8));
+	bundle_.date = static_cast<time_t>(aReader.readInt(8));
+	bundle_.timeFinished = static_cast<time_t>(aReader.readInt(8));
+	bundle_.resumeTime = static_cast<time_t>(aReader.readInt(8));
+	bundle_.priority = aReader.readPriority();
+}
+
+static QueueJournal::FileInfo* findFile(QueueJournal::BundleInfoMap& aBundles, QueueToken aToken, const string& aTarget) noexcept {
+	auto b = aBundles.find(aToken);
+	if (b == aBundles.end()) {
+		return nullptr;
+	}
+
+	auto f = b->second.files.find(aTarget);
+	return f != b->second.files.end() ? &f->second : nullptr;
+}
+
+// Changes for bundles and files that don't exist are ignored
+// Everything is read before applying the changes
+static void applyRecord(uint8_t aType, PayloadReader& aReader, QueueJournal::BundleInfoMap& bundles_) {
+	switch (aType) {
+		case RECORD_BUNDLE: {
+			QueueJournal::BundleInfo bundle;
+			readBundleHeader(aReader, bundle);
+
+			auto files = aReader.readInt(4);
+			for (uint64_t i = 0; i < files; ++i) {
+				auto target = aReader.readString();
+
+				QueueJournal::FileInfo file;
+				readFile(aReader, file);
+				bundle.files[target] = move(file);
+			}
+
+			auto token = bundle.token;
+			bundles_[token] = move(bundle);
+			break;
+		}
+		case RECORD_BUNDLE_UPDATE: {
+			QueueJournal::BundleInfo header;
+			readBundleHeader(aReader, header);
+
+			auto b = bundles_.find(header.token);
+			if (b != bundles_.end()) {
+				header.files = move(b->second.files);
+				b->second = move(header);
+			}
+			break;
+		}
+		case RECORD_BUNDLE_REMOVE: {
+			auto token = static_cast<QueueToken>(aReader.readInt(4));
+			bundles_.erase(token);
+			break;
+		}
+		case RECORD_FILE: {
+			auto token = static_cast<QueueToken>(aReader.readInt(4));
+			auto target = aReader.readString();
+
+			QueueJournal::FileInfo file;
+			readFile(aReader, file);
+
+			auto b = bundles_.find(token);
+			if (b != bundles_.end()) {
+				b->second.files[target] = move(file);
+			}
+			break;
+		}
+		case RECORD_FILE_REMOVE: {
+			auto token = static_cast<QueueToken>(aReader.readInt(4));
+			auto target = aReader.readString();
+
+			auto b = bundles_.find(token);
+			if (b != bundles_.end()) {
+				b->second.files.erase(target);
+			}
+			break;
+		}
+		case RECORD_FILE_PRIORITY: {
+			auto token = static_cast<QueueToken>(aReader.readInt(4));
+			auto target = aReader.readString();
+			auto priority = aReader.readPriority();
+			auto autoPriority = (aReader.readInt(1) & FILE_FLAG_AUTO_PRIORITY) > 0;
+
+			auto f = findFile(bundles_, token, target);
+			if (f) {
+				f->priority = priority;
+				f->autoPriority = autoPriority;
+			}
+			break;
+		}
+		case RECORD_SOURCE: {
+			auto token = static_cast<QueueToken>(aReader.readInt(4));
+			auto target = aReader.readString();
+
+			QueueJournal::SourceInfo source;
+			readSource(aReader, source);
+
+			auto f = findFile(bundles_, token, target);
+			if (f) {
+				auto s = find_if(f->sources.begin(), f->sources.end(), [&](const QueueJournal::SourceInfo& aSource) { return aSource.cid == source.cid; });
+				if (s != f->sources.end()) {
+					*s = move(source);
+				} else {
+					f->sources.push_back(move(source));
+				}
+			}
+			break;
+		}
+		case RECORD_SOURCE_REMOVE: {
+			auto token = static_cast<QueueToken>(aReader.readInt(4));
+			auto target = aReader.readString();
+			auto cid = aReader.readCID();
+
+			auto f = findFile(bundles_, token, target);
+			if (f) {
+				f->sources.erase(remove_if(f->sources.begin(), f->sources.end(), [&](const QueueJournal::SourceInfo& aSource) { return aSource.cid == cid; }), f->sources.end());
+			}
+			break;
+		}
+		case RECORD_SEGMENT: {
+			auto token = static_cast<QueueToken>(aReader.readInt(4));
+			auto target = aReader.readString();
+			auto start = static_cast<int64_t>(aReader.readInt(8));
+			auto size = static_cast<int64_t>(aReader.readInt(8));
+
+			auto f = findFile(bundles_, token, target);
+			if (f && start >= 0 && size > 0 && start + size <= f->size) {
+				f->done.add(Segment(start, size));
+			}
+			break;
+		}
+		default: throw QueueJournalException("Invalid record type");
+	}
+
+	if (!aReader.isEnd()) {
+		throw QueueJournalException("Invalid record length");
+	}
+}
+
+// Returns false if the header is incomplete or it has a different magic or version
+static bool readHeader(const string& aData, const char* aMagic, uint64_t& generation_) noexcept {
+	if (aData.size() < HEADER_SIZE || memcmp(aData.data(), aMagic, MAGIC_SIZE) != 0) {
+		return false;
+	}
+
+	PayloadReader reader(reinterpret_cast<const uint8_t*>(aData.data()) + MAGIC_SIZE, HEADER_SIZE - MAGIC_SIZE);
+	if (reader.readInt(4) != QueueJournal::VERSION) {
+		return false;
+	}
+
+	generation_ = reader.readInt(8);
+	return true;
+}
+
+// Applies the records until the end of the data or the first invalid record
+// Returns the end position of the last valid record
+static size_t applyRecords(const string& aData, size_t aPos, QueueJournal::BundleInfoMap& bundles_) noexcept {
+	auto data = reinterpret_cast<const uint8_t*>(aData.data());
+	while (aData.size() - aPos >= RECORD_HEADER_SIZE + RECORD_CHECKSUM_SIZE) {
+		auto p = data + aPos;
+
+		uint64_t len = 0;
+		for (int i = 0; i < 4; ++i) {
+			len |= static_cast<uint64_t>(p[1 + i]) << (i * 8);
+		}
+
+		if (len > aData.size() - aPos - RECORD_HEADER_SIZE - RECORD_CHECKSUM_SIZE) {
+			break;
+		}
+
+		uint32_t crc = 0;
+		for (int i = 0; i < 4; ++i) {
+			crc |= static_cast<uint32_t>(p[RECORD_HEADER_SIZE + len + i]) << (i * 8);
+		}
+
+		if (crc != updateCrc(0, p, RECORD_HEADER_SIZE + static_cast<size_t>(len))) {
+			break;
+		}
+
+		try {
+			PayloadReader reader(p + RECORD_HEADER_SIZE, static_cast<size_t>(len));
+			applyRecord(p[0], reader, bundles_);
+		} catch (const QueueJournalException&) {
+			break;
+		}
+
+		aPos += RECORD_HEADER_SIZE + static_cast<size_t>(len) + RECORD_CHECKSUM_SIZE;
+	}
+
+	return aPos;
+}
+
+
+QueueJournal::QueueJournal(const string& aDirectory) noexcept : snapshotPath(aDirectory + "QueueSnapshot.bin"), journalPath(aDirectory + "QueueJournal.bin") {
+
+}
+
+QueueJournal::~QueueJournal() {
+
+}
+
+bool QueueJournal::exists() const noexcept {
+	return Util::fileExists(snapshotPath);
+}
+
+int64_t QueueJournal::load(BundleInfoMap& bundles_) {
+	Lock l(cs);
+	journal.reset();
+	journalSize = 0;
+
+	{
+		auto data = File(snapshotPath, File::READ, File::OPEN).read();
+		if (!readHeader(data, SNAPSHOT_MAGIC, generation)) {
+			throw QueueJournalException("Unsupported snapshot file");
+		}
+
+		auto end = applyRecords(data, HEADER_SIZE, bundles_);
+		if (end != data.size()) {
+			throw QueueJournalException("Snapshot file is corrupted");
+		}
+
+		snapshotSize = data.size();
+	}
+
+	if (!Util::fileExists(journalPath)) {
+		return 0;
+	}
+
+	auto data = File(journalPath, File::READ, File::OPEN).read();
+
+	uint64_t journalGeneration = 0;
+	if (!readHeader(data, JOURNAL_MAGIC, journalGeneration) || journalGeneration != generation) {
+		// Left over from an interrupted compaction (or the header wasn't written completely)
+		return 0;
+	}
+
+	auto end = applyRecords(data, HEADER_SIZE, bundles_);
+	journalSize = end;
+	return data.size() - end;
+}
+
+void QueueJournal::addBundle(const BundleInfo& aBundle) noexcept {
+	Lock l(cs);
+	writeRecord(pending, RECORD_BUNDLE, [&] {
+		writeBundle(pending, aBundle);
+	});
+}
+
+void QueueJournal::updateBundle(const BundleInfo& aBundle) noexcept {
+	Lock l(cs);
+	writeRecord(pending, RECORD_BUNDLE_UPDATE, [&] {
+		writeBundleHeader(pending, aBundle);
+	});
+}
+
+void QueueJournal::removeBundle(QueueToken aToken) noexcept {
+	Lock l(cs);
+	writeRecord(pending, RECORD_BUNDLE_REMOVE, [&] {
+		writeInt(pending, aToken, 4);
+	});
+}
+
+void QueueJournal::addFile(QueueToken aToken, const string& aTarget, const FileInfo& aFile) noexcept {
+	Lock l(cs);
+	writeRecord(pending, RECORD_FILE, [&] {
+		writeInt(pending, aToken, 4);
+		writeString(pending, aTarget);
+		writeFile(pending, aFile);
+	});
+}
+
+void QueueJournal::removeFile(QueueToken aToken, const string& aTarget) noexcept {
+	Lock l(cs);
+	writeRecord(pending, RECORD_FILE_REMOVE, [&] {
+		writeInt(pending, aToken, 4);
+		writeString(pending, aTarget);
+	});
+}
+
+void QueueJournal::setFilePriority(QueueToken aToken, const string& aTarget, Priority aPriority, bool aAutoPriority) noexcept {
+	Lock l(cs);
+	writeRecord(pending, RECORD_FILE_PRIORITY, [&] {
+		writeInt(pending, aToken, 4);
+		writeString(pending, aTarget);
+		writeInt(pending, static_cast<uint8_t>(aPriority), 1);
+		writeInt(pending, aAutoPriority ? FILE_FLAG_AUTO_PRIORITY : 0, 1);
+	});
+}
+
+void QueueJournal::addSource(QueueToken aToken, const string& aTarget, const SourceInfo& aSource) noexcept {
+	Lock l(cs);
+	writeRecord(pending, RECORD_SOURCE, [&] {
+		writeInt(pending, aToken, 4);
+		writeString(pending, aTarget);
+		writeSource(pending, aSource);
+	});
+}
+
+void QueueJournal::removeSource(QueueToken aToken, const string& aTarget, const CID& aCID) noexcept {
+	Lock l(cs);
+	writeRecord(pending, RECORD_SOURCE_REMOVE, [&] {
+		writeInt(pending, aToken, 4);
+		writeString(pending, aTarget);
+		writeBytes(pending, aCID.data(), CID::SIZE);
+	});
+}
+
+void QueueJournal::addSegment(QueueToken aToken, const string& aTarget, const Segment& aSegment) noexcept {
+	Lock l(cs);
+	writeRecord(pending, RECORD_SEGMENT, [&] {
+		writeInt(pending, aToken, 4);
+		writeString(pending, aTarget);
+		writeInt(pending, aSegment.getStart(), 8);
+		writeInt(pending, aSegment.getSize(), 8);
+	});
+}
+
+void QueueJournal::openJournal() {
+	if (journal) {
+		return;
+	}
+
+	if (journalSize == 0) {
+		auto f = make_unique<File>(journalPath, File::WRITE, File::CREATE | File::TRUNCATE);
+
+		ByteVector header;
+		writeHeader(header, JOURNAL_MAGIC, generation);
+		f->write(&header[0], header.size());
+
+		journal = move(f);
+		journalSize = header.size();
+	} else {
+		// Cut off the records that weren't written completely
+		auto f = make_unique<File>(journalPath, File::WRITE, File::OPEN);
+		f->setSize(journalSize);
+		f->setPos(journalSize);
+
+		journal = move(f);
+	}
+}
+
+void QueueJournal::flush() {
+	Lock l(cs);
+	if (pending.empty()) {
+		return;
+	}
+
+	try {
+		openJournal();
+		journal->write(&pending[0], pending.size());
+		journal->flushBuffers(true);
+	} catch (const FileException&) {
+		// Possible partial records are removed when the journal is opened again
+		journal.reset();
+		throw;
+	}
+
+	journalSize += pending.size();
+	pending.clear();
+}
+
+bool QueueJournal::needsCompaction() const noexcept {
+	Lock l(cs);
+	return journalSize > max(snapshotSize, static_cast<int64_t>(MIN_COMPACTION_SIZE));
+}
+
+void QueueJournal::compact(const BundleListF& aListBundles) {
+	Lock l(cs);
+
+	auto tmpPath = snapshotPath + ".tmp";
+	auto newGeneration = generation + 1;
+	int64_t newSnapshotSize = 0;
+
+	{
+		File f(tmpPath, File::WRITE, File::CREATE | File::TRUNCATE);
+
+		ByteVector buf;
+		buf.reserve(BUFFER_SIZE);
+		writeHeader(buf, SNAPSHOT_MAGIC, newGeneration);
+
+		auto writeBuffer = [&] {
+			if (!buf.empty()) {
+				f.write(&buf[0], buf.size());
+				newSnapshotSize += buf.size();
+				buf.clear();
+			}
+		};
+
+		aListBundles([&](const BundleInfo& aBundle) {
+			writeRecord(buf, RECORD_BUNDLE, [&] {
+				writeBundle(buf, aBundle);
+			});
+
+			if (buf.size() >= BUFFER_SIZE) {
+				writeBuffer();
+			}
+		});
+
+		writeBuffer();
+		f.flushBuffers(true);
+	}
+
+	File::renameFile(tmpPath, snapshotPath);
+
+	generation = newGeneration;
+	snapshotSize = newSnapshotSize;
+
+	// The old journal is ignored from now on and the pending changes are included in the snapshot
+	journal.reset();
+	journalSize = 0;
+	pending.clear();
+	openJournal();
+}
+
+} // namespace dcpp
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_QUEUE_JOURNAL_H
+#define DCPLUSPLUS_DCPP_QUEUE_JOURNAL_H
+
+#include "typedefs.h"
+
+#include "CID.h"
+#include "CriticalSection.h"
+#include "Exception.h"
+#include "MerkleTree.h"
+#include "QueueItemBase.h"
+#include "SegmentSet.h"
+
+#include <boost/noncopyable.hpp>
+
+namespace dcpp {
+
+/*
+* Binary queue storage (all integers are little-endian, strings are stored as uint32 length + UTF-8)
+*
+* The queue is stored in a snapshot file and an append-only journal that contains the changes made after the snapshot
+* was written. Both files start with a header: magic (4 bytes), version (uint32), generation (uint64)
+*
+* Records:		type (1 byte), payload length (uint32), payload, CRC32 of the previous fields (uint32)
+*
+* Bundle:			'B', bundle header, file count (uint32) followed by the files (target + file)
+* Bundle updated:	'U', bundle header (the files are kept)
+* Bundle removed:	'b', token (uint32)
+* File:				'F', token, target, file
+* File removed:		'f', token, target
+* File priority:	'P', token, target, priority (int8), auto priority (uint8)
+* Source added:		'S', token, target, source
+* Source removed:	's', token, target, CID (24 bytes)
+* Segment done:		'G', token, target, start (int64), size (int64)
+*
+* Bundle header:	token (uint32), flags (uint8), target, added, date, time finished, resume time (int64), priority (int8)
+* File:				size, added, time finished (int64), TTH (24 bytes), priority (int8), flags (uint8), max segments (uint8), temp target,
+*					last source, segment count (uint32) + start, size (int64), source count (uint32) + sources
+* Source:			CID (24 bytes), nick, hub hint
+*
+* The snapshot contains a bundle record for each bundle. When a new snapshot is written, it gets the next generation and
+* the journal is started again with the same generation. A journal with a different generation is a leftover from an interrupted
+* compaction and it's ignored. Loading stops at the first incomplete or corrupted journal record (interrupted write) and
+* the record is cut off when the journal is opened for writing.
+*
+* All records can be applied multiple times without changing the result.
+*/
+
+class QueueJournal : boost::noncopyable {
+public:
+	struct SourceInfo {
+		CID cid;
+		string nick;
+		string hubHint;
+	};
+
+	struct FileInfo {
+		int64_t size = 0;
+		time_t added = 0;
+		time_t timeFinished = 0;
+		TTHValue tth;
+		Priority priority = Priority::DEFAULT;
+		bool autoPriority = false;
+		uint8_t maxSegments = 1;
+		string tempTarget;
+		string lastSource;
+		SegmentSet done;
+		vector<SourceInfo> sources;
+
+		bool isFinished() const noexcept { return done.getBytes() == size; }
+	};
+
+	// Files by target path
+	typedef unordered_map<string, FileInfo> FileInfoMap;
+
+	struct BundleInfo {
+		QueueToken token = 0;
+		string target;
+		bool fileBundle = false;
+		time_t added = 0;
+		time_t date = 0;
+		time_t timeFinished = 0;
+		time_t resumeTime = 0;
+		Priority priority = Priority::DEFAULT;
+		bool autoPriority = false;
+		bool addedByAutoSearch = false;
+
+		FileInfoMap files;
+	};
+
+	typedef map<QueueToken, BundleInfo> BundleInfoMap;
+
+	typedef function<void(const BundleInfo&)> BundleInfoF;
+	typedef function<void(const BundleInfoF&)> BundleListF;
+
+	static const uint32_t VERSION;
+
+	QueueJournal(const string& aDirectory) noexcept;
+	~QueueJournal();
+
+	// Whether the queue has been stored in this format
+	bool exists() const noexcept;
+
+	// Reads the snapshot and applies the journal on top of it
+	// Returns the number of bytes that were discarded from the end of the journal
+	// Throws QueueJournalException if the snapshot is invalid (the bundles read before the error are returned) and FileException on read errors
+	int64_t load(BundleInfoMap& bundles_);
+
+	// The changes are kept in memory until the journal is flushed
+	void addBundle(const BundleInfo& aBundle) noexcept;
+	void updateBundle(const BundleInfo& aBundle) noexcept;
+	void removeBundle(QueueToken aToken) noexcept;
+
+	void addFile(QueueToken aToken, const string& aTarget, const FileInfo& aFile) noexcept;
+	void removeFile(QueueToken aToken, const string& aTarget) noexcept;
+	void setFilePriority(QueueToken aToken, const string& aTarget, Priority aPriority, bool aAutoPriority) noexcept;
+
+	void addSource(QueueToken aToken, const string& aTarget, const SourceInfo& aSource) noexcept;
+	void removeSource(QueueToken aToken, const string& aTarget, const CID& aCID) noexcept;
+
+	void addSegment(QueueToken aToken, const string& aTarget, const Segment& aSegment) noexcept;
+
+	// Appends the pending changes in the journal
+	// Throws FileException
+	void flush();
+
+	// The journal is compacted when it has grown larger than the snapshot
+	bool needsCompaction() const noexcept;
+
+	// Writes a new snapshot with the bundles passed by the callback and starts a new journal
+	// The listed bundles must include all changes that are pending (they are discarded)
+	// Throws FileException
+	void compact(const BundleListF& aListBundles);
+
+	const string& getSnapshotPath() const noexcept { return snapshotPath; }
+	const string& getJournalPath() const noexcept { return journalPath; }
+
+	int64_t getJournalSize() const noexcept { return journalSize; }
+	int64_t getSnapshotSize() const noexcept { return snapshotSize; }
+private:
+	const string snapshotPath;
+	const string journalPath;
+
+	mutable CriticalSection cs;
+
+	unique_ptr<File> journal;
+	ByteVector pending;
+
+	uint64_t generation = 0;
+
+	// Size of the valid content in the files
+	int64_t journalSize = 0;
+	int64_t snapshotSize = 0;
+
+	// Opens the journal for appending (or starts a new one)
+	void openJournal();
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_QUEUE_JOURNAL_H)
@@ -287,7 +287,7 @@ bool QueueManager::recheckFileImpl(const string& aPath, bool isBundleCheck, int6
 
 	TigerTree tt;
 	bool gotTree = HashManager::getInstance()->getTree(tth, tt);
-	QueueItem::SegmentSet done;
+	SegmentSet done;
 
 	{
 		RLock l(cs);
@@ -348,7 +348,7 @@ bool QueueManager::recheckFileImpl(const string& aPath, bool isBundleCheck, int6
 				q->addFinishedSegment(blockSegment);
 			} else {
 				// undownloaded segments aren't corrupted...
-				if (!blockSegment.inSet(done))
+				if (!done.contains(blockSegment))
 					return;
 
 				dcdebug("Integrity check failed for the block at pos " I64_FMT "\n", pos);
@@ -359,6 +359,7 @@ bool QueueManager::recheckFileImpl(const string& aPath, bool isBundleCheck, int6
 		});
 
 		segmentsDone = q->segmentsDone();
+		bundleQueue.journalFile(q);
 	}
 
 	if (failedBytes > 0) {
@@ -1129,9 +1130,7 @@ bool QueueManager::addSource(const QueueItemPtr& qi, const HintedUser& aUser, Fl
 	if ((!SETTING(SOURCEFILE).empty()) && (!SETTING(SOUNDS_DISABLED)))
 		PlaySound(Text::toT(SETTING(SOURCEFILE)).c_str(), NULL, SND_FILENAME | SND_ASYNC);
 #endif
-	if (qi->getBundle()) {
-		qi->getBundle()->setDirty();
-	}
+	bundleQueue.journalSourceAdded(qi, aUser);
 
 	return wantConnection;
 	
@@ -1177,6 +1176,7 @@ Download* QueueManager::getDownload(UserConnection& aSource, const QueueTokenSet
 			if (!Util::fileExists(q->getTempTarget())) {
 				// Temp target gone?
 				q->resetDownloaded();
+				bundleQueue.journalFile(q);
 			}
 		}
 
@@ -1682,7 +1682,9 @@ void QueueManager::onDownloadFailed(QueueItemPtr& aQI, Download* aDownload, bool
 			downloaded -= downloaded % aDownload->getTigerTree().getBlockSize();
 
 			if (downloaded > 0) {
-				aQI->addFinishedSegment(Segment(aDownload->getStartPos(), downloaded));
+				Segment segment(aDownload->getStartPos(), downloaded);
+				aQI->addFinishedSegment(segment);
+				bundleQueue.journalSegment(aQI, segment);
 			}
 
 			if (aRotateQueue && aQI->getBundle()) {
@@ -1768,6 +1770,7 @@ void QueueManager::onFileDownloadCompleted(QueueItemPtr& aQI, Download* aDownloa
 	{
 		WLock l(cs);
 		aQI->addFinishedSegment(aDownload->getSegment());
+		bundleQueue.journalSegment(aQI, aDownload->getSegment());
 		wholeFileCompleted = aQI->segmentsDone();
 
 		dcdebug("Finish segment for %s (" I64_FMT ", " I64_FMT ")\n", aDownload->getToken().c_str(), aDownload->getSegment().getStart(), aDownload->getSegment().getEnd());
@@ -1817,6 +1820,7 @@ void QueueManager::setSegments(const string& aTarget, uint8_t aSegments) noexcep
 	auto qi = fileQueue.findFile(aTarget);
 	if (qi) {
 		qi->setMaxSegments(aSegments);
+		bundleQueue.journalFile(qi);
 	}
 }
 
@@ -1931,12 +1935,12 @@ void QueueManager::removeFileSource(QueueItemPtr& q, const UserPtr& aUser, Flags
 
 		userQueue.removeQI(q, aUser, false, aReason);
 		q->removeSource(aUser, aReason);
+		bundleQueue.journalSourceRemoved(q, aUser);
 	}
 
 	fire(QueueManagerListener::ItemSources(), q);
 
 	if (q->getBundle()) {
-		q->getBundle()->setDirty();
 		fire(QueueManagerListener::BundleSources(), q->getBundle());
 	}
 endCheck:
@@ -1996,6 +2000,7 @@ void QueueManager::setBundlePriority(BundlePtr& aBundle, Priority p, bool aKeepA
 	if (oldPrio == p) {
 		if (aBundle->getResumeTime() != aResumeTime) {
 			aBundle->setResumeTime(aResumeTime);
+			bundleQueue.journalBundle(aBundle);
 			fire(QueueManagerListener::BundlePriority(), aBundle);
 		}
 		return;
@@ -2021,7 +2026,10 @@ void QueueManager::setBundlePriority(BundlePtr& aBundle, Priority p, bool aKeepA
 			qi = aBundle->getQueueItems().front();
 			userQueue.setQIPriority(qi, p);
 			qi->setAutoPriority(aBundle->getAutoPriority());
+			bundleQueue.journalFilePriority(qi);
 		}
+
+		bundleQueue.journalBundle(aBundle);
 	}
 
 	if (qi) {
@@ -2030,8 +2038,6 @@ void QueueManager::setBundlePriority(BundlePtr& aBundle, Priority p, bool aKeepA
 
 	fire(QueueManagerListener::BundlePriority(), aBundle);
 
-	aBundle->setDirty();
-
 	if (p == Priority::PAUSED_FORCE) {
 		DownloadManager::getInstance()->disconnectBundle(aBundle);
 	} else if (oldPrio <= Priority::LOWEST) {
@@ -2059,8 +2065,11 @@ void QueueManager::toggleBundleAutoPriority(BundlePtr& aBundle) noexcept {
 	if (aBundle->isFileBundle()) {
 		RLock l(cs);
 		aBundle->getQueueItems().front()->setAutoPriority(aBundle->getAutoPriority());
+		bundleQueue.journalFilePriority(aBundle->getQueueItems().front());
 	}
 
+	bundleQueue.journalBundle(aBundle);
+
 	if (aBundle->isPausedPrio()) {
 		// We don't want this one to stay paused if the auto priorities can't be counted
 		setBundlePriority(aBundle, Priority::LOW, true);
@@ -2071,8 +2080,6 @@ void QueueManager::toggleBundleAutoPriority(BundlePtr& aBundle) noexcept {
 
 	// Recount priorities as soon as possible
 	setLastAutoPrio(0);
-
-	aBundle->setDirty();
 }
 
 int QueueManager::removeCompletedBundles() noexcept {
@@ -2153,7 +2160,7 @@ void QueueManager::setQIPriority(QueueItemPtr& q, Priority p, bool aKeepAutoPrio
 
 	fire(QueueManagerListener::ItemPriority(), q);
 
-	b->setDirty();
+	bundleQueue.journalFilePriority(q);
 	if (p == Priority::PAUSED_FORCE && running) {
 		DownloadManager::getInstance()->abortDownload(q->getTarget());
 	} else if (!q->isPausedPrio()) {
@@ -2185,7 +2192,7 @@ void QueueManager::setQIAutoPriority(const string& aTarget) noexcept {
 	q->setAutoPriority(!q->getAutoPriority());
 	fire(QueueManagerListener::ItemPriority(), q);
 
-	q->getBundle()->setDirty();
+	bundleQueue.journalFilePriority(q);
 
 	if(q->getAutoPriority()) {
 		if (SETTING(AUTOPRIO_TYPE) == SettingsManager::PRIO_PROGRESS) {
@@ -2296,6 +2303,190 @@ private:
 void QueueManager::loadQueue(function<void (float)> progressF) noexcept {
 	setMatchers();
 
+	if (bundleQueue.getJournal().exists()) {
+		loadJournal(progressF);
+	} else {
+		importXmlQueue(progressF);
+	}
+
+	TimerManager::getInstance()->addListener(this); 
+	SearchManager::getInstance()->addListener(this);
+	ClientManager::getInstance()->addListener(this);
+	ShareManager::getInstance()->addListener(this);
+
+	auto finishedCount = getFinishedBundlesCount();
+	if (finishedCount > 500)
+		LogManager::getInstance()->message(STRING_F(BUNDLE_X_FINISHED_WARNING, finishedCount), LogMessage::SEV_WARNING);
+
+}
+
+void QueueManager::loadJournal(function<void (float)> progressF) noexcept {
+	auto& journal = bundleQueue.getJournal();
+
+	QueueJournal::BundleInfoMap bundleInfos;
+	bool compact = false;
+	try {
+		auto discarded = journal.load(bundleInfos);
+		if (discarded > 0) {
+			LogManager::getInstance()->message("Incomplete queue changes (" + Util::formatBytes(discarded) + ") were discarded from " + journal.getJournalPath(), LogMessage::SEV_WARNING);
+		}
+	} catch (const Exception& e) {
+		// Save the bundles that could be loaded
+		LogManager::getInstance()->message(STRING_F(BUNDLE_LOAD_FAILED, journal.getSnapshotPath() % e.getError().c_str()), LogMessage::SEV_ERROR);
+		compact = true;
+	}
+
+	vector<const QueueJournal::BundleInfo*> infoList;
+	for (const auto& b: bundleInfos | map_values) {
+		infoList.push_back(&b);
+	}
+
+	// multithreaded loading
+	atomic<long> loaded(0);
+	try {
+		parallel_for_each(infoList.begin(), infoList.end(), [&](const QueueJournal::BundleInfo* aInfo) {
+			try {
+				loadBundle(*aInfo);
+			} catch (const Exception& e) {
+				LogManager::getInstance()->message(STRING_F(BUNDLE_LOAD_FAILED, aInfo->target % e.getError().c_str()), LogMessage::SEV_ERROR);
+				journal.removeBundle(aInfo->token);
+			}
+
+			loaded++;
+			progressF(static_cast<float>(loaded) / static_cast<float>(infoList.size()));
+		});
+	} catch (std::exception& e) {
+		LogManager::getInstance()->message("Loading the queue failed: " + string(e.what()), LogMessage::SEV_INFO);
+	}
+
+	if (compact) {
+		RLock l(cs);
+		bundleQueue.saveQueue(true);
+	}
+}
+
+void QueueManager::loadBundle(const QueueJournal::BundleInfo& aInfo) {
+	BundlePtr bundle = nullptr;
+	if (!aInfo.fileBundle) {
+		if (!ConnectionManager::getInstance()->tokens.addToken(Util::toString(aInfo.token), CONNECTION_TYPE_DOWNLOAD)) {
+			throw Exception("Duplicate bundle token");
+		}
+
+		bundle = make_shared<Bundle>(aInfo.target, aInfo.added, aInfo.autoPriority ? Priority::DEFAULT : aInfo.priority, aInfo.date, aInfo.token, false);
+		bundle->setTimeFinished(aInfo.timeFinished);
+		bundle->setAddedByAutoSearch(aInfo.addedByAutoSearch);
+		bundle->setResumeTime(aInfo.resumeTime);
+	}
+
+	// File bundles are created from the file
+	auto addBundleItem = [&](QueueItemPtr& qi) {
+		if (!aInfo.fileBundle) {
+			bundleQueue.addBundleItem(qi, bundle);
+			return;
+		}
+
+		if (!ConnectionManager::getInstance()->tokens.addToken(Util::toString(aInfo.token), CONNECTION_TYPE_DOWNLOAD)) {
+			fileQueue.remove(qi);
+			throw Exception("Duplicate token");
+		}
+
+		bundle = make_shared<Bundle>(qi, aInfo.date, aInfo.token, false);
+		bundle->setTimeFinished(qi->getTimeFinished());
+		bundle->setAddedByAutoSearch(aInfo.addedByAutoSearch);
+		bundle->setResumeTime(aInfo.resumeTime);
+
+		bundleQueue.addBundleItem(qi, bundle);
+	};
+
+	for (const auto& f: aInfo.files) {
+		if (aInfo.fileBundle && bundle) {
+			break;
+		}
+
+		const auto& file = f.second;
+		if (file.size == 0) {
+			continue;
+		}
+
+		if (file.isFinished()) {
+			if (!Util::fileExists(f.first)) {
+				continue;
+			}
+
+			WLock l(cs);
+			auto ret = fileQueue.add(f.first, file.size, 0, Priority::DEFAULT, Util::emptyString, file.added, file.tth);
+			if (!ret.second) {
+				continue;
+			}
+
+			auto& qi = ret.first;
+			qi->setStatus(QueueItem::STATUS_COMPLETED);
+			qi->addFinishedSegment(Segment(0, file.size)); //make it complete
+			qi->setTimeFinished(file.timeFinished);
+			qi->setLastSource(file.lastSource);
+
+			addBundleItem(qi);
+			continue;
+		}
+
+		string target;
+		try {
+			// @todo do something better about existing files
+			target = QueueManager::checkTarget(f.first);
+			if (target.empty())
+				continue;
+		} catch (const Exception&) {
+			continue;
+		}
+
+		if (!aInfo.fileBundle && !AirUtil::isParentOrExactLocal(bundle->getTarget(), target)) {
+			//the file isn't inside the main bundle dir, can't add this
+			continue;
+		}
+
+		HintedUserList sources;
+		for (const auto& s: file.sources) {
+			auto user = ClientManager::getInstance()->loadUser(s.cid.toBase32(), s.hubHint, s.nick);
+			if (user) {
+				sources.emplace_back(user, s.hubHint);
+			}
+		}
+
+		WLock l(cs);
+		auto ret = fileQueue.add(target, file.size, 0, file.autoPriority ? Priority::DEFAULT : file.priority, file.tempTarget, file.added, file.tth);
+		if (!ret.second) {
+			continue;
+		}
+
+		auto& qi = ret.first;
+		qi->setMaxSegments(max((uint8_t)1, file.maxSegments));
+		addBundleItem(qi);
+
+		for (const auto& segment: file.done) {
+			qi->addFinishedSegment(segment);
+		}
+
+		if (qi->getAutoPriority() && SETTING(AUTOPRIO_TYPE) == SettingsManager::PRIO_PROGRESS) {
+			qi->setPriority(qi->calculateAutoPriority());
+		}
+
+		for (const auto& u: sources) {
+			try {
+				addSource(qi, u, 0, false);
+			} catch (const Exception&) {
+				//...
+			}
+		}
+	}
+
+	if (!bundle || bundle->isEmpty()) {
+		throw Exception(aInfo.fileBundle ? STRING(NO_FILES_FROM_FILE) : STRING_F(NO_FILES_WERE_LOADED, aInfo.target));
+	}
+
+	addLoadedBundle(bundle);
+}
+
+void QueueManager::importXmlQueue(function<void (float)> progressF) noexcept {
 	// migrate old bundles
 	Util::migrate(Util::getPath(Util::PATH_BUNDLES), "Bundle*");
 
@@ -2338,15 +2529,21 @@ void QueueManager::loadQueue(function<void (float)> progressF) noexcept {
 		// ...
 	}
 
-	TimerManager::getInstance()->addListener(this); 
-	SearchManager::getInstance()->addListener(this);
-	ClientManager::getInstance()->addListener(this);
-	ShareManager::getInstance()->addListener(this);
+	// Write the snapshot (the bundle files are kept if it fails so that they will be imported again on the next startup)
+	{
+		RLock l(cs);
+		if (!bundleQueue.saveQueue(true)) {
+			return;
+		}
+	}
 
-	auto finishedCount = getFinishedBundlesCount();
-	if (finishedCount > 500)
-		LogManager::getInstance()->message(STRING_F(BUNDLE_X_FINISHED_WARNING, finishedCount), LogMessage::SEV_WARNING);
+	for (const auto& path: fileList) {
+		File::deleteFile(path);
+	}
 
+	if (!fileList.empty()) {
+		LogManager::getInstance()->message("The queue was converted from " + Util::toString(fileList.size()) + " bundle files to " + bundleQueue.getJournal().getSnapshotPath(), LogMessage::SEV_INFO);
+	}
 }
 
 static const string sFile = "File";
@@ -3479,11 +3676,13 @@ void QueueManager::removeBundleItem(QueueItemPtr& qi, bool aFinished) noexcept{
 		WLock l(cs);
 		bundleQueue.removeBundleItem(qi, aFinished);
 		if (aFinished) {
+			bundleQueue.journalFile(qi);
 			if (bundle->getQueueItems().empty()) {
 				bundleQueue.removeSearchPrio(bundle);
 				emptyBundle = true;
 			}
 		} else {
+			bundleQueue.journalFileRemoved(qi);
 			emptyBundle = bundle->isEmpty();
 		}
 
@@ -3498,6 +3697,7 @@ void QueueManager::removeBundleItem(QueueItemPtr& qi, bool aFinished) noexcept{
 			return;
 		} else {
 			bundle->finishBundle();
+			bundleQueue.journalBundle(bundle);
 			setBundleStatus(bundle, Bundle::STATUS_DOWNLOADED);
 			removeBundleLists(bundle);
 		}
@@ -3510,7 +3710,6 @@ void QueueManager::removeBundleItem(QueueItemPtr& qi, bool aFinished) noexcept{
 		fire(QueueManagerListener::SourceFilesUpdated(), u);
 
 	fire(QueueManagerListener::BundleSources(), bundle);
-	bundle->setDirty();
 }
 
 bool QueueManager::removeBundle(QueueToken aBundleToken, bool removeFinishedFiles) noexcept {
@@ -3636,7 +3835,7 @@ MemoryInputStream* QueueManager::generateTTHList(QueueToken aBundleToken, bool i
 	if (tths.size() == 0) {
 		throw QueueException(UserConnection::FILE_NOT_AVAILABLE);
 	} else {
-		return new MemoryInputStream(tths);
+		return new MemoryInputStream(move(tths));
 	}
 }
 
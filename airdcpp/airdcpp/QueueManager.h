@@ -421,6 +421,14 @@ private:
 	void removeBundleItem(QueueItemPtr& qi, bool finished) noexcept;
 	void addLoadedBundle(BundlePtr& aBundle) noexcept;
 
+	void loadJournal(function<void (float)> progressF) noexcept;
+
+	// Converts the bundle XML files used by earlier versions (the files are removed after the snapshot has been written)
+	void importXmlQueue(function<void (float)> progressF) noexcept;
+
+	// Throws on errors
+	void loadBundle(const QueueJournal::BundleInfo& aInfo);
+
 	// Add a new bundle in queue or (called from inside a WLock)
 	// onBundleAdded must be called separately from outside the lock afterwards
 	void addBundle(BundlePtr& aBundle, int aFilesAdded) noexcept;
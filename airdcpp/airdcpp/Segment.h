@@ -60,12 +60,6 @@ public:
 		size = rhs.getStart() - start;
 	}
 
-	bool inSet(const set<Segment>& segmentSet) const noexcept {
-		return find_if(segmentSet.begin(), segmentSet.end(), [&](const Segment& s) {
-			return s.contains(*this);
-		}) != segmentSet.end();
-	}
-	
 	bool contains(const Segment& rhs) const noexcept {
 		return getStart() <= rhs.getStart() && getEnd() >= rhs.getEnd();
 	}
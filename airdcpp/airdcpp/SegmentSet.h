@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_SEGMENT_SET_H
+#define DCPLUSPLUS_DCPP_SEGMENT_SET_H
+
+#include "typedefs.h"
+
+#include "Segment.h"
+
+namespace dcpp {
+
+/**
+* Ordered set of file ranges
+*
+* Overlapping and adjacent segments are merged when they are added, so the segments in the set never
+* touch each other. A range is covered by the set only if a single segment contains it and all lookups
+* are logarithmic.
+*/
+class SegmentSet {
+public:
+	typedef set<Segment>::const_iterator const_iterator;
+
+	// Add the segment and merge it with the overlapping and adjacent segments
+	// Returns the number of bytes that weren't included in the set before
+	int64_t add(const Segment& aSegment) noexcept {
+		auto start = aSegment.getStart();
+		auto end = aSegment.getEnd();
+		auto oldBytes = bytes;
+
+		auto i = firstEndingAfter(start - 1);
+		while (i != segments.end() && i->getStart() <= end) {
+			start = min(start, i->getStart());
+			end = max(end, i->getEnd());
+			bytes -= i->getSize();
+			i = segments.erase(i);
+		}
+
+		segments.emplace(start, end - start);
+		bytes += end - start;
+		return bytes - oldBytes;
+	}
+
+	// Segment containing the position (end() if the position isn't in the set)
+	const_iterator find(int64_t aPos) const noexcept {
+		auto i = firstEndingAfter(aPos);
+		return i != segments.end() && i->getStart() <= aPos ? i : segments.end();
+	}
+
+	// First segment that ends after the position
+	const_iterator firstEndingAfter(int64_t aPos) const noexcept {
+		auto i = segments.upper_bound(Segment(aPos, numeric_limits<int64_t>::max()));
+		if (i != segments.begin()) {
+			auto prev = std::prev(i);
+			if (prev->getEnd() > aPos) {
+				return prev;
+			}
+		}
+
+		return i;
+	}
+
+	// Whether a single segment in the set contains the whole range
+	bool contains(const Segment& aSegment) const noexcept {
+		auto i = segments.upper_bound(Segment(aSegment.getStart(), numeric_limits<int64_t>::max()));
+		return i != segments.begin() && std::prev(i)->contains(aSegment);
+	}
+
+	// Whether any segment in the set overlaps with the range
+	bool overlaps(const Segment& aSegment) const noexcept {
+		// The last segment starting before the end of the range
+		auto i = segments.lower_bound(Segment(aSegment.getEnd(), numeric_limits<int64_t>::min()));
+		return i != segments.begin() && std::prev(i)->overlaps(aSegment);
+	}
+
+	// Total size of the segments
+	int64_t getBytes() const noexcept { return bytes; }
+
+	const_iterator begin() const noexcept { return segments.begin(); }
+	const_iterator end() const noexcept { return segments.end(); }
+
+	size_t size() const noexcept { return segments.size(); }
+	bool empty() const noexcept { return segments.empty(); }
+
+	void clear() noexcept {
+		segments.clear();
+		bytes = 0;
+	}
+private:
+	set<Segment> segments;
+	int64_t bytes = 0;
+};
+
+} // namespace dcpp
+
+#endif /* DCPLUSPLUS_DCPP_SEGMENT_SET_H */
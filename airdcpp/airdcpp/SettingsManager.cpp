@@ -831,7 +831,7 @@ SettingsManager::SettingsManager() : connectionRegex("(\\d+(\\.\\d+)?)")
 	//set depending on the cpu count
 	setDefault(MAX_HASHING_THREADS, std::thread::hardware_concurrency());
 
-	setDefault(HASHERS_PER_VOLUME, 1);
+	setDefault(HASHERS_PER_VOLUME, 0);
 
 	setDefault(MIN_DUPE_CHECK_SIZE, 512);
 	setDefault(WARN_ELEVATED, true);
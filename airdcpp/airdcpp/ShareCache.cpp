@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "ShareCache.h"
+
+#include "ZUtils.h"
+
+namespace dcpp {
+
+#define MAGIC "ASCB"
+#define MAGIC_SIZE 4
+
+#define RECORD_DIRECTORY 'D'
+#define RECORD_DIRECTORY_END 'E'
+#define RECORD_FILE 'F'
+#define RECORD_END 'Z'
+
+#define BUFFER_SIZE (256 * 1024)
+
+const uint32_t ShareCacheReader::VERSION = 1;
+
+static uint32_t updateCrc(uint32_t aCrc, const uint8_t* aData, size_t aLen) noexcept {
+	if (aLen == 0) {
+		return aCrc;
+	}
+
+	return static_cast<uint32_t>(crc32(aCrc, aData, static_cast<uInt>(aLen)));
+}
+
+ShareCacheWriter::ShareCacheWriter(OutputStream* aStream, const string& aRootPath, time_t aRootDate) : s(aStream), crc(0) {
+	buf.reserve(BUFFER_SIZE);
+
+	write(MAGIC, MAGIC_SIZE);
+	writeInt(ShareCacheReader::VERSION, 4);
+	writeName(aRootPath);
+	writeInt(aRootDate, 8);
+}
+
+void ShareCacheWriter::write(const void* aData, size_t aLen) noexcept {
+	auto p = static_cast<const uint8_t*>(aData);
+	buf.insert(buf.end(), p, p + aLen);
+}
+
+void ShareCacheWriter::writeInt(uint64_t aValue, int aBytes) noexcept {
+	for (int i = 0; i < aBytes; ++i) {
+		buf.push_back(static_cast<uint8_t>(aValue >> (i * 8)));
+	}
+}
+
+void ShareCacheWriter::writeName(const string& aName) {
+	if (aName.size() > UINT16_MAX) {
+		throw ShareCacheException("Name " + aName + " is too long");
+	}
+
+	writeInt(aName.size(), 2);
+	write(aName.data(), aName.size());
+}
+
+void ShareCacheWriter::startDirectory(const string& aName, time_t aDate) {
+	buf.push_back(RECORD_DIRECTORY);
+	writeName(aName);
+	writeInt(aDate, 8);
+
+	depth++;
+	flush();
+}
+
+void ShareCacheWriter::endDirectory() {
+	dcassert(depth > 0);
+	buf.push_back(RECORD_DIRECTORY_END);
+
+	depth--;
+	flush();
+}
+
+void ShareCacheWriter::addFile(const string& aName, int64_t aSize, time_t aDate, const TTHValue& aTTH) {
+	buf.push_back(RECORD_FILE);
+	writeName(aName);
+	writeInt(aSize, 8);
+	writeInt(aDate, 8);
+	write(aTTH.data, TTHValue::BYTES);
+
+	flush();
+}
+
+void ShareCacheWriter::finish() {
+	dcassert(depth == 0);
+	buf.push_back(RECORD_END);
+
+	crc = updateCrc(crc, &buf[0], buf.size());
+	writeInt(crc, 4);
+
+	s->write(&buf[0], buf.size());
+	buf.clear();
+}
+
+void ShareCacheWriter::flush() {
+	if (buf.size() >= BUFFER_SIZE) {
+		crc = updateCrc(crc, &buf[0], buf.size());
+		s->write(&buf[0], buf.size());
+		buf.clear();
+	}
+}
+
+
+ShareCacheReader::ShareCacheReader(CallBack* aCallBack) noexcept : cb(aCallBack), crc(0) {
+
+}
+
+void ShareCacheReader::ensure(size_t aLen) {
+	if (buf.size() - pos >= aLen) {
+		return;
+	}
+
+	// Move the unread bytes to the beginning
+	crc = updateCrc(crc, buf.data(), pos);
+	buf.erase(buf.begin(), buf.begin() + pos);
+	pos = 0;
+
+	while (buf.size() < aLen) {
+		auto oldSize = buf.size();
+		size_t len = max(static_cast<size_t>(BUFFER_SIZE), aLen);
+		buf.resize(oldSize + len);
+		is->read(&buf[oldSize], len);
+		buf.resize(oldSize + len);
+
+		if (len == 0) {
+			throw ShareCacheException("Unexpected end of file");
+		}
+	}
+}
+
+uint64_t ShareCacheReader::readInt(int aBytes) {
+	ensure(aBytes);
+
+	uint64_t ret = 0;
+	for (int i = 0; i < aBytes; ++i) {
+		ret |= static_cast<uint64_t>(buf[pos + i]) << (i * 8);
+	}
+
+	pos += aBytes;
+	return ret;
+}
+
+void ShareCacheReader::readName(string& name_) {
+	auto len = static_cast<size_t>(readInt(2));
+	if (len == 0) {
+		throw ShareCacheException("Empty name");
+	}
+
+	ensure(len);
+	name_.assign(reinterpret_cast<const char*>(&buf[pos]), len);
+	pos += len;
+}
+
+bool ShareCacheReader::parse(InputStream& aStream) {
+	is = &aStream;
+
+	ensure(MAGIC_SIZE + 4);
+	if (memcmp(&buf[pos], MAGIC, MAGIC_SIZE) != 0) {
+		throw ShareCacheException("Invalid file");
+	}
+
+	pos += MAGIC_SIZE;
+	if (readInt(4) != VERSION) {
+		return false;
+	}
+
+	readName(rootPath);
+	rootDate = static_cast<time_t>(readInt(8));
+
+	string name;
+	TTHValue tth;
+	int depth = 0;
+
+	for (;;) {
+		ensure(1);
+		auto type = buf[pos++];
+		if (type == RECORD_FILE) {
+			readName(name);
+			auto size = static_cast<int64_t>(readInt(8));
+			auto date = static_cast<time_t>(readInt(8));
+
+			ensure(TTHValue::BYTES);
+			memcpy(tth.data, &buf[pos], TTHValue::BYTES);
+			pos += TTHValue::BYTES;
+
+			cb->addFile(name, size, date, tth);
+		} else if (type == RECORD_DIRECTORY) {
+			readName(name);
+			auto date = static_cast<time_t>(readInt(8));
+
+			depth++;
+			cb->startDirectory(name, date);
+		} else if (type == RECORD_DIRECTORY_END) {
+			if (depth == 0) {
+				throw ShareCacheException("Invalid directory structure");
+			}
+
+			depth--;
+			cb->endDirectory();
+		} else if (type == RECORD_END) {
+			if (depth != 0) {
+				throw ShareCacheException("Invalid directory structure");
+			}
+
+			break;
+		} else {
+			throw ShareCacheException("Invalid record type");
+		}
+	}
+
+	auto expectedCrc = updateCrc(crc, buf.data(), pos);
+	if (static_cast<uint32_t>(readInt(4)) != expectedCrc) {
+		throw ShareCacheException("Checksum mismatch");
+	}
+
+	return true;
+}
+
+} // namespace dcpp
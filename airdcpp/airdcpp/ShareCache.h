@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_SHARE_CACHE_H
+#define DCPLUSPLUS_DCPP_SHARE_CACHE_H
+
+#include "typedefs.h"
+
+#include "Exception.h"
+#include "MerkleTree.h"
+#include "Streams.h"
+
+#include <boost/noncopyable.hpp>
+
+namespace dcpp {
+
+/*
+* Binary share cache format (one file per share root, all integers are little-endian)
+*
+* Header:		magic (4 bytes), version (uint32), root path (uint16 length + UTF-8), root date (int64)
+* Directory:	'D', name (uint16 length + UTF-8), date (int64), followed by the content records and 'E'
+* File:			'F', name (uint16 length + UTF-8), size (int64), date (int64), TTH (24 bytes)
+* End:			'Z', CRC32 of all previous bytes (uint32)
+*
+* Records have no alignment requirements, so the file can be parsed from a memory mapped region as well.
+*/
+
+class ShareCacheWriter : boost::noncopyable {
+public:
+	ShareCacheWriter(OutputStream* aStream, const string& aRootPath, time_t aRootDate);
+
+	void startDirectory(const string& aName, time_t aDate);
+	void endDirectory();
+	void addFile(const string& aName, int64_t aSize, time_t aDate, const TTHValue& aTTH);
+
+	// Writes the end marker and the checksum (nothing can be added after this)
+	void finish();
+private:
+	OutputStream* s;
+
+	ByteVector buf;
+	uint32_t crc;
+	int depth = 0;
+
+	void write(const void* aData, size_t aLen) noexcept;
+	void writeName(const string& aName);
+	void writeInt(uint64_t aValue, int aBytes) noexcept;
+
+	void flush();
+};
+
+class ShareCacheReader : boost::noncopyable {
+public:
+	class CallBack : boost::noncopyable {
+	public:
+		virtual ~CallBack() { }
+
+		virtual void startDirectory(const string& aName, time_t aDate) = 0;
+		virtual void endDirectory() = 0;
+		virtual void addFile(const string& aName, int64_t aSize, time_t aDate, const TTHValue& aTTH) = 0;
+	};
+
+	static const uint32_t VERSION;
+
+	ShareCacheReader(CallBack* aCallBack) noexcept;
+
+	// Returns false if the file was saved with a different version of the format
+	// Throws ShareCacheException if the content is invalid
+	bool parse(InputStream& aStream);
+
+	const string& getRootPath() const noexcept { return rootPath; }
+	time_t getRootDate() const noexcept { return rootDate; }
+private:
+	CallBack* cb;
+
+	InputStream* is = nullptr;
+	ByteVector buf;
+	size_t pos = 0;
+
+	// Checksum of the bytes that have been removed from the buffer
+	uint32_t crc;
+
+	string rootPath;
+	time_t rootDate = 0;
+
+	// Makes sure that the buffer contains at least aLen unread bytes
+	void ensure(size_t aLen);
+
+	uint64_t readInt(int aBytes);
+	void readName(string& name_);
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_SHARE_CACHE_H)
@@ -21,16 +21,17 @@
 
 #include "AirUtil.h"
 #include "Bundle.h"
-#include "BZUtils.h"
 #include "ClientManager.h"
 #include "ErrorCollector.h"
 #include "File.h"
 #include "FilteredFile.h"
 #include "LogManager.h"
 #include "HashManager.h"
+#include "ParallelBZOutputStream.h"
 #include "ResourceManager.h"
 #include "ScopedFunctor.h"
 #include "SearchResult.h"
+#include "ShareCache.h"
 #include "SharePathValidator.h"
 #include "SimpleXML.h"
 #include "StringTokenizer.h"
@@ -46,6 +47,8 @@
 
 #include "concurrency.h"
 
+#include <thread>
+
 namespace dcpp {
 
 using std::string;
@@ -58,13 +61,25 @@ using boost::range::remove_if;
 
 #define SHARE_CACHE_VERSION "3"
 
+// Share bloom size limits (bits)
+#define SHARE_BLOOM_MIN_SIZE (1 << 20)
+#define SHARE_BLOOM_MAX_SIZE (1 << 28)
+
+// Maximum number of cached search result lists
+#define SHARE_SEARCH_CACHE_SIZE 500
+
+// Limits for cached partial file lists
+#define SHARE_PARTIAL_LIST_CACHE_SIZE 200
+#define SHARE_PARTIAL_LIST_CACHE_BYTES (32 * 1024 * 1024)
+
 #ifdef ATOMIC_FLAG_INIT
 atomic_flag ShareManager::refreshing = ATOMIC_FLAG_INIT;
 #else
 atomic_flag ShareManager::refreshing;
 #endif
 
-ShareManager::ShareManager() : bloom(new ShareBloom(1 << 20)), validator(new SharePathValidator())
+ShareManager::ShareManager() : bloom(new ShareBloom(SHARE_BLOOM_MIN_SIZE)), validator(new SharePathValidator()), searchCache(SHARE_SEARCH_CACHE_SIZE),
+	partialListCache(SHARE_PARTIAL_LIST_CACHE_SIZE, SHARE_PARTIAL_LIST_CACHE_BYTES)
 { 
 	SettingsManager::getInstance()->addListener(this);
 	HashManager::getInstance()->addListener(this);
@@ -231,9 +246,8 @@ StringList ShareManager::getRealPaths(const TTHValue& root) const noexcept {
 	StringList ret;
 
 	RLock l(cs);
-	const auto i = tthIndex.equal_range(const_cast<TTHValue*>(&root)); 
-	for (auto f = i.first; f != i.second; ++f) {
-		ret.push_back((*f).second->getRealPath());
+	for (const auto& f : tthIndex.equal_range(root)) {
+		ret.push_back(f->getRealPath());
 	}
 
 	const auto k = tempShares.find(root);
@@ -247,7 +261,7 @@ StringList ShareManager::getRealPaths(const TTHValue& root) const noexcept {
 
 bool ShareManager::isTTHShared(const TTHValue& tth) const noexcept {
 	RLock l(cs);
-	return tthIndex.find(const_cast<TTHValue*>(&tth)) != tthIndex.end();
+	return tthIndex.find(tth) != nullptr;
 }
 
 void ShareManager::Directory::increaseSize(int64_t aSize, int64_t& totalSize_) noexcept {
@@ -357,9 +371,9 @@ string ShareManager::toVirtual(const TTHValue& tth, ProfileToken aProfile) const
 		return Transfer::USER_LIST_NAME;
 	}
 
-	auto i = tthIndex.find(const_cast<TTHValue*>(&tth)); 
-	if (i != tthIndex.end()) {
-		return i->second->getAdcPath();
+	auto f = tthIndex.find(tth);
+	if (f) {
+		return f->getAdcPath();
 	}
 
 	//nothing found throw;
@@ -394,13 +408,12 @@ void ShareManager::toRealWithSize(const string& aVirtualFile, const ProfileToken
 
 		RLock l(cs);
 		if(any_of(aProfiles.begin(), aProfiles.end(), [](ProfileToken s) { return s != SP_HIDDEN; })) {
-			const auto flst = tthIndex.equal_range(const_cast<TTHValue*>(&tth));
-			for(auto f = flst.first; f != flst.second; ++f) {
+			for(const auto& f: tthIndex.equal_range(tth)) {
 				noAccess_ = false; //we may throw if the file doesn't exist on the disk so always reset this to prevent invalid access denied messages
 				auto profiles = aProfiles;
-				if (f->second->getParent()->hasProfile(profiles)) {
-					path_ = f->second->getRealPath();
-					size_ = f->second->getSize();
+				if (f->getParent()->hasProfile(profiles)) {
+					path_ = f->getRealPath();
+					size_ = f->getSize();
 					return;
 				} else {
 					noAccess_ = true;
@@ -464,8 +477,7 @@ MemoryInputStream* ShareManager::getTree(const string& virtualFile, ProfileToken
 		}
 	}
 
-	ByteVector buf = tree.getLeafData();
-	return new MemoryInputStream(&buf[0], buf.size());
+	return new MemoryInputStream(tree.getLeafData());
 }
 
 AdcCommand ShareManager::getFileInfo(const string& aFile, ProfileToken aProfile) {
@@ -491,9 +503,8 @@ AdcCommand ShareManager::getFileInfo(const string& aFile, ProfileToken aProfile)
 	TTHValue val(aFile.substr(4));
 	
 	RLock l(cs);
-	auto i = tthIndex.find(const_cast<TTHValue*>(&val)); 
-	if(i != tthIndex.end()) {
-		const Directory::File* f = i->second;
+	auto f = tthIndex.find(val);
+	if(f) {
 		AdcCommand cmd(AdcCommand::CMD_RES);
 		cmd.addParam("FN", f->getAdcPath());
 		cmd.addParam("SI", Util::toString(f->getSize()));
@@ -708,7 +719,7 @@ void ShareManager::loadProfile(SimpleXML& aXml, const string& aName, ProfileToke
 
 			// Validate in case we have changed the rules
 			auto vName = validateVirtualName(loadedVirtualName.empty() ? Util::getLastDir(realPath) : loadedVirtualName);
-			Directory::createRoot(realPath, vName, { aToken }, incoming, 0, rootPaths, lowerDirNameMap, *bloom.get(), lastRefreshTime);
+			Directory::createRoot(realPath, vName, { aToken }, incoming, 0, rootPaths, lowerDirNameMap, *bloom.get(), searchIndex, lastRefreshTime);
 		}
 	}
 
@@ -796,7 +807,7 @@ OptionalProfileToken ShareManager::getProfileByName(const string& aName) const n
 	return (*p)->getToken();
 }
 
-ShareManager::Directory::Ptr ShareManager::Directory::createNormal(DualString&& aRealName, const Ptr& aParent, time_t aLastWrite, Directory::MultiMap& dirNameMap_, ShareBloom& bloom) noexcept {
+ShareManager::Directory::Ptr ShareManager::Directory::createNormal(DualString&& aRealName, const Ptr& aParent, time_t aLastWrite, Directory::MultiMap& dirNameMap_, ShareBloom& bloom, ShareSearchIndex& searchIndex_) noexcept {
 	auto dir = Ptr(new Directory(move(aRealName), aParent, aLastWrite, nullptr));
 
 	if (aParent) {
@@ -806,19 +817,19 @@ ShareManager::Directory::Ptr ShareManager::Directory::createNormal(DualString&&
 		}
 	}
 
-	addDirName(dir, dirNameMap_, bloom);
+	addDirName(dir, dirNameMap_, bloom, searchIndex_);
 	return dir;
 }
 
 ShareManager::Directory::Ptr ShareManager::Directory::createRoot(const string& aRootPath, const string& aVname, const ProfileTokenSet& aProfiles, bool aIncoming, 
-	time_t aLastWrite, Map& rootPaths_, Directory::MultiMap& dirNameMap_, ShareBloom& bloom, time_t aLastRefreshTime) noexcept
+	time_t aLastWrite, Map& rootPaths_, Directory::MultiMap& dirNameMap_, ShareBloom& bloom, ShareSearchIndex& searchIndex_, time_t aLastRefreshTime) noexcept
 {
 	auto dir = Ptr(new Directory(Util::getLastDir(aRootPath), nullptr, aLastWrite, RootDirectory::create(aRootPath, aVname, aProfiles, aIncoming, aLastRefreshTime)));
 
 	dcassert(rootPaths_.find(dir->getRealPath()) == rootPaths_.end());
 	rootPaths_[dir->getRealPath()] = dir;
 
-	addDirName(dir, dirNameMap_, bloom);
+	addDirName(dir, dirNameMap_, bloom, searchIndex_);
 	return dir;
 }
 
@@ -837,8 +848,18 @@ bool ShareManager::Directory::setParent(const Directory::Ptr& aDirectory, const
 	return true;
 }
 
-void ShareManager::Directory::cleanIndices(Directory& aDirectory, int64_t& sharedSize_, File::TTHMap& tthIndex_, Directory::MultiMap& dirNames_) noexcept {
-	aDirectory.cleanIndices(sharedSize_, tthIndex_, dirNames_);
+void ShareManager::Directory::cleanIndices(Directory& aDirectory, int64_t& sharedSize_, File::TTHMap& tthIndex_, Directory::MultiMap& dirNames_, ShareSearchIndex& searchIndex_) noexcept {
+	// Empty directories are commonly removed while building the tree, avoid going through the whole search index with those
+	auto removeSingle = !aDirectory.isRoot() && aDirectory.directories.empty() && aDirectory.files.empty();
+	if (removeSingle) {
+		searchIndex_.remove(&aDirectory, aDirectory.getVirtualNameLower());
+	}
+
+	ShareSearchIndex::ItemSet removedDirectories;
+	aDirectory.cleanIndices(sharedSize_, tthIndex_, dirNames_, removedDirectories);
+	if (!removeSingle) {
+		searchIndex_.remove(removedDirectories);
+	}
 
 	if (aDirectory.parent) {
 		aDirectory.parent->directories.erase_key(aDirectory.realName.getLower());
@@ -846,21 +867,24 @@ void ShareManager::Directory::cleanIndices(Directory& aDirectory, int64_t& share
 	}
 }
 
-void ShareManager::Directory::File::updateIndices(ShareBloom& bloom_, int64_t& sharedSize_, TTHMap& tthIndex_) noexcept {
+void ShareManager::Directory::File::updateIndices(ShareBloom& bloom_, int64_t& sharedSize_, TTHMap& tthIndex_, ShareSearchIndex& searchIndex_) noexcept {
 	parent->increaseSize(size, sharedSize_);
 #ifdef _DEBUG
 	checkAddedTTHDebug(this, tthIndex_);
 #endif
 
-	tthIndex_.emplace(const_cast<TTHValue*>(&tth), this);
+	tthIndex_.insert(this);
 	bloom_.add(name.getLower());
+	searchIndex_.add(parent, name.getLower());
 }
 
-void ShareManager::Directory::cleanIndices(int64_t& sharedSize_, HashFileMap& tthIndex_, Directory::MultiMap& dirNames_) noexcept {
+void ShareManager::Directory::cleanIndices(int64_t& sharedSize_, HashFileMap& tthIndex_, Directory::MultiMap& dirNames_, ShareSearchIndex::ItemSet& removedDirectories_) noexcept {
 	for (auto& d : directories) {
-		d->cleanIndices(sharedSize_, tthIndex_, dirNames_);
+		d->cleanIndices(sharedSize_, tthIndex_, dirNames_, removedDirectories_);
 	}
 
+	removedDirectories_.insert(this);
+
 	//remove from the name map
 	removeDirName(*this, dirNames_);
 
@@ -873,12 +897,8 @@ void ShareManager::Directory::cleanIndices(int64_t& sharedSize_, HashFileMap& tt
 void ShareManager::Directory::File::cleanIndices(int64_t& sharedSize_, File::TTHMap& tthIndex_) noexcept {
 	parent->decreaseSize(size, sharedSize_);
 
-	auto flst = tthIndex_.equal_range(const_cast<TTHValue*>(&tth));
-	auto p = find(flst | map_values, this);
-	if (p.base() != flst.second)
-		tthIndex_.erase(p.base());
-	else
-		dcassert(0);
+	auto removed = tthIndex_.erase(this);
+	dcassert(removed);
 }
 
 static const string SDIRECTORY = "Directory";
@@ -889,16 +909,48 @@ static const string DATE = "Date";
 static const string SHARE = "Share";
 static const string SVERSION = "Version";
 
-struct ShareManager::ShareLoader : public SimpleXMLReader::ThreadedCallBack, public ShareManager::RefreshInfo {
+struct ShareManager::ShareLoader : public SimpleXMLReader::CallBack, public ShareCacheReader::CallBack, public ShareManager::RefreshInfo {
 	ShareLoader(const string& aPath, const ShareManager::Directory::Ptr& aOldRoot, ShareManager::ShareBloom& aBloom) :
 		ShareManager::RefreshInfo(aPath, aOldRoot, 0, aBloom),
-		ThreadedCallBack(aOldRoot->getRoot()->getCacheXmlPath()),
+		xmlPath(aOldRoot->getRoot()->getCacheXmlPath()),
+		binaryPath(aOldRoot->getRoot()->getCacheBinaryPath()),
 		curDirPath(aOldRoot->getRoot()->getPath()),
 		curDirPathLower(Text::toLower(aOldRoot->getRoot()->getPath()))
 	{ 
 		cur = newShareDirectory;
 	}
 
+	// Load the binary cache if it exists and has the current version, XML cache otherwise
+	void load() {
+		if (Util::fileExists(binaryPath)) {
+			File f(binaryPath, File::READ, File::OPEN, File::BUFFER_SEQUENTIAL, false);
+
+			ShareCacheReader reader(this);
+			if (reader.parse(f)) {
+				if (Util::stricmp(reader.getRootPath(), path) != 0) {
+					throw ShareCacheException("The cache is for a different directory");
+				}
+
+				cur->setLastWrite(reader.getRootDate());
+				return;
+			}
+
+			dcdebug("Unsupported binary cache version for %s, loading the XML cache\n", path.c_str());
+		}
+
+		{
+			File f(xmlPath, File::READ, File::OPEN, File::BUFFER_SEQUENTIAL, false);
+			SimpleXMLReader(this).parse(f);
+		}
+
+		// Convert to the binary format
+		cur->getRoot()->setCacheDirty(true);
+	}
+
+	void deleteCacheFiles() noexcept {
+		File::deleteFile(binaryPath);
+		File::deleteFile(xmlPath);
+	}
 
 	void startTag(const string& aName, StringPairList& attribs, bool simple) {
 		if(compare(aName, SDIRECTORY) == 0) {
@@ -908,7 +960,7 @@ struct ShareManager::ShareLoader : public SimpleXMLReader::ThreadedCallBack, pub
 			if(!name.empty()) {
 				curDirPath += name + PATH_SEPARATOR;
 
-				cur = ShareManager::Directory::createNormal(name, cur, Util::toTimeT(date), lowerDirNameMapNew, bloom);
+				cur = ShareManager::Directory::createNormal(name, cur, Util::toTimeT(date), lowerDirNameMapNew, bloom, searchIndexNew);
 				if (!cur) {
 					throw Exception("Duplicate directory name");
 				}
@@ -932,7 +984,7 @@ struct ShareManager::ShareLoader : public SimpleXMLReader::ThreadedCallBack, pub
 				DualString name(fname);
 				HashedFile fi;
 				HashManager::getInstance()->getFileInfo(curDirPathLower + name.getLower(), curDirPath + fname, fi);
-				addFile(move(name), cur, fi, tthIndexNew, bloom, addedSize);
+				ShareManager::addFile(move(name), cur, fi, tthIndexNew, bloom, searchIndexNew, addedSize);
 			} catch(Exception& e) {
 				hashSize += File::getSize(curDirPath + fname);
 				dcdebug("Error loading file list %s \n", e.getError().c_str());
@@ -955,6 +1007,24 @@ struct ShareManager::ShareLoader : public SimpleXMLReader::ThreadedCallBack, pub
 		}
 	}
 
+	// The file information is stored in the binary cache so there's no need to look it up from the hash database
+	void startDirectory(const string& aName, time_t aDate) {
+		cur = ShareManager::Directory::createNormal(aName, cur, aDate, lowerDirNameMapNew, bloom, searchIndexNew);
+		if (!cur) {
+			throw ShareCacheException("Duplicate directory name");
+		}
+	}
+
+	void endDirectory() {
+		cur = cur->getParent();
+	}
+
+	void addFile(const string& aName, int64_t aSize, time_t aDate, const TTHValue& aTTH) {
+		ShareManager::addFile(aName, cur, HashedFile(aTTH, aDate, aSize), tthIndexNew, bloom, searchIndexNew, addedSize);
+	}
+
+	const string xmlPath;
+	const string binaryPath;
 private:
 	friend struct SizeSort;
 
@@ -972,7 +1042,7 @@ bool ShareManager::loadCache(function<void(float)> progressF) noexcept{
 
 	Util::migrate(Util::getPath(Util::PATH_SHARECACHE), "ShareCache_*");
 
-	// Get all cache XMLs
+	// Get all cache files
 	StringList fileList = File::findFiles(Util::getPath(Util::PATH_SHARECACHE), "ShareCache_*", File::TYPE_FILE);
 
 	if (fileList.empty()) {
@@ -983,18 +1053,21 @@ bool ShareManager::loadCache(function<void(float)> progressF) noexcept{
 
 	// Create loaders
 	for (const auto& p : fileList) {
-		if (Util::getFileExt(p) == ".xml") {
+		auto ext = Util::getFileExt(p);
+		if (ext == ".xml" || ext == ".bin") {
 			// Find the corresponding directory pointer for this path
 			auto rp = find_if(rootPaths | map_values, [&p](const Directory::Ptr& aDir) {
-				return Util::stricmp(aDir->getRoot()->getCacheXmlPath(), p) == 0; 
+				return Util::stricmp(aDir->getRoot()->getCacheXmlPath(), p) == 0 || Util::stricmp(aDir->getRoot()->getCacheBinaryPath(), p) == 0;
 			});
 
 			if (rp.base() != rootPaths.end()) {
-				try {
-					auto loader = std::make_shared<ShareLoader>(rp.base()->first, *rp, *bloom.get());
-					cacheLoaders.emplace_back(loader);
-					continue;
-				} catch (...) {}
+				// Both formats may exist for the same root
+				auto hasLoader = any_of(cacheLoaders.begin(), cacheLoaders.end(), [&](const ShareLoaderPtr& aLoader) { return aLoader->path == rp.base()->first; });
+				if (!hasLoader) {
+					cacheLoaders.emplace_back(std::make_shared<ShareLoader>(rp.base()->first, *rp, *bloom.get()));
+				}
+
+				continue;
 			}
 		}
 
@@ -1016,14 +1089,18 @@ bool ShareManager::loadCache(function<void(float)> progressF) noexcept{
 				//LogManager::getInstance()->message("Thread: " + Util::toString(::GetCurrentThreadId()) + "Size " + Util::toString(loader.size), LogMessage::SEV_INFO);
 				auto& loader = *i;
 				try {
-					SimpleXMLReader(&loader).parse(*loader.file);
+					loader.load();
 				} catch (SimpleXMLException& e) {
 					LogManager::getInstance()->message(STRING_F(LOAD_FAILED_X, loader.xmlPath % e.getError()), LogMessage::SEV_ERROR);
 					hasFailedCaches = true;
-					File::deleteFile(loader.xmlPath);
+					loader.deleteCacheFiles();
+				} catch (ShareCacheException& e) {
+					LogManager::getInstance()->message(STRING_F(LOAD_FAILED_X, loader.binaryPath % e.getError()), LogMessage::SEV_ERROR);
+					hasFailedCaches = true;
+					loader.deleteCacheFiles();
 				} catch (...) {
 					hasFailedCaches = true;
-					File::deleteFile(loader.xmlPath);
+					loader.deleteCacheFiles();
 				}
 
 				if (progressF) {
@@ -1114,16 +1191,22 @@ void ShareManager::countStats(time_t& totalAge_, size_t& totalDirs_, int64_t& to
 }
 
 optional<ShareManager::ShareItemStats> ShareManager::getShareItemStats() const noexcept {
-	unordered_set<decltype(tthIndex)::key_type> uniqueTTHs;
+	unordered_set<TTHValue*> uniqueTTHs;
 
 	{
 		RLock l(cs);
-		for (auto tth : tthIndex | map_keys) {
-			uniqueTTHs.insert(tth);
+		for (auto f : tthIndex) {
+			uniqueTTHs.insert(const_cast<TTHValue*>(&f->getTTH()));
 		}
 	}
 
 	ShareItemStats stats;
+	{
+		RLock l(cs);
+		stats.searchIndexKeys = searchIndex.getKeyCount();
+		stats.searchIndexEntries = searchIndex.getEntryCount();
+	}
+
 	stats.profileCount = shareProfiles.size() - 1; // remove hidden
 	stats.uniqueFileCount = uniqueTTHs.size();
 
@@ -1158,6 +1241,17 @@ ShareManager::ShareSearchStats ShareManager::getSearchMatchingStats() const noex
 	stats.autoSearches = autoSearches;
 	stats.tthSearches = tthSearches;
 
+	{
+		RLock l(cs);
+		stats.bloomSize = bloom->getSize();
+		stats.bloomFillRate = bloom->getFillRate();
+		stats.bloomFalsePositiveRate = bloom->getFalsePositiveRate();
+	}
+
+	stats.cacheHits = searchCache.getHits();
+	stats.cacheMisses = searchCache.getMisses();
+	stats.cacheEntries = searchCache.getSize();
+
 	return stats;
 }
 
@@ -1178,7 +1272,8 @@ Total shared files: %d (of which %d%% are lowercase)\r\n\
 Unique TTHs: %d (%d%%)\r\n\
 Total shared directories: %d (%d files per directory)\r\n\
 Average age of a file: %s\r\n\
-Average name length of a shared item: %d bytes (total size %s)")
+Average name length of a shared item: %d bytes (total size %s)\r\n\
+Search index: %d n-grams (%d directory entries)")
 
 		% itemStats.profileCount
 		% itemStats.rootDirectoryCount
@@ -1189,6 +1284,7 @@ Average name length of a shared item: %d bytes (total size %s)")
 		% Util::formatTime(itemStats.averageFileAge, false, true)
 		% itemStats.averageNameLength
 		% Util::formatBytes(itemStats.totalNameSize)
+		% itemStats.searchIndexKeys % itemStats.searchIndexEntries
 	);
 
 	auto searchStats = getSearchMatchingStats();
@@ -1200,7 +1296,9 @@ Filtered text searches: %d%% (%d%% of the matched ones returned results)\r\n\
 Average search tokens (non-filtered only): %d (%d bytes per token)\r\n\
 Auto searches (text, ADC only): %d%%\r\n\
 Average time for matching a recursive search: %d ms\r\n\
-TTH searches: %d%% (hash bloom mode: %s)")
+TTH searches: %d%% (hash bloom mode: %s)\r\n\
+Share bloom: %s (%d%% filled, false positive rate per n-gram %d%%)\r\n\
+Search result cache: %d%% hit rate (%d hits, %d cached searches)")
 
 		% searchStats.totalSearches % searchStats.totalSearchesPerSecond
 		% searchStats.recursiveSearches % searchStats.unfilteredRecursiveSearchesPerSecond
@@ -1210,6 +1308,16 @@ TTH searches: %d%% (hash bloom mode: %s)")
 		% searchStats.averageSearchMatchMs
 		% Util::countPercentage(searchStats.tthSearches, searchStats.totalSearches)
 		% (SETTING(BLOOM_MODE) != SettingsManager::BLOOM_DISABLED ? "Enabled" : "Disabled") // bloom mode
+		% Util::formatBytes(static_cast<int64_t>(searchStats.bloomSize / 8)) % (searchStats.bloomFillRate * 100) % (searchStats.bloomFalsePositiveRate * 100)
+		% Util::countPercentage(searchStats.cacheHits, searchStats.cacheHits + searchStats.cacheMisses) % searchStats.cacheHits % searchStats.cacheEntries
+	);
+
+	ret += boost::str(boost::format(
+"\r\n\r\n-=[ Partial file lists ]=-\r\n\r\n\
+Partial list cache: %d%% hit rate (%d hits, %d cached lists, %s)")
+
+		% Util::countPercentage(partialListCache.getHits(), partialListCache.getHits() + partialListCache.getMisses()) % partialListCache.getHits()
+		% partialListCache.getSize() % Util::formatBytes(static_cast<int64_t>(partialListCache.getBytes()))
 	);
 
 	return ret;
@@ -1400,14 +1508,13 @@ ShareManager::Directory::Ptr ShareManager::Directory::findDirectoryByName(const
 
 bool ShareManager::isFileShared(const TTHValue& aTTH) const noexcept{
 	RLock l (cs);
-	return tthIndex.find(const_cast<TTHValue*>(&aTTH)) != tthIndex.end();
+	return tthIndex.find(aTTH) != nullptr;
 }
 
 bool ShareManager::isFileShared(const TTHValue& aTTH, ProfileToken aProfile) const noexcept{
 	RLock l (cs);
-	const auto files = tthIndex.equal_range(const_cast<TTHValue*>(&aTTH));
-	for(auto i = files.first; i != files.second; ++i) {
-		if(i->second->getParent()->hasProfile(aProfile)) {
+	for(const auto& f: tthIndex.equal_range(aTTH)) {
+		if(f->getParent()->hasProfile(aProfile)) {
 			return true;
 		}
 	}
@@ -1415,24 +1522,107 @@ bool ShareManager::isFileShared(const TTHValue& aTTH, ProfileToken aProfile) con
 	return false;
 }
 
-bool ShareManager::RefreshInfo::checkContent(const Directory::Ptr& aDirectory) noexcept {
+bool ShareManager::RefreshIndices::checkContent(const Directory::Ptr& aDirectory) noexcept {
 	if (SETTING(SKIP_EMPTY_DIRS_SHARE) && aDirectory->getDirectories().empty() && aDirectory->files.empty()) {
 		// Remove from parent
-		Directory::cleanIndices(*aDirectory.get(), addedSize, tthIndexNew, lowerDirNameMapNew);
+		Directory::cleanIndices(*aDirectory.get(), addedSize, tthIndexNew, lowerDirNameMapNew, searchIndexNew);
 		return false;
 	}
 
 	return true;
 }
 
-ShareManager::ShareBuilder::ShareBuilder(const string& aPath, const Directory::Ptr& aOldRoot, time_t aLastWrite, ShareBloom& bloom_, bool& shutdown_, SharePathValidator& aPathValidator) :
-	shutdown(shutdown_), pathValidator(aPathValidator), RefreshInfo(aPath, aOldRoot, aLastWrite, bloom_) {
+void ShareManager::RefreshIndices::merge(RefreshIndices& aIndices) noexcept {
+	lowerDirNameMapNew.insert(aIndices.lowerDirNameMapNew.begin(), aIndices.lowerDirNameMapNew.end());
+	tthIndexNew.merge(aIndices.tthIndexNew);
+	searchIndexNew.merge(aIndices.searchIndexNew);
+
+	hashSize += aIndices.hashSize;
+	addedSize += aIndices.addedSize;
+
+	aIndices.lowerDirNameMapNew.clear();
+	aIndices.hashSize = 0;
+	aIndices.addedSize = 0;
+}
+
+/**
+* Part of the tree that is walked by a single task
+*
+* The indices are split in segments, each one followed by the subtask that was started after it.
+* Merging them recursively in that order gives the same indices as walking the whole tree in a single thread.
+* The directory tree itself can't be modified by subtasks, except for the content of their own directory.
+*/
+class ShareManager::ShareBuilder::BuildTask : boost::noncopyable {
+public:
+	// Tasks with indices of their own
+	BuildTask() noexcept {
+		addSegment();
+	}
+
+	// The first segment of the root task is stored directly in the builder
+	BuildTask(RefreshIndices& aIndices) noexcept {
+		segments.emplace_back(&aIndices);
+	}
+
+	// Indices for the next directories and files
+	RefreshIndices& getIndices() noexcept {
+		return *segments.back().indices;
+	}
+
+	// The returned task must be started by the caller
+	BuildTask& addSubtask() noexcept {
+		auto subtask = new BuildTask();
+		segments.back().subtask.reset(subtask);
+
+		addSegment();
+		return *subtask;
+	}
+
+	// Move the indices of all segments and subtasks in tree order
+	void mergeTo(RefreshIndices& aIndices) noexcept {
+		for (auto& s: segments) {
+			if (s.indices != &aIndices) {
+				aIndices.merge(*s.indices);
+			}
+
+			if (s.subtask) {
+				s.subtask->mergeTo(aIndices);
+			}
+		}
+	}
+
+	// Directories that can only be checked for content after the subtasks have finished (in post-order)
+	vector<pair<Directory::Ptr, RefreshIndices*>> pendingChecks;
+
+	task_group subtasks;
+private:
+	struct Segment {
+		Segment(RefreshIndices* aIndices) noexcept : indices(aIndices) { }
+		Segment(unique_ptr<RefreshIndices>&& aIndices) noexcept : indices(aIndices.get()), ownIndices(move(aIndices)) { }
+
+		RefreshIndices* indices;
+		unique_ptr<RefreshIndices> ownIndices;
+
+		unique_ptr<BuildTask> subtask;
+	};
+
+	void addSegment() noexcept {
+		segments.emplace_back(unique_ptr<RefreshIndices>(new RefreshIndices()));
+	}
+
+	deque<Segment> segments;
+};
+
+ShareManager::ShareBuilder::ShareBuilder(const string& aPath, const Directory::Ptr& aOldRoot, time_t aLastWrite, ShareBloom& bloom_, bool& shutdown_, SharePathValidator& aPathValidator, bool aParallel) :
+	shutdown(shutdown_), pathValidator(aPathValidator), parallel(aParallel && PARALLEL_TASKS && std::thread::hardware_concurrency() > 1), RefreshInfo(aPath, aOldRoot, aLastWrite, bloom_) {
 
 }
 
 bool ShareManager::ShareBuilder::buildTree() noexcept {
 	try {
-		buildTree(path, Text::toLower(path), newShareDirectory);
+		BuildTask task(*this);
+		runTask(path, Text::toLower(path), newShareDirectory, task);
+		task.mergeTo(*this);
 	} catch (const std::bad_alloc&) {
 		LogManager::getInstance()->message(STRING_F(DIR_REFRESH_FAILED, path % STRING(OUT_OF_MEMORY)), LogMessage::SEV_ERROR);
 		return false;
@@ -1444,13 +1634,40 @@ bool ShareManager::ShareBuilder::buildTree() noexcept {
 	return true;
 }
 
-void ShareManager::ShareBuilder::buildTree(const string& aPath, const string& aPathLower, const Directory::Ptr& aParent) {
+bool ShareManager::ShareBuilder::startSubtask() noexcept {
+	return parallel && queuedTasks.load() < static_cast<int>(std::thread::hardware_concurrency());
+}
+
+void ShareManager::ShareBuilder::runTask(const string& aPath, const string& aPathLower, const Directory::Ptr& aDirectory, BuildTask& task_) {
+	try {
+		buildTree(aPath, aPathLower, aDirectory, task_);
+	} catch (...) {
+		task_.subtasks.cancel();
+		task_.subtasks.wait();
+		throw;
+	}
+
+	task_.subtasks.wait();
+
+	for (const auto& p: task_.pendingChecks) {
+		p.second->checkContent(p.first);
+	}
+}
+
+bool ShareManager::ShareBuilder::buildTree(const string& aPath, const string& aPathLower, const Directory::Ptr& aParent, BuildTask& task_) {
 	ErrorCollector errors;
+	auto hasSubtasks = false;
+
+	// Files are checked from the hash database at once after the directory has been listed
+	vector<DualString> fileNames;
+	StringList namesLower, names;
+	vector<HashedFile> fileInfos;
+
 	FileFindIter end;
 	for(FileFindIter i(aPath, "*"); i != end && !shutdown; ++i) {
 		const auto name = i->getFileName();
 		if(name.empty()) {
-			return;
+			return hasSubtasks;
 		}
 
 		const auto isDirectory = i->isDirectory();
@@ -1479,23 +1696,55 @@ void ShareManager::ShareBuilder::buildTree(const string& aPath, const string& aP
 		}
 
 		if (isDirectory) {
-			auto curDir = Directory::createNormal(move(dualName), aParent, i->getLastWriteTime(), lowerDirNameMapNew, bloom);
-			if (curDir) {
-				buildTree(curPath, curPathLower, curDir);
-				checkContent(curDir);
+			if (startSubtask()) {
+				// The directory is created here as the parent can't be modified from other threads
+				auto& subtask = task_.addSubtask();
+				auto& indices = subtask.getIndices();
+				auto curDir = Directory::createNormal(move(dualName), aParent, i->getLastWriteTime(), indices.lowerDirNameMapNew, bloom, indices.searchIndexNew);
+				if (curDir) {
+					task_.pendingChecks.emplace_back(curDir, &indices);
+					hasSubtasks = true;
+
+					queuedTasks++;
+					task_.subtasks.run([this, curPath, curPathLower, curDir, &subtask] {
+						queuedTasks--;
+						runTask(curPath, curPathLower, curDir, subtask);
+					});
+				}
+			} else {
+				auto& indices = task_.getIndices();
+				auto curDir = Directory::createNormal(move(dualName), aParent, i->getLastWriteTime(), indices.lowerDirNameMapNew, bloom, indices.searchIndexNew);
+				if (curDir) {
+					if (buildTree(curPath, curPathLower, curDir, task_)) {
+						// Subdirectories may still be removed
+						task_.pendingChecks.emplace_back(curDir, &indices);
+						hasSubtasks = true;
+					} else {
+						indices.checkContent(curDir);
+					}
+				}
 			}
 		} else {
 			// Not a directory, assume it's a file...
-			int64_t size = i->getSize();
-			try {
-				HashedFile fi(i->getLastWriteTime(), size);
-				if(HashManager::getInstance()->checkTTH(aPathLower + dualName.getLower(), aPath + name, fi)) {
-					addFile(move(dualName), aParent, fi, tthIndexNew, bloom, addedSize);
+			namesLower.push_back(dualName.getLower());
+			names.push_back(name);
+			fileInfos.emplace_back(i->getLastWriteTime(), i->getSize());
+			fileNames.push_back(move(dualName));
+		}
+	}
+
+	if (!fileNames.empty() && !shutdown) {
+		try {
+			auto& indices = task_.getIndices();
+			auto hashed = HashManager::getInstance()->checkTTHs(aPathLower, aPath, namesLower, names, fileInfos);
+			for (size_t i = 0; i < fileNames.size(); ++i) {
+				if (hashed[i]) {
+					addFile(move(fileNames[i]), aParent, fileInfos[i], indices.tthIndexNew, bloom, indices.searchIndexNew, indices.addedSize);
 				} else {
-					hashSize += size;
+					indices.hashSize += fileInfos[i].getSize();
 				}
-			} catch(const HashException&) {
 			}
+		} catch(const HashException&) {
 		}
 	}
 
@@ -1503,6 +1752,8 @@ void ShareManager::ShareBuilder::buildTree(const string& aPath, const string& aP
 	if (!msg.empty()) {
 		LogManager::getInstance()->message(STRING_F(SHARE_FILES_BLOCKED, aPath % msg), LogMessage::SEV_INFO);
 	}
+
+	return hasSubtasks;
 }
 
 #ifdef _DEBUG
@@ -1518,9 +1769,8 @@ void ShareManager::checkAddedDirNameDebug(const Directory::Ptr& aDir, Directory:
 }
 
 void ShareManager::checkAddedTTHDebug(const Directory::File* aFile, HashFileMap& aTTHIndex) noexcept {
-	auto flst = aTTHIndex.equal_range(const_cast<TTHValue*>(&aFile->getTTH()));
-	auto p = find(flst | map_values, aFile);
-	dcassert(p.base() == flst.second);
+	auto flst = aTTHIndex.equal_range(aFile->getTTH());
+	dcassert(boost::find(flst, aFile) == flst.end());
 }
 
 void ShareManager::validateDirectoryTreeDebug() noexcept {
@@ -1539,7 +1789,7 @@ void ShareManager::validateDirectoryTreeDebug() noexcept {
 	StringList filesDiff, directoriesDiff;
 	if (files.size() != tthIndex.size()) {
 		OrderedStringSet indexed;
-		for (const auto& f : tthIndex | map_values) {
+		for (const auto& f : tthIndex) {
 			indexed.insert(f->getRealPath());
 		}
 
@@ -1577,8 +1827,8 @@ void ShareManager::validateDirectoryRecursiveDebug(const Directory::Ptr& aDir, O
 
 	int64_t realDirectorySize = 0;
 	for (const auto& f : aDir->files) {
-		auto flst = tthIndex.equal_range(const_cast<TTHValue*>(&f->getTTH()));
-		dcassert(boost::count_if(flst | map_values, [&](const Directory::File* aFile) {
+		auto flst = tthIndex.equal_range(f->getTTH());
+		dcassert(boost::count_if(flst, [&](const Directory::File* aFile) {
 			return aFile->getRealPath() == f->getRealPath();
 		}) == 1);
 
@@ -1827,6 +2077,7 @@ bool ShareManager::removeProfile(ProfileToken aToken) noexcept {
 		}
 
 		shareProfiles.erase(remove(shareProfiles.begin(), shareProfiles.end(), aToken), shareProfiles.end());
+		shareRevision++;
 	}
 	
 	fire(ShareManagerListener::ProfileRemoved(), aToken); //removeRootDirectories() might take a while so fire listener first.
@@ -1847,7 +2098,8 @@ bool ShareManager::addRootDirectory(const ShareDirectoryInfoPtr& aDirectoryInfo)
 			dcassert(find_if(rootPaths | map_keys, IsParentOrExact(path, PATH_SEPARATOR)).base() == rootPaths.end());
 
 			// It's a new parent, will be handled in the task thread
-			Directory::createRoot(path, aDirectoryInfo->virtualName, aDirectoryInfo->profiles, aDirectoryInfo->incoming, File::getLastModified(path), rootPaths, lowerDirNameMap, *bloom.get(), 0);
+			Directory::createRoot(path, aDirectoryInfo->virtualName, aDirectoryInfo->profiles, aDirectoryInfo->incoming, File::getLastModified(path), rootPaths, lowerDirNameMap, *bloom.get(), searchIndex, 0);
+			shareRevision++;
 		}
 	}
 
@@ -1880,8 +2132,10 @@ bool ShareManager::removeRootDirectory(const string& aPath) noexcept {
 		rootPaths.erase(k);
 
 		// Remove the root
-		Directory::cleanIndices(*sd, sharedSize, tthIndex, lowerDirNameMap);
+		Directory::cleanIndices(*sd, sharedSize, tthIndex, lowerDirNameMap, searchIndex);
+		shareRevision++;
 		File::deleteFile(sd->getRoot()->getCacheXmlPath());
+		File::deleteFile(sd->getRoot()->getCacheBinaryPath());
 	}
 
 	HashManager::getInstance()->stopHashing(aPath);
@@ -1922,10 +2176,11 @@ bool ShareManager::updateRootDirectory(const ShareDirectoryInfoPtr& aDirectoryIn
 
 			removeDirName(*p->second, lowerDirNameMap);
 			rootDirectory->setName(vName);
-			addDirName(p->second, lowerDirNameMap, *bloom.get());
+			addDirName(p->second, lowerDirNameMap, *bloom.get(), searchIndex);
 
 			rootDirectory->setIncoming(aDirectoryInfo->incoming);
 			rootDirectory->setRootProfiles(aDirectoryInfo->profiles);
+			shareRevision++;
 		} else {
 			return false;
 		}
@@ -2004,10 +2259,10 @@ ShareManager::RefreshInfo::RefreshInfo(const string& aPath, const Directory::Ptr
 	// Use a different directory for building the tree
 	if (aOldShareDirectory && aOldShareDirectory->getRoot()) {
 		newShareDirectory = Directory::createRoot(aPath, aOldShareDirectory->getVirtualName(), aOldShareDirectory->getRoot()->getRootProfiles(), aOldShareDirectory->getRoot()->getIncoming(),
-			aLastWrite, rootPathsNew, lowerDirNameMapNew, bloom_, aOldShareDirectory->getRoot()->getLastRefreshTime());
+			aLastWrite, rootPathsNew, lowerDirNameMapNew, bloom_, searchIndexNew, aOldShareDirectory->getRoot()->getLastRefreshTime());
 	} else {
 		// We'll set the parent later
-		newShareDirectory = Directory::createNormal(Util::getLastDir(aPath), nullptr, aLastWrite, lowerDirNameMapNew, bloom_);
+		newShareDirectory = Directory::createNormal(Util::getLastDir(aPath), nullptr, aLastWrite, lowerDirNameMapNew, bloom_, searchIndexNew);
 	}
 }
 
@@ -2054,15 +2309,17 @@ void ShareManager::runTasks(function<void (float)> progressF /*nullptr*/) noexce
 		}
 
 		ShareBuilderSet refreshDirs;
+		auto parallel = SETTING(REFRESH_THREADING) == SettingsManager::MULTITHREAD_ALWAYS || (SETTING(REFRESH_THREADING) == SettingsManager::MULTITHREAD_MANUAL && (task->type == TYPE_MANUAL || task->type == TYPE_STARTUP_BLOCKING));
 
-		ShareBloom* refreshBloom = t.first == REFRESH_ALL ? new ShareBloom(1 << 20) : bloom.get();
+		// Size the new bloom based on the current content (items may be added from multiple refresh threads)
+		ShareBloom* refreshBloom = t.first == REFRESH_ALL ? new ShareBloom(bloom->getRecommendedSize(SHARE_BLOOM_MIN_SIZE, SHARE_BLOOM_MAX_SIZE)) : bloom.get();
 
 		// Get refresh infos for each path
 		{
 			RLock l (cs);
 			for(auto& refreshPath: dirs) {
 				auto directory = findDirectory(refreshPath);
-				refreshDirs.insert(std::make_shared<ShareBuilder>(refreshPath, directory, File::getLastModified(refreshPath), *refreshBloom, aShutdown, *validator.get()));
+				refreshDirs.insert(std::make_shared<ShareBuilder>(refreshPath, directory, File::getLastModified(refreshPath), *refreshBloom, aShutdown, *validator.get(), parallel));
 			}
 		}
 
@@ -2106,7 +2363,7 @@ void ShareManager::runTasks(function<void (float)> progressF /*nullptr*/) noexce
 		};
 
 		try {
-			if (SETTING(REFRESH_THREADING) == SettingsManager::MULTITHREAD_ALWAYS || (SETTING(REFRESH_THREADING) == SettingsManager::MULTITHREAD_MANUAL && (task->type == TYPE_MANUAL || task->type == TYPE_STARTUP_BLOCKING))) {
+			if (parallel) {
 				TaskScheduler s;
 				parallel_for_each(refreshDirs.begin(), refreshDirs.end(), doRefresh);
 			} else {
@@ -2138,19 +2395,20 @@ void ShareManager::runTasks(function<void (float)> progressF /*nullptr*/) noexce
 #endif
 }
 
-void ShareManager::RefreshInfo::mergeRefreshChanges(Directory::MultiMap& lowerDirNameMap_, Directory::Map& rootPaths_, HashFileMap& tthIndex_, int64_t& totalHash_, int64_t& totalAdded_, ProfileTokenSet* dirtyProfiles_) noexcept {
+void ShareManager::RefreshInfo::mergeRefreshChanges(Directory::MultiMap& lowerDirNameMap_, Directory::Map& rootPaths_, HashFileMap& tthIndex_, ShareSearchIndex& searchIndex_, int64_t& totalHash_, int64_t& totalAdded_, ProfileTokenSet* dirtyProfiles_) noexcept {
 #ifdef _DEBUG
 	for (const auto& d: lowerDirNameMapNew | map_values) {
 		checkAddedDirNameDebug(d, lowerDirNameMap_);
 	}
 
-	for (const auto& f : tthIndexNew | map_values) {
+	for (const auto& f : tthIndexNew) {
 		checkAddedTTHDebug(f, tthIndex_);
 	}
 #endif
 
 	lowerDirNameMap_.insert(lowerDirNameMapNew.begin(), lowerDirNameMapNew.end());
-	tthIndex_.insert(tthIndexNew.begin(), tthIndexNew.end());
+	tthIndex_.merge(tthIndexNew);
+	searchIndex_.merge(searchIndexNew);
 
 	for (const auto& rp : rootPathsNew) {
 		//dcassert(rootPaths_.find(rp.first) == rootPaths_.end());
@@ -2201,6 +2459,7 @@ void ShareManager::setRefreshState(const string& aRefreshPath, RefreshState aSta
 
 bool ShareManager::applyRefreshChanges(RefreshInfo& ri, int64_t& totalHash_, ProfileTokenSet* aDirtyProfiles) {
 	Directory::Ptr parent = nullptr;
+	shareRevision++;
 
 	// Recursively remove the content of this dir from TTHIndex and directory name map
 	if (ri.oldShareDirectory) {
@@ -2212,7 +2471,7 @@ bool ShareManager::applyRefreshChanges(RefreshInfo& ri, int64_t& totalHash_, Pro
 		parent = ri.oldShareDirectory->getParent();
 
 		// Remove the old directory
-		Directory::cleanIndices(*ri.oldShareDirectory, sharedSize, tthIndex, lowerDirNameMap);
+		Directory::cleanIndices(*ri.oldShareDirectory, sharedSize, tthIndex, lowerDirNameMap, searchIndex);
 	}
 
 	// Set the parent for refreshed subdirectories
@@ -2237,7 +2496,7 @@ bool ShareManager::applyRefreshChanges(RefreshInfo& ri, int64_t& totalHash_, Pro
 		}
 	}
 
-	ri.mergeRefreshChanges(lowerDirNameMap, rootPaths, tthIndex, totalHash_, sharedSize, aDirtyProfiles);
+	ri.mergeRefreshChanges(lowerDirNameMap, rootPaths, tthIndex, searchIndex, totalHash_, sharedSize, aDirtyProfiles);
 	dcdebug("Share changes applied for the directory %s\n", ri.path.c_str());
 	return true;
 }
@@ -2298,8 +2557,8 @@ ShareDirectoryInfoList ShareManager::getRootInfos() const noexcept {
 		
 void ShareManager::getBloom(HashBloom& bloom_) const noexcept {
 	RLock l(cs);
-	for(const auto tth: tthIndex | map_keys)
-		bloom_.add(*tth);
+	for(const auto f: tthIndex)
+		bloom_.add(f->getTTH());
 
 	for(const auto& tth: tempShares | map_keys)
 		bloom_.add(tth);
@@ -2329,23 +2588,21 @@ FileList* ShareManager::generateXmlList(ProfileToken aProfile, bool forced /*fal
 	{
 		Lock lFl(fl->cs);
 		if (fl->allowGenerateNew(forced)) {
-			auto tmpName = fl->getFileName().substr(0, fl->getFileName().length() - 4);
 			try {
 				{
-					File f(tmpName, File::RW, File::TRUNCATE | File::CREATE, File::BUFFER_SEQUENTIAL, false);
-
-					toFilelist(f, ADC_ROOT_STR, aProfile, true);
-
-					fl->setXmlListLen(f.getSize());
-
 					File bz(fl->getFileName(), File::WRITE, File::TRUNCATE | File::CREATE, File::BUFFER_SEQUENTIAL, false);
 					// We don't care about the leaves...
 					CalcOutputStream<TTFilter<1024 * 1024 * 1024>, false> bzTree(&bz);
-					FilteredOutputStream<BZFilter, false> bzipper(&bzTree);
+
+					// The XML is compressed while it's being generated (the amount of uncompressed data in memory is limited)
+					ParallelBZOutputStream bzipper(&bzTree);
 					CalcOutputStream<TTFilter<1024 * 1024 * 1024>, false> newXmlFile(&bzipper);
+					BufferedOutputStream<false> xmlBuffer(&newXmlFile, 256 * 1024);
+
+					toFilelist(xmlBuffer, ADC_ROOT_STR, aProfile, true);
+					xmlBuffer.flushBuffers(false);
 
-					newXmlFile.write(f.read());
-					newXmlFile.flushBuffers(false);
+					fl->setXmlListLen(bzipper.getInputSize());
 
 					newXmlFile.getFilter().getTree().finalize();
 					bzTree.getFilter().getTree().finalize();
@@ -2366,8 +2623,6 @@ FileList* ShareManager::generateXmlList(ProfileToken aProfile, bool forced /*fal
 					throw ShareException(UserConnection::FILE_NOT_AVAILABLE);
 				}
 			}
-
-			File::deleteFile(tmpName);
 		}
 	}
 	return fl;
@@ -2378,6 +2633,20 @@ MemoryInputStream* ShareManager::generatePartialList(const string& aVirtualPath,
 		return 0;
 	}
 
+	auto cacheKey = PartialListCache::getKey(aVirtualPath, aProfile, aRecursive);
+
+	uint64_t revision;
+	{
+		RLock l(cs);
+		revision = shareRevision;
+	}
+
+	auto cached = partialListCache.get(cacheKey, revision);
+	if (cached) {
+		dcdebug("Partial list served from cache (%s)\n", aVirtualPath.c_str());
+		return new MemoryInputStream(cached);
+	}
+
 	string xml = Util::emptyString;
 
 	{
@@ -2390,7 +2659,11 @@ MemoryInputStream* ShareManager::generatePartialList(const string& aVirtualPath,
 		return nullptr;
 	} else {
 		dcdebug("Partial list generated (%s)\n", aVirtualPath.c_str());
-		return new MemoryInputStream(xml);
+
+		// The share may have changed after the revision was read but such entries are never returned for newer revisions either
+		auto list = make_shared<const string>(move(xml));
+		partialListCache.put(cacheKey, revision, list);
+		return new MemoryInputStream(list);
 	}
 }
 
@@ -2547,14 +2820,6 @@ void ShareManager::FilelistDirectory::filesToXml(OutputStream& xmlFile, string&
 	}
 }
 
-void ShareManager::Directory::filesToXmlList(OutputStream& xmlFile, string& indent, string& tmp2) const {
-	for(const auto& f: files) {
-		xmlFile.write(indent);
-		xmlFile.write(LITERAL("<File Name=\""));
-		xmlFile.write(SimpleXML::escape(f->name.lowerCaseOnly() ? f->name.getLower() : f->name.getNormal(), tmp2, true));
-		xmlFile.write(LITERAL("\"/>\r\n"));
-	}
-}
 
 ShareManager::Directory::File::File(DualString&& aName, const Directory::Ptr& aParent, const HashedFile& aFileInfo) : 
 	size(aFileInfo.getSize()), parent(aParent.get()), tth(aFileInfo.getRoot()), lastWrite(aFileInfo.getTimeStamp()), name(move(aName)) {
@@ -2586,6 +2851,10 @@ string ShareManager::RootDirectory::getCacheXmlPath() const noexcept {
 	return Util::getPath(Util::PATH_SHARECACHE) + "ShareCache_" + Util::validateFileName(path) + ".xml";
 }
 
+string ShareManager::RootDirectory::getCacheBinaryPath() const noexcept {
+	return Util::getPath(Util::PATH_SHARECACHE) + "ShareCache_" + Util::validateFileName(path) + ".bin";
+}
+
 void ShareManager::RootDirectory::setName(const string& aName) noexcept {
 	virtualName.reset(new DualString(aName));
 }
@@ -2611,35 +2880,26 @@ void ShareManager::saveXmlList(function<void(float)> progressF /*nullptr*/) noex
 
 		try {
 			parallel_for_each(dirtyDirs.begin(), dirtyDirs.end(), [&](const Directory::Ptr& d) {
-				string path = d->getRoot()->getCacheXmlPath();
+				string path = d->getRoot()->getCacheBinaryPath();
 				try {
 					{
-						string indent, tmp;
-
 						//create a backup first in case we get interrupted on creation.
 						File ff(path + ".tmp", File::WRITE, File::TRUNCATE | File::CREATE);
-						BufferedOutputStream<false> xmlFile(&ff);
-
-						xmlFile.write(SimpleXML::utf8Header);
-						xmlFile.write(LITERAL("<Share Version=\"" SHARE_CACHE_VERSION));
-						xmlFile.write(LITERAL("\" Path=\""));
-						xmlFile.write(SimpleXML::escape(d->getRoot()->getPath(), tmp, true));
-
-						xmlFile.write(LITERAL("\" Date=\""));
-						xmlFile.write(SimpleXML::escape(Util::toString(d->getLastWrite()), tmp, true));
-						xmlFile.write(LITERAL("\">\r\n"));
-						indent += '\t';
+						ShareCacheWriter writer(&ff, d->getRoot()->getPath(), d->getLastWrite());
 
 						for (const auto& child : d->getDirectories()) {
-							child->toXmlList(xmlFile, indent, tmp);
+							child->toCache(writer);
 						}
-						d->filesToXmlList(xmlFile, indent, tmp);
+						d->filesToCache(writer);
 
-						xmlFile.write(LITERAL("</Share>"));
+						writer.finish();
 					}
 
 					File::deleteFile(path);
 					File::renameFile(path + ".tmp", path);
+
+					// The XML cache is only read when upgrading from older versions
+					File::deleteFile(d->getRoot()->getCacheXmlPath());
 				} catch (Exception& e) {
 					LogManager::getInstance()->message(STRING_F(SAVE_FAILED_X, path % e.getError()), LogMessage::SEV_WARNING);
 				}
@@ -2659,25 +2919,21 @@ void ShareManager::saveXmlList(function<void(float)> progressF /*nullptr*/) noex
 	lastSave = GET_TICK();
 }
 
-void ShareManager::Directory::toXmlList(OutputStream& xmlFile, string& indent, string& tmp) {
-	xmlFile.write(indent);
-	xmlFile.write(LITERAL("<Directory Name=\""));
-	xmlFile.write(SimpleXML::escape(realName.lowerCaseOnly() ? realName.getLower() : realName.getNormal(), tmp, true));
+void ShareManager::Directory::toCache(ShareCacheWriter& aWriter) const {
+	aWriter.startDirectory(realName.lowerCaseOnly() ? realName.getLower() : realName.getNormal(), lastWrite);
 
-	xmlFile.write(LITERAL("\" Date=\""));
-	xmlFile.write(SimpleXML::escape(Util::toString(lastWrite), tmp, true));
-	xmlFile.write(LITERAL("\">\r\n"));
+	filesToCache(aWriter);
+	for (const auto& d: directories) {
+		d->toCache(aWriter);
+	}
 
-	indent += '\t';
-	filesToXmlList(xmlFile, indent, tmp);
+	aWriter.endDirectory();
+}
 
-	for(const auto& d: directories) {
-		d->toXmlList(xmlFile, indent, tmp);
+void ShareManager::Directory::filesToCache(ShareCacheWriter& aWriter) const {
+	for (const auto& f: files) {
+		aWriter.addFile(f->name.lowerCaseOnly() ? f->name.getLower() : f->name.getNormal(), f->getSize(), f->getLastWrite(), f->getTTH());
 	}
-
-	indent.erase(indent.length()-1);
-	xmlFile.write(indent);
-	xmlFile.write(LITERAL("</Directory>\r\n"));
 }
 
 MemoryInputStream* ShareManager::generateTTHList(const string& dir, bool recurse, ProfileToken aProfile) const noexcept {
@@ -2705,7 +2961,7 @@ MemoryInputStream* ShareManager::generateTTHList(const string& dir, bool recurse
 		dcdebug("Partial NULL");
 		return nullptr;
 	} else {
-		return new MemoryInputStream(tths);
+		return new MemoryInputStream(move(tths));
 	}
 }
 
@@ -2783,7 +3039,7 @@ void ShareManager::nmdcSearch(SearchResultList& l, const string& nmdcString, int
 * but not the parents...
 */
 
-void ShareManager::Directory::search(SearchResultInfo::Set& results_, SearchQuery& aStrings, int aLevel) const noexcept{
+void ShareManager::Directory::search(SearchResultInfo::Set& results_, SearchQuery& aStrings, int aLevel, const SearchCandidates* aCandidates, SearchCandidates::PatternMask aMatchedPatterns) const noexcept{
 	const auto& dirName = getVirtualNameLower();
 	if (aStrings.isExcludedLower(dirName)) {
 		return;
@@ -2796,6 +3052,10 @@ void ShareManager::Directory::search(SearchResultInfo::Set& results_, SearchQuer
 	// Find any matches in the directory name
 	// Subdirectories of fully matched items won't match anything
 	if (aStrings.matchesAnyDirectoryLower(dirName)) {
+		if (aCandidates) {
+			aMatchedPatterns |= SearchCandidates::getMatchedPatterns(aStrings);
+		}
+
 		bool positionsComplete = aStrings.positionsComplete();
 		if (aStrings.itemType != SearchQuery::TYPE_FILE && positionsComplete && aStrings.gt == 0 && aStrings.matchesDate(lastWrite)) {
 			// Full match
@@ -2832,7 +3092,7 @@ void ShareManager::Directory::search(SearchResultInfo::Set& results_, SearchQuer
 	}
 
 	// Match files
-	if(aStrings.itemType != SearchQuery::TYPE_DIRECTORY) {
+	if(aStrings.itemType != SearchQuery::TYPE_DIRECTORY && (!aCandidates || aCandidates->matchesFiles(this, aMatchedPatterns))) {
 		for(const auto& f: files) {
 			if (!aStrings.matchesFileLower(f->name.getLower(), f->getSize(), f->getLastWrite())) {
 				continue;
@@ -2846,7 +3106,11 @@ void ShareManager::Directory::search(SearchResultInfo::Set& results_, SearchQuer
 
 	// Match directories
 	for(const auto& d: directories) {
-		d->search(results_, aStrings, aLevel);
+		if (aCandidates && !aCandidates->matchesTree(d.get(), aMatchedPatterns)) {
+			continue;
+		}
+
+		d->search(results_, aStrings, aLevel, aCandidates, aMatchedPatterns);
 	}
 
 	// Moving to a lower level
@@ -2868,8 +3132,7 @@ void ShareManager::adcSearch(SearchResultList& results, SearchQuery& srch, const
 	RLock l(cs);
 	if(srch.root) {
 		tthSearches++;
-		const auto i = tthIndex.equal_range(const_cast<TTHValue*>(&(*srch.root)));
-		for(auto& f: i | map_values) {
+		for(const auto& f: tthIndex.equal_range(*srch.root)) {
 			if (f->hasProfile(aProfile) && AirUtil::isParentOrExactAdc(aDir, f->getAdcPath())) {
 				f->addSR(results, srch.addParents);
 				return;
@@ -2898,6 +3161,18 @@ void ShareManager::adcSearch(SearchResultList& results, SearchQuery& srch, const
 		}
 	}
 
+	// Same searches are often received from multiple hubs in a short period of time
+	// (the results are appended only to an empty list so that the maximum result count is applied correctly)
+	string cacheKey;
+	if (results.empty()) {
+		cacheKey = SearchCache::getKey(srch, aProfile, aDir);
+		if (searchCache.get(cacheKey, shareRevision, results)) {
+			if (!results.empty())
+				recursiveSearchesResponded++;
+			return;
+		}
+	}
+
 	// Get the search roots
 	Directory::List roots;
 	if (aDir == ADC_ROOT_STR) {
@@ -2908,10 +3183,16 @@ void ShareManager::adcSearch(SearchResultList& results, SearchQuery& srch, const
 
 	auto start = GET_TICK();
 
+	// Skip directories without possible matches
+	unique_ptr<SearchCandidates> candidates(new SearchCandidates(searchIndex, srch));
+	if (!candidates->hasCandidates()) {
+		candidates.reset();
+	}
+
 	// go them through recursively
 	Directory::SearchResultInfo::Set resultInfos;
 	for (const auto& d: roots) {
-		d->search(resultInfos, srch, 0);
+		d->search(resultInfos, srch, 0, candidates.get(), 0);
 	}
 
 	// update statistics
@@ -2932,11 +3213,249 @@ void ShareManager::adcSearch(SearchResultList& results, SearchQuery& srch, const
 		}
 	}
 
+	if (!cacheKey.empty()) {
+		// Still holding the share lock so the revision can't have changed
+		searchCache.put(cacheKey, shareRevision, results);
+	}
+
 	if (!results.empty())
 		recursiveSearchesResponded++;
 }
 
-void ShareManager::addDirName(const Directory::Ptr& aDir, Directory::MultiMap& aDirNames, ShareBloom& aBloom) noexcept {
+string ShareManager::SearchCache::getKey(const SearchQuery& aSearch, const OptionalProfileToken& aProfile, const string& aDir) noexcept {
+	string ret;
+
+	auto addStr = [&ret](const string& aStr) {
+		ret += aStr;
+		ret += '\0';
+	};
+
+	auto addSorted = [&addStr](StringList&& aList) {
+		sort(aList.begin(), aList.end());
+		for (const auto& s : aList) {
+			addStr(s);
+		}
+
+		addStr(Util::emptyString);
+	};
+
+	// The order of the include patterns affects the relevance of the results
+	for (const auto& p : aSearch.include.getPatterns()) {
+		addStr(p.str());
+	}
+	addStr(Util::emptyString);
+
+	{
+		StringList excluded;
+		for (const auto& p : aSearch.exclude.getPatterns()) {
+			excluded.push_back(p.str());
+		}
+
+		addSorted(move(excluded));
+	}
+
+	addSorted(StringList(aSearch.ext));
+	addSorted(StringList(aSearch.noExt));
+
+	addStr(Util::toString(aSearch.gt));
+	addStr(Util::toString(aSearch.lt));
+	addStr(Util::toString(aSearch.minDate));
+	addStr(Util::toString(aSearch.maxDate));
+	addStr(Util::toString(aSearch.maxResults));
+	addStr(Util::toString(aSearch.matchType));
+	addStr(Util::toString(aSearch.itemType));
+	addStr(Util::toString(aSearch.addParents));
+
+	addStr(aProfile ? Util::toString(*aProfile) : "-");
+	addStr(aDir);
+	return ret;
+}
+
+bool ShareManager::SearchCache::get(const string& aKey, uint64_t aRevision, SearchResultList& results_) noexcept {
+	Lock l(cs);
+	auto i = entries.find(aKey);
+	if (i == entries.end()) {
+		misses++;
+		return false;
+	}
+
+	auto& entry = i->second;
+	if (entry.revision != aRevision) {
+		// The share has changed
+		lruKeys.erase(entry.lruPosition);
+		entries.erase(i);
+		misses++;
+		return false;
+	}
+
+	lruKeys.splice(lruKeys.begin(), lruKeys, entry.lruPosition);
+	results_.insert(results_.end(), entry.results.begin(), entry.results.end());
+	hits++;
+	return true;
+}
+
+void ShareManager::SearchCache::put(const string& aKey, uint64_t aRevision, const SearchResultList& aResults) noexcept {
+	Lock l(cs);
+	auto i = entries.find(aKey);
+	if (i != entries.end()) {
+		// Added by another thread
+		auto& entry = i->second;
+		entry.results = aResults;
+		entry.revision = aRevision;
+		lruKeys.splice(lruKeys.begin(), lruKeys, entry.lruPosition);
+		return;
+	}
+
+	if (entries.size() >= maxEntries) {
+		entries.erase(lruKeys.back());
+		lruKeys.pop_back();
+	}
+
+	lruKeys.push_front(aKey);
+	entries.emplace(aKey, Entry({ aResults, aRevision, lruKeys.begin() }));
+}
+
+void ShareManager::SearchCache::clear() noexcept {
+	Lock l(cs);
+	entries.clear();
+	lruKeys.clear();
+}
+
+size_t ShareManager::SearchCache::getSize() const noexcept {
+	Lock l(cs);
+	return entries.size();
+}
+
+string ShareManager::PartialListCache::getKey(const string& aVirtualPath, const OptionalProfileToken& aProfile, bool aRecursive) noexcept {
+	return (aProfile ? Util::toString(*aProfile) : "-") + '\0' + (aRecursive ? "1" : "0") + '\0' + aVirtualPath;
+}
+
+MemoryInputStream::SharedBuffer ShareManager::PartialListCache::get(const string& aKey, uint64_t aRevision) noexcept {
+	Lock l(cs);
+	auto i = entries.find(aKey);
+	if (i == entries.end()) {
+		misses++;
+		return nullptr;
+	}
+
+	auto& entry = i->second;
+	if (entry.revision != aRevision) {
+		// The share has changed
+		removeEntry(i);
+		misses++;
+		return nullptr;
+	}
+
+	lruKeys.splice(lruKeys.begin(), lruKeys, entry.lruPosition);
+	hits++;
+	return entry.list;
+}
+
+void ShareManager::PartialListCache::put(const string& aKey, uint64_t aRevision, const MemoryInputStream::SharedBuffer& aList) noexcept {
+	if (aList->size() > maxBytes / 8) {
+		return;
+	}
+
+	Lock l(cs);
+	auto i = entries.find(aKey);
+	if (i != entries.end()) {
+		// Added by another thread
+		if (i->second.revision >= aRevision) {
+			return;
+		}
+
+		removeEntry(i);
+	}
+
+	while (!lruKeys.empty() && (entries.size() >= maxEntries || bytes + aList->size() > maxBytes)) {
+		removeEntry(entries.find(lruKeys.back()));
+	}
+
+	lruKeys.push_front(aKey);
+	entries.emplace(aKey, Entry({ aList, aRevision, lruKeys.begin() }));
+	bytes += aList->size();
+}
+
+void ShareManager::PartialListCache::removeEntry(unordered_map<string, Entry>::iterator aEntry) noexcept {
+	bytes -= aEntry->second.list->size();
+	lruKeys.erase(aEntry->second.lruPosition);
+	entries.erase(aEntry);
+}
+
+void ShareManager::PartialListCache::clear() noexcept {
+	Lock l(cs);
+	entries.clear();
+	lruKeys.clear();
+	bytes = 0;
+}
+
+size_t ShareManager::PartialListCache::getSize() const noexcept {
+	Lock l(cs);
+	return entries.size();
+}
+
+size_t ShareManager::PartialListCache::getBytes() const noexcept {
+	Lock l(cs);
+	return bytes;
+}
+
+ShareManager::SearchCandidates::SearchCandidates(const ShareSearchIndex& aIndex, const SearchQuery& aSearch) noexcept {
+	const auto& patterns = aSearch.include.getPatterns();
+	auto patternCount = min(patterns.size(), static_cast<size_t>(numeric_limits<PatternMask>::digits));
+
+	levelCandidates.resize(patternCount);
+	treeCandidates.resize(patternCount);
+	for (size_t i = 0; i < patternCount; ++i) {
+		if (!aIndex.getCandidates(patterns[i].str(), levelCandidates[i])) {
+			// Too short
+			continue;
+		}
+
+		indexedPatterns |= static_cast<PatternMask>(1) << i;
+
+		// Parents must be searched as well
+		auto& tree = treeCandidates[i];
+		for (auto d : levelCandidates[i]) {
+			while (d && tree.insert(d).second) {
+				d = d->getParent();
+			}
+		}
+	}
+}
+
+bool ShareManager::SearchCandidates::matches(const vector<ShareSearchIndex::ItemSet>& aCandidates, PatternMask aPatterns, const Directory* aDir) noexcept {
+	for (size_t i = 0; aPatterns != 0; ++i, aPatterns >>= 1) {
+		if ((aPatterns & 1) && aCandidates[i].find(aDir) == aCandidates[i].end()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ShareManager::SearchCandidates::matchesFiles(const Directory* aDir, PatternMask aMatchedPatterns) const noexcept {
+	return matches(levelCandidates, indexedPatterns & ~aMatchedPatterns, aDir);
+}
+
+bool ShareManager::SearchCandidates::matchesTree(const Directory* aDir, PatternMask aMatchedPatterns) const noexcept {
+	return matches(treeCandidates, indexedPatterns & ~aMatchedPatterns, aDir);
+}
+
+ShareManager::SearchCandidates::PatternMask ShareManager::SearchCandidates::getMatchedPatterns(const SearchQuery& aSearch) noexcept {
+	PatternMask ret = 0;
+
+	const auto& positions = aSearch.getLastPositions();
+	auto patternCount = min(positions.size(), static_cast<size_t>(numeric_limits<PatternMask>::digits));
+	for (size_t i = 0; i < patternCount; ++i) {
+		if (positions[i] != string::npos) {
+			ret |= static_cast<PatternMask>(1) << i;
+		}
+	}
+
+	return ret;
+}
+
+void ShareManager::addDirName(const Directory::Ptr& aDir, Directory::MultiMap& aDirNames, ShareBloom& aBloom, ShareSearchIndex& aSearchIndex) noexcept {
 	const auto& nameLower = aDir->getVirtualNameLower();
 
 #ifdef _DEBUG
@@ -2944,6 +3463,7 @@ void ShareManager::addDirName(const Directory::Ptr& aDir, Directory::MultiMap& a
 #endif
 	aDirNames.emplace(const_cast<string*>(&nameLower), aDir);
 	aBloom.add(nameLower);
+	aSearchIndex.add(aDir.get(), nameLower);
 }
 
 void ShareManager::removeDirName(const Directory& aDir, Directory::MultiMap& aDirNames) noexcept {
@@ -3047,7 +3567,7 @@ ShareManager::Directory::Ptr ShareManager::getDirectory(const string& aRealPath)
 	// Create missing directories
 	for (const auto& curName : tokens) {
 		curDir->updateModifyDate();
-		curDir = Directory::createNormal(DualString(curName), curDir, File::getLastModified(curDir->getRealPath()), lowerDirNameMap, *bloom.get());
+		curDir = Directory::createNormal(DualString(curName), curDir, File::getLastModified(curDir->getRealPath()), lowerDirNameMap, *bloom.get(), searchIndex);
 	}
 
 	return curDir;
@@ -3068,13 +3588,14 @@ void ShareManager::onFileHashed(const string& fname, HashedFile& fileInfo) noexc
 			return;
 		}
 
-		addFile(Util::getFileName(fname), d, fileInfo, tthIndex, *bloom.get(), sharedSize, &dirtyProfiles);
+		addFile(Util::getFileName(fname), d, fileInfo, tthIndex, *bloom.get(), searchIndex, sharedSize, &dirtyProfiles);
+		shareRevision++;
 	}
 
 	setProfilesDirty(dirtyProfiles, false);
 }
 
-void ShareManager::addFile(DualString&& aName, const Directory::Ptr& aDir, const HashedFile& aFileInfo, HashFileMap& tthIndex_, ShareBloom& aBloom_, int64_t& sharedSize_, ProfileTokenSet* dirtyProfiles_) noexcept {
+void ShareManager::addFile(DualString&& aName, const Directory::Ptr& aDir, const HashedFile& aFileInfo, HashFileMap& tthIndex_, ShareBloom& aBloom_, ShareSearchIndex& searchIndex_, int64_t& sharedSize_, ProfileTokenSet* dirtyProfiles_) noexcept {
 	{
 		auto i = aDir->files.find(aName.getLower());
 		if (i != aDir->files.end()) {
@@ -3086,7 +3607,7 @@ void ShareManager::addFile(DualString&& aName, const Directory::Ptr& aDir, const
 	}
 
 	auto it = aDir->files.insert_sorted(new Directory::File(move(aName), aDir, aFileInfo)).first;
-	(*it)->updateIndices(aBloom_, sharedSize_, tthIndex_);
+	(*it)->updateIndices(aBloom_, sharedSize_, tthIndex_, searchIndex_);
 
 	if (dirtyProfiles_) {
 		aDir->copyRootProfiles(*dirtyProfiles_, true);
@@ -30,17 +30,21 @@
 #include "DualString.h"
 #include "DupeType.h"
 #include "Exception.h"
+#include "FastAlloc.h"
 #include "HashBloom.h"
 #include "HashedFile.h"
 #include "MerkleTree.h"
+#include "NGramIndex.h"
 #include "Pointer.h"
 #include "SearchQuery.h"
 #include "ShareDirectoryInfo.h"
 #include "ShareProfile.h"
 #include "Singleton.h"
 #include "SortedVector.h"
+#include "Streams.h"
 #include "StringSearch.h"
 #include "TaskQueue.h"
+#include "TTHIndex.h"
 #include "Thread.h"
 #include "TimerManager.h"
 #include "UserConnection.h"
@@ -48,9 +52,8 @@
 namespace dcpp {
 
 class File;
-class OutputStream;
-class MemoryInputStream;
 class SearchQuery;
+class ShareCacheWriter;
 class SharePathValidator;
 
 class FileList;
@@ -242,6 +245,9 @@ public:
 		double averageNameLength = 0;
 		size_t totalNameSize = 0;
 		time_t averageFileAge = 0;
+
+		size_t searchIndexKeys = 0;
+		size_t searchIndexEntries = 0;
 	};
 	optional<ShareItemStats> getShareItemStats() const noexcept;
 
@@ -258,6 +264,14 @@ public:
 		double averageSearchTokenLength = 0;
 
 		uint64_t autoSearches = 0, tthSearches = 0;
+
+		// Share bloom (size in bits, rates 0-1)
+		size_t bloomSize = 0;
+		double bloomFillRate = 0;
+		double bloomFalsePositiveRate = 0;
+
+		uint64_t cacheHits = 0, cacheMisses = 0;
+		size_t cacheEntries = 0;
 	};
 	ShareSearchStats getSearchMatchingStats() const noexcept;
 
@@ -333,6 +347,12 @@ private:
 	uint64_t autoSearches = 0;
 	typedef BloomFilter<5> ShareBloom;
 
+	class Directory;
+	class SearchCandidates;
+
+	// Maps name n-grams to directories (based on the name of the directory and the files inside it)
+	typedef NGramIndex<const Directory*> ShareSearchIndex;
+
 	class RootDirectory : boost::noncopyable {
 		public:
 			typedef shared_ptr<RootDirectory> Ptr;
@@ -365,6 +385,7 @@ private:
 
 			void setName(const string& aName) noexcept;
 			string getCacheXmlPath() const noexcept;
+			string getCacheBinaryPath() const noexcept;
 		private:
 			RootDirectory(const string& aRootPath, const string& aVname, const ProfileTokenSet& aProfiles, bool aIncoming, time_t aLastRefreshTime) noexcept;
 
@@ -388,7 +409,7 @@ private:
 			const string& operator()(const Ptr& a) const noexcept { return a->realName.getLower(); }
 		};
 
-		class File {
+		class File : public FastAlloc<File> {
 		public:
 			struct NameLower {
 				const string& operator()(const File* a) const noexcept { return a->name.getLower(); }
@@ -396,7 +417,7 @@ private:
 
 			//typedef set<File, FileLess> Set;
 			typedef SortedVector<File*, std::vector, string, Compare, NameLower> Set;
-			typedef unordered_multimap<TTHValue*, const Directory::File*> TTHMap;
+			typedef TTHIndex<File> TTHMap;
 
 			File(DualString&& aName, const Directory::Ptr& aParent, const HashedFile& aFileInfo);
 			~File();
@@ -415,7 +436,7 @@ private:
 
 			DualString name;
 
-			void updateIndices(ShareBloom& aBloom_, int64_t& sharedSize_, File::TTHMap& tthIndex_) noexcept;
+			void updateIndices(ShareBloom& aBloom_, int64_t& sharedSize_, File::TTHMap& tthIndex_, ShareSearchIndex& searchIndex_) noexcept;
 			void cleanIndices(int64_t& sharedSize_, TTHMap& tthIndex_) noexcept;
 		};
 
@@ -455,15 +476,15 @@ private:
 		typedef SortedVector<Ptr, std::vector, string, Compare, NameLower> Set;
 		File::Set files;
 
-		static Ptr createNormal(DualString&& aRealName, const Ptr& aParent, time_t aLastWrite, Directory::MultiMap& dirNameMap_, ShareBloom& bloom) noexcept;
-		static Ptr createRoot(const string& aRootPath, const string& aVname, const ProfileTokenSet& aProfiles, bool aIncoming, time_t aLastWrite, Map& rootPaths_, Directory::MultiMap& dirNameMap_, ShareBloom& bloom_, time_t aLastRefreshTime) noexcept;
+		static Ptr createNormal(DualString&& aRealName, const Ptr& aParent, time_t aLastWrite, Directory::MultiMap& dirNameMap_, ShareBloom& bloom, ShareSearchIndex& searchIndex_) noexcept;
+		static Ptr createRoot(const string& aRootPath, const string& aVname, const ProfileTokenSet& aProfiles, bool aIncoming, time_t aLastWrite, Map& rootPaths_, Directory::MultiMap& dirNameMap_, ShareBloom& bloom_, ShareSearchIndex& searchIndex_, time_t aLastRefreshTime) noexcept;
 
 		// Set a new parent for the directory
 		// Possible directories with the same name must be removed from the parent first
 		static bool setParent(const Directory::Ptr& aDirectory, const Directory::Ptr& aParent) noexcept;
 
 		// Remove directory from possible parent and all shared containers
-		static void cleanIndices(Directory& aDirectory, int64_t& sharedSize_, File::TTHMap& tthIndex_, Directory::MultiMap& aDirNames_) noexcept;
+		static void cleanIndices(Directory& aDirectory, int64_t& sharedSize_, File::TTHMap& tthIndex_, Directory::MultiMap& aDirNames_, ShareSearchIndex& searchIndex_) noexcept;
 
 		struct HasRootProfile {
 			HasRootProfile(const OptionalProfileToken& aProfile) : profile(aProfile) { }
@@ -494,14 +515,15 @@ private:
 
 		void getProfileInfo(ProfileToken aProfile, int64_t& totalSize, size_t& filesCount) const noexcept;
 
-		void search(SearchResultInfo::Set& aResults, SearchQuery& aStrings, int aLevel) const noexcept;
+		// Candidates are optional and will be used for skipping directories that can't contain matches
+		void search(SearchResultInfo::Set& aResults, SearchQuery& aStrings, int aLevel, const SearchCandidates* aCandidates, uint64_t aMatchedPatterns) const noexcept;
 
 		void toFileList(FilelistDirectory& aListDir, bool aRecursive);
 		void toTTHList(OutputStream& tthList, string& tmp2, bool recursive) const;
 
 		//for file list caching
-		void toXmlList(OutputStream& xmlFile, string& indent, string& tmp);
-		void filesToXmlList(OutputStream& xmlFile, string& indent, string& tmp2) const;
+		void toCache(ShareCacheWriter& aWriter) const;
+		void filesToCache(ShareCacheWriter& aWriter) const;
 
 		GETSET(time_t, lastWrite, LastWrite);
 
@@ -539,7 +561,7 @@ private:
 
 		Directory::Ptr findDirectoryByName(const string& aName) const noexcept;
 	private:
-		void cleanIndices(int64_t& sharedSize_, File::TTHMap& tthIndex_, Directory::MultiMap& dirNames_) noexcept;
+		void cleanIndices(int64_t& sharedSize_, File::TTHMap& tthIndex_, Directory::MultiMap& dirNames_, ShareSearchIndex::ItemSet& removedDirectories_) noexcept;
 
 		Directory* parent;
 		Set directories;
@@ -570,6 +592,36 @@ private:
 		void filesToXml(OutputStream& xmlFile, string& indent, string& tmp2, bool addDate) const;
 	};
 
+	// Directories that may contain matches for the include patterns of a single search (based on the search index)
+	class SearchCandidates {
+	public:
+		typedef uint64_t PatternMask;
+
+		SearchCandidates(const ShareSearchIndex& aIndex, const SearchQuery& aSearch) noexcept;
+
+		// Returns false if none of the patterns can be used for filtering
+		bool hasCandidates() const noexcept { return indexedPatterns != 0; }
+
+		// Check whether files directly inside the directory may match the patterns that haven't been matched by the parents
+		bool matchesFiles(const Directory* aDir, PatternMask aMatchedPatterns) const noexcept;
+
+		// Check whether anything inside the directory tree may match the patterns that haven't been matched by the parents
+		bool matchesTree(const Directory* aDir, PatternMask aMatchedPatterns) const noexcept;
+
+		// Get the include patterns that were found from the previously matched name
+		static PatternMask getMatchedPatterns(const SearchQuery& aSearch) noexcept;
+	private:
+		static bool matches(const vector<ShareSearchIndex::ItemSet>& aCandidates, PatternMask aPatterns, const Directory* aDir) noexcept;
+
+		PatternMask indexedPatterns = 0;
+
+		// Directories containing each pattern directly
+		vector<ShareSearchIndex::ItemSet> levelCandidates;
+
+		// Level candidates and their parents
+		vector<ShareSearchIndex::ItemSet> treeCandidates;
+	};
+
 	ShareDirectoryInfoPtr getRootInfo(const Directory::Ptr& aDir) const noexcept;
 
 	void addAsyncTask(AsyncF aF) noexcept;
@@ -578,6 +630,8 @@ private:
 	void getDirectoriesByAdcName(const string& aAdcPath, Directory::List& dirs_) const noexcept;
 
 	friend class Singleton<ShareManager>;
+	friend class ShareSearchBenchmark;
+	friend class ShareRefreshBenchmark;
 
 	typedef Directory::File::TTHMap HashFileMap;
 	HashFileMap tthIndex;
@@ -623,38 +677,150 @@ private:
 	// All directory names cached for easy lookups
 	Directory::MultiMap lowerDirNameMap;
 
-	class RefreshInfo : boost::noncopyable {
+	// Name n-grams of all directories and files
+	ShareSearchIndex searchIndex;
+
+	// Results of recent recursive searches
+	// Entries are valid only for the share revision that they were created for
+	class SearchCache : boost::noncopyable {
+	public:
+		SearchCache(size_t aMaxEntries) noexcept : maxEntries(aMaxEntries) { }
+
+		// Normalized key containing all search parameters that may affect the results
+		static string getKey(const SearchQuery& aSearch, const OptionalProfileToken& aProfile, const string& aDir) noexcept;
+
+		bool get(const string& aKey, uint64_t aRevision, SearchResultList& results_) noexcept;
+		void put(const string& aKey, uint64_t aRevision, const SearchResultList& aResults) noexcept;
+		void clear() noexcept;
+
+		size_t getSize() const noexcept;
+		uint64_t getHits() const noexcept { return hits; }
+		uint64_t getMisses() const noexcept { return misses; }
+	private:
+		typedef list<string> KeyList;
+		struct Entry {
+			SearchResultList results;
+			uint64_t revision;
+			KeyList::iterator lruPosition;
+		};
+
+		// Most recently used first
+		KeyList lruKeys;
+		unordered_map<string, Entry> entries;
+
+		const size_t maxEntries;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+
+		mutable CriticalSection cs;
+	};
+
+	SearchCache searchCache;
+
+	// Recently generated partial file lists (the same directories are commonly requested by many users)
+	// Entries are valid only for the share revision that they were created for
+	class PartialListCache : boost::noncopyable {
+	public:
+		PartialListCache(size_t aMaxEntries, size_t aMaxBytes) noexcept : maxEntries(aMaxEntries), maxBytes(aMaxBytes) { }
+
+		static string getKey(const string& aVirtualPath, const OptionalProfileToken& aProfile, bool aRecursive) noexcept;
+
+		MemoryInputStream::SharedBuffer get(const string& aKey, uint64_t aRevision) noexcept;
+
+		// Lists larger than a fraction of the total size limit aren't cached
+		void put(const string& aKey, uint64_t aRevision, const MemoryInputStream::SharedBuffer& aList) noexcept;
+		void clear() noexcept;
+
+		size_t getSize() const noexcept;
+		size_t getBytes() const noexcept;
+		uint64_t getHits() const noexcept { return hits; }
+		uint64_t getMisses() const noexcept { return misses; }
+	private:
+		typedef list<string> KeyList;
+		struct Entry {
+			MemoryInputStream::SharedBuffer list;
+			uint64_t revision;
+			KeyList::iterator lruPosition;
+		};
+
+		void removeEntry(unordered_map<string, Entry>::iterator aEntry) noexcept;
+
+		// Most recently used first
+		KeyList lruKeys;
+		unordered_map<string, Entry> entries;
+
+		const size_t maxEntries;
+		const size_t maxBytes;
+		size_t bytes = 0;
+
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+
+		mutable CriticalSection cs;
+	};
+
+	mutable PartialListCache partialListCache;
+
+	// Incremented whenever searchable share content changes (protected by cs)
+	uint64_t shareRevision = 0;
+
+	// Index changes for a refreshed tree (or a part of it)
+	class RefreshIndices : boost::noncopyable {
+	public:
+		int64_t hashSize = 0;
+		int64_t addedSize = 0;
+		Directory::MultiMap lowerDirNameMapNew;
+		HashFileMap tthIndexNew;
+		ShareSearchIndex searchIndexNew;
+
+		bool checkContent(const Directory::Ptr& aDirectory) noexcept;
+
+		// Move all changes from another instance
+		void merge(RefreshIndices& aIndices) noexcept;
+	};
+
+	class RefreshInfo : public RefreshIndices {
 	public:
 		RefreshInfo(const string& aPath, const Directory::Ptr& aOldRoot, time_t aLastWrite, ShareBloom& bloom_);
 		~RefreshInfo();
 
 		Directory::Ptr oldShareDirectory;
 		Directory::Ptr newShareDirectory;
-		int64_t hashSize = 0;
-		int64_t addedSize = 0;
 		Directory::Map rootPathsNew;
-		Directory::MultiMap lowerDirNameMapNew;
-		HashFileMap tthIndexNew;
 
 		string path;
 
 		ShareManager::ShareBloom& bloom;
 
-		void mergeRefreshChanges(Directory::MultiMap& aDirNameMap, Directory::Map& aRootPaths, HashFileMap& aTTHIndex, int64_t& totalHash, int64_t& totalAdded, ProfileTokenSet* dirtyProfiles) noexcept;
-		bool checkContent(const Directory::Ptr& aDirectory) noexcept;
+		void mergeRefreshChanges(Directory::MultiMap& aDirNameMap, Directory::Map& aRootPaths, HashFileMap& aTTHIndex, ShareSearchIndex& aSearchIndex, int64_t& totalHash, int64_t& totalAdded, ProfileTokenSet* dirtyProfiles) noexcept;
 	};
 
 	class ShareBuilder : public RefreshInfo {
 	public:
-		ShareBuilder(const string& aPath, const Directory::Ptr& aOldRoot, time_t aLastWrite, ShareBloom& bloom_, bool& shutdown_, SharePathValidator& aPathValidator);
+		// Subdirectories are walked in parallel tasks if aParallel is set
+		ShareBuilder(const string& aPath, const Directory::Ptr& aOldRoot, time_t aLastWrite, ShareBloom& bloom_, bool& shutdown_, SharePathValidator& aPathValidator, bool aParallel);
 
 		// Recursive function for building a new share tree from a path
 		bool buildTree() noexcept;
 	private:
-		void buildTree(const string& aPath, const string& aPathLower, const Directory::Ptr& aCurrentDirectory);
+		class BuildTask;
+
+		// Returns true if subtasks were started for the directory or any of its subdirectories
+		bool buildTree(const string& aPath, const string& aPathLower, const Directory::Ptr& aCurrentDirectory, BuildTask& task_);
+
+		// Build the directory and wait for all subtasks that were started from it
+		void runTask(const string& aPath, const string& aPathLower, const Directory::Ptr& aDirectory, BuildTask& task_);
+
+		// Subdirectories are moved to a new task only while there are idle threads
+		bool startSubtask() noexcept;
 
 		bool& shutdown;
 		SharePathValidator& pathValidator;
+
+		const bool parallel;
+
+		// Tasks that haven't been picked by a thread yet
+		atomic<int> queuedTasks { 0 };
 	};
 
 	typedef shared_ptr<ShareBuilder> ShareBuilderPtr;
@@ -675,9 +841,9 @@ private:
 	// Safe to call with non-root directories
 	void setRefreshState(const string& aPath, RefreshState aState, bool aUpdateRefreshTime) noexcept;
 
-	static void addFile(DualString&& aName, const Directory::Ptr& aDir, const HashedFile& fi, HashFileMap& tthIndex_, ShareBloom& aBloom_, int64_t& sharedSize_, ProfileTokenSet* dirtyProfiles_ = nullptr) noexcept;
+	static void addFile(DualString&& aName, const Directory::Ptr& aDir, const HashedFile& fi, HashFileMap& tthIndex_, ShareBloom& aBloom_, ShareSearchIndex& searchIndex_, int64_t& sharedSize_, ProfileTokenSet* dirtyProfiles_ = nullptr) noexcept;
 
-	static void addDirName(const Directory::Ptr& dir, Directory::MultiMap& aDirNames, ShareBloom& aBloom) noexcept;
+	static void addDirName(const Directory::Ptr& dir, Directory::MultiMap& aDirNames, ShareBloom& aBloom, ShareSearchIndex& aSearchIndex) noexcept;
 	static void removeDirName(const Directory& dir, Directory::MultiMap& aDirNames) noexcept;
 
 #ifdef _DEBUG
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include "stdinc.h"
+#include "ShareRefreshBenchmark.h"
+
+#include "File.h"
+#include "HashManager.h"
+#include "ShareManager.h"
+#include "SharePathValidator.h"
+#include "TigerHash.h"
+
+#include "concurrency.h"
+
+#include <chrono>
+
+namespace dcpp {
+
+using std::chrono::steady_clock;
+
+ShareRefreshBenchmark::ShareRefreshBenchmark(const string& aPath, const TreeOptions& aOptions) noexcept : path(aPath), options(aOptions) {
+
+}
+
+size_t ShareRefreshBenchmark::createTree() {
+	// Directories are numbered in breadth-first order (0 is the root)
+	StringList directoryPaths;
+	directoryPaths.reserve(options.directories + 1);
+	directoryPaths.push_back(path);
+
+	size_t created = 0;
+	for (int i = 1; i <= options.directories; ++i) {
+		const auto& parent = directoryPaths[(i - 1) / max(options.directoriesPerLevel, 1)];
+		directoryPaths.push_back(parent + "directory " + Util::toString(i) + PATH_SEPARATOR_STR);
+	}
+
+	for (const auto& directoryPath: directoryPaths) {
+		File::ensureDirectory(directoryPath);
+
+		for (int i = 0; i < options.filesPerDirectory; ++i) {
+			auto filePath = directoryPath + "file " + Util::toString(i) + ".bin";
+			if (File::getSize(filePath) == 1) {
+				continue;
+			}
+
+			File(filePath, File::WRITE, File::CREATE | File::TRUNCATE).write("x", 1);
+
+			// Unique TTH for each path
+			TigerHash hash;
+			hash.update(filePath.data(), filePath.size());
+
+			HashManager::getInstance()->addFile(filePath, HashedFile(TTHValue(hash.finalize()), File::getLastModified(filePath), 1));
+			created++;
+		}
+	}
+
+	return created;
+}
+
+ShareRefreshBenchmark::Result ShareRefreshBenchmark::run(bool aParallel) noexcept {
+	auto sm = ShareManager::getInstance();
+
+	ShareManager::ShareBloom bloom(1 << 20);
+	bool shutdown = false;
+
+	ShareManager::ShareBuilder builder(path, nullptr, File::getLastModified(path), bloom, shutdown, *sm->validator.get(), aParallel);
+
+	Result result;
+	{
+		TaskScheduler s;
+
+		auto start = steady_clock::now();
+		builder.buildTree();
+		result.timeMs = std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+	}
+
+	result.directories = builder.lowerDirNameMapNew.size();
+	result.files = builder.tthIndexNew.size();
+	result.searchIndexEntries = builder.searchIndexNew.getEntryCount();
+	result.hashSize = builder.hashSize;
+
+	StringList paths;
+	for (const auto& d: builder.lowerDirNameMapNew | map_values) {
+		paths.push_back(d->getRealPath());
+	}
+
+	for (const auto& f: builder.tthIndexNew) {
+		paths.push_back(f->getRealPath());
+	}
+
+	sort(paths.begin(), paths.end());
+	for (const auto& p: paths) {
+		boost::hash_combine(result.contentHash, p);
+	}
+
+	return result;
+}
+
+string ShareRefreshBenchmark::formatResult(const Result& aResult) noexcept {
+	return boost::str(boost::format(
+"%d directories, %d files (%d search index entries, %s to hash) in %.1f ms\r\n\
+Content hash: %x")
+
+		% aResult.directories % aResult.files % aResult.searchIndexEntries % Util::formatBytes(aResult.hashSize) % aResult.timeMs
+		% aResult.contentHash
+	);
+}
+
+} // namespace dcpp
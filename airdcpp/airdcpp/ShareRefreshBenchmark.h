@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef DCPLUSPLUS_DCPP_SHARE_REFRESH_BENCHMARK_H
+#define DCPLUSPLUS_DCPP_SHARE_REFRESH_BENCHMARK_H
+
+#include "typedefs.h"
+
+namespace dcpp {
+
+/**
+* Generates a directory tree on disk and builds share trees from it the same way as when refreshing
+*
+* The files are added in the hash database when the tree is created so that the refresh won't queue them for hashing.
+* The instance must not be used for anything else (no shared roots are added in ShareManager).
+*/
+class ShareRefreshBenchmark {
+public:
+	struct TreeOptions {
+		int directories = 500000;
+		int directoriesPerLevel = 8;
+		int filesPerDirectory = 0;
+	};
+
+	struct Result {
+		size_t directories = 0;
+		size_t files = 0;
+		size_t searchIndexEntries = 0;
+		int64_t hashSize = 0;
+		double timeMs = 0;
+
+		// Hash of the sorted directory and file paths
+		size_t contentHash = 0;
+	};
+
+	ShareRefreshBenchmark(const string& aPath, const TreeOptions& aOptions) noexcept;
+
+	// Create the directories and files that don't exist yet
+	// Returns the number of created files
+	// Throws FileException, HashException
+	size_t createTree();
+
+	// Build a share tree (single-threaded or with parallel subdirectory tasks)
+	Result run(bool aParallel) noexcept;
+
+	static string formatResult(const Result& aResult) noexcept;
+private:
+	const string path;
+	const TreeOptions options;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_SHARE_REFRESH_BENCHMARK_H)
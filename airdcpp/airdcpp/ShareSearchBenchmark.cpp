@@ -0,0 +1,476 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "stdinc.h"
+#include "ShareSearchBenchmark.h"
+
+#include "AdcCommand.h"
+#include "Encoder.h"
+#include "NmdcHub.h"
+#include "SearchQuery.h"
+#include "SettingsManager.h"
+#include "ShareManager.h"
+#include "StringTokenizer.h"
+
+#include <chrono>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace dcpp {
+
+using std::chrono::steady_clock;
+
+// Names of the generated roots
+#define BENCHMARK_ROOT_PATH "/synthetic-share/"
+
+// Syllables for generating the words
+static const char* syllables[] = {
+	"ka", "lo", "mi", "ne", "ru", "sa", "to", "vi", "xe", "zo",
+	"bar", "cel", "dun", "fir", "gor", "hal", "jin", "kor", "lum", "mor",
+	"an", "el", "in", "on", "ur", "ax", "ey", "oz", "ib", "ul"
+};
+
+static const char* fileExtensions[] = {
+	"mkv", "avi", "mp3", "flac", "jpg", "nfo", "sfv", "rar", "r00", "r01", "zip", "txt", "iso", "mp4", "epub"
+};
+
+static const char* groupNames[] = {
+	"GRP", "SCENE", "WEB", "REPACK", "iNT", "DUPE"
+};
+
+template<class T, size_t N>
+static const T& randomItem(std::mt19937& aRandom, const T (&aItems)[N]) noexcept {
+	return aItems[std::uniform_int_distribution<size_t>(0, N - 1)(aRandom)];
+}
+
+ShareSearchBenchmark::ShareSearchBenchmark(const TreeOptions& aTreeOptions) noexcept : treeOptions(aTreeOptions) {
+	Random random(treeOptions.seed);
+
+	// Words
+	{
+		StringSet added;
+		std::uniform_int_distribution<int> syllableCount(1, 4);
+		while (static_cast<int>(vocabulary.size()) < treeOptions.vocabularySize) {
+			string word;
+			for (auto i = syllableCount(random); i > 0; --i) {
+				word += randomItem(random, syllables);
+			}
+
+			if (added.insert(word).second) {
+				vocabulary.push_back(word);
+			}
+		}
+	}
+
+	// Zipf weights
+	{
+		double total = 0;
+		wordWeights.reserve(vocabulary.size());
+		for (size_t i = 0; i < vocabulary.size(); ++i) {
+			total += 1.0 / pow(static_cast<double>(i + 1), treeOptions.zipfExponent);
+			wordWeights.push_back(total);
+		}
+
+		for (auto& w : wordWeights) {
+			w /= total;
+		}
+	}
+}
+
+const string& ShareSearchBenchmark::randomWord(Random& aRandom) const noexcept {
+	auto pos = std::upper_bound(wordWeights.begin(), wordWeights.end(), std::uniform_real_distribution<double>(0, 1)(aRandom));
+	return vocabulary[min(static_cast<size_t>(distance(wordWeights.begin(), pos)), vocabulary.size() - 1)];
+}
+
+string ShareSearchBenchmark::randomName(Random& aRandom, bool aIsDirectory) const noexcept {
+	auto wordCount = std::uniform_int_distribution<int>(1, max(treeOptions.maxWordsPerName, 1))(aRandom);
+
+	string ret;
+	for (int i = 0; i < wordCount; ++i) {
+		if (!ret.empty()) {
+			ret += aIsDirectory ? '.' : ' ';
+		}
+
+		auto word = randomWord(aRandom);
+
+		// Mixed case
+		if (aRandom() % 3 == 0) {
+			word[0] = static_cast<char>(toupper(word[0]));
+		}
+
+		ret += word;
+	}
+
+	if (aIsDirectory) {
+		if (aRandom() % 4 == 0) {
+			ret += "-";
+			ret += randomItem(aRandom, groupNames);
+		}
+	} else {
+		ret += ".";
+		ret += randomItem(aRandom, fileExtensions);
+	}
+
+	return ret;
+}
+
+static size_t getHeapUsage() noexcept {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+	auto info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+TTHValue ShareSearchBenchmark::randomTTH(Random& aRandom) noexcept {
+	TTHValue ret;
+	for (auto& b : ret.data) {
+		b = static_cast<uint8_t>(aRandom());
+	}
+
+	return ret;
+}
+
+ShareSearchBenchmark::TreeStats ShareSearchBenchmark::createShare() noexcept {
+	auto sm = ShareManager::getInstance();
+
+	TreeStats stats;
+	auto start = GET_TICK();
+	auto heapStart = getHeapUsage();
+
+	Random random(treeOptions.seed);
+	std::uniform_real_distribution<double> chance(0, 1);
+	std::uniform_int_distribution<int64_t> fileSize(1, 4LL * 1024 * 1024 * 1024);
+	auto now = GET_TIME();
+
+	ProfileTokenSet profiles = { SETTING(DEFAULT_SP) };
+
+	WLock l(sm->cs);
+
+	// Size the bloom based on the expected amount of names
+	{
+		size_t expectedItems = 0;
+		size_t levelDirectories = 1;
+		for (int level = 0; level <= treeOptions.depth; ++level) {
+			expectedItems += levelDirectories * (treeOptions.filesPerDirectory + 1);
+			levelDirectories *= treeOptions.directoriesPerLevel;
+		}
+
+		// Each name adds roughly as many n-grams as it has characters (aim for 50% fill rate)
+		auto expectedNGrams = expectedItems * treeOptions.roots * treeOptions.maxWordsPerName * 4;
+		auto bloomSize = expectedNGrams * 5;
+		sm->bloom.reset(new ShareManager::ShareBloom(min(max(bloomSize, static_cast<size_t>(1 << 20)), static_cast<size_t>(1 << 28))));
+	}
+
+	function<void (const ShareManager::Directory::Ptr&, int)> addContent;
+	addContent = [&](const ShareManager::Directory::Ptr& aDir, int aLevel) {
+		stats.directories++;
+
+		for (int i = 0; i < treeOptions.filesPerDirectory; ++i) {
+			TTHValue tth;
+			if (!sharedTTHs.empty() && chance(random) < treeOptions.duplicateRate) {
+				tth = sharedTTHs[std::uniform_int_distribution<size_t>(0, sharedTTHs.size() - 1)(random)];
+			} else {
+				tth = randomTTH(random);
+				sharedTTHs.push_back(tth);
+			}
+
+			ShareManager::addFile(DualString(randomName(random, false)), aDir, HashedFile(tth, now, fileSize(random)), sm->tthIndex, *sm->bloom.get(), sm->searchIndex, sm->sharedSize);
+		}
+
+		if (aLevel >= treeOptions.depth) {
+			return;
+		}
+
+		for (int i = 0; i < treeOptions.directoriesPerLevel; ++i) {
+			auto dir = ShareManager::Directory::createNormal(DualString(randomName(random, true)), aDir, now, sm->lowerDirNameMap, *sm->bloom.get(), sm->searchIndex);
+			if (dir) {
+				addContent(dir, aLevel + 1);
+			}
+		}
+	};
+
+	for (int i = 0; i < treeOptions.roots; ++i) {
+		auto path = string(BENCHMARK_ROOT_PATH) + "Root" + Util::toString(i) + PATH_SEPARATOR;
+		auto root = ShareManager::Directory::createRoot(path, "Synthetic" + Util::toString(i), profiles, false, now, sm->rootPaths, sm->lowerDirNameMap, *sm->bloom.get(), sm->searchIndex, now);
+		addContent(root, 0);
+	}
+
+	stats.files = sm->tthIndex.size();
+	stats.uniqueTTHs = sharedTTHs.size();
+	sm->shareRevision++;
+
+	stats.buildTimeMs = GET_TICK() - start;
+
+	// Generated TTHs aren't part of the share
+	auto heapEnd = getHeapUsage();
+	if (heapEnd > heapStart) {
+		stats.heapUsage = heapEnd - heapStart - sharedTTHs.capacity() * sizeof(TTHValue);
+	}
+
+	return stats;
+}
+
+StringList ShareSearchBenchmark::generateSearches(const QueryOptions& aOptions) const noexcept {
+	StringList ret;
+	ret.reserve(aOptions.count);
+
+	Random random(aOptions.seed);
+	std::uniform_real_distribution<double> chance(0, 1);
+	std::uniform_int_distribution<int> termCount(1, max(aOptions.maxTerms, 1));
+
+	auto getTerm = [&]() {
+		if (chance(random) < aOptions.missRate) {
+			// Unknown word
+			string ret;
+			for (int i = 0; i < 3; ++i) {
+				ret += randomItem(random, syllables);
+			}
+
+			return ret + "q";
+		}
+
+		return randomWord(random);
+	};
+
+	for (int i = 0; i < aOptions.count; ++i) {
+		bool nmdc = chance(random) < aOptions.nmdcRate;
+		bool tth = chance(random) < aOptions.tthRate;
+
+		TTHValue root;
+		if (tth) {
+			root = (!sharedTTHs.empty() && chance(random) >= aOptions.missRate) ? sharedTTHs[std::uniform_int_distribution<size_t>(0, sharedTTHs.size() - 1)(random)] : randomTTH(random);
+		}
+
+		if (nmdc) {
+			string terms;
+			if (tth) {
+				terms = "TTH:" + root.toBase32();
+			} else {
+				for (auto t = termCount(random); t > 0; --t) {
+					if (!terms.empty()) {
+						terms += '$';
+					}
+
+					terms += getTerm();
+				}
+			}
+
+			ret.push_back("$Search Hub:benchmark F?T?0?" + string(tth ? "9" : "1") + "?" + terms);
+		} else {
+			AdcCommand cmd(AdcCommand::CMD_SCH, AdcCommand::TYPE_BROADCAST);
+			cmd.setFrom(1);
+			if (tth) {
+				cmd.addParam("TR", root.toBase32());
+			} else {
+				for (auto t = termCount(random); t > 0; --t) {
+					cmd.addParam("AN", getTerm());
+				}
+
+				if (chance(random) < 0.1) {
+					cmd.addParam("NO", getTerm());
+				}
+
+				if (chance(random) < 0.1) {
+					cmd.addParam("EX", randomItem(random, fileExtensions));
+				}
+			}
+
+			cmd.addParam("TO", Util::toString(i) + (chance(random) < 0.3 ? "/as" : ""));
+
+			auto line = cmd.toString(1);
+			ret.push_back(line.substr(0, line.size() - 1));
+		}
+	}
+
+	return ret;
+}
+
+bool ShareSearchBenchmark::runAdc(const string& aLine, size_t& results_) noexcept {
+	try {
+		AdcCommand cmd(aLine);
+		if (cmd.getCommand() != AdcCommand::CMD_SCH) {
+			return false;
+		}
+
+		string token;
+		cmd.getParam("TO", 0, token);
+
+		SearchResultList results;
+		SearchQuery srch(cmd.getParameters(), 10);
+		ShareManager::getInstance()->adcSearch(results, srch, SETTING(DEFAULT_SP), CID(), ADC_ROOT_STR, token.find("/as") != string::npos);
+
+		results_ = results.size();
+		return true;
+	} catch (const Exception&) {
+		//...
+	}
+
+	return false;
+}
+
+bool ShareSearchBenchmark::runNmdc(const string& aLine, size_t& results_) noexcept {
+	// $Search seeker F?T?size?type?terms
+	auto i = aLine.find(' ');
+	if (i == string::npos) {
+		return false;
+	}
+
+	auto j = aLine.find(' ', i + 1);
+	if (j == string::npos || aLine.size() < j + 5) {
+		return false;
+	}
+
+	bool isPassive = aLine.compare(i + 1, 4, "Hub:") == 0;
+
+	StringTokenizer<string> params(aLine.substr(j + 1), '?');
+	const auto& tokens = params.getTokens();
+	if (tokens.size() < 5) {
+		return false;
+	}
+
+	int sizeMode;
+	if (tokens[0] == "F") {
+		sizeMode = Search::SIZE_DONTCARE;
+	} else if (tokens[1] == "F") {
+		sizeMode = Search::SIZE_ATLEAST;
+	} else {
+		sizeMode = Search::SIZE_ATMOST;
+	}
+
+	// The terms may contain question marks
+	string terms;
+	for (auto t = tokens.begin() + 4; t != tokens.end(); ++t) {
+		if (!terms.empty()) {
+			terms += '?';
+		}
+
+		terms += *t;
+	}
+
+	terms = NmdcHub::unescape(terms);
+	if (terms.empty()) {
+		return false;
+	}
+
+	SearchResultList results;
+	ShareManager::getInstance()->nmdcSearch(results, terms, sizeMode, Util::toInt64(tokens[2]), Util::toInt(tokens[3]) - 1, isPassive ? 5 : 10, false);
+
+	results_ = results.size();
+	return true;
+}
+
+ShareSearchBenchmark::Report ShareSearchBenchmark::run(const StringList& aSearchLines) noexcept {
+	auto sm = ShareManager::getInstance();
+	auto statsBefore = sm->getSearchMatchingStats();
+
+	Report report;
+	vector<double> times;
+	times.reserve(aSearchLines.size());
+
+	auto start = steady_clock::now();
+	for (const auto& line : aSearchLines) {
+		size_t results = 0;
+		bool valid = false;
+
+		auto searchStart = steady_clock::now();
+		if (line.compare(0, 8, "$Search ") == 0) {
+			valid = runNmdc(line, results);
+			if (valid) {
+				report.nmdcSearches++;
+			}
+		} else if (line.size() > 4 && line.compare(1, 3, "SCH") == 0) {
+			valid = runAdc(line, results);
+			if (valid) {
+				report.adcSearches++;
+			}
+		}
+
+		if (!valid) {
+			report.invalidSearches++;
+			continue;
+		}
+
+		times.push_back(std::chrono::duration<double, std::micro>(steady_clock::now() - searchStart).count());
+
+		report.totalResults += results;
+		if (results > 0) {
+			report.searchesWithResults++;
+		}
+	}
+
+	report.totalTimeMs = std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+	if (times.empty()) {
+		return report;
+	}
+
+	report.searchesPerSecond = static_cast<double>(times.size()) / (report.totalTimeMs / 1000);
+	report.averageResults = static_cast<double>(report.totalResults) / times.size();
+
+	sort(times.begin(), times.end());
+	report.p50 = times[times.size() / 2];
+	report.p99 = times[min(times.size() * 99 / 100, times.size() - 1)];
+	report.max = times.back();
+
+	auto statsAfter = sm->getSearchMatchingStats();
+	auto recursive = statsAfter.recursiveSearches - statsBefore.recursiveSearches;
+	if (recursive > 0) {
+		report.bloomRejectRate = static_cast<double>(statsAfter.filteredSearches - statsBefore.filteredSearches) / recursive;
+	}
+
+	auto cacheHits = statsAfter.cacheHits - statsBefore.cacheHits;
+	auto cacheLookups = cacheHits + statsAfter.cacheMisses - statsBefore.cacheMisses;
+	if (cacheLookups > 0) {
+		report.cacheHitRate = static_cast<double>(cacheHits) / cacheLookups;
+	}
+
+	return report;
+}
+
+string ShareSearchBenchmark::formatTreeStats(const TreeStats& aStats) noexcept {
+	return boost::str(boost::format(
+"Synthetic share: %d directories, %d files (%d unique TTHs), created in %d ms\r\n\
+Heap usage: %s (%d bytes per file)")
+
+		% aStats.directories % aStats.files % aStats.uniqueTTHs % aStats.buildTimeMs
+		% Util::formatBytes(static_cast<int64_t>(aStats.heapUsage)) % Util::countAverage(aStats.heapUsage, aStats.files)
+	);
+}
+
+string ShareSearchBenchmark::formatReport(const Report& aReport) noexcept {
+	return boost::str(boost::format(
+"Searches: %d ADC, %d NMDC (%d invalid lines skipped)\r\n\
+Total time: %.1f ms (%.0f searches per second)\r\n\
+Latency: p50 %.1f us, p99 %.1f us, max %.1f us\r\n\
+Bloom rejects: %.1f%% of text searches\r\n\
+Result cache hits: %.1f%%\r\n\
+Results: %d total (%.2f per search, %d searches with results)")
+
+		% aReport.adcSearches % aReport.nmdcSearches % aReport.invalidSearches
+		% aReport.totalTimeMs % aReport.searchesPerSecond
+		% aReport.p50 % aReport.p99 % aReport.max
+		% (aReport.bloomRejectRate * 100)
+		% (aReport.cacheHitRate * 100)
+		% aReport.totalResults % aReport.averageResults % aReport.searchesWithResults
+	);
+}
+
+} // namespace dcpp
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_SHARE_SEARCH_BENCHMARK_H
+#define DCPLUSPLUS_DCPP_SHARE_SEARCH_BENCHMARK_H
+
+#include "typedefs.h"
+
+#include "HashValue.h"
+#include "TigerHash.h"
+
+#include <random>
+
+namespace dcpp {
+
+/**
+* Generates a synthetic in-memory share and replays incoming searches against it
+*
+* The generated directories are added in ShareManager without accessing the filesystem
+* (the share must not contain other roots and the instance should not be used for anything else)
+*/
+class ShareSearchBenchmark {
+public:
+	struct TreeOptions {
+		int roots = 4;
+		int depth = 4;
+		int directoriesPerLevel = 6;
+		int filesPerDirectory = 20;
+
+		// Names are built from a vocabulary of words with Zipf-distributed popularity
+		int vocabularySize = 20000;
+		int maxWordsPerName = 4;
+		double zipfExponent = 1.0;
+
+		// Share of files that reuse a TTH of an earlier file (0-1)
+		double duplicateRate = 0.05;
+
+		uint32_t seed = 1;
+	};
+
+	struct QueryOptions {
+		int count = 100000;
+
+		// Shares of NMDC and TTH searches (0-1), the rest are ADC text searches
+		double nmdcRate = 0.3;
+		double tthRate = 0.3;
+
+		// Share of search terms that don't exist in the vocabulary (0-1)
+		double missRate = 0.2;
+		int maxTerms = 3;
+
+		uint32_t seed = 2;
+	};
+
+	struct TreeStats {
+		size_t directories = 0;
+		size_t files = 0;
+		size_t uniqueTTHs = 0;
+		uint64_t buildTimeMs = 0;
+
+		// Heap memory allocated for the share (0 if not supported on this platform)
+		size_t heapUsage = 0;
+	};
+
+	struct Report {
+		size_t adcSearches = 0;
+		size_t nmdcSearches = 0;
+		size_t invalidSearches = 0;
+
+		double totalTimeMs = 0;
+		double searchesPerSecond = 0;
+
+		// Latency of a single search (microseconds)
+		double p50 = 0;
+		double p99 = 0;
+		double max = 0;
+
+		// Counted from ShareManager search statistics (0-1)
+		double bloomRejectRate = 0;
+		double cacheHitRate = 0;
+
+		size_t totalResults = 0;
+		double averageResults = 0;
+		size_t searchesWithResults = 0;
+	};
+
+	ShareSearchBenchmark(const TreeOptions& aTreeOptions) noexcept;
+
+	// Add the synthetic roots in ShareManager
+	TreeStats createShare() noexcept;
+
+	// Generate a search mix using words from the share vocabulary
+	// The returned lines are formatted as incoming ADC (BSCH) and NMDC ($Search) commands
+	StringList generateSearches(const QueryOptions& aOptions) const noexcept;
+
+	// Pass searches through ShareManager::adcSearch/nmdcSearch
+	// Other lines than ADC SCH and NMDC $Search commands are ignored
+	Report run(const StringList& aSearchLines) noexcept;
+
+	static string formatTreeStats(const TreeStats& aStats) noexcept;
+	static string formatReport(const Report& aReport) noexcept;
+private:
+	const TreeOptions treeOptions;
+	StringList vocabulary;
+
+	// Cumulative word probabilities for Zipf sampling
+	vector<double> wordWeights;
+
+	vector<TTHValue> sharedTTHs;
+
+	typedef std::mt19937 Random;
+
+	const string& randomWord(Random& aRandom) const noexcept;
+	string randomName(Random& aRandom, bool aIsDirectory) const noexcept;
+	static TTHValue randomTTH(Random& aRandom) noexcept;
+
+	bool runAdc(const string& aLine, size_t& results_) noexcept;
+	bool runNmdc(const string& aLine, size_t& results_) noexcept;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_SHARE_SEARCH_BENCHMARK_H)
@@ -24,6 +24,14 @@
 #include "Text.h"
 #include "Streams.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define XML_SCAN_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
 namespace dcpp {
 
 static bool isSpace(int c) {
@@ -67,6 +75,107 @@ static bool isNameChar(int c) {
 		;
 }
 
+#ifdef XML_SCAN_SSE2
+static size_t firstSetBit(int mask) {
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, static_cast<unsigned long>(mask));
+	return index;
+#else
+	return static_cast<size_t>(__builtin_ctz(static_cast<unsigned int>(mask)));
+#endif
+}
+#endif
+
+// Returns the position of the first a or b (or len if neither one is found)
+static size_t findAny(const char* data, size_t len, char a, char b) {
+	size_t i = 0;
+
+#ifdef XML_SCAN_SSE2
+	const auto va = _mm_set1_epi8(a);
+	const auto vb = _mm_set1_epi8(b);
+	for(; i + 16 <= len; i += 16) {
+		auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		auto mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+		if(mask != 0) {
+			return i + firstSetBit(mask);
+		}
+	}
+#endif
+
+	for(; i < len; ++i) {
+		if(data[i] == a || data[i] == b) {
+			return i;
+		}
+	}
+
+	return len;
+}
+
+static bool isAscii(const char* data, size_t len) {
+	size_t i = 0;
+
+#ifdef XML_SCAN_SSE2
+	for(; i + 16 <= len; i += 16) {
+		if(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i))) != 0) {
+			return false;
+		}
+	}
+#endif
+
+	for(; i < len; ++i) {
+		if(static_cast<unsigned char>(data[i]) >= 0x80) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Decodes the entity reference (there must be at least 7 characters available)
+// Returns the length of the reference or 0 if it isn't valid
+static size_t parseEntity(const char* p, string& d_) {
+	if(p[1] == 'l' && p[2] == 't' && p[3] == ';') {
+		d_.append(1, '<');
+		return 4;
+	} else if(p[1] == 'g' && p[2] == 't' && p[3] == ';') {
+		d_.append(1, '>');
+		return 4;
+	} else if(p[1] == 'a' && p[2] == 'm' && p[3] == 'p' && p[4] == ';') {
+		d_.append(1, '&');
+		return 5;
+	} else if(p[1] == 'q' && p[2] == 'u' && p[3] == 'o' && p[4] == 't' && p[5] == ';') {
+		d_.append(1, '"');
+		return 6;
+	} else if(p[1] == 'a' && p[2] == 'p' && p[3] == 'o' && p[4] == 's' && p[5] == ';') {
+		d_.append(1, '\'');
+		return 6;
+		
+	// Ignore &#00000 decimal and &#x0000 hex values to avoid error, they wouldn't be parsed anyway
+	} else if(p[1] == '#' && isdigit(p[2]) && p[3] == ';') {
+		return 4;
+	} else if(p[1] == '#' && isdigit(p[2]) && isdigit(p[3]) && p[4] == ';') {
+		return 5;
+	} else if(p[1] == '#' && isdigit(p[2]) && isdigit(p[3]) && isdigit(p[4]) && p[5] == ';') {
+		return 6;
+	} else if(p[1] == '#' && isdigit(p[2]) && isdigit(p[3]) && isdigit(p[4]) && isdigit(p[5]) && p[6] == ';') {
+		return 7;
+	} else if(p[1] == '#' && isdigit(p[2]) && isdigit(p[3]) && isdigit(p[4]) && isdigit(p[5]) && isdigit(p[6]) && p[7] == ';') {
+		return 8;
+		
+	} else if(p[1] == '#' && (p[2] == 'x' ||  p[2] == 'X') && isxdigit(p[3]) && p[4] == ';') {
+		return 5;
+	} else if(p[1] == '#' && (p[2] == 'x' ||  p[2] == 'X') && isxdigit(p[3]) && isxdigit(p[4]) && p[5] == ';') {
+		return 6;
+	} else if(p[1] == '#' && (p[2] == 'x' ||  p[2] == 'X') && isxdigit(p[3]) && isxdigit(p[4]) && isxdigit(p[5]) && p[6] == ';') {
+		return 7;
+	} else if(p[1] == '#' && (p[2] == 'x' ||  p[2] == 'X') && isxdigit(p[3]) && isxdigit(p[4]) && isxdigit(p[5]) && isxdigit(p[6]) && p[7] == ';') {
+		return 8;
+	}
+
+	return 0;
+}
+
 SimpleXMLReader::ThreadedCallBack::ThreadedCallBack(const string& path) {
 	file.reset(new File(path, dcpp::File::READ, dcpp::File::OPEN, File::BUFFER_SEQUENTIAL, false));
 	size = file->getSize();
@@ -88,7 +197,8 @@ SimpleXMLReader::SimpleXMLReader(SimpleXMLReader::CallBack* callback, int aFlags
 	bufPos(0), pos(0), cb(callback), state(STATE_START), flags(aFlags)
 {
 	elements.reserve(64);
-	attribs.reserve(16);
+	attribPos.reserve(16);
+	attribs.views.reserve(16);
 }
 
 void SimpleXMLReader::append(std::string& str, size_t maxLen, int c) {
@@ -127,6 +237,51 @@ const string& SimpleXMLReader::CallBack::getAttrib(StringPairList& attribs, cons
 	}
 }
 
+boost::string_ref SimpleXMLReader::Attribs::get(const string& name, size_t hint) const noexcept {
+	if(hint < views.size() && views[hint].first == name) {
+		return views[hint].second;
+	}
+
+	for(const auto& a: views) {
+		if(a.first == name) {
+			return a.second;
+		}
+	}
+
+	return boost::string_ref();
+}
+
+StringPairList& SimpleXMLReader::Attribs::toList() const {
+	// Assign the existing strings so that their buffers are reused
+	list.resize(views.size());
+	for(size_t i = 0; i < views.size(); ++i) {
+		list[i].first.assign(views[i].first.data(), views[i].first.size());
+		list[i].second.assign(views[i].second.data(), views[i].second.size());
+	}
+
+	return list;
+}
+
+void SimpleXMLReader::startTag(bool simple) {
+	auto& views = attribs.views;
+	views.clear();
+
+	for(size_t i = 0; i < attribPos.size(); ++i) {
+		const auto& a = attribPos[i];
+		auto valueEnd = i + 1 < attribPos.size() ? attribPos[i + 1].name : attribArena.size();
+
+		views.emplace_back(
+			boost::string_ref(attribArena.data() + a.name, a.value - a.name),
+			boost::string_ref(attribArena.data() + a.value, valueEnd - a.value)
+		);
+	}
+
+	cb->startTagView(elements.back(), attribs, simple);
+
+	attribPos.clear();
+	attribArena.clear();
+}
+
 bool SimpleXMLReader::literal(const char* lit, size_t len, bool withSpace, ParseState newState) {
 	string::size_type n = 0, nend = bufSize();
 	for(; n < nend && n < len; ++n) {
@@ -152,6 +307,165 @@ bool SimpleXMLReader::literal(const char* lit, size_t len, bool withSpace, Parse
 	return true;
 }
 
+bool SimpleXMLReader::elementFast() {
+	if(!needChars(2) || charAt(0) != '<') {
+		return false;
+	}
+
+	if(charAt(1) == '/') {
+		return elementEndFast();
+	}
+
+	if(!isNameStartChar(charAt(1)) || elements.size() >= MAX_NESTING) {
+		return false;
+	}
+
+	dcassert(attribPos.empty() && attribArena.empty());
+
+	// Anything unusual (including a tag that doesn't fit in the buffer) is left for the state machine
+	auto fallback = [this] {
+		attribPos.clear();
+		attribArena.clear();
+		return false;
+	};
+
+	const char* p = buf.data() + bufPos + 1;
+	const char* end = buf.data() + buf.size();
+
+	const char* name = p;
+	while(p < end && isNameChar(*p)) {
+		++p;
+	}
+
+	const auto nameLen = static_cast<size_t>(p - name);
+	if(p == end || nameLen > MAX_NAME_SIZE || (!isSpace(*p) && *p != '/' && *p != '>')) {
+		return false;
+	}
+
+	bool simple = false;
+	for(;;) {
+		while(p < end && isSpace(*p)) {
+			++p;
+		}
+
+		if(p == end) {
+			return fallback();
+		}
+
+		if(*p == '>') {
+			++p;
+			break;
+		}
+
+		if(*p == '/') {
+			if(p + 1 == end || p[1] != '>') {
+				return fallback();
+			}
+
+			simple = true;
+			p += 2;
+			break;
+		}
+
+		// Attribute name
+		if(!isNameStartChar(*p)) {
+			return fallback();
+		}
+
+		const char* attribName = p;
+		while(p < end && isNameChar(*p)) {
+			++p;
+		}
+
+		if(static_cast<size_t>(p - attribName) > MAX_NAME_SIZE) {
+			return fallback();
+		}
+
+		attribPos.push_back({ attribArena.size(), string::npos });
+		attribArena.append(attribName, p);
+		auto& attrib = attribPos.back();
+		attrib.value = attribArena.size();
+
+		while(p < end && isSpace(*p)) {
+			++p;
+		}
+
+		if(p == end || *p != '=') {
+			return fallback();
+		}
+
+		++p;
+		while(p < end && isSpace(*p)) {
+			++p;
+		}
+
+		if(p == end || (*p != '"' && *p != '\'')) {
+			return fallback();
+		}
+
+		// Attribute value
+		const char quote = *p++;
+		for(;;) {
+			auto i = findAny(p, end - p, quote, '&');
+			attribArena.append(p, i);
+			p += i;
+
+			if(p == end || attribArena.size() - attrib.value > MAX_VALUE_SIZE) {
+				return fallback();
+			}
+
+			if(*p == quote) {
+				++p;
+				break;
+			}
+
+			auto len = end - p > 6 ? parseEntity(p, attribArena) : 0;
+			if(len == 0) {
+				return fallback();
+			}
+
+			p += len;
+		}
+
+		decodeString(attribArena, attrib.value);
+	}
+
+	// Pending data is passed on at the same position as with the state machine
+	const auto len = static_cast<size_t>(p - (buf.data() + bufPos));
+	advancePos(2);
+	flushData();
+
+	elements.emplace_back(name, nameLen);
+	advancePos(len - 2);
+
+	startTag(simple);
+	if(simple) {
+		elements.pop_back();
+	}
+
+	return true;
+}
+
+bool SimpleXMLReader::elementEndFast() {
+	if(elements.empty()) {
+		return false;
+	}
+
+	const auto& top = elements.back();
+	if(!needChars(top.size() + 3) || buf.compare(bufPos + 2, top.size(), top) != 0 || charAt(top.size() + 2) != '>') {
+		return false;
+	}
+
+	advancePos(2);
+	flushData();
+
+	advancePos(top.size() + 1);
+
+	cb->endTag(top);
+	elements.pop_back();
+	return true;
+}
+
 bool SimpleXMLReader::element() {
 	if(!needChars(2)) {
 		return true;
@@ -195,8 +509,7 @@ bool SimpleXMLReader::elementName() {
 		} else if(c == '>') {
 			append(elements.back(), MAX_NAME_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
 
-			cb->startTag(elements.back(), attribs, false);
-			attribs.clear();
+			startTag(false);
 
 			state = STATE_CONTENT;
 			advancePos(i + 1);
@@ -219,8 +532,8 @@ bool SimpleXMLReader::elementAttr() {
 
 	int c = charAt(0);
 	if(isNameStartChar(c)) {
-		attribs.emplace_back();
-		append(attribs.back().first, MAX_NAME_SIZE, c);
+		attribPos.push_back({ attribArena.size(), string::npos });
+		attribArena.push_back(static_cast<char>(c));
 
 		state = STATE_ELEMENT_ATTR_NAME;
 		advancePos(1);
@@ -232,18 +545,23 @@ bool SimpleXMLReader::elementAttr() {
 }
 
 bool SimpleXMLReader::elementAttrName() {
+	auto& attrib = attribPos.back();
+	const auto maxLen = attrib.name + MAX_NAME_SIZE;
+
 	size_t i = 0;
 	for(size_t iend = bufSize(); i < iend; ++i) {
 		int c = charAt(i);
 
 		if(isSpace(c)) {
-			append(attribs.back().first, MAX_NAME_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+			append(attribArena, maxLen, buf.begin() + bufPos, buf.begin() + bufPos + i);
+			attrib.value = attribArena.size();
 
 			state = STATE_ELEMENT_ATTR_EQ;
 			advancePos(i + 1);
 			return true;
 		} else if(c == '=') {
-			append(attribs.back().first, MAX_NAME_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+			append(attribArena, maxLen, buf.begin() + bufPos, buf.begin() + bufPos + i);
+			attrib.value = attribArena.size();
 
 			state = STATE_ELEMENT_ATTR_VALUE;
 			advancePos(i + 1);
@@ -253,34 +571,33 @@ bool SimpleXMLReader::elementAttrName() {
 		}
 	}
 
-	append(attribs.back().first, MAX_NAME_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+	append(attribArena, maxLen, buf.begin() + bufPos, buf.begin() + bufPos + i);
 	advancePos(i);
 	return true;
 }
 
 bool SimpleXMLReader::elementAttrValue() {
-	size_t i = 0;
-	for(size_t iend = bufSize(); i < iend; ++i) {
-		int c = charAt(i);
+	const auto valueStart = attribPos.back().value;
+	const auto maxLen = valueStart + MAX_VALUE_SIZE;
+	const char quote = state == STATE_ELEMENT_ATTR_VALUE_APOS ? '\'' : '"';
 
-		if((state == STATE_ELEMENT_ATTR_VALUE_APOS && c == '\'') || (state == STATE_ELEMENT_ATTR_VALUE_QUOT && c == '"')) {
-			append(attribs.back().second, MAX_VALUE_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+	auto i = findAny(buf.data() + bufPos, bufSize(), quote, '&');
+	append(attribArena, maxLen, buf.begin() + bufPos, buf.begin() + bufPos + i);
 
-			decodeString(attribs.back().second);
+	if(i == bufSize()) {
+		advancePos(i);
+		return true;
+	}
 
-			state = STATE_ELEMENT_ATTR;
-			advancePos(i + 1);
-			return true;
-		} else if(c == '&') {
-			append(attribs.back().second, MAX_VALUE_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
-			advancePos(i);
-			return entref(attribs.back().second);
-		}
+	if(charAt(i) == '&') {
+		advancePos(i);
+		return entref(attribArena, maxLen);
 	}
 
-	append(attribs.back().second, MAX_VALUE_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
-	advancePos(i);
+	decodeString(attribArena, valueStart);
 
+	state = STATE_ELEMENT_ATTR;
+	advancePos(i + 1);
 	return true;
 }
 
@@ -290,9 +607,8 @@ bool SimpleXMLReader::elementEndSimple() {
 	}
 
 	if(charAt(0) == '>') {
-		cb->startTag(elements.back(), attribs, true);
+		startTag(true);
 		elements.pop_back();
-		attribs.clear();
 
 		state = STATE_CONTENT;
 		advancePos(1);
@@ -308,8 +624,7 @@ bool SimpleXMLReader::elementEndComplex() {
 	}
 
 	if(charAt(0) == '>') {
-		cb->startTag(elements.back(), attribs, false);
-		attribs.clear();
+		startTag(false);
 
 		state = STATE_CONTENT;
 		advancePos(1);
@@ -372,11 +687,12 @@ bool SimpleXMLReader::declEncodingValue() {
 
 		if((state == STATE_DECL_ENCODING_NAME_APOS && c == '\'') || (state == STATE_DECL_ENCODING_NAME_QUOT && c == '"')) {
 			encoding = Text::toLower(encoding);
+			utf8Encoding = compare(encoding, Text::utf8) == 0;
 			state = STATE_DECL_STANDALONE;
 			advancePos(1);
 			return true;
 		} else if(c == '&') {
-			if(!entref(encoding)) {
+			if(!entref(encoding, MAX_VALUE_SIZE)) {
 				return false;
 			}
 		} else {
@@ -390,18 +706,22 @@ bool SimpleXMLReader::declEncodingValue() {
 
 bool SimpleXMLReader::comment() {
 	while(bufSize() > 0) {
-		int c = charAt(0);
+		auto p = static_cast<const char*>(memchr(buf.data() + bufPos, '-', bufSize()));
+		if(!p) {
+			advancePos(bufSize());
+			return true;
+		}
+
+		advancePos(p - (buf.data() + bufPos));
 
 		// TODO We shouldn't allow ---> to end a comment
-		if(c == '-') {
-			if(!needChars(3)) {
-				return true;
-			}
-			if(charAt(1) == '-' && charAt(2) == '>') {
-				state = STATE_CONTENT;
-				advancePos(3);
-				return true;
-			}
+		if(!needChars(3)) {
+			return true;
+		}
+		if(charAt(1) == '-' && charAt(2) == '>') {
+			state = STATE_CONTENT;
+			advancePos(3);
+			return true;
 		}
 
 		advancePos(1);
@@ -412,88 +732,44 @@ bool SimpleXMLReader::comment() {
 
 bool SimpleXMLReader::cdata() {
 	while (bufSize() > 0) {
-		int c = charAt(0);
+		auto p = static_cast<const char*>(memchr(buf.data() + bufPos, ']', bufSize()));
+		auto i = p ? static_cast<size_t>(p - (buf.data() + bufPos)) : bufSize();
 
-		if (c == ']') {
-			if (!needChars(3)) {
-				return true;
-			}
-			if (charAt(1) == ']' && charAt(2) == '>') {
-				state = STATE_CONTENT;
-				advancePos(3);
-				return true;
-			}
+		append(value, MAX_VALUE_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
+		advancePos(i);
+
+		if (!p || !needChars(3)) {
+			return true;
 		}
 
-		append(value, MAX_VALUE_SIZE, c);
+		if (charAt(1) == ']' && charAt(2) == '>') {
+			state = STATE_CONTENT;
+			advancePos(3);
+			return true;
+		}
+
+		append(value, MAX_VALUE_SIZE, ']');
 		advancePos(1);
 	}
 
 	return true;
 }
 
-bool SimpleXMLReader::entref(string& d) {
-	if(d.size() > MAX_VALUE_SIZE) {
+bool SimpleXMLReader::entref(string& d, size_t maxLen) {
+	if(d.size() > maxLen) {
 		error("Buffer overflow");
 	}
 
 	if(bufSize() > 6) {
-		if(charAt(1) == 'l' && charAt(2) == 't' && charAt(3) == ';') {
-			d.append(1, '<');
-			advancePos(4);
-			return true;
-		} else if(charAt(1) == 'g' && charAt(2) == 't' && charAt(3) == ';') {
-			d.append(1, '>');
-			advancePos(4);
-			return true;
-		} else if(charAt(1) == 'a' && charAt(2) == 'm' && charAt(3) == 'p' && charAt(4) == ';') {
-			d.append(1, '&');
-			advancePos(5);
-			return true;
-		} else if(charAt(1) == 'q' && charAt(2) == 'u' && charAt(3) == 'o' && charAt(4) == 't' && charAt(5) == ';') {
-			d.append(1, '"');
-			advancePos(6);
-			return true;
-		} else if(charAt(1) == 'a' && charAt(2) == 'p' && charAt(3) == 'o' && charAt(4) == 's' && charAt(5) == ';') {
-			d.append(1, '\'');
-			advancePos(6);
-			return true;
-			
-		// Ignore &#00000 decimal and &#x0000 hex values to avoid error, they wouldn't be parsed anyway
-		} else if(charAt(1) == '#' && isdigit(charAt(2)) && charAt(3) == ';') {
-			advancePos(4);
-			return true;
-		} else if(charAt(1) == '#' && isdigit(charAt(2)) && isdigit(charAt(3)) && charAt(4) == ';') {
-			advancePos(5);
-			return true;
-		} else if(charAt(1) == '#' && isdigit(charAt(2)) && isdigit(charAt(3)) && isdigit(charAt(4)) && charAt(5) == ';') {
-			advancePos(6);
-			return true;
-		} else if(charAt(1) == '#' && isdigit(charAt(2)) && isdigit(charAt(3)) && isdigit(charAt(4)) && isdigit(charAt(5)) && charAt(6) == ';') {
-			advancePos(7);
-			return true;
-		} else if(charAt(1) == '#' && isdigit(charAt(2)) && isdigit(charAt(3)) && isdigit(charAt(4)) && isdigit(charAt(5)) && isdigit(charAt(6)) && charAt(7) == ';') {
-			advancePos(8);
-			return true;
-			
-		} else if(charAt(1) == '#' && (charAt(2) == 'x' ||  charAt(2) == 'X') && isxdigit(charAt(3)) && charAt(4) == ';') {
-			advancePos(5);
-			return true;
-		} else if(charAt(1) == '#' && (charAt(2) == 'x' ||  charAt(2) == 'X') && isxdigit(charAt(3)) && isxdigit(charAt(4)) && charAt(5) == ';') {
-			advancePos(6);
-			return true;
-		} else if(charAt(1) == '#' && (charAt(2) == 'x' ||  charAt(2) == 'X') && isxdigit(charAt(3)) && isxdigit(charAt(4)) && isxdigit(charAt(5)) && charAt(6) == ';') {
-			advancePos(7);
-			return true;
-		} else if(charAt(1) == '#' && (charAt(2) == 'x' ||  charAt(2) == 'X') && isxdigit(charAt(3)) && isxdigit(charAt(4)) && isxdigit(charAt(5)) && isxdigit(charAt(6)) && charAt(7) == ';') {
-			advancePos(8);
-			return true;
+		auto len = parseEntity(buf.data() + bufPos, d);
+		if(len == 0) {
+			return false;
 		}
-	} else {
-		return true;
+
+		advancePos(len);
 	}
 
-	return false;
+	return true;
 }
 
 bool SimpleXMLReader::content() {
@@ -501,15 +777,15 @@ bool SimpleXMLReader::content() {
 		return true;
 	}
 
-	int c = charAt(0);
-
-	if(c == '&') {
-		return entref(value);
+	if(charAt(0) == '&') {
+		return entref(value, MAX_VALUE_SIZE);
 	}
 
-	append(value, MAX_VALUE_SIZE, c);
+	// The first character may also be a '<' that didn't start any markup
+	auto i = 1 + findAny(buf.data() + bufPos + 1, bufSize() - 1, '<', '&');
+	append(value, MAX_VALUE_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
 
-	advancePos(1);
+	advancePos(i);
 
 	return true;
 }
@@ -554,17 +830,21 @@ bool SimpleXMLReader::skipSpace(bool store) {
 	if(!needChars(1)) {
 		return true;
 	}
-	bool skipped = false;
-	int c;
-	while(needChars(1) && isSpace(c = charAt(0))) {
-		if(store) {
-			append(value, MAX_VALUE_SIZE, c);
-		}
-		advancePos();
-		skipped = true;
+
+	size_t i = 0;
+	for(size_t iend = bufSize(); i < iend && isSpace(charAt(i)); ++i)
+		;
+
+	if(i == 0) {
+		return false;
+	}
+
+	if(store) {
+		append(value, MAX_VALUE_SIZE, buf.begin() + bufPos, buf.begin() + bufPos + i);
 	}
 
-	return skipped;
+	advancePos(i);
+	return true;
 }
 
 bool SimpleXMLReader::needChars(size_t n) const {
@@ -727,6 +1007,7 @@ bool SimpleXMLReader::process() {
 			break;
 		case STATE_CONTENT:
 			skipSpace(true)
+			|| elementFast()
 			|| literal(LITN("<!--"), false, STATE_COMMENT)
 			|| literal(LITN("<![CDATA["), false, STATE_CDATA)
 			|| element()
@@ -750,10 +1031,8 @@ bool SimpleXMLReader::process() {
 			return true;
 		}
 
-		if(oldState == STATE_CONTENT && state != oldState && !value.empty()) {
-			decodeString(value);
-			cb->data(value);
-			value.clear();
+		if(oldState == STATE_CONTENT && state != oldState) {
+			flushData();
 		}
 
 		oldState = state;
@@ -764,10 +1043,27 @@ bool SimpleXMLReader::process() {
 	return false;
 };
 
-void SimpleXMLReader::decodeString(string& str_) {
-	auto isUtf8 = encoding.empty() || compare(encoding, Text::utf8) == 0;
+void SimpleXMLReader::flushData() {
+	if(!value.empty()) {
+		decodeString(value);
+		cb->data(value);
+		value.clear();
+	}
+}
+
+void SimpleXMLReader::decodeString(string& str_, size_t start) {
+	if (utf8Encoding && isAscii(str_.data() + start, str_.size() - start)) {
+		return;
+	}
+
+	if (start > 0) {
+		auto tmp = str_.substr(start);
+		decodeString(tmp);
+		str_.replace(start, string::npos, tmp);
+		return;
+	}
 
-	if (!isUtf8) {
+	if (!utf8Encoding) {
 		str_ = Text::toUtf8(str_, encoding);
 	} else if (!Text::validateUtf8(str_)) {
 		if (flags & FLAG_REPLACE_INVALID_UTF8) {
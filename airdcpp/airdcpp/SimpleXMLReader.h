@@ -23,11 +23,36 @@
 #include "File.h"
 
 #include <boost/noncopyable.hpp>
+#include <boost/utility/string_ref.hpp>
 
 namespace dcpp {
 
 class SimpleXMLReader {
 public:
+	/** Attributes of a tag as name / value views to the attribute arena of the reader.
+	The views are valid only until the startTag callback returns. */
+	class Attribs : private boost::noncopyable {
+	public:
+		typedef std::pair<boost::string_ref, boost::string_ref> Attrib;
+		typedef std::vector<Attrib> List;
+
+		List::const_iterator begin() const noexcept { return views.begin(); }
+		List::const_iterator end() const noexcept { return views.end(); }
+		size_t size() const noexcept { return views.size(); }
+
+		/** Value of an attribute (empty if the attribute doesn't exist).
+		@param hint Expected position of the attribute. */
+		boost::string_ref get(const std::string& name, size_t hint) const noexcept;
+
+		/** Copies the attributes to a list of strings. The list is reused between the tags. */
+		StringPairList& toList() const;
+	private:
+		friend class SimpleXMLReader;
+
+		List views;
+		mutable StringPairList list;
+	};
+
 	struct CallBack : private boost::noncopyable {
 		virtual ~CallBack() { }
 
@@ -38,6 +63,11 @@ public:
 		@param simple Whether this tag is void of any data (<example/>). */
 		virtual void startTag(const std::string& /*name*/, StringPairList& /*attribs*/, bool /*simple*/) { }
 
+		/** A new XML tag has been encountered (attributes are passed as views without copying them).
+		The default implementation copies the attributes to strings and calls startTag, loaders of
+		large documents should override this instead. */
+		virtual void startTagView(const std::string& name, const Attribs& attribs, bool simple) { startTag(name, attribs.toList(), simple); }
+
 		/** Contents of an XML tag have been read.
 		@param data Contents of the tag.
 		@note This may be called several times per tag with partial contents in mixed content
@@ -51,6 +81,7 @@ public:
 
 	protected:
 		static const std::string& getAttrib(StringPairList& attribs, const std::string& name, size_t hint);
+		static boost::string_ref getAttrib(const Attribs& attribs, const std::string& name, size_t hint) noexcept { return attribs.get(name, hint); }
 	};
 
 	struct ThreadedCallBack : public CallBack {
@@ -83,6 +114,12 @@ public:
 	bool parse(const char* data, size_t len);
 	bool parse(const string& str);
 
+	// False if the document uses an encoding that is converted to UTF-8 while parsing
+	bool isUTF8() const noexcept { return utf8Encoding; }
+
+	// Adds data that was parsed separately to the input position (reported in errors)
+	void skipInput(uint64_t aBytes) noexcept { pos += aBytes; }
+
 private:
 
 	static const size_t MAX_NAME_SIZE = 1024; 
@@ -167,11 +204,22 @@ private:
 	std::string::size_type bufPos;
 	uint64_t pos;
 
-	StringPairList attribs;
+	// Names and values of the attributes of the current tag
+	// The value of an attribute ends where the name of the next one starts
+	struct AttribPos {
+		size_t name;
+		size_t value;
+	};
+
+	std::string attribArena;
+	std::vector<AttribPos> attribPos;
+	Attribs attribs;
+
 	std::string value;
 
 	CallBack* cb;
 	std::string encoding;
+	bool utf8Encoding = true;
 
 	ParseState state;
 
@@ -192,6 +240,10 @@ private:
 	bool declVersionNum();
 	bool declEncodingValue();
 
+	// Parses a complete tag from the buffer without going through the states
+	bool elementFast();
+	bool elementEndFast();
+
 	bool element();
 	bool elementName();
 	bool elementEnd();
@@ -208,14 +260,18 @@ private:
 
 	bool content();
 
-	bool entref(std::string& d);
+	bool entref(std::string& d, size_t maxLen);
 
 	bool process();
 	bool spaceOrError(const char* error);
 
 	bool error(const char* message);
 
-	void decodeString(string& str_);
+	void startTag(bool simple);
+	void flushData();
+
+	// Validates (or converts) the string starting from the given position
+	void decodeString(string& str_, size_t start = 0);
 
 	const int flags;
 };
@@ -90,15 +90,27 @@ public:
 
 class MemoryInputStream : public InputStream {
 public:
-	MemoryInputStream(const uint8_t* src, size_t len) : pos(0), size(len), buf(new uint8_t[len]) {
-		memcpy(buf, src, len);
+	// Immutable data that can be read by multiple streams at the same time
+	typedef shared_ptr<const string> SharedBuffer;
+
+	// Copy the data
+	MemoryInputStream(const uint8_t* src, size_t len) : MemoryInputStream(make_shared<const string>(reinterpret_cast<const char*>(src), len)) {
+	}
+	MemoryInputStream(const string& src) : MemoryInputStream(make_shared<const string>(src)) {
+	}
+
+	// Take the ownership of the data without copying it
+	MemoryInputStream(string&& src) : MemoryInputStream(make_shared<const string>(move(src))) {
 	}
-	MemoryInputStream(const string& src) : pos(0), size(src.size()), buf(new uint8_t[src.size()]) {
-		memcpy(buf, src.data(), src.size());
+	MemoryInputStream(ByteVector&& src) {
+		auto data = make_shared<const ByteVector>(move(src));
+		buf = data->data();
+		size = data->size();
+		owner = move(data);
 	}
 
-	~MemoryInputStream() {
-		delete[] buf;
+	// Read the shared data without copying it
+	MemoryInputStream(const SharedBuffer& aBuffer) : owner(aBuffer), buf(reinterpret_cast<const uint8_t*>(aBuffer->data())), size(aBuffer->size()) {
 	}
 
 	size_t read(void* tgt, size_t& len) override {
@@ -111,9 +123,12 @@ public:
 	size_t getSize() const { return size; }
 
 private:
-	size_t pos;
-	size_t size;
-	uint8_t* buf;
+	// Keeps the data alive
+	shared_ptr<const void> owner;
+
+	const uint8_t* buf = nullptr;
+	size_t pos = 0;
+	size_t size = 0;
 };
 
 class IOStream : public InputStream, public OutputStream {
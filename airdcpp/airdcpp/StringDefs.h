@@ -779,7 +779,7 @@ enum Strings { // @DontAdd
 	MAX_SIZE, // "Max size"
 	MAX_UPLOAD_RATE, // "Maximum upload rate (0 = infinite)"
 	MAX_USERS, // "Max users"
-	MAX_VOL_HASHERS, // "Maximum number of hashers per volume"
+	MAX_VOL_HASHERS, // "Maximum number of hashers per volume (0 = automatic)"
 	MBITS, // "Mbit/s"
 	MBITSPS, // "MBits/s"
 	MBPS, // "MB/s"
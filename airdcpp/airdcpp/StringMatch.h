@@ -59,6 +59,10 @@ struct StringMatch {
 
 	bool prepare();
 	bool match(const string& str) const;
+
+	// Prepared patterns of the current method (nullptr if the method is different)
+	const StringSearch* getStringSearch() const noexcept { return boost::get<StringSearch>(&search); }
+	const boost::regex* getRegex() const noexcept { return boost::get<boost::regex>(&search); }
 private:
 	boost::variant<StringSearch, string, boost::regex> search;
 	bool isWildCard;
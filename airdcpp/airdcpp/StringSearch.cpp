@@ -87,14 +87,96 @@ size_t StringSearch::Pattern::matchLower(const string& aText, int aStartPos) con
 	return string::npos;
 }
 
+StringSearch::Automaton::Automaton(const PatternList& aPatterns) noexcept : patternLengths(aPatterns.size()) {
+	dcassert(aPatterns.size() <= MAX_PATTERNS);
+
+	// Character classes
+	memset(charClasses, 0, sizeof(charClasses));
+	for (const auto& p : aPatterns) {
+		for (auto c : p.str()) {
+			auto& charClass = charClasses[static_cast<uint8_t>(c)];
+			if (charClass == 0) {
+				charClass = static_cast<uint8_t>(classCount++);
+			}
+		}
+	}
+
+	// Build the trie (0 = no transition, the root state can't be a target)
+	transitions.resize(classCount);
+	outputs.resize(1);
+	for (size_t i = 0; i < aPatterns.size(); ++i) {
+		const auto& pattern = aPatterns[i].str();
+		patternLengths[i] = pattern.size();
+
+		uint32_t state = 0;
+		for (auto c : pattern) {
+			auto& next = transitions[state * classCount + charClasses[static_cast<uint8_t>(c)]];
+			if (next == 0) {
+				next = static_cast<uint32_t>(outputs.size());
+				outputs.push_back(0);
+				transitions.resize(outputs.size() * classCount);
+			}
+
+			// The vector may have been reallocated
+			state = transitions[state * classCount + charClasses[static_cast<uint8_t>(c)]];
+		}
+
+		outputs[state] |= static_cast<PatternMask>(1) << i;
+	}
+
+	// Failure links (breadth-first), convert the trie into a complete transition table
+	vector<uint32_t> failures(outputs.size());
+	deque<uint32_t> queue;
+	for (size_t c = 0; c < classCount; ++c) {
+		auto next = transitions[c];
+		if (next != 0) {
+			queue.push_back(next);
+		}
+	}
+
+	while (!queue.empty()) {
+		auto state = queue.front();
+		queue.pop_front();
+
+		outputs[state] |= outputs[failures[state]];
+		for (size_t c = 0; c < classCount; ++c) {
+			auto& next = transitions[state * classCount + c];
+			if (next != 0) {
+				failures[next] = transitions[failures[state] * classCount + c];
+				queue.push_back(next);
+			} else {
+				next = transitions[failures[state] * classCount + c];
+			}
+		}
+	}
+}
 
 void StringSearch::addString(const string& aStr) {
-	if (!aStr.empty())
+	if (!aStr.empty()) {
 		patterns.emplace_back(Text::toLower(aStr));
+
+		if (patterns.size() >= MIN_AUTOMATON_PATTERNS && patterns.size() <= Automaton::MAX_PATTERNS) {
+			automaton = make_shared<Automaton>(patterns);
+		} else {
+			automaton = nullptr;
+		}
+	}
 }
 
 bool StringSearch::match_all(const string& aText) const {
 	auto text = Text::toLower(aText);
+	if (automaton) {
+		const auto allPatterns = (static_cast<Automaton::PatternMask>(1) << patterns.size()) - 1;
+
+		Automaton::PatternMask found = 0;
+		automaton->scanLower(text, [&](size_t aPattern, size_t) {
+			found |= static_cast<Automaton::PatternMask>(1) << aPattern;
+			return found != allPatterns;
+		});
+
+		return found == allPatterns;
+	}
+
 	for (const auto& p : patterns) {
 		if (p.matchLower(text) == string::npos) {
 			return false;
@@ -105,6 +187,16 @@ bool StringSearch::match_all(const string& aText) const {
 }
 
 bool StringSearch::match_any_lower(const string& aText) const {
+	if (automaton) {
+		bool found = false;
+		automaton->scanLower(aText, [&](size_t, size_t) {
+			found = true;
+			return false;
+		});
+
+		return found;
+	}
+
 	for (const auto& p : patterns) {
 		if (p.matchLower(aText) != string::npos) {
 			return true;
@@ -119,6 +211,10 @@ bool StringSearch::match_any(const string& aText) const {
 }
 
 int StringSearch::matchLower(const string& aText, bool aResumeOnNoMatch, ResultList* results_) const {
+	if (automaton) {
+		return matchLowerAutomaton(aText, aResumeOnNoMatch, results_);
+	}
+
 	int matches = 0, listPos = 0;
 	for (const auto& p: patterns) {
 		size_t addPos = string::npos;
@@ -157,8 +253,60 @@ int StringSearch::matchLower(const string& aText, bool aResumeOnNoMatch, ResultL
 	return matches;
 }
 
+int StringSearch::matchLowerAutomaton(const string& aText, bool aResumeOnNoMatch, ResultList* results_) const {
+	dcassert(Text::isLower(aText));
+
+	// Get the first and last positions of each pattern with a single pass
+	size_t firstPositions[Automaton::MAX_PATTERNS];
+	size_t lastPositions[Automaton::MAX_PATTERNS];
+	fill_n(firstPositions, patterns.size(), string::npos);
+
+	automaton->scanLower(aText, [&](size_t aPattern, size_t aPos) {
+		if (firstPositions[aPattern] == string::npos) {
+			firstPositions[aPattern] = aPos;
+		}
+
+		lastPositions[aPattern] = aPos;
+		return true;
+	});
+
+	// Pick the same positions as with matching the patterns one by one
+	int matches = 0;
+	for (size_t listPos = 0; listPos < patterns.size(); ++listPos) {
+		auto pos = firstPositions[listPos];
+		if (pos == string::npos) {
+			if (!aResumeOnNoMatch) {
+				if (results_) {
+					fill_n((*results_).begin(), listPos, string::npos);
+				}
+				return 0;
+			}
+
+			continue;
+		}
+
+		if (results_ && listPos > 0) {
+			// prefer sequential match order if this isn't the first pattern
+			auto prevPos = (*results_)[listPos - 1];
+			if (prevPos != string::npos && prevPos > pos) {
+				// use the first match after the previous pattern or the last one if there are no such matches
+				pos = lastPositions[listPos] < prevPos ? lastPositions[listPos] : patterns[listPos].matchLower(aText, static_cast<int>(prevPos));
+				dcassert(pos != string::npos);
+			}
+		}
+
+		matches++;
+		if (results_) {
+			(*results_)[listPos] = pos;
+		}
+	}
+
+	return matches;
+}
+
 void StringSearch::clear() {
 	patterns.clear();
+	automaton = nullptr;
 }
 
 }
\ No newline at end of file
@@ -28,7 +28,9 @@ namespace dcpp {
 * one pattern against many strings (currently Quick Search, a variant of
 * Boyer-Moore. Code based on "A very fast substring search algorithm" by
 * D. Sunday).
-* @todo Perhaps find an algo suitable for matching multiple substrings.
+*
+* Larger pattern sets are compiled into an Aho-Corasick automaton so that
+* all patterns can be matched with a single pass over the text.
 */
 class StringSearch {
 public:
@@ -64,6 +66,45 @@ public:
 
 	typedef vector<Pattern> PatternList;
 
+	/**
+	* Aho-Corasick automaton matching all patterns of the list at once.
+	* Bytes not used by any of the patterns share a single character class.
+	*/
+	class Automaton {
+	public:
+		typedef uint64_t PatternMask;
+		enum { MAX_PATTERNS = 64 };
+
+		explicit Automaton(const PatternList& aPatterns) noexcept;
+
+		/** Call aF(patternIndex, startPos) for every occurrence, stop when it returns false */
+		template<class F>
+		void scanLower(const string& aText, F&& aF) const noexcept {
+			uint32_t state = 0;
+			auto tx = (const uint8_t*)aText.data();
+			for (size_t i = 0; i < aText.size(); ++i) {
+				state = transitions[state * classCount + charClasses[tx[i]]];
+
+				auto output = outputs[state];
+				for (size_t p = 0; output != 0; ++p, output >>= 1) {
+					if ((output & 1) && !aF(p, i + 1 - patternLengths[p])) {
+						return;
+					}
+				}
+			}
+		}
+	private:
+		uint8_t charClasses[256];
+		size_t classCount = 1;
+
+		// state * classCount + charClass
+		vector<uint32_t> transitions;
+
+		// Patterns ending in each state
+		vector<PatternMask> outputs;
+		vector<size_t> patternLengths;
+	};
+
 	bool match_all(const string& aText) const;
 	bool match_any(const string& aText) const;
 	bool match_any_lower(const string& aText) const;
@@ -76,7 +117,13 @@ public:
 	inline bool empty() const { return patterns.empty(); }
 	inline const PatternList& getPatterns() const { return patterns; }
 private:
+	// Minimum number of patterns for using the automaton, the Sunday search is faster with fewer patterns
+	enum { MIN_AUTOMATON_PATTERNS = 3 };
+
+	int matchLowerAutomaton(const string& aText, bool aResumeOnNoMatch, ResultList* results_) const;
+
 	PatternList patterns;
+	shared_ptr<const Automaton> automaton;
 };
 
 } // namespace dcpp
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef DCPLUSPLUS_DCPP_TTH_INDEX_H
+#define DCPLUSPLUS_DCPP_TTH_INDEX_H
+
+#include "typedefs.h"
+
+#include "MerkleTree.h"
+
+namespace dcpp {
+
+/**
+* Multimap from TTHs to items, the TTH is read from the item (T::getTTH)
+*
+* Uses an open addressing table that stores a single pointer per item (compared to a separately
+* allocated node and a bucket per item with the standard unordered containers). TTHs are already
+* uniformly distributed so their first bytes are used as hash without mixing.
+*
+* Items are stored as plain pointers and the TTH of an item must not change while it's in the index.
+*/
+template<class T>
+class TTHIndex {
+public:
+	// Items with the same TTH
+	class Range {
+	public:
+		class iterator {
+		public:
+			typedef std::forward_iterator_tag iterator_category;
+			typedef const T* value_type;
+			typedef ptrdiff_t difference_type;
+			typedef const T* const* pointer;
+			typedef const T* const& reference;
+
+			iterator(const TTHIndex* aIndex, size_t aPos, const TTHValue* aTTH) noexcept : index(aIndex), pos(aPos), tth(aTTH) {
+				skipToMatch();
+			}
+
+			reference operator*() const noexcept { return index->table[pos]; }
+			iterator& operator++() noexcept { pos = index->next(pos); skipToMatch(); return *this; }
+			iterator operator++(int) noexcept { auto ret = *this; ++(*this); return ret; }
+
+			bool operator==(const iterator& rhs) const noexcept { return pos == rhs.pos; }
+			bool operator!=(const iterator& rhs) const noexcept { return pos != rhs.pos; }
+		private:
+			void skipToMatch() noexcept {
+				while (pos != npos) {
+					auto item = index->table[pos];
+					if (!item) {
+						pos = npos;
+						return;
+					}
+
+					if (item != tombstone() && item->getTTH() == *tth) {
+						return;
+					}
+
+					pos = index->next(pos);
+				}
+			}
+
+			const TTHIndex* index;
+			size_t pos;
+			const TTHValue* tth;
+		};
+
+		typedef iterator const_iterator;
+
+		Range(const TTHIndex* aIndex, const TTHValue& aTTH) noexcept : index(aIndex), tth(aTTH) { }
+
+		iterator begin() const noexcept { return iterator(index, index->table.empty() ? npos : index->getSlot(tth), &tth); }
+		iterator end() const noexcept { return iterator(index, npos, &tth); }
+		bool empty() const noexcept { return begin() == end(); }
+	private:
+		const TTHIndex* index;
+		const TTHValue tth;
+	};
+
+	// All items
+	class const_iterator {
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef const T* value_type;
+		typedef ptrdiff_t difference_type;
+		typedef const T* const* pointer;
+		typedef const T* const& reference;
+
+		const_iterator(const TTHIndex* aIndex, size_t aPos) noexcept : index(aIndex), pos(aPos) {
+			skipEmpty();
+		}
+
+		reference operator*() const noexcept { return index->table[pos]; }
+		const_iterator& operator++() noexcept { ++pos; skipEmpty(); return *this; }
+		const_iterator operator++(int) noexcept { auto ret = *this; ++(*this); return ret; }
+
+		bool operator==(const const_iterator& rhs) const noexcept { return pos == rhs.pos; }
+		bool operator!=(const const_iterator& rhs) const noexcept { return pos != rhs.pos; }
+	private:
+		void skipEmpty() noexcept {
+			while (pos < index->table.size() && (!index->table[pos] || index->table[pos] == tombstone())) {
+				++pos;
+			}
+		}
+
+		const TTHIndex* index;
+		size_t pos;
+	};
+
+	TTHIndex() { }
+	TTHIndex(TTHIndex&) = delete;
+	TTHIndex& operator=(TTHIndex&) = delete;
+
+	void insert(const T* aItem) noexcept {
+		reserve(items + 1);
+
+		auto pos = getSlot(aItem->getTTH());
+		while (table[pos] && table[pos] != tombstone()) {
+			pos = next(pos);
+		}
+
+		if (table[pos] == tombstone()) {
+			tombstones--;
+		}
+
+		table[pos] = aItem;
+		items++;
+	}
+
+	// Returns false if the item wasn't found
+	bool erase(const T* aItem) noexcept {
+		if (table.empty()) {
+			return false;
+		}
+
+		for (auto pos = getSlot(aItem->getTTH()); table[pos]; pos = next(pos)) {
+			if (table[pos] == aItem) {
+				table[pos] = tombstone();
+				items--;
+				tombstones++;
+
+				if (items * 8 < table.size() && table.size() > MIN_SIZE) {
+					// Most of the content was removed
+					rehash(items);
+				}
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Move all items from another index
+	void merge(TTHIndex& aIndex) noexcept {
+		if (items == 0 && tombstones == 0) {
+			table.swap(aIndex.table);
+			items = aIndex.items;
+			tombstones = aIndex.tombstones;
+			aIndex.clear();
+			return;
+		}
+
+		reserve(items + aIndex.items);
+		for (auto i : aIndex) {
+			insert(i);
+		}
+
+		aIndex.clear();
+	}
+
+	// Returns any item with the TTH
+	const T* find(const TTHValue& aTTH) const noexcept {
+		auto r = equal_range(aTTH);
+		auto i = r.begin();
+		return i != r.end() ? *i : nullptr;
+	}
+
+	Range equal_range(const TTHValue& aTTH) const noexcept {
+		return Range(this, aTTH);
+	}
+
+	const_iterator begin() const noexcept { return const_iterator(this, 0); }
+	const_iterator end() const noexcept { return const_iterator(this, table.size()); }
+
+	void clear() noexcept {
+		table.clear();
+		table.shrink_to_fit();
+		items = 0;
+		tombstones = 0;
+	}
+
+	size_t size() const noexcept { return items; }
+	bool empty() const noexcept { return items == 0; }
+
+	// Allocated memory
+	size_t getTableSize() const noexcept { return table.capacity() * sizeof(const T*); }
+private:
+	static const size_t npos = static_cast<size_t>(-1);
+	static const size_t MIN_SIZE = 64;
+
+	static const T* tombstone() noexcept {
+		return reinterpret_cast<const T*>(static_cast<uintptr_t>(1));
+	}
+
+	size_t getSlot(const TTHValue& aTTH) const noexcept {
+		size_t hash;
+		memcpy(&hash, aTTH.data, sizeof(size_t));
+		return hash & (table.size() - 1);
+	}
+
+	size_t next(size_t aPos) const noexcept {
+		return (aPos + 1) & (table.size() - 1);
+	}
+
+	// Keep the load factor (including removed slots) below 75%
+	void reserve(size_t aItems) noexcept {
+		if ((aItems + tombstones) * 4 >= table.size() * 3) {
+			rehash(aItems);
+		}
+	}
+
+	void rehash(size_t aItems) noexcept {
+		size_t newSize = MIN_SIZE;
+		while (newSize * 3 <= aItems * 4 + 4) {
+			newSize <<= 1;
+		}
+
+		// Grow in larger steps
+		if (newSize > table.size() && aItems > items) {
+			newSize <<= 1;
+		}
+
+		vector<const T*> oldTable(newSize, nullptr);
+		oldTable.swap(table);
+		items = 0;
+		tombstones = 0;
+
+		for (auto item : oldTable) {
+			if (item && item != tombstone()) {
+				auto pos = getSlot(item->getTTH());
+				while (table[pos]) {
+					pos = next(pos);
+				}
+
+				table[pos] = item;
+				items++;
+			}
+		}
+	}
+
+	vector<const T*> table;
+	size_t items = 0;
+	size_t tombstones = 0;
+};
+
+} // namespace dcpp
+
+#endif // !defined(DCPLUSPLUS_DCPP_TTH_INDEX_H)
@@ -249,6 +249,154 @@ uint8_t* TigerHash::finalize() {
 	return getResult();
 }
 
+// Multi-buffer variants of the macros above for LEAF_LANES (4) messages, each step is performed for all lanes
+// before moving to the next one (the rounds of a single message depend on each other so interleaving
+// lets the CPU overlap the table lookups). The lanes are expanded explicitly so that the state stays in registers.
+#define lane_round(a,b,c,xi,mul) \
+	round(a[0],b[0],c[0],x[0][xi],mul) \
+	round(a[1],b[1],c[1],x[1][xi],mul) \
+	round(a[2],b[2],c[2],x[2][xi],mul) \
+	round(a[3],b[3],c[3],x[3][xi],mul)
+
+#define lane_pass(a,b,c,mul) \
+	lane_round(a,b,c,0,mul) \
+	lane_round(b,c,a,1,mul) \
+	lane_round(c,a,b,2,mul) \
+	lane_round(a,b,c,3,mul) \
+	lane_round(b,c,a,4,mul) \
+	lane_round(c,a,b,5,mul) \
+	lane_round(a,b,c,6,mul) \
+	lane_round(b,c,a,7,mul)
+
+#define lane_key_schedule_single(l) \
+	x[l][0] -= x[l][7] ^ _ULL(0xA5A5A5A5A5A5A5A5); \
+	x[l][1] ^= x[l][0]; \
+	x[l][2] += x[l][1]; \
+	x[l][3] -= x[l][2] ^ ((~x[l][1])<<19); \
+	x[l][4] ^= x[l][3]; \
+	x[l][5] += x[l][4]; \
+	x[l][6] -= x[l][5] ^ ((~x[l][4])>>23); \
+	x[l][7] ^= x[l][6]; \
+	x[l][0] += x[l][7]; \
+	x[l][1] -= x[l][0] ^ ((~x[l][7])<<19); \
+	x[l][2] ^= x[l][1]; \
+	x[l][3] += x[l][2]; \
+	x[l][4] -= x[l][3] ^ ((~x[l][2])>>23); \
+	x[l][5] ^= x[l][4]; \
+	x[l][6] += x[l][5]; \
+	x[l][7] -= x[l][6] ^ _ULL(0x0123456789ABCDEF);
+
+#define lane_key_schedule \
+	lane_key_schedule_single(0) \
+	lane_key_schedule_single(1) \
+	lane_key_schedule_single(2) \
+	lane_key_schedule_single(3)
+
+void TigerHash::compressLanes(const uint64_t (&aBlocks)[LEAF_LANES][8], uint64_t (&state_)[LEAF_LANES][3]) noexcept {
+	static_assert(LEAF_LANES == 4, "The lane macros must be updated when changing the lane count");
+
+	uint64_t a[LEAF_LANES], b[LEAF_LANES], c[LEAF_LANES];
+	uint64_t x[LEAF_LANES][8];
+
+	memcpy(x, aBlocks, sizeof(x));
+	for(size_t l = 0; l < LEAF_LANES; l++) {
+		a[l] = state_[l][0];
+		b[l] = state_[l][1];
+		c[l] = state_[l][2];
+	}
+
+	lane_pass(a,b,c,5)
+	lane_key_schedule
+	lane_pass(c,a,b,7)
+	lane_key_schedule
+	lane_pass(b,c,a,9)
+
+	for(size_t l = 0; l < LEAF_LANES; l++) {
+		state_[l][0] ^= a[l];
+		state_[l][1] = b[l] - state_[l][1];
+		state_[l][2] += c[l];
+	}
+}
+
+void TigerHash::hashLeafLanes(const uint8_t* aData, size_t aLeafSize, uint8_t aPrefix, uint8_t* results_) noexcept {
+	const size_t msgLen = aLeafSize + 1;
+	const size_t fullBlocks = msgLen / BLOCK_SIZE;
+	const size_t tailLen = msgLen % BLOCK_SIZE;
+	const size_t tailBlocks = tailLen + 1 + sizeof(uint64_t) > BLOCK_SIZE ? 2 : 1;
+
+	uint64_t state[LEAF_LANES][3];
+	uint64_t x[LEAF_LANES][8];
+
+	for(size_t l = 0; l < LEAF_LANES; l++) {
+		state[l][0] = _ULL(0x0123456789ABCDEF);
+		state[l][1] = _ULL(0xFEDCBA9876543210);
+		state[l][2] = _ULL(0xF096A5B4C3B2E187);
+	}
+
+	for(size_t k = 0; k < fullBlocks; k++) {
+		for(size_t l = 0; l < LEAF_LANES; l++) {
+			auto data = aData + l * aLeafSize;
+			if(k == 0) {
+				auto p = (uint8_t*)x[l];
+				p[0] = aPrefix;
+				memcpy(p + 1, data, BLOCK_SIZE - 1);
+			} else {
+				memcpy(x[l], data + k * BLOCK_SIZE - 1, BLOCK_SIZE);
+			}
+		}
+
+		compressLanes(x, state);
+	}
+
+	// Remaining bytes and the padding (same as in finalize)
+	uint64_t tail[LEAF_LANES][2][8];
+	memzero(tail, sizeof(tail));
+	for(size_t l = 0; l < LEAF_LANES; l++) {
+		auto data = aData + l * aLeafSize;
+		auto p = (uint8_t*)tail[l];
+		if(tailLen > 0) {
+			if(fullBlocks == 0) {
+				p[0] = aPrefix;
+				memcpy(p + 1, data, tailLen - 1);
+			} else {
+				memcpy(p, data + fullBlocks * BLOCK_SIZE - 1, tailLen);
+			}
+		}
+
+		p[tailLen] = 0x01;
+		tail[l][tailBlocks - 1][7] = static_cast<uint64_t>(msgLen) << 3;
+	}
+
+	for(size_t k = 0; k < tailBlocks; k++) {
+		for(size_t l = 0; l < LEAF_LANES; l++) {
+			memcpy(x[l], tail[l][k], BLOCK_SIZE);
+		}
+
+		compressLanes(x, state);
+	}
+
+	for(size_t l = 0; l < LEAF_LANES; l++) {
+		memcpy(results_ + l * BYTES, state[l], BYTES);
+	}
+}
+
+void TigerHash::hashLeaves(const uint8_t* aData, size_t aLeafSize, size_t aCount, uint8_t aPrefix, uint8_t* results_) noexcept {
+	size_t leaf = 0;
+
+#ifndef TIGER_BIG_ENDIAN
+	for(; leaf + LEAF_LANES <= aCount; leaf += LEAF_LANES) {
+		hashLeafLanes(aData + leaf * aLeafSize, aLeafSize, aPrefix, results_ + leaf * BYTES);
+	}
+#endif
+
+	for(; leaf < aCount; leaf++) {
+		TigerHash h;
+		h.update(&aPrefix, 1);
+		h.update(aData + leaf * aLeafSize, aLeafSize);
+		memcpy(results_ + leaf * BYTES, h.finalize(), BYTES);
+	}
+}
+
 uint64_t TigerHash::table[4*256] = {
 	_ULL(0x02AAB17CF7E90C5E)   /*    0 */,    _ULL(0xAC424B03E243A8EC)   /*    1 */,
 		_ULL(0x72CD5BE30DD5FCD3)   /*    2 */,    _ULL(0x6D019B93F6F97F3A)   /*    3 */,
@@ -57,6 +57,16 @@ public:
 	uint8_t* finalize();
 
 	uint8_t* getResult() const noexcept { return (uint8_t*) res; }
+
+	/** Number of leaves that hashLeaves processes together */
+	static const size_t LEAF_LANES = 4;
+
+	/**
+	 * Calculates the hashes of aCount consecutive blocks of aLeafSize bytes, each one prefixed with aPrefix
+	 * (leaves of a Merkle tree). The results are stored consecutively in results_ (aCount * BYTES).
+	 * Independent leaves are compressed interleaved, which is faster than hashing them one by one.
+	 */
+	static void hashLeaves(const uint8_t* aData, size_t aLeafSize, size_t aCount, uint8_t aPrefix, uint8_t* results_) noexcept;
 private:
 	enum { BLOCK_SIZE = 512/8 };
 	/** 512 bit blocks for the compress function */
@@ -69,6 +79,9 @@ private:
 	static uint64_t table[];
 
 	void tigerCompress(const uint64_t* data, uint64_t state[3]);
+
+	static void hashLeafLanes(const uint8_t* aData, size_t aLeafSize, uint8_t aPrefix, uint8_t* results_) noexcept;
+	static void compressLanes(const uint64_t (&aBlocks)[LEAF_LANES][8], uint64_t (&state_)[LEAF_LANES][3]) noexcept;
 };
 
 } // namespace dcpp
@@ -297,9 +297,9 @@ checkslots:
 					CryptoManager::getInstance()->decodeBZ2(reinterpret_cast<const uint8_t*>(bz2.data()), bz2.size(), xml);
 					// Clear to save some memory...
 					string().swap(bz2);
-					is.reset(new MemoryInputStream(xml));
 					start = 0;
 					fileSize = size = xml.size();
+					is.reset(new MemoryInputStream(move(xml)));
 				} else {
 					countFilePositions();
 					auto f = make_unique<File>(sourceFile, File::READ, File::OPEN | File::SHARED_WRITE); // write for partial sharing
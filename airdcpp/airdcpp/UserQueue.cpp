@@ -79,9 +79,10 @@ QueueItemPtr UserQueue::getNext(const UserPtr& aUser, const QueueTokenSet& runni
 		qi = getNextBundleQI(aUser, runningBundles, onlineHubs, (Priority)minPrio, wantedSize, lastSpeed, aType, allowOverlap, lastError_, hasDownload);
 	}
 
-	if (!qi && !allowOverlap) {
+	if (!qi && !allowOverlap && SETTING(OVERLAP_SLOW_SOURCES) && lastSpeed > 0) {
 		//no free segments. let's do another round and now check if there are slow sources which can be overlapped
-		qi = getNext(aUser, runningBundles, onlineHubs, lastError_, hasDownload, minPrio, wantedSize, lastSpeed, aType, true);
+		//(only running bundle items can be overlapped, the highest priority queue is checked without speed)
+		qi = getNextBundleQI(aUser, runningBundles, onlineHubs, minPrio, wantedSize, lastSpeed, aType, true, lastError_, hasDownload);
 	}
 
 	if (qi)
@@ -109,7 +110,9 @@ QueueItemPtr UserQueue::getNextBundleQI(const UserPtr& aUser, const QueueTokenSe
 	Priority minPrio, int64_t wantedSize, int64_t lastSpeed, QueueItemBase::DownloadType aType, bool allowOverlap, 
 	string& lastError_, bool& hasDownload) noexcept{
 
-	lastError_ = Util::emptyString;
+	if (!allowOverlap) {
+		lastError_ = Util::emptyString;
+	}
 
 	auto bundleLimit = SETTING(MAX_RUNNING_BUNDLES);
 	auto i = userBundleQueue.find(aUser);
@@ -136,11 +139,20 @@ QueueItemPtr UserQueue::getNextBundleQI(const UserPtr& aUser, const QueueTokenSe
 }
 
 void UserQueue::addDownload(QueueItemPtr& qi, Download* d) noexcept {
+	auto wasWaiting = qi->isWaiting();
 	qi->addDownload(d);
+
+	if (wasWaiting && qi->getBundle()) {
+		qi->getBundle()->setUserQueueRunning(qi, true);
+	}
 }
 
 void UserQueue::removeDownload(QueueItemPtr& qi, const string& aToken) noexcept {
 	qi->removeDownload(aToken);
+
+	if (qi->isWaiting() && qi->getBundle()) {
+		qi->getBundle()->setUserQueueRunning(qi, false);
+	}
 }
 
 void UserQueue::setQIPriority(QueueItemPtr& qi, Priority p) noexcept {
@@ -157,8 +169,12 @@ void UserQueue::removeQI(QueueItemPtr& qi, bool removeRunning /*true*/) noexcept
 
 void UserQueue::removeQI(QueueItemPtr& qi, const UserPtr& aUser, bool removeRunning /*true*/, Flags::MaskType reason) noexcept{
 
-	if(removeRunning) {
+	if(removeRunning && qi->isRunning()) {
 		qi->removeDownloads(aUser);
+
+		if (qi->isWaiting() && qi->getBundle()) {
+			qi->getBundle()->setUserQueueRunning(qi, false);
+		}
 	}
 
 	dcassert(qi->isSource(aUser));
@@ -35,6 +35,9 @@ using tbb::concurrent_queue;
 using tbb::parallel_for_each;
 using tbb::task_group;
 
+// Tasks passed to task_group are run by a pool of worker threads
+static const bool PARALLEL_TASKS = true;
+
 class TaskScheduler {
 public:
 	TaskScheduler() { }
@@ -58,6 +61,9 @@ using concurrency::concurrent_queue;
 using concurrency::task_group;
 using concurrency::parallel_for_each;
 
+// Tasks passed to task_group are run by a pool of worker threads
+static const bool PARALLEL_TASKS = true;
+
 class TaskScheduler {
 public:
 	TaskScheduler() {
@@ -86,6 +92,20 @@ public:
 
 #define parallel_for_each for_each
 
+	// Tasks are run immediately in the calling thread
+	static const bool PARALLEL_TASKS = false;
+
+	class task_group {
+	public:
+		template <typename F>
+		void run(const F& f) {
+			f();
+		}
+
+		void wait() { }
+		void cancel() { }
+	};
+
 	template <typename T>
 	class concurrent_queue {
 	public:
@@ -21,9 +21,24 @@
 #include "DirectoryMonitor.h"
 
 #include <airdcpp/AirUtil.h>
+#include <airdcpp/File.h>
 #include <airdcpp/LogManager.h>
 #include <airdcpp/ResourceManager.h>
 #include <airdcpp/Text.h>
+#include <airdcpp/TimerManager.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/statfs.h>
+
+#include <boost/range/algorithm/find.hpp>
+#include <boost/range/algorithm/find_if.hpp>
+#endif
 
 
 namespace dcpp {
@@ -64,7 +79,25 @@ void DirectoryMonitor::Server::init() {
 		throw MonitorException(Util::translateError(::GetLastError()));
 	}
 #else
+	if (fd == -1) {
+		efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+		if (efd == -1 || fd == -1) {
+			auto error = errno;
+			if (efd != -1) {
+				::close(efd);
+				efd = -1;
+			}
 
+			if (fd != -1) {
+				::close(fd);
+				fd = -1;
+			}
+
+			threadRunning.clear();
+			throw MonitorException(getErrorStr(error));
+		}
+	}
 #endif
 
 	start();
@@ -189,13 +222,38 @@ void Monitor::openDirectory(HANDLE iocp) {
 
 #else
 
-Monitor::Monitor(const string& aPath, DirectoryMonitor::Server* aServer, int monitorFlags, size_t bufferSize) {
+// Events for the watched directories
+#define INOTIFY_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+#ifdef FAN_REPORT_DFID_NAME
+// Events for the marked filesystems
+// Modifications are reported only when the file is closed as the whole filesystem may be busy
+#define FANOTIFY_EVENTS (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_CLOSE_WRITE | FAN_ONDIR)
+#endif
+
+#define WATCH_LIMIT_ERROR "The maximum number of inotify watches has been reached (increase fs.inotify.max_user_watches or run the application with the CAP_SYS_ADMIN and CAP_DAC_READ_SEARCH capabilities to monitor whole filesystems)"
+
+// Repeated modification notifications for the same file are ignored within this period (ms)
+#define MODIFY_NOTIFICATION_INTERVAL 1000
+
+Monitor::Monitor(const string& aPath, DirectoryMonitor::Server* aServer) : path(aPath), server(aServer), changes(0) {
 }
 
-Monitor::~Monitor() { }
+Monitor::~Monitor() {
+	dcassert(watches.empty());
+}
 
 void Monitor::stopMonitoring() {
+	for (const auto& w: watches) {
+		server->watchMonitors.erase(w.first);
+		inotify_rm_watch(server->fd, w.first);
+	}
+
+	watches.clear();
 
+	// The thread will delete the monitor
+	stopped = true;
+	server->wakeUp();
 }
 
 DirectoryMonitor::Server::Server(DirectoryMonitor* aBase, int numThreads) : base(aBase), m_bTerminate(false), m_nThreads(numThreads) {
@@ -203,7 +261,30 @@ DirectoryMonitor::Server::Server(DirectoryMonitor* aBase, int numThreads) : base
 }
 
 DirectoryMonitor::Server::~Server() {
+	join();
+
+	for (const auto& fs: markedFilesystems) {
+		::close(fs.second);
+	}
 
+	if (fanotifyFd != -1) {
+		::close(fanotifyFd);
+	}
+
+	if (fd != -1) {
+		::close(fd);
+	}
+
+	if (efd != -1) {
+		::close(efd);
+	}
+}
+
+void DirectoryMonitor::Server::wakeUp() noexcept {
+	if (efd != -1) {
+		uint64_t value = 1;
+		::write(efd, &value, sizeof(value));
+	}
 }
 
 #endif
@@ -356,19 +437,534 @@ bool DirectoryMonitor::Server::addDirectory(const string& aPath) {
 #else
 
 bool DirectoryMonitor::Server::addDirectory(const string& aPath) {
+	{
+		RLock l(cs);
+		if (monitors.find(aPath) != monitors.end())
+			return false;
+	}
+
+	init();
+
+	WLock l(cs);
+	auto mon = new Monitor(aPath, this);
+	try {
+		if (!addWatches(mon, aPath)) {
+			addFilesystemMark(mon);
+		}
+
+		monitors.emplace(aPath, mon);
+		failedDirectories.erase(aPath);
+	} catch (const MonitorException&) {
+		mon->stopMonitoring();
+		delete mon;
+
+		failedDirectories.insert(aPath);
+		throw;
+	}
+
 	return true;
 }
 
 void DirectoryMonitor::Server::deleteDirectory(DirectoryMonitor::Server::MonitorMap::iterator mon) {
+	auto fsid = mon->second->fanotify ? mon->second->fsid : Util::emptyString;
+
+	delete mon->second;
+	monitors.erase(mon);
 
+	if (!fsid.empty() && boost::find_if(monitors | map_values, [&](const Monitor* m) { return m->fanotify && m->fsid == fsid; }).base() == monitors.end()) {
+		removeFilesystemMark(fsid);
+	}
+}
+
+bool DirectoryMonitor::Server::addWatches(Monitor* aMonitor, const string& aPath, unordered_set<int>* visited_) {
+	auto wd = inotify_add_watch(fd, aPath.c_str(), aPath == aMonitor->path ? INOTIFY_EVENTS : INOTIFY_EVENTS | IN_DONT_FOLLOW);
+	if (wd == -1) {
+		if (errno == ENOSPC) {
+			return false;
+		}
+
+		if (aPath == aMonitor->path) {
+			throw MonitorException(getErrorStr(errno));
+		}
+
+		// Removed or inaccessible subdirectory
+		return true;
+	}
+
+	auto owner = watchMonitors.emplace(wd, aMonitor).first->second;
+	if (owner != aMonitor) {
+		// Watched by another monitor with an overlapping path already
+		return true;
+	}
+
+	aMonitor->watches[wd] = aPath;
+	if (visited_) {
+		visited_->insert(wd);
+	}
+
+	FileFindIter end;
+	for (FileFindIter i(aPath, "*"); i != end; ++i) {
+		if (i->isDirectory() && !i->isLink()) {
+			if (!addWatches(aMonitor, aPath + i->getFileName() + PATH_SEPARATOR, visited_)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+// Watch paths are compared case-sensitively (as they are received from the system)
+static bool isWatchedSub(const string& aWatchPath, const string& aParent) noexcept {
+	return aWatchPath.compare(0, aParent.length(), aParent) == 0;
+}
+
+void DirectoryMonitor::Server::removeWatches(Monitor* aMonitor, const string& aPath) noexcept {
+	for (auto i = aMonitor->watches.begin(); i != aMonitor->watches.end();) {
+		if (isWatchedSub(i->second, aPath)) {
+			watchMonitors.erase(i->first);
+			inotify_rm_watch(fd, i->first);
+			i = aMonitor->watches.erase(i);
+		} else {
+			i++;
+		}
+	}
+}
+
+void DirectoryMonitor::Server::renameWatches(Monitor* aMonitor, const string& aOldPath, const string& aNewPath) noexcept {
+	for (auto& w: aMonitor->watches) {
+		if (isWatchedSub(w.second, aOldPath)) {
+			w.second = aNewPath + w.second.substr(aOldPath.length());
+		}
+	}
 }
 
 int DirectoryMonitor::Server::read() {
-	return 0;
+	pollfd fds[3] = {
+		{ efd, POLLIN, 0 },
+		{ fd, POLLIN, 0 },
+		{ fanotifyFd, POLLIN, 0 }
+	};
+
+	// The fanotify instance is created on demand (the thread is woken up after that)
+	auto ret = poll(fds, fanotifyFd != -1 ? 3 : 2, -1);
+	if (ret < 0) {
+		if (errno != EINTR) {
+			dcdebug("DirectoryMonitor: poll failed (%s)\n", Util::translateError(errno).c_str());
+			Thread::sleep(1000);
+		}
+
+		return 1;
+	}
+
+	if (fds[0].revents & POLLIN) {
+		uint64_t value;
+		::read(efd, &value, sizeof(value));
+	}
+
+	if (fds[1].revents & POLLIN) {
+		readInotify();
+	}
+
+	if (fds[2].fd != -1 && (fds[2].revents & POLLIN)) {
+		readFanotify();
+	}
+
+	{
+		WLock l(cs);
+		for (auto i = monitors.begin(); i != monitors.end();) {
+			if (i->second->stopped) {
+				deleteDirectory(i++);
+			} else {
+				i++;
+			}
+		}
+
+		if (m_bTerminate && monitors.empty()) {
+			return 0;
+		}
+	}
+
+	return 1;
 }
 
-void DirectoryMonitor::processNotification(const string& aPath, const ByteVector& aBuf) {
+void DirectoryMonitor::Server::readInotify() {
+	// Notifications of each monitor
+	MonitorNotificationMap notifications;
+
+	// Root path -> error, the directories are failed after all events have been handled
+	map<string, string> failures;
+
+	// Renames are reported as two separate events that have the same cookie
+	struct PendingMove {
+		Monitor* monitor;
+		string path;
+		bool isDirectory;
+	};
+
+	unordered_map<uint32_t, PendingMove> pendingMoves;
+
+	auto watchDirectory = [&](Monitor* aMonitor, const string& aPath) {
+		try {
+			if (!addWatches(aMonitor, aPath)) {
+				addFilesystemMark(aMonitor);
+			}
+		} catch (const MonitorException& e) {
+			failures.emplace(aMonitor->path, e.getError());
+		}
+	};
+
+	alignas(inotify_event) char buf[64 * 1024];
+
+	WLock l(cs);
+	for (;;) {
+		auto len = ::read(fd, buf, sizeof(buf));
+		if (len <= 0) {
+			break;
+		}
+
+		for (auto p = buf; p < buf + len; p += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(p)->len) {
+			const auto& event = *reinterpret_cast<inotify_event*>(p);
+			if (event.mask & IN_Q_OVERFLOW) {
+				// Events were lost, refresh everything and rebuild the watches (directories may have been added, moved or removed)
+				for (const auto& m: monitors | map_values) {
+					if (m->stopped || m->fanotify) {
+						continue;
+					}
+
+					addNotification(notifications[m], Notification::OVERFLOW, m->path);
+
+					unordered_set<int> visited;
+					try {
+						if (!addWatches(m, m->path, &visited)) {
+							addFilesystemMark(m);
+							continue;
+						}
+					} catch (const MonitorException& e) {
+						failures.emplace(m->path, e.getError());
+						continue;
+					}
+
+					// Directories that were moved outside the root
+					for (auto i = m->watches.begin(); i != m->watches.end();) {
+						if (visited.find(i->first) == visited.end()) {
+							watchMonitors.erase(i->first);
+							inotify_rm_watch(fd, i->first);
+							i = m->watches.erase(i);
+						} else {
+							i++;
+						}
+					}
+				}
+
+				continue;
+			}
+
+			auto mi = watchMonitors.find(event.wd);
+			if (mi == watchMonitors.end()) {
+				continue;
+			}
+
+			auto mon = mi->second;
+			const auto directoryPath = mon->watches[event.wd];
+
+			if (event.mask & IN_IGNORED) {
+				// Removed by the system
+				mon->watches.erase(event.wd);
+				watchMonitors.erase(mi);
 
+				if (directoryPath == mon->path && !mon->stopped && !mon->fanotify) {
+					failures.emplace(mon->path, getErrorStr(ENOENT));
+				}
+
+				continue;
+			}
+
+			if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+				// Reported by the parent directory as well (or with IN_IGNORED for roots)
+				continue;
+			}
+
+			auto isDirectory = (event.mask & IN_ISDIR) != 0;
+			auto path = directoryPath + event.name;
+			mon->changes++;
+
+			auto& monitorNotifications = notifications[mon];
+			if (event.mask & IN_MOVED_FROM) {
+				pendingMoves[event.cookie] = { mon, path, isDirectory };
+			} else if (event.mask & IN_MOVED_TO) {
+				auto move = pendingMoves.find(event.cookie);
+				if (move != pendingMoves.end() && move->second.monitor == mon) {
+					if (isDirectory) {
+						renameWatches(mon, move->second.path + PATH_SEPARATOR, path + PATH_SEPARATOR);
+					}
+
+					addNotification(monitorNotifications, Notification::RENAMED, path, move->second.path);
+					pendingMoves.erase(move);
+				} else {
+					if (move != pendingMoves.end()) {
+						// Moved from another monitored root, the watches must be released first
+						if (move->second.isDirectory) {
+							removeWatches(move->second.monitor, move->second.path + PATH_SEPARATOR);
+						}
+
+						addNotification(notifications[move->second.monitor], Notification::DELETED, move->second.path);
+						pendingMoves.erase(move);
+					}
+
+					// Moved from an unmonitored location
+					if (isDirectory) {
+						watchDirectory(mon, path + PATH_SEPARATOR);
+					}
+
+					addNotification(monitorNotifications, Notification::CREATED, path);
+				}
+			} else if (event.mask & IN_CREATE) {
+				if (isDirectory) {
+					watchDirectory(mon, path + PATH_SEPARATOR);
+				}
+
+				addNotification(monitorNotifications, Notification::CREATED, path);
+			} else if (event.mask & IN_DELETE) {
+				addNotification(monitorNotifications, Notification::DELETED, path);
+			} else if (event.mask & IN_MODIFY) {
+				addNotification(monitorNotifications, Notification::MODIFIED, path);
+			}
+		}
+	}
+
+	// Moved outside the monitored directories
+	for (const auto& move: pendingMoves | map_values) {
+		if (move.isDirectory) {
+			removeWatches(move.monitor, move.path + PATH_SEPARATOR);
+		}
+
+		addNotification(notifications[move.monitor], Notification::DELETED, move.path);
+	}
+
+	for (const auto& f: failures) {
+		failDirectory(f.first, f.second);
+	}
+
+	dispatchNotifications(notifications);
+}
+
+void DirectoryMonitor::Server::dispatchNotifications(MonitorNotificationMap& aNotifications) noexcept {
+	auto tick = GET_TICK();
+	if (lastModificationsPruned + MODIFY_NOTIFICATION_INTERVAL <= tick) {
+		for (auto i = recentModifications.begin(); i != recentModifications.end();) {
+			if (i->second + MODIFY_NOTIFICATION_INTERVAL <= tick) {
+				i = recentModifications.erase(i);
+			} else {
+				i++;
+			}
+		}
+
+		lastModificationsPruned = tick;
+	}
+
+	for (auto& n: aNotifications) {
+		if (boost::find(monitors | map_values, n.first).base() == monitors.end()) {
+			// Failed
+			continue;
+		}
+
+		// Skip repeated modifications of the same file (a single notification will keep the refresh delayed)
+		auto& list = n.second;
+		list.erase(remove_if(list.begin(), list.end(), [&](const Notification& aNotification) {
+			if (aNotification.type != Notification::MODIFIED) {
+				return false;
+			}
+
+			auto i = recentModifications.emplace(aNotification.path, tick);
+			if (!i.second) {
+				if (i.first->second + MODIFY_NOTIFICATION_INTERVAL > tick) {
+					return true;
+				}
+
+				i.first->second = tick;
+			}
+
+			return false;
+		}), list.end());
+
+		if (!list.empty()) {
+			auto monBase = base;
+			base->callAsync([=] { monBase->processNotifications(list); });
+		}
+	}
+}
+
+void DirectoryMonitor::Server::addFilesystemMark(Monitor* aMonitor) {
+#ifdef FAN_REPORT_DFID_NAME
+	// Use the fanotify mark for the whole tree
+	removeWatches(aMonitor, aMonitor->path);
+
+	if (fanotifyFd == -1) {
+		fanotifyFd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_CLOEXEC | FAN_NONBLOCK, O_RDONLY | O_LARGEFILE);
+		if (fanotifyFd == -1) {
+			throw MonitorException(WATCH_LIMIT_ERROR);
+		}
+
+		// Start polling it
+		wakeUp();
+	}
+
+	struct statfs info;
+	if (statfs(aMonitor->path.c_str(), &info) != 0) {
+		throw MonitorException(getErrorStr(errno));
+	}
+
+	auto fsid = string(reinterpret_cast<const char*>(&info.f_fsid), sizeof(info.f_fsid));
+	if (markedFilesystems.find(fsid) == markedFilesystems.end()) {
+		// Needed for resolving the file handles
+		auto dirFd = ::open(aMonitor->path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dirFd == -1) {
+			throw MonitorException(getErrorStr(errno));
+		}
+
+		if (fanotify_mark(fanotifyFd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_EVENTS, AT_FDCWD, aMonitor->path.c_str()) != 0) {
+			::close(dirFd);
+			throw MonitorException(WATCH_LIMIT_ERROR);
+		}
+
+		markedFilesystems.emplace(fsid, dirFd);
+	}
+
+	aMonitor->fanotify = true;
+	aMonitor->fsid = fsid;
+
+	if (debug) {
+		LogManager::getInstance()->message("Monitoring the filesystem of " + aMonitor->path + " (no inotify watches available)", LogMessage::SEV_INFO);
+	}
+#else
+	throw MonitorException(WATCH_LIMIT_ERROR);
+#endif
+}
+
+void DirectoryMonitor::Server::removeFilesystemMark(const string& aFsid) noexcept {
+#ifdef FAN_REPORT_DFID_NAME
+	auto i = markedFilesystems.find(aFsid);
+	if (i == markedFilesystems.end()) {
+		return;
+	}
+
+	fanotify_mark(fanotifyFd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, FANOTIFY_EVENTS, i->second, nullptr);
+	::close(i->second);
+	markedFilesystems.erase(i);
+	handlePaths.clear();
+#endif
+}
+
+string DirectoryMonitor::Server::resolveHandle(const string& aFsid, void* aHandle) noexcept {
+#ifdef FAN_REPORT_DFID_NAME
+	auto handle = reinterpret_cast<file_handle*>(aHandle);
+	auto key = aFsid + string(reinterpret_cast<const char*>(handle), sizeof(file_handle) + handle->handle_bytes);
+
+	auto cached = handlePaths.find(key);
+	if (cached != handlePaths.end()) {
+		return cached->second;
+	}
+
+	auto fs = markedFilesystems.find(aFsid);
+	if (fs == markedFilesystems.end()) {
+		return Util::emptyString;
+	}
+
+	auto dirFd = open_by_handle_at(fs->second, handle, O_PATH | O_CLOEXEC);
+	if (dirFd == -1) {
+		// Removed
+		return Util::emptyString;
+	}
+
+	char buf[PATH_MAX];
+	auto len = readlink(("/proc/self/fd/" + Util::toString(dirFd)).c_str(), buf, sizeof(buf));
+	::close(dirFd);
+	if (len <= 0) {
+		return Util::emptyString;
+	}
+
+	auto path = Util::validatePath(string(buf, len), true);
+
+	// Each directory that has had changes is cached (the cache is reset when directories are moved or removed)
+	if (handlePaths.size() >= 10000) {
+		handlePaths.clear();
+	}
+
+	handlePaths.emplace(key, path);
+	return path;
+#else
+	return Util::emptyString;
+#endif
+}
+
+void DirectoryMonitor::Server::readFanotify() {
+#ifdef FAN_REPORT_DFID_NAME
+	MonitorNotificationMap notifications;
+	alignas(fanotify_event_metadata) char buf[64 * 1024];
+
+	WLock l(cs);
+	for (;;) {
+		auto len = ::read(fanotifyFd, buf, sizeof(buf));
+		if (len <= 0) {
+			break;
+		}
+
+		auto event = reinterpret_cast<fanotify_event_metadata*>(buf);
+		for (; FAN_EVENT_OK(event, len); event = FAN_EVENT_NEXT(event, len)) {
+			if (event->mask & FAN_Q_OVERFLOW) {
+				for (const auto& m: monitors | map_values) {
+					if (m->fanotify) {
+						addNotification(notifications[m], Notification::OVERFLOW, m->path);
+					}
+				}
+
+				continue;
+			}
+
+			auto info = reinterpret_cast<fanotify_event_info_fid*>(event + 1);
+			if (info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME) {
+				continue;
+			}
+
+			auto handle = reinterpret_cast<file_handle*>(info->handle);
+			string name(reinterpret_cast<const char*>(handle->f_handle + handle->handle_bytes));
+			if (name.empty() || name == ".") {
+				continue;
+			}
+
+			auto directoryPath = resolveHandle(string(reinterpret_cast<const char*>(&info->fsid), sizeof(info->fsid)), handle);
+			if (directoryPath.empty()) {
+				continue;
+			}
+
+			auto path = directoryPath + name;
+			auto mon = boost::find_if(monitors | map_values, [&](const Monitor* m) { return m->fanotify && !m->stopped && AirUtil::isSubLocal(path, m->path); });
+			if (mon.base() == monitors.end()) {
+				// Unmonitored path on the same filesystem
+				continue;
+			}
+
+			if ((event->mask & FAN_ONDIR) && (event->mask & (FAN_DELETE | FAN_MOVED_FROM))) {
+				// Paths of the cached directories may have changed
+				handlePaths.clear();
+			}
+
+			(*mon)->changes++;
+
+			auto& monitorNotifications = notifications[*mon];
+			if (event->mask & (FAN_CREATE | FAN_MOVED_TO)) {
+				addNotification(monitorNotifications, Notification::CREATED, path);
+			} else if (event->mask & (FAN_DELETE | FAN_MOVED_FROM)) {
+				addNotification(monitorNotifications, Notification::DELETED, path);
+			} else if (event->mask & FAN_CLOSE_WRITE) {
+				addNotification(monitorNotifications, Notification::MODIFIED, path);
+			}
+		}
+	}
+
+	dispatchNotifications(notifications);
+#endif
 }
 
 #endif
@@ -545,6 +1141,40 @@ void DirectoryMonitor::processNotification(const string& aPath, const ByteVector
 
 #else
 
+void DirectoryMonitor::addNotification(NotificationList& notifications_, Notification::Type aType, const string& aPath, const string& aOldPath) noexcept {
+	// Writes generate a series of events for the same file
+	if (!notifications_.empty()) {
+		const auto& last = notifications_.back();
+		if (last.type == aType && last.path == aPath && last.oldPath == aOldPath) {
+			return;
+		}
+	}
+
+	notifications_.emplace_back(aType, aPath, aOldPath);
+}
+
+void DirectoryMonitor::processNotifications(const NotificationList& aNotifications) {
+	for (const auto& n: aNotifications) {
+		switch (n.type) {
+			case Notification::CREATED:
+				fire(DirectoryMonitorListener::FileCreated(), n.path);
+				break;
+			case Notification::MODIFIED:
+				fire(DirectoryMonitorListener::FileModified(), n.path);
+				break;
+			case Notification::RENAMED:
+				fire(DirectoryMonitorListener::FileRenamed(), n.oldPath, n.path);
+				break;
+			case Notification::DELETED:
+				fire(DirectoryMonitorListener::FileDeleted(), n.path);
+				break;
+			case Notification::OVERFLOW:
+				fire(DirectoryMonitorListener::Overflow(), n.path);
+				break;
+		}
+	}
+}
+
 #endif
 
 } //dcpp
@@ -71,9 +71,31 @@ public:
 		server->setDebug(aEnabled);
 	}
 private:
+#ifndef WIN32
+	struct Notification {
+		enum Type {
+			CREATED,
+			MODIFIED,
+			RENAMED,
+			DELETED,
+			OVERFLOW
+		};
+
+		Notification(Type aType, const string& aPath, const string& aOldPath = Util::emptyString) : type(aType), path(aPath), oldPath(aOldPath) { }
+
+		Type type;
+		string path;
+		string oldPath;
+	};
+
+	typedef vector<Notification> NotificationList;
+#endif
+
 	friend class Monitor;
 	class Server : public Thread {
 	public:
+		friend class Monitor;
+
 		Server(DirectoryMonitor* aBase, int numThreads);
 		~Server();
 		bool addDirectory(const string& aPath);
@@ -124,8 +146,54 @@ private:
 #ifdef WIN32
 		HANDLE m_hIOCP;
 #else
+		// Used for waking up the thread when monitors are removed
 		int efd = -1;
+		void wakeUp() noexcept;
+
+		// inotify instance, each monitored directory has a watch of its own
 		int fd = -1;
+		std::unordered_map<int, Monitor*> watchMonitors;
+
+		void readInotify();
+
+		// Add watches for the directory and its subdirectories (or update the paths of existing ones)
+		// The descriptors of all watches that were found are added in visited_
+		// Returns false if the inotify watch limit has been reached
+		// Throws MonitorException if the root directory can't be watched
+		bool addWatches(Monitor* aMonitor, const string& aPath, std::unordered_set<int>* visited_ = nullptr);
+
+		// Remove watches for the directory and its subdirectories
+		void removeWatches(Monitor* aMonitor, const string& aPath) noexcept;
+
+		// Update the watch paths after a directory has been renamed
+		void renameWatches(Monitor* aMonitor, const string& aOldPath, const string& aNewPath) noexcept;
+
+		// fanotify instance for monitors that have run out of inotify watches
+		// The whole filesystem is marked so there is no need for per-directory watches (requires CAP_SYS_ADMIN)
+		int fanotifyFd = -1;
+
+		// Filesystem ID -> directory descriptor for resolving file handles
+		map<string, int> markedFilesystems;
+
+		// File handle -> directory path
+		unordered_map<string, string> handlePaths;
+
+		void readFanotify();
+		string resolveHandle(const string& aFsid, void* aHandle) noexcept;
+
+		// Switch the monitor to a filesystem mark
+		// Throws MonitorException if the fanotify API isn't available
+		void addFilesystemMark(Monitor* aMonitor);
+		void removeFilesystemMark(const string& aFsid) noexcept;
+
+		// Repeated modification notifications for the same file are ignored for a while
+		// Path -> tick of the last reported modification
+		unordered_map<string, uint64_t> recentModifications;
+		uint64_t lastModificationsPruned = 0;
+
+		// Queue the notifications to be fired from the dispatcher (must be called from inside WLock)
+		typedef map<Monitor*, NotificationList> MonitorNotificationMap;
+		void dispatchNotifications(MonitorNotificationMap& aNotifications) noexcept;
 #endif
 		int	m_nThreads;
 		set<string> failedDirectories;
@@ -133,7 +201,14 @@ private:
 
 	Server* server;
 
+#ifdef WIN32
 	void processNotification(const string& aPath, const ByteVector& aBuf);
+#else
+	// Notifications are collected from a single read and consecutive duplicates are skipped
+	static void addNotification(NotificationList& notifications_, Notification::Type aType, const string& aPath, const string& aOldPath = Util::emptyString) noexcept;
+	void processNotifications(const NotificationList& aNotifications);
+#endif
+
 	DispatcherQueue dispatcher;
 };
 
@@ -149,15 +224,16 @@ public:
 	void openDirectory(HANDLE iocp);
 	void beginRead();
 #else
-	//int addWatch(const string& aPath);
-
-	Monitor(const string& aPath, DirectoryMonitor::Server* aParent, int monitorFlags, size_t bufferSize);
+	Monitor(const string& aPath, DirectoryMonitor::Server* aParent);
 	~Monitor();
 #endif
 
 	void stopMonitoring();
 
+#ifdef WIN32
 	void queueNotificationTask(int dwSize);
+#endif
+
 	DirectoryMonitor::Server* server;
 private:
 	uint64_t changes;
@@ -180,7 +256,17 @@ private:
 	int errorCount;
 	int key;
 #else
+	const string path;
+
+	// Watch descriptor -> directory path
+	std::unordered_map<int, string> watches;
+
+	// Events are received from a fanotify filesystem mark instead of inotify watches
+	bool fanotify = false;
+	string fsid;
 
+	// Waiting to be deleted by the monitoring thread
+	bool stopped = false;
 #endif
 };
 
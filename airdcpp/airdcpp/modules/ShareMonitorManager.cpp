@@ -303,6 +303,11 @@ namespace dcpp {
 		}
 
 		addModifyInfo(Util::getFilePath(aNewPath));
+
+		// Moved between directories
+		if (Util::getFilePath(aOldPath) != Util::getFilePath(aNewPath)) {
+			addModifyInfo(Util::getFilePath(aOldPath));
+		}
 	}
 
 	void ShareMonitorManager::on(DirectoryMonitorListener::FileDeleted, const string& aPath) noexcept {
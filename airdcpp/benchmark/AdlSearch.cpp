@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Matches a synthetic file list against a generated set of ADL searches with the compiled
+// matcher and by evaluating each search separately, and verifies that the results are identical
+//
+// Usage: airdcpp-adl-search-benchmark [searches] [directories] [files per directory]
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/ADLSearch.h>
+#include <airdcpp/Util.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+using namespace dcpp;
+
+static const char* words[] = {
+	"Album", "live", "remastered", "deluxe", "edition", "Bonus", "track", "demo", "mix", "remix",
+	"Season", "episode", "complete", "collection", "Sample", "subs", "english", "finnish", "extended", "cut",
+	"x264", "x265", "HEVC", "1080p", "720p", "2160p", "WEB", "BluRay", "proper", "repack",
+	"disc", "part", "vol", "original", "soundtrack", "score", "acoustic", "unplugged", "session", "radio",
+	"the", "and", "of", "night", "day", "summer", "winter", "blue", "red", "black",
+	"\xc3\xa4\xc3\xa4ni", "k\xc3\xa4yt\xc3\xa4v\xc3\xa4", "\xc3\x96LJY", "\xe2\x82\xac", "caf\xc3\xa9"
+};
+
+static const char* extensions[] = {
+	".mkv", ".avi", ".mp4", ".mp3", ".flac", ".nfo", ".sfv", ".jpg", ".txt", ".rar", ".r00", ".iso", ".srt"
+};
+
+static const char* regexes[] = {
+	"\\.(mkv|avi|mp4)$", "^[Ss]ample", "(?i)x26[45]", "[Ss]\\d{2}[Ee]\\d{2}", "\\.r\\d\\d$", "^(?:the|The) ",
+	"(?i:remaster)", "(?<!re)mix", "Disc ?\\d", "\\d{3,4}p", "(?=.*live)(?=.*album)", "^[^.]+\\.nfo$",
+	"(\\w)\\1\\1", "(?i)\\Qvol\\E", "(?#comment)BluRay", "(?x) Blu Ray", "[(]1[)]", "\\(?2\\)?",
+	"[[:digit:]]{2}0p", "\\x41lbum", "\\<live\\>", "Ed+ition", "(?i)ALBUM", "\\p{upper}EB", "e{2,}", "summer|winter",
+	"[]a-z]ack", "x26(?-i:4)", "Bonus\\.track"
+};
+
+template<class T, size_t N>
+static size_t countOf(T(&)[N]) { return N; }
+
+struct Item {
+	string name;
+	string adcPath; // Parent directory
+	int64_t size;
+};
+
+static string randomName(std::mt19937& aRandom, size_t aMaxWords) {
+	string name;
+	auto count = aRandom() % aMaxWords + 1;
+	for (size_t i = 0; i < count; ++i) {
+		if (!name.empty()) {
+			name += aRandom() % 3 == 0 ? "." : " ";
+		}
+
+		name += words[aRandom() % countOf(words)];
+	}
+
+	if (aRandom() % 4 == 0) {
+		name += " " + Util::toString(aRandom() % 100);
+	}
+
+	return name;
+}
+
+static vector<ADLSearch> generateSearches(size_t aCount) {
+	std::mt19937 random(1);
+	vector<ADLSearch> searches;
+
+	for (size_t i = 0; i < aCount; ++i) {
+		ADLSearch search;
+		auto type = random() % 10;
+		if (type < 2) {
+			search.setRegEx(true);
+			search.setPattern(regexes[random() % countOf(regexes)]);
+		} else if (i == 5) {
+			// No patterns, matches everything
+			search.setPattern("  ");
+		} else {
+			string pattern;
+			auto count = random() % 3 + 1;
+			for (size_t p = 0; p < count; ++p) {
+				string word = words[random() % countOf(words)];
+				if (random() % 5 == 0) {
+					word = word.substr(0, word.size() / 2 + 1);
+				}
+
+				pattern += (pattern.empty() ? "" : " ") + word;
+			}
+
+			if (random() % 5 == 0) {
+				pattern += " " + string(extensions[random() % countOf(extensions)]);
+			}
+
+			search.setPattern(pattern);
+		}
+
+		auto sourceType = random() % 10;
+		search.sourceType = sourceType < 6 ? ADLSearch::OnlyFile : sourceType < 8 ? ADLSearch::OnlyDirectory : ADLSearch::FullPath;
+
+		if (random() % 4 == 0) {
+			search.typeFileSize = static_cast<ADLSearch::SizeType>(random() % 3);
+			search.minFileSize = random() % 3 == 0 ? -1 : static_cast<int64_t>(random() % 512);
+			search.maxFileSize = random() % 3 == 0 ? -1 : search.minFileSize + static_cast<int64_t>(random() % 2048);
+		}
+
+		search.isActive = random() % 20 != 0;
+		search.prepare();
+		searches.push_back(std::move(search));
+	}
+
+	return searches;
+}
+
+static void generateList(size_t aDirectories, size_t aFiles, vector<Item>& directories_, vector<Item>& files_) {
+	std::mt19937 random(2);
+
+	StringList parents = { ADC_ROOT_STR };
+	for (size_t d = 0; d < aDirectories; ++d) {
+		const auto& parent = parents[random() % parents.size()];
+		auto name = randomName(random, 4);
+		directories_.push_back({ name, parent, -1 });
+
+		auto path = parent + name + ADC_SEPARATOR_STR;
+		auto files = random() % (aFiles * 2 + 1);
+		for (size_t f = 0; f < files; ++f) {
+			files_.push_back({ randomName(random, 5) + extensions[random() % countOf(extensions)], path, static_cast<int64_t>(random() % (1LL << 31)) << (random() % 5) });
+		}
+
+		parents.push_back(path);
+	}
+}
+
+template<class F>
+static double measure(F&& aFunc) {
+	auto start = std::chrono::steady_clock::now();
+	aFunc();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+	auto searchCount = argc > 1 ? Util::toUInt32(argv[1]) : 300;
+	auto directoryCount = argc > 2 ? Util::toUInt32(argv[2]) : 5000;
+	auto fileCount = argc > 3 ? Util::toUInt32(argv[3]) : 20;
+
+	auto searches = generateSearches(searchCount);
+
+	vector<Item> directories, files;
+	generateList(directoryCount, fileCount, directories, files);
+	std::cout << searches.size() << " searches, " << directories.size() << " directories, " << files.size() << " files" << std::endl;
+
+	// Evaluate each search separately
+	vector<ADLSearchMatcher::ResultList> expected(directories.size() + files.size());
+	size_t expectedMatches = 0;
+	auto searchTime = measure([&] {
+		for (size_t i = 0; i < directories.size(); ++i) {
+			for (size_t s = 0; s < searches.size(); ++s) {
+				if (searches[s].matchesDirectory(directories[i].name)) {
+					expected[i].push_back(s);
+				}
+			}
+		}
+
+		for (size_t i = 0; i < files.size(); ++i) {
+			const auto& f = files[i];
+			const auto nmdcPath = Util::toNmdcFile(f.adcPath + f.name);
+			for (size_t s = 0; s < searches.size(); ++s) {
+				if (searches[s].matchesFile(f.name, nmdcPath, f.size)) {
+					expected[directories.size() + i].push_back(s);
+				}
+			}
+		}
+	});
+
+	for (const auto& e: expected) {
+		expectedMatches += e.size();
+	}
+
+	// Compiled searches
+	vector<ADLSearchMatcher::ResultList> results(expected.size());
+	unique_ptr<ADLSearchMatcher> matcher;
+	auto compileTime = measure([&] {
+		matcher.reset(new ADLSearchMatcher(searches));
+	});
+
+	auto matcherTime = measure([&] {
+		for (size_t i = 0; i < directories.size(); ++i) {
+			matcher->matchDirectory(directories[i].name, results[i]);
+		}
+
+		for (size_t i = 0; i < files.size(); ++i) {
+			const auto& f = files[i];
+			matcher->matchFile(f.name, f.adcPath, f.size, results[directories.size() + i]);
+		}
+	});
+
+	size_t errors = 0;
+	for (size_t i = 0; i < expected.size(); ++i) {
+		if (expected[i] != results[i]) {
+			if (errors++ < 10) {
+				const auto& item = i < directories.size() ? directories[i] : files[i - directories.size()];
+				std::cout << "FAILED: different searches matched " << item.adcPath << item.name << " (" << expected[i].size() << " expected, " << results[i].size() << " found)" << std::endl;
+			}
+		}
+	}
+
+	std::cout << expectedMatches << " matches" << std::endl;
+	std::cout << "separate searches: " << searchTime * 1000 << " ms, compiled searches: " << matcherTime * 1000 << " ms (compiled in " << compileTime * 1000 << " ms)" << std::endl;
+	std::cout << (errors == 0 ? "The results are identical" : Util::toString(errors) + " errors") << std::endl;
+	return errors == 0 ? 0 : 1;
+}
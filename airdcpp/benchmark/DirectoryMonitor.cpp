@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Runs create/modify/rename/delete storms in a temporary directory and verifies that
+// every change is covered by a monitoring notification (for the path itself or for one of its parents,
+// similar to how the changes are refreshed in the share)
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/AirUtil.h>
+#include <airdcpp/File.h>
+#include <airdcpp/Thread.h>
+#include <airdcpp/Util.h>
+
+#include <airdcpp/modules/DirectoryMonitor.h>
+
+#include <chrono>
+#include <iostream>
+
+#include <stdlib.h>
+
+using namespace dcpp;
+
+class Listener : public DirectoryMonitorListener {
+public:
+	StringSet created;
+	StringSet modified;
+	StringSet deleted;
+	vector<pair<string, string>> renamed;
+	StringList failed;
+	int overflows = 0;
+	int notifications = 0;
+
+	void clear() {
+		created.clear();
+		modified.clear();
+		deleted.clear();
+		renamed.clear();
+		overflows = 0;
+		notifications = 0;
+	}
+
+	void on(DirectoryMonitorListener::FileCreated, const string& aPath) noexcept override { created.insert(aPath); notifications++; }
+	void on(DirectoryMonitorListener::FileModified, const string& aPath) noexcept override { modified.insert(aPath); notifications++; }
+	void on(DirectoryMonitorListener::FileRenamed, const string& aOld, const string& aNew) noexcept override { renamed.emplace_back(aOld, aNew); notifications++; }
+	void on(DirectoryMonitorListener::FileDeleted, const string& aPath) noexcept override { deleted.insert(aPath); notifications++; }
+	void on(DirectoryMonitorListener::Overflow, const string&) noexcept override { overflows++; notifications++; }
+	void on(DirectoryMonitorListener::DirectoryFailed, const string& aPath, const string& aError) noexcept override { failed.push_back(aPath + ": " + aError); }
+};
+
+// Notifications are expected to have been received after the monitor has been idle for this long
+static const auto IDLE_TIME = std::chrono::milliseconds(1000);
+
+// Dispatch notifications until there have been none for a while
+static void waitNotifications(DirectoryMonitor& aMonitor) {
+	auto idleSince = std::chrono::steady_clock::now();
+	while (std::chrono::steady_clock::now() - idleSince < IDLE_TIME) {
+		if (aMonitor.dispatch()) {
+			idleSince = std::chrono::steady_clock::now();
+		} else {
+			Thread::sleep(10);
+		}
+	}
+}
+
+// The path itself or one of its parents (inside the root) was reported
+static bool isCovered(const StringSet& aPaths, const string& aPath, const string& aRoot) {
+	auto path = aPath;
+	while (path.length() > aRoot.length()) {
+		if (aPaths.find(path) != aPaths.end()) {
+			return true;
+		}
+
+		path = Util::getFilePath(path);
+		path.pop_back();
+	}
+
+	return false;
+}
+
+static int errors = 0;
+
+static void check(bool aResult, const string& aMessage) {
+	if (!aResult) {
+		std::cout << "FAILED: " << aMessage << std::endl;
+		errors++;
+	}
+}
+
+template<class F>
+static double measure(DirectoryMonitor& aMonitor, F&& aFunc) {
+	auto start = std::chrono::steady_clock::now();
+	aFunc();
+	waitNotifications(aMonitor);
+	auto end = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double>(end - start - IDLE_TIME).count();
+}
+
+int main(int argc, char* argv[]) {
+	const int directories = argc > 1 ? Util::toInt(argv[1]) : 100;
+	const int filesPerDirectory = argc > 2 ? Util::toInt(argv[2]) : 20;
+
+	char tmpl[] = "/tmp/airdcpp-monitor-XXXXXX";
+	if (!mkdtemp(tmpl)) {
+		std::cout << "Failed to create a temporary directory" << std::endl;
+		return 1;
+	}
+
+	const auto base = string(tmpl) + PATH_SEPARATOR;
+	const auto root = base + "root" + PATH_SEPARATOR;
+	const auto outside = base + "outside" + PATH_SEPARATOR;
+	File::ensureDirectory(root);
+	File::ensureDirectory(outside);
+
+	Listener listener;
+	DirectoryMonitor monitor(1, false);
+	monitor.addListener(&listener);
+
+	try {
+		monitor.addDirectory(root);
+	} catch (const MonitorException& e) {
+		std::cout << "Failed to monitor " << root << ": " << e.getError() << std::endl;
+		return 1;
+	}
+
+	auto getDirectory = [&](int aDir) { return root + "directory " + Util::toString(aDir) + PATH_SEPARATOR + "sub" + PATH_SEPARATOR; };
+	auto getFile = [&](int aDir, int aFile) { return getDirectory(aDir) + "file " + Util::toString(aFile); };
+
+	// Create
+	StringList createdPaths;
+	auto createTime = measure(monitor, [&] {
+		for (int d = 0; d < directories; ++d) {
+			File::ensureDirectory(getDirectory(d));
+			createdPaths.push_back(root + "directory " + Util::toString(d));
+			createdPaths.push_back(getDirectory(d).substr(0, getDirectory(d).length() - 1));
+			for (int f = 0; f < filesPerDirectory; ++f) {
+				File::createFile(getFile(d, f), "a");
+				createdPaths.push_back(getFile(d, f));
+			}
+		}
+	});
+
+	for (const auto& p: createdPaths) {
+		check(isCovered(listener.created, p, root) || listener.overflows > 0, "creation of " + p + " wasn't reported");
+	}
+
+	std::cout << "Created " << createdPaths.size() << " items, " << listener.notifications << " notifications (" << listener.overflows << " overflows), " << createTime << " s" << std::endl;
+	listener.clear();
+
+	// Modifications right after the creation may not be reported separately
+	Thread::sleep(1500);
+
+	// Modify (repeatedly, the notifications should be coalesced)
+	auto modifyTime = measure(monitor, [&] {
+		for (int round = 0; round < 5; ++round) {
+			for (int d = 0; d < directories; ++d) {
+				for (int f = 0; f < filesPerDirectory; ++f) {
+					File file(getFile(d, f), File::WRITE, File::OPEN);
+					file.setEndPos(0);
+					file.write("b");
+				}
+			}
+		}
+	});
+
+	for (int d = 0; d < directories; ++d) {
+		for (int f = 0; f < filesPerDirectory; ++f) {
+			check(listener.modified.count(getFile(d, f)) > 0 || listener.overflows > 0, "modification of " + getFile(d, f) + " wasn't reported");
+		}
+	}
+
+	std::cout << "Modified " << directories * filesPerDirectory * 5 << " times, " << listener.notifications << " notifications (" << listener.overflows << " overflows), " << modifyTime << " s" << std::endl;
+	listener.clear();
+
+	// Rename the directories and create new files in them (the watches must follow the new paths)
+	auto renameTime = measure(monitor, [&] {
+		for (int d = 0; d < directories; ++d) {
+			auto path = root + "directory " + Util::toString(d);
+			File::renameFile(path, path + " renamed");
+			File::createFile(path + " renamed" + PATH_SEPARATOR + "sub" + PATH_SEPARATOR + "new file", "c");
+		}
+	});
+
+	for (int d = 0; d < directories; ++d) {
+		// Filesystem marks report renames as separate removals and creations
+		auto path = root + "directory " + Util::toString(d);
+		auto renamed = find(listener.renamed.begin(), listener.renamed.end(), make_pair(path, path + " renamed")) != listener.renamed.end() ||
+			(listener.deleted.count(path) > 0 && listener.created.count(path + " renamed") > 0);
+		check(renamed || listener.overflows > 0, "renaming of " + path + " wasn't reported");
+
+		auto filePath = path + " renamed" + PATH_SEPARATOR + "sub" + PATH_SEPARATOR + "new file";
+		check(listener.created.count(filePath) > 0 || listener.overflows > 0, "creation of " + filePath + " wasn't reported");
+	}
+
+	std::cout << "Renamed " << directories << " directories, " << listener.notifications << " notifications (" << listener.overflows << " overflows), " << renameTime << " s" << std::endl;
+	listener.clear();
+
+	// Move the directories outside the root, changes in them must not be reported anymore
+	for (int d = 0; d < directories; ++d) {
+		File::renameFile(root + "directory " + Util::toString(d) + " renamed", outside + "directory " + Util::toString(d));
+	}
+
+	waitNotifications(monitor);
+
+	for (int d = 0; d < directories; ++d) {
+		auto path = root + "directory " + Util::toString(d) + " renamed";
+		check(listener.deleted.count(path) > 0 || listener.overflows > 0, "removal of " + path + " wasn't reported");
+	}
+
+	listener.clear();
+	for (int d = 0; d < directories; ++d) {
+		File::createFile(outside + "directory " + Util::toString(d) + PATH_SEPARATOR + "sub" + PATH_SEPARATOR + "outside file", "d");
+	}
+
+	waitNotifications(monitor);
+	check(listener.notifications == 0, "got " + Util::toString(listener.notifications) + " notifications for paths outside the root");
+
+	// Move them back and delete everything
+	for (int d = 0; d < directories; ++d) {
+		File::renameFile(outside + "directory " + Util::toString(d), root + "directory " + Util::toString(d));
+	}
+
+	waitNotifications(monitor);
+	listener.clear();
+
+	auto deleteTime = measure(monitor, [&] {
+		for (int d = 0; d < directories; ++d) {
+			File::removeDirectoryForced(root + "directory " + Util::toString(d) + PATH_SEPARATOR);
+		}
+	});
+
+	for (const auto& p: createdPaths) {
+		check(isCovered(listener.deleted, p, root) || listener.overflows > 0, "removal of " + p + " wasn't reported");
+	}
+
+	std::cout << "Deleted " << createdPaths.size() << " items, " << listener.notifications << " notifications (" << listener.overflows << " overflows), " << deleteTime << " s" << std::endl;
+
+	for (const auto& f: listener.failed) {
+		check(false, "monitoring failed: " + f);
+	}
+
+	std::cout << monitor.getStats() << std::endl;
+
+	monitor.removeListener(&listener);
+	monitor.stopMonitoring();
+	File::removeDirectoryForced(base);
+
+	std::cout << (errors == 0 ? "All changes were reported" : Util::toString(errors) + " errors") << std::endl;
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Compresses a generated file list with the single-threaded and the parallel bzip2 encoder
+// and verifies that both outputs decompress to the original data
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/BZUtils.h>
+#include <airdcpp/Encoder.h>
+#include <airdcpp/File.h>
+#include <airdcpp/FilteredFile.h>
+#include <airdcpp/ParallelBZOutputStream.h>
+#include <airdcpp/Util.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+
+using namespace dcpp;
+
+static string generateList(size_t aSize) {
+	std::mt19937 random(1);
+	string xml = "<?xml version=\"1.0\" encoding=\"utf-8\" standalone=\"yes\"?>\r\n<FileListing Version=\"1\" Base=\"/\">\r\n";
+
+	uint8_t tth[24];
+	size_t directory = 0;
+	while (xml.size() < aSize) {
+		xml += "\t<Directory Name=\"Directory " + Util::toString(directory++) + "\" Date=\"" + Util::toString(1500000000 + random() % 100000000) + "\">\r\n";
+		auto files = random() % 30;
+		for (size_t f = 0; f < files; ++f) {
+			for (auto& b: tth) {
+				b = static_cast<uint8_t>(random());
+			}
+
+			xml += "\t\t<File Name=\"Some file name " + Util::toString(random() % 1000) + ".ext\" Size=\"" + Util::toString(random()) + "\" TTH=\"" + Encoder::toBase32(tth, sizeof(tth)) + "\"/>\r\n";
+		}
+
+		xml += "\t</Directory>\r\n";
+	}
+
+	xml += "</FileListing>";
+	return xml;
+}
+
+static string decompress(const string& aData) {
+	string ret;
+	UnBZFilter filter;
+
+	ByteVector buf(1024 * 1024);
+	size_t pos = 0;
+	for (;;) {
+		auto inSize = aData.size() - pos;
+		auto outSize = buf.size();
+		auto more = filter(aData.data() + pos, inSize, &buf[0], outSize);
+		pos += inSize;
+		ret.append(reinterpret_cast<const char*>(&buf[0]), outSize);
+		if (!more) {
+			break;
+		}
+	}
+
+	return ret;
+}
+
+template<class F>
+static double measure(F&& aFunc) {
+	auto start = std::chrono::steady_clock::now();
+	aFunc();
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char* argv[]) {
+	const size_t size = (argc > 1 ? Util::toUInt32(argv[1]) : 64) * 1024 * 1024;
+	const int maxThreads = argc > 2 ? Util::toInt(argv[2]) : static_cast<int>(max(std::thread::hardware_concurrency(), 1U));
+	const string outputPath = argc > 3 ? argv[3] : Util::emptyString;
+
+	std::cout << "Generating a file list of " << size / (1024 * 1024) << " MB..." << std::endl;
+	auto xml = generateList(size);
+
+	int errors = 0;
+	auto verify = [&](const string& aName, const string& aCompressed) {
+		if (decompress(aCompressed) != xml) {
+			std::cout << "FAILED: " << aName << " output doesn't decompress to the original data" << std::endl;
+			errors++;
+		}
+	};
+
+	// Single stream encoder
+	{
+		string compressed;
+		auto time = measure([&] {
+			StringOutputStream sos(compressed);
+			FilteredOutputStream<BZFilter, false> bz(&sos);
+			bz.write(xml);
+			bz.flushBuffers(false);
+		});
+
+		std::cout << "BZFilter: " << time << " s, " << compressed.size() << " bytes" << std::endl;
+		verify("BZFilter", compressed);
+	}
+
+	for (int threads = 1; threads <= maxThreads; threads *= 2) {
+		string compressed;
+		auto time = measure([&] {
+			StringOutputStream sos(compressed);
+			ParallelBZOutputStream bz(&sos, threads);
+
+			// Small writes similar to the file list generation
+			for (size_t pos = 0; pos < xml.size(); pos += 100) {
+				bz.write(xml.data() + pos, min(static_cast<size_t>(100), xml.size() - pos));
+			}
+
+			bz.flushBuffers(false);
+		});
+
+		std::cout << "ParallelBZOutputStream (" << threads << " threads): " << time << " s, " << compressed.size() << " bytes" << std::endl;
+		verify("ParallelBZOutputStream", compressed);
+
+		if (!outputPath.empty() && threads == 1) {
+			// Can be checked with other decoders
+			File f(outputPath, File::WRITE, File::CREATE | File::TRUNCATE);
+			f.write(compressed);
+		}
+	}
+
+	if (errors == 0) {
+		std::cout << "All outputs were decompressed successfully" << std::endl;
+	}
+
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,539 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Measures the memory usage of loaded file lists and the time needed for loading, merging partial lists,
+// searching and comparing (list diff) them. The lists are loaded both sequentially and with multiple threads
+// and the loaded trees (and the errors with malformed generated lists) are compared. Searches are performed
+// both by walking the tree and with the search index, and the index creation time and memory usage are reported.
+//
+// Usage: airdcpp-filelist-loading-benchmark [files.xml.bz2 | files.xml]...
+// A generated file list is used if no files are given (partial lists are tested only with the generated list)
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/BZUtils.h>
+#include <airdcpp/ClientManager.h>
+#include <airdcpp/DirectoryListing.h>
+#include <airdcpp/Encoder.h>
+#include <airdcpp/File.h>
+#include <airdcpp/FilteredFile.h>
+#include <airdcpp/HashManager.h>
+#include <airdcpp/LogManager.h>
+#include <airdcpp/ResourceManager.h>
+#include <airdcpp/SearchQuery.h>
+#include <airdcpp/SettingsManager.h>
+#include <airdcpp/ShareManager.h>
+#include <airdcpp/SimpleXML.h>
+#include <airdcpp/TimerManager.h>
+#include <airdcpp/Util.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include <malloc.h>
+#include <stdlib.h>
+
+using namespace dcpp;
+
+// Allocated bytes, including large blocks allocated with mmap
+static size_t getHeapUsage() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	auto info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+#else
+	auto info = mallinfo();
+	return static_cast<size_t>(info.uordblks) + static_cast<size_t>(info.hblkhd);
+#endif
+}
+
+template<class F>
+static double measure(F&& aFunc) {
+	auto start = std::chrono::steady_clock::now();
+	aFunc();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char* words[] = { "Album", "Live", "Remastered", "Episode", "Season", "Documentary", "Collection", "Edition",
+	"Original", "Soundtrack", "Concert", "Extended", "Deluxe", "Anthology", "Chapter", "Volume" };
+
+struct Generator {
+	Generator(int aDirectories, int aSubdirectories, int aFiles) : directories(aDirectories), subdirectories(aSubdirectories), files(aFiles) { }
+
+	const int directories;
+	const int subdirectories;
+	const int files;
+
+	string getDirectoryName(int aDirectory) const {
+		return string(words[aDirectory % 16]) + " " + Util::toString(aDirectory) + (aDirectory % 10 == 0 ? " & \xc3\xa4\xc3\xb6" : "");
+	}
+
+	// Full list
+	string generate() const {
+		string xml = string(SimpleXML::utf8Header) + "<FileListing Version=\"1\" Base=\"/\" Generator=\"DC++ 0.868\">\r\n";
+		for (int d = 0; d < directories; ++d) {
+			xml += "<Directory Name=\"" + escape(getDirectoryName(d)) + "\" Date=\"1500000000\">\r\n";
+			appendContent(xml, d);
+			xml += "</Directory>\r\n";
+		}
+
+		return xml + "</FileListing>";
+	}
+
+	// Partial list of the root directory (only the top level directories)
+	string generatePartialRoot() const {
+		string xml = string(SimpleXML::utf8Header) + "<FileListing Version=\"1\" Base=\"/\" BaseDate=\"1500000000\" Generator=\"DC++ 0.868\">\r\n";
+		for (int d = 0; d < directories; ++d) {
+			xml += "<Directory Name=\"" + escape(getDirectoryName(d)) + "\" Date=\"1500000000\" Incomplete=\"1\" Directories=\"" +
+				Util::toString(subdirectories) + "\" Files=\"" + Util::toString(subdirectories * files) + "\"/>\r\n";
+		}
+
+		return xml + "</FileListing>";
+	}
+
+	// Recursive partial list of a top level directory
+	string generatePartial(int aDirectory) const {
+		string xml = string(SimpleXML::utf8Header) + "<FileListing Version=\"1\" Base=\"" + escape(getBase(aDirectory)) + "\" BaseDate=\"1500000000\" Generator=\"DC++ 0.868\">\r\n";
+		appendContent(xml, aDirectory);
+		return xml + "</FileListing>";
+	}
+
+	string getBase(int aDirectory) const {
+		return ADC_ROOT_STR + getDirectoryName(aDirectory) + ADC_SEPARATOR_STR;
+	}
+private:
+	void appendContent(string& xml_, int aDirectory) const {
+		std::mt19937 random(aDirectory);
+
+		uint8_t tth[24];
+		for (int s = 0; s < subdirectories; ++s) {
+			xml_ += "<Directory Name=\"" + string(words[random() % 16]) + " " + Util::toString(s) + " (" + Util::toString(1990 + random() % 30) + ")\" Date=\"1500000000\">\r\n";
+			for (int f = 0; f < files; ++f) {
+				for (auto& b: tth) {
+					b = static_cast<uint8_t>(random());
+				}
+
+				auto name = Util::toString(f + 1) + " - " + words[random() % 16] + " " + words[random() % 16] + " " + Util::toString(random() % 10000) + (f % 7 == 0 ? " <\xe2\x82\xac>" : "") + ".mp3";
+				xml_ += "<File Name=\"" + escape(name) + "\" Size=\"" + Util::toString(random()) + "\" TTH=\"" + Encoder::toBase32(tth, sizeof(tth)) + "\"/>\r\n";
+			}
+
+			xml_ += "</Directory>\r\n";
+		}
+	}
+
+	static string escape(const string& aStr) {
+		string tmp;
+		return SimpleXML::escape(aStr, tmp, true);
+	}
+};
+
+// Threads used for loading full lists in parallel
+static const int loadingThreads = 4;
+
+static DirectoryListing* createList(const string& aPath, bool aPartial, int aThreads = loadingThreads) {
+	auto user = ClientManager::getInstance()->getUser(CID::generate());
+	auto list = new DirectoryListing(HintedUser(user, Util::emptyString), aPartial, aPath, false);
+	list->setLoadingThreads(aThreads);
+	return list;
+}
+
+// Everything that is loaded from the list as text
+static void dumpTree(const DirectoryListing::Directory& aDir, string& dump_) {
+	dump_ += "D " + aDir.getAdcPath() + " " + Util::toString(aDir.getType()) + " " + Util::toString(aDir.getRemoteDate()) + " " +
+		Util::toString(aDir.getPartialSize()) + " " + Util::toString(aDir.getContentInfo().directories) + " " + Util::toString(aDir.getContentInfo().files) + "\n";
+
+	for (const auto& f: aDir.files) {
+		if (f->getParent() != &aDir) {
+			dump_ += "Invalid parent\n";
+		}
+
+		dump_ += "F " + f->getName() + " " + Util::toString(f->getSize()) + " " + f->getTTH().toBase32() + " " + Util::toString(f->getRemoteDate()) + "\n";
+	}
+
+	for (const auto& d: aDir.directories | map_values) {
+		if (d->getParent() != &aDir) {
+			dump_ += "Invalid parent\n";
+		}
+
+		dumpTree(*d, dump_);
+	}
+}
+
+static string dumpTree(const DirectoryListing& aList) {
+	string dump;
+	dumpTree(*aList.getRoot(), dump);
+	return dump;
+}
+
+// Returns the error message
+static string tryLoad(const string& aPath, int aThreads) {
+	unique_ptr<DirectoryListing> list(createList(aPath, false, aThreads));
+	try {
+		list->loadFile();
+	} catch (const Exception& e) {
+		return e.getError();
+	}
+
+	return "(no error)";
+}
+
+static const DirectoryListing::File* findFile(const DirectoryListing::Directory& aDir) {
+	if (!aDir.files.empty()) {
+		return aDir.files.back().get();
+	}
+
+	for (const auto& d: aDir.directories | map_values) {
+		auto f = findFile(*d);
+		if (f) {
+			return f;
+		}
+	}
+
+	return nullptr;
+}
+
+struct TestQuery {
+	string query;
+	StringList extensions;
+	SearchQuery::ItemType type;
+	int64_t minSize;
+
+	unique_ptr<SearchQuery> create() const {
+		unique_ptr<SearchQuery> ret;
+		if (type == SearchQuery::TYPE_ANY && query.size() == 39 && Encoder::isBase32(query.c_str())) {
+			ret.reset(new SearchQuery(TTHValue(query)));
+		} else {
+			ret.reset(new SearchQuery(query, StringList(), extensions, Search::MATCH_PATH_PARTIAL));
+			ret->itemType = type;
+			ret->gt = minSize;
+		}
+
+		ret->maxResults = numeric_limits<size_t>::max();
+		return ret;
+	}
+};
+
+// Searches with and without the search index must give the same results
+// An existing index is used if aCreateIndex is false
+static int testSearch(DirectoryListing& aList, bool aCreateIndex = true) {
+	int errors = 0;
+
+	vector<TestQuery> queries = {
+		{ "live", StringList(), SearchQuery::TYPE_ANY, 0 },
+		{ "remastered 1999", StringList(), SearchQuery::TYPE_ANY, 0 },
+		{ "episode 12", StringList(), SearchQuery::TYPE_ANY, 0 },
+		{ "soundtrack mp3", StringList(), SearchQuery::TYPE_ANY, 0 },
+		{ "nonexistent", StringList(), SearchQuery::TYPE_ANY, 0 },
+		{ "volume 3 deluxe", StringList(), SearchQuery::TYPE_ANY, 0 },
+		{ "season", StringList(), SearchQuery::TYPE_DIRECTORY, 0 },
+		{ "concert", { "mp3" }, SearchQuery::TYPE_FILE, 0 },
+		{ "", { "flac" }, SearchQuery::TYPE_FILE, 0 },
+		{ "live", StringList(), SearchQuery::TYPE_FILE, 4200000000LL },
+		{ "", StringList(), SearchQuery::TYPE_FILE, 4290000000LL },
+		{ "7", StringList(), SearchQuery::TYPE_ANY, 0 },
+		{ TTHValue().toBase32(), StringList(), SearchQuery::TYPE_ANY, 0 },
+	};
+
+	auto file = findFile(*aList.getRoot());
+	if (file) {
+		queries.push_back({ file->getTTH().toBase32(), StringList(), SearchQuery::TYPE_ANY, 0 });
+	}
+
+	auto runQueries = [&](bool aIndexed, vector<OrderedStringSet>& results_) {
+		for (const auto& q: queries) {
+			auto query = q.create();
+
+			OrderedStringSet paths;
+			if (aIndexed) {
+				aList.search(*aList.getRoot(), paths, *query);
+			} else {
+				aList.getRoot()->search(paths, *query);
+			}
+
+			results_.push_back(move(paths));
+		}
+	};
+
+	vector<OrderedStringSet> walkResults;
+	auto walkTime = measure([&] {
+		runQueries(false, walkResults);
+	});
+
+	auto heap = getHeapUsage();
+	auto indexTime = measure([&] {
+		if (aCreateIndex) {
+			aList.createSearchIndex();
+		}
+	});
+
+	auto memory = getHeapUsage() - heap;
+
+	vector<OrderedStringSet> indexedResults;
+	auto indexedTime = measure([&] {
+		runQueries(true, indexedResults);
+	});
+
+	size_t results = 0;
+	for (size_t i = 0; i < queries.size(); ++i) {
+		results += walkResults[i].size();
+		if (walkResults[i] != indexedResults[i]) {
+			std::cout << "FAILED: the indexed search for \"" << queries[i].query << "\" returned " << indexedResults[i].size() << " directories, " << walkResults[i].size() << " expected" << std::endl;
+			errors++;
+		}
+	}
+
+	auto info = aList.getSearchIndexInfo();
+	if (!info) {
+		std::cout << "FAILED: the search index wasn't created" << std::endl;
+		return errors + 1;
+	}
+
+	if (aCreateIndex) {
+		auto files = aList.getTotalFileCount();
+		std::cout << "search index: " << indexTime * 1000 << " ms, memory: " << memory / 1024 << " KiB (" << (files > 0 ? memory / files : 0) << " bytes per file, estimated " <<
+			info->memoryUsage / 1024 << " KiB)" << std::endl;
+	}
+
+	std::cout << "search: " << walkTime * 1000 << " ms without the index, " << indexedTime * 1000 << " ms with the index (" << queries.size() << " queries, " << results << " matching directories)" << std::endl;
+	return errors;
+}
+
+static int test(const string& aName, const string& aPath) {
+	int errors = 0;
+	std::cout << aName << std::endl;
+
+	auto heap = getHeapUsage();
+
+	unique_ptr<DirectoryListing> list;
+	auto loadTime = measure([&] {
+		list.reset(createList(aPath, false));
+		list->loadFile();
+	});
+
+	auto files = list->getTotalFileCount();
+	auto memory = getHeapUsage() - heap;
+	std::cout << "load (" << loadingThreads << " threads): " << loadTime * 1000 << " ms, " << files << " files, memory: " << memory / 1024 << " KiB (" <<
+		(files > 0 ? memory / files : 0) << " bytes per file)" << std::endl;
+
+	errors += testSearch(*list);
+
+	// Compare against a sequentially loaded copy of the list (everything should be removed)
+	{
+		unique_ptr<DirectoryListing> other;
+		auto sequentialTime = measure([&] {
+			other.reset(createList(aPath, false, 1));
+			other->loadFile();
+		});
+
+		std::cout << "load (1 thread): " << sequentialTime * 1000 << " ms" << std::endl;
+		if (dumpTree(*list) != dumpTree(*other)) {
+			std::cout << "FAILED: the lists loaded with one and " << loadingThreads << " threads are different" << std::endl;
+			errors++;
+		}
+
+		auto diffTime = measure([&] {
+			list->getRoot()->filterList(*other);
+		});
+
+		std::cout << "list diff: " << diffTime * 1000 << " ms" << std::endl;
+		if (list->getTotalFileCount() != 0) {
+			std::cout << "FAILED: " << list->getTotalFileCount() << " files remaining after the list diff" << std::endl;
+			errors++;
+		}
+	}
+
+	return errors;
+}
+
+// Malformed lists must fail with the same errors when they are loaded in parallel
+static int testErrors(const string& aXml, const string& aTempPath) {
+	int errors = 0;
+
+	auto replace = [&](const string& aFrom, const string& aTo, size_t aOccurrence) {
+		auto xml = aXml;
+		auto pos = xml.find(aFrom);
+		while (aOccurrence-- > 0 && pos != string::npos) {
+			pos = xml.find(aFrom, pos + 1);
+		}
+
+		if (pos != string::npos) {
+			xml.replace(pos, aFrom.size(), aTo);
+		}
+
+		return xml;
+	};
+
+	vector<pair<string, string>> lists = {
+		{ "truncated listing", aXml.substr(0, aXml.size() - 20) },
+		{ "truncated directory", aXml.substr(0, aXml.size() * 2 / 3) },
+		{ "duplicate directory", replace("Live 1\"", "Live 17\"", 0) },
+		{ "mismatched end tag", replace("</Directory>", "</Directoyr>", 3000) },
+		{ "invalid entity and a duplicate", replace("Live 17\"", "Live 1\"", 0).replace(aXml.size() / 2, 0, "&invalid;") },
+		{ "invalid root item", replace("</Directory>\r\n<Directory Name=\"Live 17", "</Directory>\r\n<Unknown></Unknown>\r\n<Directory Name=\"Live 17", 0) },
+	};
+
+	for (const auto& l: lists) {
+		for (const auto& compress: { false, true }) {
+			auto path = aTempPath + "errors.xml" + (compress ? ".bz2" : "");
+			{
+				File f(path, File::WRITE, File::CREATE | File::TRUNCATE);
+				if (compress) {
+					FilteredOutputStream<BZFilter, false> bz(&f);
+					bz.write(l.second);
+					bz.flushBuffers(true);
+				} else {
+					f.write(l.second);
+				}
+			}
+
+			auto sequentialError = tryLoad(path, 1);
+			auto parallelError = tryLoad(path, loadingThreads);
+			if (sequentialError != parallelError) {
+				std::cout << "FAILED: " << l.first << (compress ? " (bzip2)" : "") << ": \"" << sequentialError << "\" (1 thread), \"" << parallelError << "\" (" << loadingThreads << " threads)" << std::endl;
+				errors++;
+			}
+		}
+	}
+
+	std::cout << "errors: " << lists.size() << " malformed lists tested" << std::endl;
+	return errors;
+}
+
+static int testPartial(const Generator& aGenerator, size_t aExpectedFiles) {
+	int errors = 0;
+	std::cout << "Partial list" << std::endl;
+
+	unique_ptr<DirectoryListing> list(createList(Util::emptyString, true));
+
+	auto root = aGenerator.generatePartialRoot();
+	StringList partials;
+	for (int d = 0; d < aGenerator.directories; ++d) {
+		partials.push_back(aGenerator.generatePartial(d));
+	}
+
+	auto heap = getHeapUsage();
+	auto time = measure([&] {
+		list->loadPartialXml(root, ADC_ROOT_STR);
+		for (int d = 0; d < aGenerator.directories; ++d) {
+			list->loadPartialXml(partials[d], aGenerator.getBase(d));
+		}
+	});
+
+	auto memory = getHeapUsage() - heap;
+	std::cout << "merge: " << time * 1000 << " ms, memory: " << memory / 1024 << " KiB" << std::endl;
+
+	if (list->getTotalFileCount() != aExpectedFiles) {
+		std::cout << "FAILED: " << list->getTotalFileCount() << " files were loaded, " << aExpectedFiles << " expected" << std::endl;
+		errors++;
+	}
+
+	errors += testSearch(*list);
+
+	// Reload directories (the index is updated)
+	{
+		auto index = list->getSearchIndexInfo();
+		auto time = measure([&] {
+			for (int d = 0; d < aGenerator.directories; d += 2) {
+				list->addPartialListTask(partials[d], aGenerator.getBase(d));
+			}
+		});
+
+		std::cout << "reload: " << time * 1000 << " ms" << std::endl;
+
+		auto updated = list->getSearchIndexInfo();
+		if (!index || !updated || updated->files != index->files || updated->directories != index->directories) {
+			std::cout << "FAILED: the search index wasn't updated correctly" << std::endl;
+			errors++;
+		}
+	}
+
+	errors += testSearch(*list, false);
+
+	// Load new directories in an indexed list
+	{
+		unique_ptr<DirectoryListing> indexed(createList(Util::emptyString, true));
+		indexed->loadPartialXml(root, ADC_ROOT_STR);
+		indexed->createSearchIndex();
+		for (int d = 0; d < aGenerator.directories; d += 3) {
+			indexed->loadPartialXml(partials[d], aGenerator.getBase(d));
+		}
+
+		errors += testSearch(*indexed, false);
+	}
+
+	return errors;
+}
+
+int main(int argc, char* argv[]) {
+	char tempPath[] = "/tmp/airdcpp-benchmark-XXXXXX";
+	if (!mkdtemp(tempPath)) {
+		std::cerr << "Failed to create a temporary config directory" << std::endl;
+		return 1;
+	}
+
+	Util::initialize(string(tempPath) + PATH_SEPARATOR_STR);
+
+	ResourceManager::newInstance();
+	SettingsManager::newInstance();
+	LogManager::newInstance();
+	TimerManager::newInstance();
+	HashManager::newInstance();
+
+	// Lists remove their listeners on destruction
+	ShareManager::newInstance();
+	ClientManager::newInstance();
+
+	int errors = 0;
+	try {
+		if (argc < 2) {
+			Generator generator(400, 25, 20);
+
+			auto xml = generator.generate();
+			auto path = string(tempPath) + PATH_SEPARATOR_STR + "files.xml";
+			File(path, File::WRITE, File::CREATE | File::TRUNCATE).write(xml);
+
+			errors += test("Generated list", path);
+			errors += testErrors(xml, string(tempPath) + PATH_SEPARATOR_STR);
+			errors += testPartial(generator, generator.directories * generator.subdirectories * generator.files);
+		}
+
+		for (int i = 1; i < argc; ++i) {
+			errors += test(argv[i], argv[i]);
+		}
+	} catch (const Exception& e) {
+		std::cout << "FAILED: " << e.getError() << std::endl;
+		errors++;
+	}
+
+	ClientManager::deleteInstance();
+	ShareManager::deleteInstance();
+	HashManager::deleteInstance();
+	TimerManager::deleteInstance();
+	LogManager::deleteInstance();
+	SettingsManager::deleteInstance();
+	ResourceManager::deleteInstance();
+
+	try {
+		File::removeDirectoryForced(string(tempPath) + PATH_SEPARATOR_STR);
+	} catch (const FileException&) {
+		// ...
+	}
+
+	std::cout << (errors == 0 ? "All tests passed" : Util::toString(errors) + " errors") << std::endl;
+	return errors == 0 ? 0 : 1;
+}
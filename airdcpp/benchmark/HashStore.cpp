@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Compares single and batched file index operations (the lookups performed when refreshing
+// an already hashed share and the writes performed after hashing files)
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/File.h>
+#include <airdcpp/LevelDB.h>
+#include <airdcpp/Util.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+
+using namespace dcpp;
+
+// Value of the same size as in the file index
+static const size_t VALUE_SIZE = sizeof(uint8_t) + sizeof(uint64_t) + 24 + sizeof(int64_t);
+
+static string getFilePath(size_t aDirectory, size_t aFile) {
+	return "/mnt/share/directory " + Util::toString(aDirectory / 100) + "/sub directory " + Util::toString(aDirectory) + "/file name " + Util::toString(aFile) + ".ext";
+}
+
+template<class F>
+static double measure(F&& aFunc) {
+	auto start = std::chrono::steady_clock::now();
+	aFunc();
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		std::cout << "Usage: airdcpp-hash-store-benchmark <database directory> [files, default 1000000] [files per directory, default 20]" << std::endl;
+		return 1;
+	}
+
+	const string path = Util::validatePath(argv[1], true);
+	const size_t files = argc > 2 ? Util::toUInt32(argv[2]) : 1000000;
+	const size_t filesPerDirectory = max(argc > 3 ? Util::toUInt32(argv[3]) : 20, 1U);
+	const size_t directories = max(files / filesPerDirectory, static_cast<size_t>(1));
+
+	File::ensureDirectory(path);
+
+	// Same options as with the file index
+	unique_ptr<DbHandler> db(new LevelDB(path, "File index", 8 * 1024 * 1024, 50, true, 64 * 1024));
+	try {
+		db->open([](const string&) { }, [](const string& aMessage, bool, bool) {
+			std::cout << aMessage << std::endl;
+			return false;
+		});
+	} catch (const DbException& e) {
+		std::cout << "Failed to open the database: " << e.getError() << std::endl;
+		return 1;
+	}
+
+	std::mt19937 random(1);
+	string value(VALUE_SIZE, 'x');
+
+	if (db->size(true) < directories * filesPerDirectory) {
+		std::cout << "Creating " << directories * filesPerDirectory << " entries..." << std::endl;
+		DbBatch batch;
+		for (size_t d = 0; d < directories; ++d) {
+			for (size_t f = 0; f < filesPerDirectory; ++f) {
+				auto key = getFilePath(d, f);
+				batch.put(key.data(), key.size(), value.data(), value.size());
+			}
+
+			if (batch.size() >= 10000) {
+				db->write(batch);
+				batch.clear();
+			}
+		}
+
+		db->write(batch);
+	}
+
+	// Directories are listed in a random order (similar to the file system)
+	vector<size_t> directoryOrder(directories);
+	for (size_t d = 0; d < directories; ++d) {
+		directoryOrder[d] = d;
+	}
+
+	shuffle(directoryOrder.begin(), directoryOrder.end(), random);
+
+	size_t found = 0;
+	auto singleLookups = [&] {
+		found = 0;
+		for (auto d: directoryOrder) {
+			for (size_t f = 0; f < filesPerDirectory; ++f) {
+				auto key = getFilePath(d, filesPerDirectory - f - 1);
+				if (db->get((void*)key.data(), key.size(), VALUE_SIZE, [](void*, size_t) { return true; })) {
+					found++;
+				}
+			}
+		}
+	};
+
+	auto batchLookups = [&] {
+		found = 0;
+		StringList keys;
+		vector<DbKey> dbKeys;
+		for (auto d: directoryOrder) {
+			keys.clear();
+			dbKeys.clear();
+			for (size_t f = 0; f < filesPerDirectory; ++f) {
+				keys.push_back(getFilePath(d, filesPerDirectory - f - 1));
+			}
+
+			for (const auto& k: keys) {
+				dbKeys.emplace_back(k.data(), k.size());
+			}
+
+			db->get(dbKeys, [&](size_t, void*, size_t) { found++; });
+		}
+	};
+
+	// Warm up the caches
+	singleLookups();
+
+	auto singleTime = measure(singleLookups);
+	auto singleFound = found;
+	auto batchTime = measure(batchLookups);
+
+	if (found != singleFound || found != directories * filesPerDirectory) {
+		std::cout << "FAILED: found " << singleFound << " (single) and " << found << " (batch) entries, expected " << directories * filesPerDirectory << std::endl;
+		return 1;
+	}
+
+	std::cout << "Lookups for " << found << " files, single: " << singleTime << " s" << std::endl;
+	std::cout << "Lookups for " << found << " files, one batch per directory: " << batchTime << " s" << std::endl;
+
+	// Synced writes
+	const size_t writes = 2000;
+	auto singleWriteTime = measure([&] {
+		for (size_t i = 0; i < writes; ++i) {
+			auto key = getFilePath(directories + 1, i);
+			db->put((void*)key.data(), key.size(), (void*)value.data(), value.size());
+		}
+	});
+
+	auto batchWriteTime = measure([&] {
+		DbBatch batch;
+		for (size_t i = 0; i < writes; ++i) {
+			auto key = getFilePath(directories + 2, i);
+			batch.put(key.data(), key.size(), value.data(), value.size());
+			if (batch.size() == 256) {
+				db->write(batch);
+				batch.clear();
+			}
+		}
+
+		db->write(batch);
+	});
+
+	std::cout << "Writes for " << writes << " hashed files, single: " << singleWriteTime << " s" << std::endl;
+	std::cout << "Writes for " << writes << " hashed files, batches of 256: " << batchWriteTime << " s" << std::endl;
+	return 0;
+}
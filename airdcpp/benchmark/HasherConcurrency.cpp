@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Runs the adaptive hasher concurrency controller against simulated devices with different
+// concurrency/throughput curves and checks that it converges to the best concurrency
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/ConcurrencyController.h>
+
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+using namespace dcpp;
+
+static const int64_t MB = 1024 * 1024;
+static const int64_t READ_SIZE = 256 * 1024;
+static const int MAX_HASHERS = 8;
+
+struct Device {
+	string name;
+
+	// Throughput with the given number of concurrent readers (bytes/s)
+	std::function<int64_t (int)> throughput;
+};
+
+static int getBestConcurrency(const Device& aDevice) {
+	int best = 1;
+	for (int c = 2; c <= MAX_HASHERS; ++c) {
+		if (aDevice.throughput(c) > aDevice.throughput(best)) {
+			best = c;
+		}
+	}
+
+	return best;
+}
+
+// Returns false if the controller didn't spend most of the second half of the run at the best concurrency
+static bool simulate(const Device& aDevice, int aSeconds, std::mt19937& aRandom) {
+	std::uniform_real_distribution<double> noise(0.95, 1.05);
+
+	ConcurrencyController controller(MAX_HASHERS);
+	const auto best = getBestConcurrency(aDevice);
+
+	int64_t totalBytes = 0;
+	int convergedAt = -1;
+	int bestSeconds = 0;
+	string trace;
+
+	for (int second = 0; second < aSeconds; ++second) {
+		auto limit = controller.getLimit();
+
+		ConcurrencyController::Sample sample;
+		sample.duration = 1000;
+		sample.active = limit;
+		sample.demand = MAX_HASHERS;
+		sample.bytes = static_cast<int64_t>(static_cast<double>(aDevice.throughput(limit)) * noise(aRandom));
+		sample.reads = sample.bytes / READ_SIZE;
+
+		// Each reader gets its share of the throughput
+		sample.waitTime = sample.bytes > 0 ? sample.reads * (READ_SIZE * limit * 1000000 / sample.bytes) : 0;
+
+		totalBytes += sample.bytes;
+		if (second >= aSeconds / 2 && limit == best) {
+			bestSeconds++;
+		}
+
+		if (controller.addSample(sample)) {
+			trace += " " + std::to_string(controller.getLimit());
+			if (controller.getLimit() == best && convergedAt < 0) {
+				convergedAt = second + 1;
+			}
+		}
+	}
+
+	auto bestShare = static_cast<double>(bestSeconds) / (aSeconds - aSeconds / 2);
+	std::cout << std::left << std::setw(28) << aDevice.name
+		<< " best " << best << " (" << aDevice.throughput(best) / MB << " MiB/s)"
+		<< ", final " << controller.getLimit()
+		<< ", reached after " << (best == 1 ? 0 : convergedAt) << " s"
+		<< ", time at best " << static_cast<int>(bestShare * 100) << "%"
+		<< ", average " << totalBytes / aSeconds / MB << " MiB/s" << std::endl;
+	std::cout << "    limits:" << trace << std::endl;
+
+	return bestShare >= 0.9;
+}
+
+int main(int argc, char* argv[]) {
+	int seconds = argc > 1 ? atoi(argv[1]) : 600;
+	if (seconds < 60) {
+		std::cout << "Usage: airdcpp-hasher-concurrency-benchmark [simulated seconds, at least 60]" << std::endl;
+		return 1;
+	}
+
+	auto ssd = [](int c) { return c <= 4 ? 120 * MB * c : 480 * MB - 20 * MB * (c - 4); };
+
+	vector<Device> devices = {
+		{ "SSD", ssd },
+		{ "Hard disk", [](int c) { return c == 1 ? 150 * MB : 120 * MB - 10 * MB * c; } },
+		{ "USB disk", [](int c) { return c == 1 ? 35 * MB : 14 * MB / (c - 1); } },
+		{ "Network share", [](int c) { return 40 * MB * min(c, 6); } },
+
+		// The global hashing speed limit is reached with two readers
+		{ "SSD, limited to 200 MiB/s", [ssd](int c) { return min(ssd(c), 200 * MB); } },
+	};
+
+	std::mt19937 random(1);
+	bool ok = true;
+	for (const auto& d: devices) {
+		if (!simulate(d, seconds, random)) {
+			std::cout << "FAILED: " << d.name << " didn't converge to the best concurrency" << std::endl;
+			ok = false;
+		}
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,603 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Applies random queue changes to the queue journal and to an in-memory model and verifies that the
+// model is recovered after interrupted writes (journal cut at any position), corrupted records and
+// interrupted compactions. Finally measures the time needed for writing and loading a large queue.
+//
+// Usage: airdcpp-queue-journal-benchmark [bundles] [files per bundle] [changes]
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/File.h>
+#include <airdcpp/QueueJournal.h>
+#include <airdcpp/Util.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include <stdlib.h>
+
+using namespace dcpp;
+
+typedef QueueJournal::BundleInfoMap BundleInfoMap;
+
+// Size of the file header
+static const size_t HEADER_SIZE = 16;
+
+template<class F>
+static double measure(F&& aFunc) {
+	auto start = std::chrono::steady_clock::now();
+	aFunc();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The queue as a string so that the loaded queues can be compared with the model
+static string dump(const BundleInfoMap& aBundles) {
+	std::ostringstream os;
+	for (const auto& b: aBundles | map_values) {
+		os << "B " << b.token << " " << b.target << " " << b.fileBundle << " " << b.added << " " << b.date << " " << b.timeFinished << " " << b.resumeTime <<
+			" " << static_cast<int>(b.priority) << " " << b.autoPriority << " " << b.addedByAutoSearch << "\n";
+
+		map<string, const QueueJournal::FileInfo*> files;
+		for (const auto& f: b.files) {
+			files.emplace(f.first, &f.second);
+		}
+
+		for (const auto& f: files) {
+			const auto& file = *f.second;
+			os << " F " << f.first << " " << file.size << " " << file.added << " " << file.timeFinished << " " << file.tth.toBase32() << " " << static_cast<int>(file.priority) <<
+				" " << file.autoPriority << " " << static_cast<int>(file.maxSegments) << " " << file.tempTarget << " " << file.lastSource << "\n";
+
+			for (const auto& s: file.done) {
+				os << "  G " << s.getStart() << " " << s.getSize() << "\n";
+			}
+
+			for (const auto& s: file.sources) {
+				os << "  S " << s.cid.toBase32() << " " << s.nick << " " << s.hubHint << "\n";
+			}
+		}
+	}
+
+	return os.str();
+}
+
+static void writeData(const string& aPath, const string& aData) {
+	File f(aPath, File::WRITE, File::CREATE | File::TRUNCATE);
+	f.write(aData);
+}
+
+static string readData(const string& aPath) {
+	return File(aPath, File::READ, File::OPEN).read();
+}
+
+// Makes the same changes in the journal and in the model
+class Mutator {
+public:
+	Mutator(QueueJournal& aJournal, BundleInfoMap& aModel, uint32_t aSeed) : journal(aJournal), model(aModel), random(aSeed) { }
+
+	QueueJournal::FileInfo randomFile() {
+		QueueJournal::FileInfo f;
+		f.size = 1 + random() % (1024 * 1024 * 1024);
+		f.added = 1500000000 + random() % 1000000;
+		for (auto& c: f.tth.data) {
+			c = static_cast<uint8_t>(random());
+		}
+
+		f.priority = randomPriority();
+		f.autoPriority = random() % 2 == 0;
+		f.maxSegments = static_cast<uint8_t>(1 + random() % 10);
+
+		if (random() % 10 == 0) {
+			f.done.add(Segment(0, f.size));
+			f.timeFinished = f.added + 1000;
+			f.lastSource = "Source " + Util::toString(random() % 100);
+			return f;
+		}
+
+		auto segments = random() % 4;
+		for (uint32_t i = 0; i < segments; ++i) {
+			f.done.add(randomSegment(f.size));
+		}
+
+		if (!f.done.empty()) {
+			f.tempTarget = "/tmp/downloads/" + f.tth.toBase32() + ".dctmp";
+		}
+
+		auto sources = random() % 4;
+		for (uint32_t i = 0; i < sources; ++i) {
+			f.sources.push_back(randomSource());
+		}
+
+		return f;
+	}
+
+	QueueJournal::BundleInfo randomBundle(int aFiles) {
+		QueueJournal::BundleInfo b;
+		b.token = ++lastToken;
+		b.fileBundle = aFiles == 1 && random() % 2 == 0;
+		b.target = "/home/user/Downloads/Bundle " + Util::toString(b.token) + (b.fileBundle ? ".bin" : PATH_SEPARATOR_STR);
+		b.added = 1500000000 + random() % 1000000;
+		b.date = b.added - random() % 1000000;
+		b.priority = randomPriority();
+		b.autoPriority = random() % 2 == 0;
+		b.addedByAutoSearch = random() % 5 == 0;
+
+		for (int i = 0; i < aFiles; ++i) {
+			auto target = b.fileBundle ? b.target : b.target + "Folder " + Util::toString(i % 3) + PATH_SEPARATOR_STR + "File " + Util::toString(i) + ".bin";
+			b.files[target] = randomFile();
+		}
+
+		return b;
+	}
+
+	void next() {
+		if (model.empty()) {
+			addBundle();
+			return;
+		}
+
+		auto& b = randomItem(model).second;
+		auto target = b.files.empty() ? Util::emptyString : randomItem(b.files).first;
+		auto file = b.files.empty() ? nullptr : &b.files[target];
+
+		switch (random() % 10) {
+			case 0: addBundle(); break;
+			case 1: {
+				auto token = b.token;
+				journal.removeBundle(token);
+				model.erase(token);
+				break;
+			}
+			case 2: {
+				b.priority = randomPriority();
+				b.autoPriority = random() % 2 == 0;
+				b.resumeTime = random() % 2 == 0 ? 0 : 1600000000 + random() % 1000;
+				b.timeFinished = random() % 5 == 0 ? 1600000000 + random() % 1000 : 0;
+				journal.updateBundle(b);
+				break;
+			}
+			case 3: {
+				if (b.fileBundle) {
+					break;
+				}
+
+				auto newTarget = b.target + "File " + Util::toString(random()) + ".bin";
+				b.files[newTarget] = randomFile();
+				journal.addFile(b.token, newTarget, b.files[newTarget]);
+				break;
+			}
+			case 4: {
+				if (file) {
+					journal.removeFile(b.token, target);
+					b.files.erase(target);
+				}
+				break;
+			}
+			case 5: {
+				if (file) {
+					file->priority = randomPriority();
+					file->autoPriority = random() % 2 == 0;
+					journal.setFilePriority(b.token, target, file->priority, file->autoPriority);
+				}
+				break;
+			}
+			case 6: {
+				if (file) {
+					auto source = randomSource();
+					if (!file->sources.empty() && random() % 3 == 0) {
+						// Updated hub hint
+						source.cid = file->sources.front().cid;
+						file->sources.front() = source;
+					} else {
+						file->sources.push_back(source);
+					}
+
+					journal.addSource(b.token, target, source);
+				}
+				break;
+			}
+			case 7: {
+				if (file && !file->sources.empty()) {
+					auto cid = file->sources[random() % file->sources.size()].cid;
+					file->sources.erase(remove_if(file->sources.begin(), file->sources.end(), [&](const QueueJournal::SourceInfo& s) { return s.cid == cid; }), file->sources.end());
+					journal.removeSource(b.token, target, cid);
+				}
+				break;
+			}
+			default: {
+				if (file && !file->isFinished()) {
+					auto segment = randomSegment(file->size);
+					file->done.add(segment);
+					journal.addSegment(b.token, target, segment);
+				}
+				break;
+			}
+		}
+	}
+
+	void addBundle() {
+		auto b = randomBundle(1 + random() % 5);
+		journal.addBundle(b);
+		model[b.token] = move(b);
+	}
+private:
+	QueueJournal& journal;
+	BundleInfoMap& model;
+	std::mt19937 random;
+	QueueToken lastToken = 0;
+
+	template<class T>
+	typename T::value_type& randomItem(T& aContainer) {
+		auto i = aContainer.begin();
+		advance(i, random() % aContainer.size());
+		return *i;
+	}
+
+	Priority randomPriority() {
+		return static_cast<Priority>(static_cast<int>(Priority::PAUSED_FORCE) + random() % 6);
+	}
+
+	Segment randomSegment(int64_t aFileSize) {
+		auto start = static_cast<int64_t>(random() % aFileSize);
+		return Segment(start, 1 + static_cast<int64_t>(random() % (aFileSize - start)));
+	}
+
+	QueueJournal::SourceInfo randomSource() {
+		QueueJournal::SourceInfo s;
+		s.cid = CID::generate();
+		s.nick = "User " + Util::toString(random() % 1000);
+		s.hubHint = "adcs://hub" + Util::toString(random() % 5) + ".example.com:1511";
+		return s;
+	}
+};
+
+// Loads the given files from a separate directory and compares the result with the expected queue
+static int checkLoad(const string& aDirectory, const string& aName, const string& aSnapshot, const string& aJournal, const string& aExpected, int64_t aDiscarded) {
+	QueueJournal journal(aDirectory);
+	writeData(journal.getSnapshotPath(), aSnapshot);
+	writeData(journal.getJournalPath(), aJournal);
+
+	BundleInfoMap bundles;
+	int64_t discarded = 0;
+	try {
+		discarded = journal.load(bundles);
+	} catch (const Exception& e) {
+		std::cout << "FAILED (" << aName << "): " << e.getError() << std::endl;
+		return 1;
+	}
+
+	if (dump(bundles) != aExpected) {
+		std::cout << "FAILED (" << aName << "): the loaded queue is different" << std::endl;
+		return 1;
+	}
+
+	if (discarded != aDiscarded) {
+		std::cout << "FAILED (" << aName << "): " << discarded << " bytes were discarded instead of " << aDiscarded << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+struct Recording {
+	string snapshot;
+	string journal;
+
+	// The model after each journal record
+	vector<pair<size_t, string>> states;
+
+	const pair<size_t, string>& getState(size_t aJournalPos) const {
+		auto i = upper_bound(states.begin(), states.end(), aJournalPos, [](size_t aPos, const pair<size_t, string>& aState) { return aPos < aState.first; });
+		return i == states.begin() ? states.front() : *prev(i);
+	}
+};
+
+static int testRecovery(const string& aTempPath, int aChanges) {
+	const auto dir = aTempPath + "recovery" + PATH_SEPARATOR_STR;
+	const auto scratchDir = aTempPath + "scratch" + PATH_SEPARATOR_STR;
+	File::ensureDirectory(dir);
+	File::ensureDirectory(scratchDir);
+
+	int errors = 0;
+
+	BundleInfoMap model;
+	QueueJournal journal(dir);
+	Mutator mutator(journal, model, 1);
+
+	// Initial snapshot
+	for (int i = 0; i < 20; ++i) {
+		auto b = mutator.randomBundle(1 + i % 5);
+		model[b.token] = move(b);
+	}
+
+	journal.compact([&](const QueueJournal::BundleInfoF& aAddBundle) {
+		for (const auto& b: model | map_values) {
+			aAddBundle(b);
+		}
+	});
+
+	// Each change is flushed separately so that the model is known after each record
+	Recording recording;
+	recording.states.emplace_back(HEADER_SIZE, dump(model));
+	for (int i = 0; i < aChanges; ++i) {
+		mutator.next();
+		journal.flush();
+		recording.states.emplace_back(static_cast<size_t>(journal.getJournalSize()), dump(model));
+	}
+
+	recording.snapshot = readData(journal.getSnapshotPath());
+	recording.journal = readData(journal.getJournalPath());
+	const auto& finalState = recording.states.back().second;
+
+	std::cout << aChanges << " changes, snapshot: " << recording.snapshot.size() << " bytes, journal: " << recording.journal.size() << " bytes" << std::endl;
+
+	errors += checkLoad(scratchDir, "complete journal", recording.snapshot, recording.journal, finalState, 0);
+
+	// Interrupted writes
+	{
+		std::mt19937 random(2);
+		vector<size_t> positions;
+		for (size_t i = 0; i <= HEADER_SIZE; ++i) {
+			positions.push_back(i);
+		}
+
+		for (const auto& s: recording.states) {
+			positions.push_back(s.first - 1);
+			positions.push_back(s.first + 1);
+		}
+
+		for (int i = 0; i < 1000; ++i) {
+			positions.push_back(random() % recording.journal.size());
+		}
+
+		int tested = 0;
+		for (auto pos: positions) {
+			if (pos >= recording.journal.size()) {
+				continue;
+			}
+
+			const auto& state = recording.getState(pos);
+			auto discarded = pos < HEADER_SIZE ? 0 : pos - state.first;
+			errors += checkLoad(scratchDir, "journal cut at " + Util::toString(pos), recording.snapshot, recording.journal.substr(0, pos), state.second, discarded);
+			tested++;
+		}
+
+		std::cout << "Interrupted writes: " << tested << " positions tested" << std::endl;
+	}
+
+	// Writing after an interrupted write
+	{
+		// The longest record is cut and a shorter one is written after it
+		size_t pos = 0, longest = 0;
+		for (size_t i = 1; i < recording.states.size(); ++i) {
+			auto len = recording.states[i].first - recording.states[i - 1].first;
+			if (len > longest) {
+				longest = len;
+				pos = recording.states[i].first - 1;
+			}
+		}
+
+		auto state = recording.getState(pos);
+
+		{
+			QueueJournal scratch(scratchDir);
+			writeData(scratch.getSnapshotPath(), recording.snapshot);
+			writeData(scratch.getJournalPath(), recording.journal.substr(0, pos));
+
+			BundleInfoMap bundles;
+			scratch.load(bundles);
+
+			auto token = bundles.begin()->first;
+			scratch.removeBundle(token);
+			scratch.flush();
+			bundles.erase(token);
+
+			state.second = dump(bundles);
+		}
+
+		QueueJournal scratch(scratchDir);
+		BundleInfoMap bundles;
+		auto discarded = scratch.load(bundles);
+		if (dump(bundles) != state.second || discarded != 0) {
+			std::cout << "FAILED: incomplete record wasn't removed from the journal" << std::endl;
+			errors++;
+		}
+	}
+
+	// Corrupted records
+	{
+		std::mt19937 random(4);
+		for (int i = 0; i < 500; ++i) {
+			auto pos = random() % recording.journal.size();
+			auto data = recording.journal;
+			data[pos] ^= static_cast<char>(1 + random() % 255);
+
+			const auto& state = recording.getState(pos);
+			auto discarded = pos < HEADER_SIZE ? 0 : data.size() - state.first;
+			errors += checkLoad(scratchDir, "corrupted byte at " + Util::toString(pos), recording.snapshot, data, state.second, discarded);
+		}
+
+		auto snapshot = recording.snapshot;
+		snapshot[snapshot.size() / 2] ^= 0x20;
+
+		QueueJournal scratch(scratchDir);
+		writeData(scratch.getSnapshotPath(), snapshot);
+
+		BundleInfoMap bundles;
+		try {
+			scratch.load(bundles);
+			std::cout << "FAILED: corrupted snapshot was loaded" << std::endl;
+			errors++;
+		} catch (const QueueJournalException&) { }
+	}
+
+	// Each record applied twice
+	{
+		string data = recording.journal.substr(0, HEADER_SIZE);
+		for (size_t i = 1; i < recording.states.size(); ++i) {
+			auto start = recording.states[i - 1].first;
+			auto record = recording.journal.substr(start, recording.states[i].first - start);
+			data += record + record;
+		}
+
+		errors += checkLoad(scratchDir, "repeated records", recording.snapshot, data, finalState, 0);
+	}
+
+	// Interrupted compactions
+	{
+		// Crash while writing the new snapshot
+		auto partialSnapshot = recording.snapshot.substr(0, recording.snapshot.size() / 2);
+		writeData(scratchDir + "QueueSnapshot.bin.tmp", partialSnapshot);
+		writeData(journal.getSnapshotPath() + ".tmp", partialSnapshot);
+		errors += checkLoad(scratchDir, "partial new snapshot", recording.snapshot, recording.journal, finalState, 0);
+
+		journal.compact([&](const QueueJournal::BundleInfoF& aAddBundle) {
+			for (const auto& b: model | map_values) {
+				aAddBundle(b);
+			}
+		});
+
+		if (Util::fileExists(journal.getSnapshotPath() + ".tmp")) {
+			std::cout << "FAILED: temporary snapshot was left" << std::endl;
+			errors++;
+		}
+
+		// Crash after replacing the snapshot (the old journal is still there)
+		auto snapshot = readData(journal.getSnapshotPath());
+		errors += checkLoad(scratchDir, "old journal", snapshot, recording.journal, finalState, 0);
+
+		// The compacted queue after more changes
+		for (int i = 0; i < 100; ++i) {
+			mutator.next();
+		}
+
+		journal.flush();
+
+		QueueJournal loader(dir);
+		BundleInfoMap bundles;
+		loader.load(bundles);
+		if (dump(bundles) != dump(model)) {
+			std::cout << "FAILED: the queue is different after compaction" << std::endl;
+			errors++;
+		}
+	}
+
+	return errors;
+}
+
+static int benchmark(const string& aTempPath, int aBundles, int aFiles) {
+	const auto dir = aTempPath + "benchmark" + PATH_SEPARATOR_STR;
+	File::ensureDirectory(dir);
+
+	BundleInfoMap model;
+	size_t files = 0;
+
+	{
+		QueueJournal journal(dir);
+		Mutator mutator(journal, model, 5);
+		for (int i = 0; i < aBundles; ++i) {
+			auto b = mutator.randomBundle(aFiles);
+			b.fileBundle = false;
+			files += b.files.size();
+			model[b.token] = move(b);
+		}
+
+		auto compactTime = measure([&] {
+			journal.compact([&](const QueueJournal::BundleInfoF& aAddBundle) {
+				for (const auto& b: model | map_values) {
+					aAddBundle(b);
+				}
+			});
+		});
+
+		std::cout << model.size() << " bundles, " << files << " files, snapshot: " << journal.getSnapshotSize() << " bytes, written in " << compactTime << " s" << std::endl;
+
+		// Finished segments (flushed as on every queue save)
+		vector<tuple<QueueToken, const string*, int64_t>> fileList;
+		for (const auto& b: model | map_values) {
+			for (const auto& f: b.files) {
+				fileList.emplace_back(b.token, &f.first, f.second.size);
+			}
+		}
+
+		const int segments = 100000;
+		auto segmentTime = measure([&] {
+			std::mt19937 random(6);
+			for (int i = 0; i < segments; ++i) {
+				const auto& f = fileList[random() % fileList.size()];
+				journal.addSegment(get<0>(f), *get<1>(f), Segment(0, min<int64_t>(get<2>(f), 1024 * 1024)));
+				if (i % 1000 == 999) {
+					journal.flush();
+				}
+			}
+		});
+
+		std::cout << segments << " segment records: " << segmentTime << " s, journal: " << journal.getJournalSize() << " bytes" << std::endl;
+	}
+
+	BundleInfoMap bundles;
+	auto loadTime = measure([&] {
+		QueueJournal journal(dir);
+		journal.load(bundles);
+	});
+
+	std::cout << "Loading: " << loadTime << " s" << std::endl;
+
+	size_t loadedFiles = 0;
+	for (const auto& b: bundles | map_values) {
+		loadedFiles += b.files.size();
+	}
+
+	if (bundles.size() != model.size() || loadedFiles != files) {
+		std::cout << "FAILED: " << loadedFiles << " files were loaded" << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	auto bundles = argc > 1 ? Util::toInt(argv[1]) : 5000;
+	auto files = argc > 2 ? Util::toInt(argv[2]) : 80;
+	auto changes = argc > 3 ? Util::toInt(argv[3]) : 1000;
+
+	char tmpl[] = "/tmp/airdcpp-queue-journal-XXXXXX";
+	if (!mkdtemp(tmpl)) {
+		std::cout << "Failed to create a temporary directory" << std::endl;
+		return 1;
+	}
+
+	const auto tempPath = string(tmpl) + PATH_SEPARATOR;
+
+	int errors = 0;
+	try {
+		errors += testRecovery(tempPath, changes);
+		errors += benchmark(tempPath, bundles, files);
+	} catch (const Exception& e) {
+		std::cout << "FAILED: " << e.getError() << std::endl;
+		errors++;
+	}
+
+	File::removeDirectoryForced(tempPath);
+
+	std::cout << (errors == 0 ? "The queue was recovered in all cases" : Util::toString(errors) + " errors") << std::endl;
+	return errors == 0 ? 0 : 1;
+}
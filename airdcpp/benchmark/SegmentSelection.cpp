@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Stress tests the segment bookkeeping of queued files against the previous implementation (linear scans
+// over a set of done segments) with random segment states, and compares the speed of the block selection
+// with heavily fragmented files
+//
+// Usage: airdcpp-segment-selection-benchmark [random rounds] [fragmented file segments]
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/QueueItem.h>
+#include <airdcpp/Util.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+using namespace dcpp;
+
+// The previous implementation
+struct ReferenceItem {
+	int64_t size;
+	set<Segment> done;
+	vector<Segment> running;
+
+	// QueueItem::addFinishedSegment, returns the bytes added for the bundle
+	int64_t addFinishedSegment(const Segment& segment) {
+		int64_t addedBytes = 0;
+		done.insert(segment);
+
+		bool added = false;
+		if(done.size() != 1) {
+			for(auto i = ++done.begin() ; i != done.end(); ) {
+				auto prev = i;
+				prev--;
+				if(prev->getEnd() >= i->getStart()) {
+					Segment big(prev->getStart(), i->getEnd() - prev->getStart());
+					auto newBytes = big.getSize() - (*prev == segment ? i->getSize() : prev->getSize());
+
+					done.erase(prev);
+					done.erase(i++);
+					done.insert(big);
+					if (!added) {
+						addedBytes += newBytes;
+					}
+					added = true;
+				} else {
+					++i;
+				}
+			}
+		}
+
+		if (!added) {
+			addedBytes += segment.getSize();
+		}
+
+		return addedBytes;
+	}
+
+	bool isChunkDownloaded(int64_t startPos, int64_t& len) const {
+		for(auto& i: done) {
+			if(i.getStart() <= startPos && startPos < i.getEnd()){
+				len = min(len, i.getEnd() - startPos);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// The block selection loop of QueueItem::getNextSegment
+	bool findFreeBlock(int64_t aBlockSize, int64_t aTargetSize, const PartsInfo* aPartialInfo, Segment& block_, vector<Segment>& neededParts_) const {
+		vector<int64_t> posArray;
+		if (aPartialInfo) {
+			for(auto index: *aPartialInfo)
+				posArray.push_back(min(size, (int64_t)(index) * aBlockSize));
+		}
+
+		int64_t start = 0;
+		int64_t curSize = aTargetSize;
+
+		while(start < size) {
+			int64_t end = std::min(size, start + curSize);
+			Segment block(start, end - start);
+			bool overlaps = false;
+			for(auto i = done.begin(); !overlaps && i != done.end(); ++i) {
+				if(curSize <= aBlockSize) {
+					if(i->getStart() <= start && i->getEnd() >= end) {
+						overlaps = true;
+					}
+				} else {
+					overlaps = block.overlaps(*i);
+				}
+			}
+
+			for(auto i = running.begin(); !overlaps && i != running.end(); ++i) {
+				overlaps = block.overlaps(*i);
+			}
+
+			if(!overlaps) {
+				if(aPartialInfo) {
+					for(auto j = posArray.begin(); j < posArray.end(); j += 2){
+						if( (*j <= start && start < *(j+1)) || (start <= *j && *j < end) ) {
+							int64_t b = max(start, *j);
+							int64_t e = min(end, *(j+1));
+							neededParts_.emplace_back(b, e - b);
+						}
+					}
+				} else {
+					block_ = block;
+					return true;
+				}
+			}
+
+			if(overlaps && (curSize > aBlockSize)) {
+				curSize -= aBlockSize;
+			} else {
+				start = end;
+				curSize = aTargetSize;
+			}
+		}
+
+		return false;
+	}
+};
+
+static SegmentSet toSegmentSet(const vector<Segment>& aSegments) {
+	SegmentSet ret;
+	for (const auto& s: aSegments) {
+		if (s.getSize() > 0) {
+			ret.add(s);
+		}
+	}
+
+	return ret;
+}
+
+static bool operator==(const SegmentSet& a, const set<Segment>& b) {
+	return a.size() == b.size() && equal(a.begin(), a.end(), b.begin());
+}
+
+struct Scenario {
+	ReferenceItem reference;
+	SegmentSet done;
+	SegmentSet running;
+	PartsInfo partialInfo;
+	SegmentSet partialParts;
+	int64_t blockSize;
+};
+
+// Random done segments (finished downloads don't overlap each other) and running segments
+// Returns false if the results differ
+static bool createScenario(std::mt19937_64& aRandom, int64_t aBlocks, size_t aSegments, Scenario& scenario_) {
+	auto& reference = scenario_.reference;
+	scenario_.blockSize = 1024 * (1 + aRandom() % 4);
+	reference.size = aBlocks * scenario_.blockSize - static_cast<int64_t>(aRandom() % scenario_.blockSize);
+
+	auto randomSegment = [&](int64_t aMaxBlocks) {
+		auto start = static_cast<int64_t>(aRandom() % aBlocks) * scenario_.blockSize;
+		auto size = static_cast<int64_t>(aRandom() % aMaxBlocks + 1) * scenario_.blockSize;
+		if (aRandom() % 4 == 0) {
+			// Unaligned (e.g. aborted downloads)
+			start += aRandom() % scenario_.blockSize;
+		}
+
+		start = min(start, reference.size - 1);
+		return Segment(start, min(size, reference.size - start));
+	};
+
+	for (size_t i = 0; i < aSegments; ++i) {
+		auto segment = randomSegment(max<int64_t>(aBlocks / static_cast<int64_t>(aSegments), 1));
+		if (scenario_.done.overlaps(segment)) {
+			continue;
+		}
+
+		auto expectedBytes = reference.addFinishedSegment(segment);
+		auto expectedTotal = accumulate(reference.done.begin(), reference.done.end(), static_cast<int64_t>(0), [](int64_t aTotal, const Segment& s) {
+			return aTotal + s.getSize();
+		});
+
+		if (scenario_.done.add(segment) != expectedBytes || !(scenario_.done == reference.done) || scenario_.done.getBytes() != expectedTotal) {
+			std::cout << "FAILED: different done segments after adding " << segment.getStart() << "-" << segment.getEnd() << std::endl;
+			return false;
+		}
+	}
+
+	auto runningCount = aRandom() % 4;
+	for (size_t i = 0; i < runningCount; ++i) {
+		reference.running.push_back(randomSegment(8));
+	}
+
+	scenario_.running = toSegmentSet(reference.running);
+
+	if (aRandom() % 2 == 0) {
+		// Sorted block index pairs as sent by the clients, may overlap after rounding
+		auto blocks = reference.size / scenario_.blockSize + 1;
+		vector<uint16_t> indexes;
+		auto pairs = aRandom() % 8 + 1;
+		for (size_t i = 0; i < pairs * 2; ++i) {
+			indexes.push_back(static_cast<uint16_t>(aRandom() % (blocks + 1)));
+		}
+
+		sort(indexes.begin(), indexes.end());
+		for (size_t i = 0; i < indexes.size(); i += 2) {
+			scenario_.partialInfo.push_back(indexes[i]);
+			scenario_.partialInfo.push_back(indexes[i + 1]);
+
+			auto start = min(reference.size, static_cast<int64_t>(indexes[i]) * scenario_.blockSize);
+			auto end = min(reference.size, static_cast<int64_t>(indexes[i + 1]) * scenario_.blockSize);
+			if (start < end) {
+				scenario_.partialParts.add(Segment(start, end - start));
+			}
+		}
+	}
+
+	return true;
+}
+
+static bool verifyScenario(std::mt19937_64& aRandom, const Scenario& aScenario) {
+	const auto& reference = aScenario.reference;
+
+	// Downloaded chunks
+	for (int i = 0; i < 20; ++i) {
+		auto pos = static_cast<int64_t>(aRandom() % reference.size);
+		int64_t len = aRandom() % (reference.size * 2) + 1, expectedLen = len;
+		auto found = reference.isChunkDownloaded(pos, expectedLen);
+
+		auto d = aScenario.done.find(pos);
+		if (found != (d != aScenario.done.end()) || (found && expectedLen != min(len, d->getEnd() - pos))) {
+			std::cout << "FAILED: different result for a downloaded chunk at " << pos << std::endl;
+			return false;
+		}
+	}
+
+	// Block selection
+	auto targetSize = aScenario.blockSize * (1 + aRandom() % 16);
+	auto partialInfo = aScenario.partialInfo.empty() ? nullptr : &aScenario.partialInfo;
+
+	Segment expectedBlock, block;
+	vector<Segment> expectedParts, parts;
+	auto expectedFound = reference.findFreeBlock(aScenario.blockSize, targetSize, partialInfo, expectedBlock, expectedParts);
+	auto found = QueueItem::findFreeBlock(aScenario.done, aScenario.running, partialInfo ? &aScenario.partialParts : nullptr, reference.size, aScenario.blockSize, targetSize, block, parts);
+	if (expectedFound != found || (found && !(expectedBlock == block))) {
+		std::cout << "FAILED: different block selected (" << expectedBlock.getStart() << "-" << expectedBlock.getEnd() << " expected, " << block.getStart() << "-" << block.getEnd() << " found)" << std::endl;
+		return false;
+	}
+
+	// Overlapping advertised parts are merged, so only the covered ranges are compared
+	auto expectedCovered = toSegmentSet(expectedParts), covered = toSegmentSet(parts);
+	if (expectedCovered.size() != covered.size() || !equal(covered.begin(), covered.end(), expectedCovered.begin())) {
+		std::cout << "FAILED: different partial chunks (" << expectedParts.size() << " expected, " << parts.size() << " found)" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+template<class F>
+static double measure(F&& aFunc) {
+	auto start = std::chrono::steady_clock::now();
+	aFunc();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+	auto rounds = argc > 1 ? Util::toUInt32(argv[1]) : 20000;
+	auto fragments = argc > 2 ? Util::toUInt32(argv[2]) : 5000;
+
+	std::mt19937_64 random(1);
+
+	// Random states
+	for (uint32_t i = 0; i < rounds; ++i) {
+		Scenario scenario;
+		auto blocks = static_cast<int64_t>(random() % 2000 + 1);
+		if (!createScenario(random, blocks, random() % 64, scenario) || !verifyScenario(random, scenario)) {
+			return 1;
+		}
+	}
+
+	std::cout << rounds << " random segment states verified" << std::endl;
+
+	// A fragmented 8 GB file and a partial source having only the last blocks
+	Scenario scenario;
+	scenario.blockSize = 1024 * 1024;
+	scenario.reference.size = 8LL * 1024 * 1024 * 1024;
+
+	auto fragmentSize = scenario.reference.size / fragments;
+	for (uint32_t i = 0; i < fragments; ++i) {
+		// Leave small gaps between the fragments
+		Segment segment(i * fragmentSize, fragmentSize - 1);
+		scenario.reference.addFinishedSegment(segment);
+		scenario.done.add(segment);
+	}
+
+	auto blocks = static_cast<uint16_t>(scenario.reference.size / scenario.blockSize);
+	scenario.partialInfo = { static_cast<uint16_t>(blocks - 16), blocks };
+	scenario.partialParts.add(Segment((blocks - 16) * scenario.blockSize, 16 * scenario.blockSize));
+
+	const auto calls = 10;
+	Segment block;
+	vector<Segment> expectedParts, parts;
+	auto referenceTime = measure([&] {
+		for (int i = 0; i < calls; ++i) {
+			expectedParts.clear();
+			scenario.reference.findFreeBlock(scenario.blockSize, scenario.blockSize * 8, &scenario.partialInfo, block, expectedParts);
+		}
+	});
+
+	auto time = measure([&] {
+		for (int i = 0; i < calls; ++i) {
+			parts.clear();
+			QueueItem::findFreeBlock(scenario.done, scenario.running, &scenario.partialParts, scenario.reference.size, scenario.blockSize, scenario.blockSize * 8, block, parts);
+		}
+	});
+
+	if (expectedParts.size() != parts.size() || !equal(parts.begin(), parts.end(), expectedParts.begin())) {
+		std::cout << "FAILED: different partial chunks for the fragmented file" << std::endl;
+		return 1;
+	}
+
+	std::cout << "block selection with " << scenario.done.size() << " done segments: previous " << referenceTime * 1000 / calls << " ms, segment set " << time * 1000 / calls << " ms" << std::endl;
+	return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Writes a synthetic share tree in the XML and binary share cache formats, verifies that
+// both files contain the same tree and measures the time needed for parsing them
+// (the XML loader additionally looks up every file from the hash database, which isn't included here)
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/File.h>
+#include <airdcpp/ShareCache.h>
+#include <airdcpp/SimpleXML.h>
+#include <airdcpp/SimpleXMLReader.h>
+#include <airdcpp/Util.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include <stdlib.h>
+
+using namespace dcpp;
+
+// Items are recorded as strings so that the output of both loaders can be compared
+class Recorder : public SimpleXMLReader::CallBack, public ShareCacheReader::CallBack {
+public:
+	StringList items;
+
+	void startTag(const string& aName, StringPairList& attribs, bool aSimple) {
+		if (aName == "Directory") {
+			startDirectory(getAttrib(attribs, "Name", 0), Util::toTimeT(getAttrib(attribs, "Date", 1)));
+			if (aSimple) {
+				endDirectory();
+			}
+		} else if (aName == "File") {
+			items.push_back("F " + getAttrib(attribs, "Name", 0));
+		}
+	}
+
+	void endTag(const string& aName) {
+		if (aName == "Directory") {
+			endDirectory();
+		}
+	}
+
+	void startDirectory(const string& aName, time_t aDate) {
+		items.push_back("D " + aName + " " + Util::toString(aDate));
+	}
+
+	void endDirectory() {
+		items.push_back("E");
+	}
+
+	void addFile(const string& aName, int64_t, time_t, const TTHValue&) {
+		items.push_back("F " + aName);
+	}
+};
+
+struct Options {
+	int depth = 4;
+	int directories = 8;
+	int files = 60;
+};
+
+static void generate(OutputStream& xml_, ShareCacheWriter& binary_, const Options& aOptions, int aLevel, std::mt19937& random, string& tmp) {
+	for (int i = 0; i < aOptions.files; ++i) {
+		auto name = "File " + Util::toString(random() % 100000) + " & <" + Util::toString(i) + ">.ext";
+
+		TTHValue tth;
+		for (auto& b: tth.data) {
+			b = static_cast<uint8_t>(random());
+		}
+
+		xml_.write("<File Name=\"" + SimpleXML::escape(name, tmp, true) + "\"/>\r\n");
+		binary_.addFile(name, random(), 1500000000 + random() % 100000000, tth);
+	}
+
+	if (aLevel == aOptions.depth) {
+		return;
+	}
+
+	for (int i = 0; i < aOptions.directories; ++i) {
+		auto name = "Directory " + Util::toString(random() % 100000) + " " + Util::toString(i);
+		auto date = 1500000000 + random() % 100000000;
+
+		xml_.write("<Directory Name=\"" + SimpleXML::escape(name, tmp, true) + "\" Date=\"" + Util::toString(date) + "\">\r\n");
+		binary_.startDirectory(name, date);
+
+		generate(xml_, binary_, aOptions, aLevel + 1, random, tmp);
+
+		xml_.write("</Directory>\r\n");
+		binary_.endDirectory();
+	}
+}
+
+template<class F>
+static double measure(F&& aFunc) {
+	auto start = std::chrono::steady_clock::now();
+	aFunc();
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	if (argc > 1) options.depth = Util::toInt(argv[1]);
+	if (argc > 2) options.directories = Util::toInt(argv[2]);
+	if (argc > 3) options.files = Util::toInt(argv[3]);
+
+	char tmpl[] = "/tmp/airdcpp-share-cache-XXXXXX";
+	if (!mkdtemp(tmpl)) {
+		std::cout << "Failed to create a temporary directory" << std::endl;
+		return 1;
+	}
+
+	const auto xmlPath = string(tmpl) + PATH_SEPARATOR + "ShareCache.xml";
+	const auto binaryPath = string(tmpl) + PATH_SEPARATOR + "ShareCache.bin";
+	const string rootPath = "/share/";
+
+	// Write both formats
+	{
+		File xmlFile(xmlPath, File::WRITE, File::CREATE | File::TRUNCATE);
+		BufferedOutputStream<false> xml(&xmlFile, 256 * 1024);
+
+		File binaryFile(binaryPath, File::WRITE, File::CREATE | File::TRUNCATE);
+		ShareCacheWriter binary(&binaryFile, rootPath, 1500000000);
+
+		xml.write(SimpleXML::utf8Header);
+		xml.write("<Share Version=\"3\" Path=\"" + rootPath + "\" Date=\"1500000000\">\r\n");
+
+		std::mt19937 random(1);
+		string tmp;
+		generate(xml, binary, options, 0, random, tmp);
+
+		xml.write("</Share>");
+		xml.flushBuffers(false);
+		binary.finish();
+	}
+
+	std::cout << "XML cache: " << File::getSize(xmlPath) << " bytes, binary cache: " << File::getSize(binaryPath) << " bytes" << std::endl;
+
+	int errors = 0;
+
+	Recorder xmlRecorder;
+	auto xmlTime = measure([&] {
+		File f(xmlPath, File::READ, File::OPEN, File::BUFFER_SEQUENTIAL, false);
+		SimpleXMLReader(&xmlRecorder).parse(f);
+	});
+
+	Recorder binaryRecorder;
+	auto binaryTime = measure([&] {
+		File f(binaryPath, File::READ, File::OPEN, File::BUFFER_SEQUENTIAL, false);
+
+		ShareCacheReader reader(&binaryRecorder);
+		if (!reader.parse(f) || reader.getRootPath() != rootPath) {
+			std::cout << "FAILED: invalid binary cache header" << std::endl;
+			errors++;
+		}
+	});
+
+	std::cout << "XML: " << xmlTime << " s, binary: " << binaryTime << " s (" << binaryRecorder.items.size() << " items)" << std::endl;
+
+	if (xmlRecorder.items != binaryRecorder.items) {
+		std::cout << "FAILED: the loaded trees are different" << std::endl;
+		errors++;
+	}
+
+	// Corrupted content must be detected
+	{
+		auto data = File(binaryPath, File::READ, File::OPEN).read();
+		data[data.size() / 2] ^= 0x20;
+
+		MemoryInputStream is(data);
+		Recorder recorder;
+		try {
+			ShareCacheReader(&recorder).parse(is);
+			std::cout << "FAILED: corrupted cache was loaded" << std::endl;
+			errors++;
+		} catch (const ShareCacheException&) { }
+	}
+
+	File::removeDirectoryForced(string(tmpl) + PATH_SEPARATOR);
+
+	std::cout << (errors == 0 ? "Both caches contain the same tree" : Util::toString(errors) + " errors") << std::endl;
+	return errors == 0 ? 0 : 1;
+}
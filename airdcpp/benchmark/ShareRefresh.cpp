@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+// Compares single-threaded and parallel directory walks when refreshing a large shared directory
+// The generated tree and the hash database are kept in the given directory so that they only need to be created once
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/File.h>
+#include <airdcpp/HashManager.h>
+#include <airdcpp/LogManager.h>
+#include <airdcpp/QueueManager.h>
+#include <airdcpp/ResourceManager.h>
+#include <airdcpp/SettingsManager.h>
+#include <airdcpp/ShareManager.h>
+#include <airdcpp/ShareRefreshBenchmark.h>
+#include <airdcpp/TimerManager.h>
+
+#include <iostream>
+#include <thread>
+
+using namespace dcpp;
+
+static void printUsage() {
+	std::cout << "Usage: airdcpp-share-refresh-benchmark <work directory> [options]\n\n"
+		"  --directories N    Number of directories (default 500000)\n"
+		"  --dirs N           Subdirectories per directory (default 8)\n"
+		"  --files N          Files per directory (default 0)\n"
+		"  --runs N           Number of runs for each mode (default 3)\n"
+		"  --skip-empty       Don't share empty directories\n";
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		printUsage();
+		return 1;
+	}
+
+	ShareRefreshBenchmark::TreeOptions treeOptions;
+	int runs = 3;
+	bool skipEmpty = false;
+
+	for (int i = 2; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--skip-empty") {
+			skipEmpty = true;
+			continue;
+		}
+
+		if (i + 1 >= argc) {
+			printUsage();
+			return 1;
+		}
+
+		string value = argv[++i];
+		if (arg == "--directories") {
+			treeOptions.directories = Util::toInt(value);
+		} else if (arg == "--dirs") {
+			treeOptions.directoriesPerLevel = Util::toInt(value);
+		} else if (arg == "--files") {
+			treeOptions.filesPerDirectory = Util::toInt(value);
+		} else if (arg == "--runs") {
+			runs = max(Util::toInt(value), 1);
+		} else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	const auto workPath = Util::validatePath(argv[1], true);
+	const auto configPath = workPath + "config" + PATH_SEPARATOR_STR;
+	const auto treePath = workPath + "tree" + PATH_SEPARATOR_STR;
+	File::ensureDirectory(configPath);
+
+	Util::initialize(configPath);
+
+	ResourceManager::newInstance();
+	SettingsManager::newInstance();
+	LogManager::newInstance();
+	TimerManager::newInstance();
+	HashManager::newInstance();
+	ShareManager::newInstance();
+
+	// Directories inside queued bundles aren't shared
+	QueueManager::newInstance();
+
+	SettingsManager::getInstance()->load([](const string&, bool, bool) { return false; });
+	SettingsManager::getInstance()->set(SettingsManager::SKIP_EMPTY_DIRS_SHARE, skipEmpty);
+
+	int ret = 0;
+	try {
+		HashManager::getInstance()->startup([](const string&) { }, [](float) { }, [](const string& aMessage, bool, bool) {
+			std::cout << aMessage << std::endl;
+			return false;
+		});
+
+		// Don't hash anything that may be missing from the database
+		HashManager::HashPauser pauser;
+
+		std::cout << "Creating the tree..." << std::endl;
+		ShareRefreshBenchmark benchmark(treePath, treeOptions);
+		std::cout << benchmark.createTree() << " files added" << std::endl;
+
+		// Fill the file system caches
+		benchmark.run(false);
+
+		ShareRefreshBenchmark::Result single, parallel;
+		for (int i = 0; i < runs; ++i) {
+			auto result = benchmark.run(false);
+			if (i == 0 || result.timeMs < single.timeMs) {
+				single = result;
+			}
+
+			result = benchmark.run(true);
+			if (i == 0 || result.timeMs < parallel.timeMs) {
+				parallel = result;
+			}
+		}
+
+		std::cout << "Single thread: " << ShareRefreshBenchmark::formatResult(single) << std::endl;
+		std::cout << "Parallel (" << std::thread::hardware_concurrency() << " hardware threads): " << ShareRefreshBenchmark::formatResult(parallel) << std::endl;
+
+		if (single.contentHash != parallel.contentHash || single.directories != parallel.directories || single.files != parallel.files || 
+			single.searchIndexEntries != parallel.searchIndexEntries || single.hashSize != parallel.hashSize) {
+			std::cout << "FAILED: the trees differ" << std::endl;
+			ret = 1;
+		}
+	} catch (const Exception& e) {
+		std::cerr << "Failed to create the tree: " << e.getError() << std::endl;
+		ret = 1;
+	}
+
+	QueueManager::deleteInstance();
+	ShareManager::deleteInstance();
+
+	HashManager::getInstance()->shutdown([](float) { });
+	HashManager::deleteInstance();
+	TimerManager::deleteInstance();
+	LogManager::deleteInstance();
+	SettingsManager::deleteInstance();
+	ResourceManager::deleteInstance();
+	return ret;
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Replays incoming searches against a synthetic share
+// No hubs or shared directories are needed (settings are stored in a temporary directory)
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/ClientManager.h>
+#include <airdcpp/File.h>
+#include <airdcpp/HashManager.h>
+#include <airdcpp/LogManager.h>
+#include <airdcpp/ResourceManager.h>
+#include <airdcpp/SettingsManager.h>
+#include <airdcpp/ShareManager.h>
+#include <airdcpp/ShareSearchBenchmark.h>
+#include <airdcpp/StringTokenizer.h>
+#include <airdcpp/TimerManager.h>
+#include <airdcpp/UploadManager.h>
+
+#include <iostream>
+#include <stdlib.h>
+
+using namespace dcpp;
+
+static void printUsage() {
+	std::cout << "Usage: airdcpp-share-search-benchmark [options]\n\n"
+		"Share options:\n"
+		"  --roots N          Number of shared roots (default 4)\n"
+		"  --depth N          Directory levels inside each root (default 4)\n"
+		"  --dirs N           Subdirectories per directory (default 6)\n"
+		"  --files N          Files per directory (default 20)\n"
+		"  --vocabulary N     Number of unique words in names (default 20000)\n"
+		"  --words N          Maximum words per name (default 4)\n"
+		"  --zipf X           Word popularity skew (default 1.0)\n"
+		"  --duplicates X     Share of files with a duplicate TTH (default 0.05)\n"
+		"  --seed N           Seed for the share generator (default 1)\n\n"
+		"Search options:\n"
+		"  --searches N       Number of generated searches (default 100000)\n"
+		"  --nmdc X           Share of NMDC searches (default 0.3)\n"
+		"  --tth X            Share of TTH searches (default 0.3)\n"
+		"  --miss X           Share of unknown terms/TTHs (default 0.2)\n"
+		"  --terms N          Maximum terms per text search (default 3)\n"
+		"  --search-seed N    Seed for the search generator (default 2)\n"
+		"  --replay FILE      Replay recorded ADC SCH/NMDC $Search lines instead of generated searches\n"
+		"  --dump FILE        Save the generated searches\n";
+}
+
+int main(int argc, char* argv[]) {
+	ShareSearchBenchmark::TreeOptions treeOptions;
+	ShareSearchBenchmark::QueryOptions queryOptions;
+	string replayPath, dumpPath;
+
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--help" || i + 1 >= argc) {
+			printUsage();
+			return arg == "--help" ? 0 : 1;
+		}
+
+		string value = argv[++i];
+		if (arg == "--roots") {
+			treeOptions.roots = Util::toInt(value);
+		} else if (arg == "--depth") {
+			treeOptions.depth = Util::toInt(value);
+		} else if (arg == "--dirs") {
+			treeOptions.directoriesPerLevel = Util::toInt(value);
+		} else if (arg == "--files") {
+			treeOptions.filesPerDirectory = Util::toInt(value);
+		} else if (arg == "--vocabulary") {
+			treeOptions.vocabularySize = Util::toInt(value);
+		} else if (arg == "--words") {
+			treeOptions.maxWordsPerName = Util::toInt(value);
+		} else if (arg == "--zipf") {
+			treeOptions.zipfExponent = Util::toDouble(value);
+		} else if (arg == "--duplicates") {
+			treeOptions.duplicateRate = Util::toDouble(value);
+		} else if (arg == "--seed") {
+			treeOptions.seed = Util::toUInt32(value);
+		} else if (arg == "--searches") {
+			queryOptions.count = Util::toInt(value);
+		} else if (arg == "--nmdc") {
+			queryOptions.nmdcRate = Util::toDouble(value);
+		} else if (arg == "--tth") {
+			queryOptions.tthRate = Util::toDouble(value);
+		} else if (arg == "--miss") {
+			queryOptions.missRate = Util::toDouble(value);
+		} else if (arg == "--terms") {
+			queryOptions.maxTerms = Util::toInt(value);
+		} else if (arg == "--search-seed") {
+			queryOptions.seed = Util::toUInt32(value);
+		} else if (arg == "--replay") {
+			replayPath = value;
+		} else if (arg == "--dump") {
+			dumpPath = value;
+		} else {
+			printUsage();
+			return 1;
+		}
+	}
+
+	char tempPath[] = "/tmp/airdcpp-benchmark-XXXXXX";
+	if (!mkdtemp(tempPath)) {
+		std::cerr << "Failed to create a temporary config directory" << std::endl;
+		return 1;
+	}
+
+	Util::initialize(string(tempPath) + PATH_SEPARATOR_STR);
+
+	ResourceManager::newInstance();
+	SettingsManager::newInstance();
+	LogManager::newInstance();
+	TimerManager::newInstance();
+	HashManager::newInstance();
+	ShareManager::newInstance();
+
+	// Search results contain the slot information
+	ClientManager::newInstance();
+	UploadManager::newInstance();
+
+	// Creates the default share profiles
+	SettingsManager::getInstance()->load([](const string&, bool, bool) { return false; });
+
+	int ret = 0;
+	try {
+		ShareSearchBenchmark benchmark(treeOptions);
+		std::cout << ShareSearchBenchmark::formatTreeStats(benchmark.createShare()) << std::endl;
+
+		StringList searches;
+		if (!replayPath.empty()) {
+			StringTokenizer<string> lines(File(replayPath, File::READ, File::OPEN).read(), '\n');
+			for (auto line : lines.getTokens()) {
+				// Strip line endings and NMDC command separators
+				while (!line.empty() && (line.back() == '\r' || line.back() == '|')) {
+					line.pop_back();
+				}
+
+				searches.push_back(line);
+			}
+		} else {
+			searches = benchmark.generateSearches(queryOptions);
+		}
+
+		if (!dumpPath.empty()) {
+			File(dumpPath, File::WRITE, File::CREATE | File::TRUNCATE).write(Util::toString("\n", searches));
+		}
+
+		std::cout << ShareSearchBenchmark::formatReport(benchmark.run(searches)) << std::endl;
+		std::cout << ShareManager::getInstance()->printStats() << std::endl;
+	} catch (const FileException& e) {
+		std::cerr << "Failed to read the searches: " << e.getError() << std::endl;
+		ret = 1;
+	}
+
+	UploadManager::deleteInstance();
+	ClientManager::deleteInstance();
+	ShareManager::deleteInstance();
+	HashManager::deleteInstance();
+	TimerManager::deleteInstance();
+	LogManager::deleteInstance();
+	SettingsManager::deleteInstance();
+	ResourceManager::deleteInstance();
+
+	try {
+		File::removeDirectoryForced(string(tempPath) + PATH_SEPARATOR_STR);
+	} catch (const FileException&) {
+		// ...
+	}
+
+	return ret;
+}
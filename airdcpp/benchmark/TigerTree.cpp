@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Verifies the multi-buffer leaf hashing against the single-buffer Tiger implementation
+// and measures the hashing throughput
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/Encoder.h>
+#include <airdcpp/MerkleTree.h>
+#include <airdcpp/ParallelTreeHasher.h>
+#include <airdcpp/TigerHash.h>
+#include <airdcpp/Util.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+
+using namespace dcpp;
+
+static string tiger(const string& aData) {
+	TigerHash h;
+	h.update(aData.data(), aData.size());
+
+	char buf[TigerHash::BYTES * 2 + 1];
+	auto result = h.finalize();
+	for (size_t i = 0; i < TigerHash::BYTES; ++i) {
+		snprintf(buf + i * 2, 3, "%02X", result[i]);
+	}
+
+	return buf;
+}
+
+static string tigerTree(const ByteVector& aData, int64_t aBlockSize) {
+	TigerTree tt(aBlockSize);
+	tt.update(aData.data(), aData.size());
+	tt.finalize();
+	return tt.getRoot().toBase32();
+}
+
+// Data passed in chunks of aChunkSize bytes
+static bool compareParallel(const ByteVector& aData, int64_t aBlockSize, size_t aChunkSize) {
+	TigerTree sequential(aBlockSize);
+	sequential.update(aData.data(), aData.size());
+	sequential.finalize();
+
+	TigerTree tt(aBlockSize);
+	ParallelTreeHasher hasher(tt, ParallelTreeHasher::MIN_PARALLEL_SIZE, 4);
+	for (size_t i = 0; i < aData.size(); i += aChunkSize) {
+		hasher.update(aData.data() + i, min(aChunkSize, aData.size() - i));
+	}
+
+	hasher.finalize();
+	return hasher.isParallel() && tt.getRoot() == sequential.getRoot() && tt.getLeafData() == sequential.getLeafData() && tt.getFileSize() == sequential.getFileSize();
+}
+
+// Tree hashed one leaf at a time
+static string tigerTreeSingle(const ByteVector& aData, int64_t aBlockSize) {
+	TigerTree tt(aBlockSize);
+	for (size_t i = 0; i < aData.size(); i += TigerTree::BASE_BLOCK_SIZE) {
+		tt.update(aData.data() + i, min(TigerTree::BASE_BLOCK_SIZE, aData.size() - i));
+	}
+
+	if (aData.empty()) {
+		tt.update(nullptr, 0);
+	}
+
+	tt.finalize();
+	return tt.getRoot().toBase32();
+}
+
+static bool checkVectors() {
+	bool ok = true;
+	auto check = [&](const string& aName, const string& aResult, const string& aExpected) {
+		if (aResult != aExpected) {
+			std::cout << "FAILED: " << aName << " (" << aResult << ", expected " << aExpected << ")" << std::endl;
+			ok = false;
+		}
+	};
+
+	// Reference values
+	check("Tiger of an empty string", tiger(""), "3293AC630C13F0245F92BBB1766E16167A4E58492DDE73F3");
+	check("Tiger of \"abc\"", tiger("abc"), "2AAB1484E8C158F2BFB8C5FF41B57A525129131C957B5F93");
+	check("TTH of an empty file", tigerTree(ByteVector(), 1024), "LWPNACQDBZRYXW3VHJVCJ64QBZNGHOHHHZWCLNQ");
+
+	// Multi-buffer leaves against the single-buffer implementation
+	std::mt19937 random(1);
+	std::uniform_int_distribution<int> byteDist(0, 255);
+
+	for (size_t leafSize = 0; leafSize <= 300; ++leafSize) {
+		for (size_t count : { 1, 3, 4, 5, 9 }) {
+			ByteVector data(leafSize * count);
+			for (auto& b : data) {
+				b = static_cast<uint8_t>(byteDist(random));
+			}
+
+			for (uint8_t prefix : { 0, 1 }) {
+				ByteVector results(count * TigerHash::BYTES);
+				TigerHash::hashLeaves(data.data(), leafSize, count, prefix, results.data());
+
+				for (size_t i = 0; i < count; ++i) {
+					TigerHash h;
+					h.update(&prefix, 1);
+					h.update(data.data() + i * leafSize, leafSize);
+					if (memcmp(h.finalize(), results.data() + i * TigerHash::BYTES, TigerHash::BYTES) != 0) {
+						std::cout << "FAILED: leaf " << i << " of " << count << " (size " << leafSize << ", prefix " << static_cast<int>(prefix) << ")" << std::endl;
+						ok = false;
+					}
+				}
+			}
+		}
+	}
+
+	// Complete trees
+	for (size_t size : { 0, 1, 1023, 1024, 1025, 4095, 4096, 4097, 65536, 100000, 1048576 + 7, 9 * 1048576 + 3072 + 5 }) {
+		ByteVector data(size);
+		for (auto& b : data) {
+			b = static_cast<uint8_t>(byteDist(random));
+		}
+
+		for (int64_t blockSize : { 1024, 4096, 65536 }) {
+			check("Tree of " + Util::toString(size) + " bytes", tigerTree(data, blockSize), tigerTreeSingle(data, blockSize));
+		}
+
+		// Subtrees of different sizes (smaller and larger than the block size) in parallel
+		for (int64_t blockSize : { 65536, 262144, 4194304 }) {
+			for (size_t chunkSize : { 1000, 262144 }) {
+				if (size > 0 && !compareParallel(data, blockSize, chunkSize)) {
+					std::cout << "FAILED: parallel tree of " << size << " bytes (block size " << blockSize << ", chunk size " << chunkSize << ")" << std::endl;
+					ok = false;
+				}
+			}
+		}
+	}
+
+	return ok;
+}
+
+template<class F>
+static double measure(size_t aBytes, F&& aFunc) {
+	auto start = std::chrono::steady_clock::now();
+	aFunc();
+	auto end = std::chrono::steady_clock::now();
+
+	auto seconds = std::chrono::duration<double>(end - start).count();
+	return static_cast<double>(aBytes) / (1024 * 1024) / seconds;
+}
+
+int main(int argc, char* argv[]) {
+	size_t megabytes = argc > 1 ? Util::toUInt32(argv[1]) : 64;
+	if (megabytes == 0) {
+		std::cout << "Usage: airdcpp-tiger-tree-benchmark [megabytes to hash per round, default 64]" << std::endl;
+		return 1;
+	}
+
+	if (!checkVectors()) {
+		return 1;
+	}
+
+	std::cout << "Test vectors passed" << std::endl;
+
+	// Data is hashed in chunks of the same size that the hasher uses for reading files
+	const size_t chunkSize = 256 * 1024;
+	const size_t chunks = megabytes * 4;
+
+	ByteVector data(chunkSize);
+	std::mt19937 random(2);
+	for (auto& b : data) {
+		b = static_cast<uint8_t>(random());
+	}
+
+	const size_t leaves = chunkSize / TigerTree::BASE_BLOCK_SIZE;
+	ByteVector results(leaves * TigerHash::BYTES);
+
+	// Take the best result of multiple rounds to filter out the noise from other processes
+	double single = 0, multi = 0, tree = 0, parallelTree = 0;
+	for (int round = 0; round < 5; ++round) {
+		single = max(single, measure(chunks * chunkSize, [&] {
+			for (size_t c = 0; c < chunks; ++c) {
+				for (size_t i = 0; i < leaves; ++i) {
+					uint8_t zero = 0;
+					TigerHash h;
+					h.update(&zero, 1);
+					h.update(data.data() + i * TigerTree::BASE_BLOCK_SIZE, TigerTree::BASE_BLOCK_SIZE);
+					memcpy(results.data() + i * TigerHash::BYTES, h.finalize(), TigerHash::BYTES);
+				}
+			}
+		}));
+
+		multi = max(multi, measure(chunks * chunkSize, [&] {
+			for (size_t c = 0; c < chunks; ++c) {
+				TigerHash::hashLeaves(data.data(), TigerTree::BASE_BLOCK_SIZE, leaves, 0, results.data());
+			}
+		}));
+
+		tree = max(tree, measure(chunks * chunkSize, [&] {
+			TigerTree tt(TigerTree::calcBlockSize(static_cast<int64_t>(chunks * chunkSize), 10));
+			for (size_t c = 0; c < chunks; ++c) {
+				tt.update(data.data(), chunkSize);
+			}
+
+			tt.finalize();
+		}));
+
+		parallelTree = max(parallelTree, measure(chunks * chunkSize, [&] {
+			TigerTree tt(TigerTree::calcBlockSize(static_cast<int64_t>(chunks * chunkSize), 10));
+			ParallelTreeHasher hasher(tt, static_cast<int64_t>(chunks * chunkSize));
+			for (size_t c = 0; c < chunks; ++c) {
+				hasher.update(data.data(), chunkSize);
+			}
+
+			hasher.finalize();
+		}));
+	}
+
+	std::cout << "Leaf hashing, single-buffer: " << single << " MiB/s" << std::endl;
+	std::cout << "Leaf hashing, " << TigerHash::LEAF_LANES << " lanes: " << multi << " MiB/s" << std::endl;
+	std::cout << "Tiger tree: " << tree << " MiB/s" << std::endl;
+	std::cout << "Tiger tree, parallel subtrees (" << std::thread::hardware_concurrency() << " cores): " << parallelTree << " MiB/s" << std::endl;
+	return 0;
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Picks downloads from a user sharing tens of thousands of queued files and compares the time
+// with checking each queued file of the user (the amount of work done by a full queue scan)
+//
+// Usage: airdcpp-user-queue-benchmark [bundles] [files per bundle]
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/Bundle.h>
+#include <airdcpp/ClientManager.h>
+#include <airdcpp/ConnectionManager.h>
+#include <airdcpp/LogManager.h>
+#include <airdcpp/QueueItem.h>
+#include <airdcpp/ResourceManager.h>
+#include <airdcpp/SettingsManager.h>
+#include <airdcpp/TimerManager.h>
+#include <airdcpp/UserQueue.h>
+#include <airdcpp/Util.h>
+
+#include <chrono>
+#include <iostream>
+
+using namespace dcpp;
+
+template<class F>
+static double measure(F&& aFunc) {
+	auto start = std::chrono::steady_clock::now();
+	aFunc();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Queue {
+	UserQueue userQueue;
+	BundleList bundles;
+	QueueItemList items;
+};
+
+static void createQueue(const HintedUser& aUser, size_t aBundles, size_t aFiles, Queue& queue_) {
+	for (size_t b = 0; b < aBundles; ++b) {
+		auto bundlePath = "/tmp/downloads/Bundle " + Util::toString(b) + PATH_SEPARATOR_STR;
+		auto bundle = make_shared<Bundle>(bundlePath, GET_TIME(), static_cast<Priority>(static_cast<int>(Priority::LOWEST) + b % 4), GET_TIME(), static_cast<QueueToken>(b + 1), false);
+		queue_.bundles.push_back(bundle);
+
+		for (size_t f = 0; f < aFiles; ++f) {
+			auto qi = make_shared<QueueItem>(bundlePath + "File " + Util::toString(f) + ".bin", 100 * 1024 * 1024, Priority::NORMAL, QueueItem::FLAG_NORMAL, GET_TIME(), TTHValue(), Util::emptyString);
+			qi->setBundle(bundle);
+			qi->getSources().emplace_back(aUser);
+			bundle->addQueue(qi);
+
+			queue_.userQueue.addQI(qi);
+			queue_.items.push_back(qi);
+		}
+	}
+}
+
+// The work done by a full scan of the user's queue
+static QueueItemPtr checkAll(const UserPtr& aUser, Queue& aQueue, const OrderedStringSet& aHubs, QueueItemBase::DownloadType aType) {
+	QueueItemList items;
+	aQueue.userQueue.getUserQIs(aUser, items);
+
+	string lastError;
+	for (const auto& qi: items) {
+		if (qi->hasSegment(aUser, aHubs, lastError, 0, 0, aType, false)) {
+			return qi;
+		}
+	}
+
+	return nullptr;
+}
+
+static int test(const string& aName, Queue& aQueue, const HintedUser& aUser, const OrderedStringSet& aHubs, QueueItemBase::DownloadType aType, bool aExpectFound) {
+	const int calls = 20;
+
+	QueueItemPtr found;
+	auto nextTime = measure([&] {
+		for (int i = 0; i < calls; ++i) {
+			string lastError;
+			bool hasDownload = false;
+			found = aQueue.userQueue.getNext(aUser.user, QueueTokenSet(), aHubs, lastError, hasDownload, Priority::LOWEST, 0, 1024 * 1024, aType);
+		}
+	});
+
+	QueueItemPtr expected;
+	auto scanTime = measure([&] {
+		for (int i = 0; i < calls; ++i) {
+			expected = checkAll(aUser.user, aQueue, aHubs, aType);
+		}
+	});
+
+	std::cout << aName << ": " << nextTime * 1000 / calls << " ms (checking each queued file: " << scanTime * 1000 / calls << " ms)" << std::endl;
+	if (!!found != aExpectFound || !!expected != aExpectFound) {
+		std::cout << "FAILED: " << (aExpectFound ? "no file was found" : "a file was found") << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	char tempPath[] = "/tmp/airdcpp-benchmark-XXXXXX";
+	if (!mkdtemp(tempPath)) {
+		std::cerr << "Failed to create a temporary config directory" << std::endl;
+		return 1;
+	}
+
+	Util::initialize(string(tempPath) + PATH_SEPARATOR_STR);
+
+	ResourceManager::newInstance();
+	SettingsManager::newInstance();
+	LogManager::newInstance();
+	TimerManager::newInstance();
+	ClientManager::newInstance();
+	ConnectionManager::newInstance();
+
+	SettingsManager::getInstance()->set(SettingsManager::OVERLAP_SLOW_SOURCES, true);
+
+	auto bundles = argc > 1 ? Util::toUInt32(argv[1]) : 5;
+	auto files = argc > 2 ? Util::toUInt32(argv[2]) : 10000;
+
+	const string hubUrl = "adc://hub.example.com:1511";
+	HintedUser user(ClientManager::getInstance()->getUser(CID::generate()), hubUrl);
+	OrderedStringSet hubs = { hubUrl };
+
+	int errors = 0;
+	{
+		Queue queue;
+		createQueue(user, bundles, files, queue);
+		std::cout << queue.items.size() << " queued files in " << queue.bundles.size() << " bundles" << std::endl;
+
+		errors += test("Normal connection", queue, user, hubs, QueueItem::TYPE_ANY, true);
+
+		// There are no small files in bundles
+		errors += test("Small file connection", queue, user, hubs, QueueItem::TYPE_SMALL, false);
+
+		// All files are unavailable from the current hubs
+		for (auto& qi: queue.items) {
+			qi->getSource(user)->blockedHubs.insert(hubUrl);
+		}
+
+		errors += test("Blocked hubs", queue, user, hubs, QueueItem::TYPE_ANY, false);
+
+		for (auto& qi: queue.items) {
+			queue.userQueue.removeQI(qi);
+		}
+	}
+
+	ConnectionManager::deleteInstance();
+	ClientManager::deleteInstance();
+	TimerManager::deleteInstance();
+	LogManager::deleteInstance();
+	SettingsManager::deleteInstance();
+	ResourceManager::deleteInstance();
+
+	return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2011-2019 AirDC++ Project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+// Measures the parsing throughput of file lists with the string-based and the view-based
+// SimpleXMLReader callbacks and verifies that both APIs (and chunked parsing) produce the same events
+//
+// Usage: airdcpp-xml-parsing-benchmark [files.xml.bz2 | files.xml]...
+// A generated file list is used if no files are given
+
+#include <airdcpp/stdinc.h>
+
+#include <airdcpp/BZUtils.h>
+#include <airdcpp/Encoder.h>
+#include <airdcpp/File.h>
+#include <airdcpp/FilteredFile.h>
+#include <airdcpp/SimpleXML.h>
+#include <airdcpp/SimpleXMLReader.h>
+#include <airdcpp/Util.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+using namespace dcpp;
+
+static const string sFile = "File";
+static const string sDirectory = "Directory";
+static const string sName = "Name";
+static const string sSize = "Size";
+static const string sTTH = "TTH";
+
+struct LoadResult {
+	size_t items = 0;
+	int64_t totalSize = 0;
+};
+
+// Reads the file list attributes like DirectoryListing does
+class StringLoader : public SimpleXMLReader::CallBack, public LoadResult {
+public:
+	void startTag(const string& aName, StringPairList& attribs, bool) {
+		if (aName == sFile) {
+			items += !getAttrib(attribs, sName, 0).empty();
+			totalSize += Util::toInt64(getAttrib(attribs, sSize, 1));
+			items += !getAttrib(attribs, sTTH, 2).empty();
+		} else if (aName == sDirectory) {
+			items += !getAttrib(attribs, sName, 0).empty();
+		}
+	}
+};
+
+class ViewLoader : public SimpleXMLReader::CallBack, public LoadResult {
+public:
+	void startTagView(const string& aName, const SimpleXMLReader::Attribs& attribs, bool) {
+		if (aName == sFile) {
+			items += !getAttrib(attribs, sName, 0).empty();
+			totalSize += Util::toInt64(getAttrib(attribs, sSize, 1).to_string());
+			items += !getAttrib(attribs, sTTH, 2).empty();
+		} else if (aName == sDirectory) {
+			items += !getAttrib(attribs, sName, 0).empty();
+		}
+	}
+};
+
+// Records all events as strings
+class Recorder : public SimpleXMLReader::CallBack {
+public:
+	Recorder(bool aViews) : views(aViews) { }
+
+	StringList events;
+
+	void startTag(const string& aName, StringPairList& attribs, bool aSimple) {
+		dcassert(!views);
+
+		auto e = "S " + aName + (aSimple ? " /" : "");
+		for (const auto& a: attribs) {
+			e += " " + a.first + "=" + a.second;
+		}
+
+		events.push_back(e);
+	}
+
+	void startTagView(const string& aName, const SimpleXMLReader::Attribs& attribs, bool aSimple) {
+		if (!views) {
+			SimpleXMLReader::CallBack::startTagView(aName, attribs, aSimple);
+			return;
+		}
+
+		auto e = "S " + aName + (aSimple ? " /" : "");
+		for (const auto& a: attribs) {
+			e += " " + a.first.to_string() + "=" + a.second.to_string();
+		}
+
+		events.push_back(e);
+	}
+
+	void data(const string& aData) {
+		events.push_back("D " + aData);
+	}
+
+	void endTag(const string& aName) {
+		events.push_back("E " + aName);
+	}
+private:
+	const bool views;
+};
+
+static string generateList() {
+	std::mt19937 random(1);
+	string xml = "<?xml version=\"1.0\" encoding=\"utf-8\" standalone=\"yes\"?>\r\n<FileListing Version=\"1\" Base=\"/\" Generator=\"DC++ 0.868\">\r\n";
+
+	string tmp;
+	uint8_t tth[24];
+	for (size_t directory = 0; directory < 20000; ++directory) {
+		auto name = "Directory " + Util::toString(directory) + (directory % 10 == 0 ? " & \xc3\xa4\xc3\xb6" : "");
+		xml += "\t<Directory Name=\"" + SimpleXML::escape(name, tmp, true) + "\" Date=\"" + Util::toString(1500000000 + random() % 100000000) + "\">\r\n";
+
+		auto files = random() % 30;
+		for (size_t f = 0; f < files; ++f) {
+			for (auto& b: tth) {
+				b = static_cast<uint8_t>(random());
+			}
+
+			name = "Some file name " + Util::toString(random() % 1000) + (f % 7 == 0 ? " <\xe2\x82\xac>" : "") + ".ext";
+			xml += "\t\t<File Name=\"" + SimpleXML::escape(name, tmp, true) + "\" Size=\"" + Util::toString(random()) + "\" TTH=\"" + Encoder::toBase32(tth, sizeof(tth)) + "\"/>\r\n";
+		}
+
+		xml += "\t</Directory>\r\n";
+	}
+
+	xml += "</FileListing>";
+	return xml;
+}
+
+static string readList(const string& aPath) {
+	if (Util::getFileExt(aPath) == ".bz2") {
+		File f(aPath, File::READ, File::OPEN);
+		FilteredInputStream<UnBZFilter, false> is(&f);
+
+		string ret;
+		char buf[64 * 1024];
+		for (;;) {
+			size_t len = sizeof(buf);
+			len = is.read(buf, len);
+			if (len == 0) {
+				break;
+			}
+
+			ret.append(buf, len);
+		}
+
+		return ret;
+	}
+
+	return File(aPath, File::READ, File::OPEN).read();
+}
+
+template<class F>
+static double measure(F&& aFunc) {
+	// Best of several runs
+	double best = 0;
+	for (int i = 0; i < 5; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		aFunc();
+		auto time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (i == 0 || time < best) {
+			best = time;
+		}
+	}
+
+	return best;
+}
+
+static int test(const string& aName, const string& aXml) {
+	int errors = 0;
+	std::cout << aName << ": " << aXml.size() << " bytes" << std::endl;
+
+	// Compare the events
+	{
+		Recorder strings(false);
+		SimpleXMLReader(&strings).parse(aXml);
+
+		Recorder views(true);
+		SimpleXMLReader(&views).parse(aXml);
+
+		// Random chunk sizes
+		Recorder chunked(true);
+		{
+			std::mt19937 random(1);
+			SimpleXMLReader reader(&chunked);
+			for (size_t pos = 0; pos < aXml.size();) {
+				auto len = min(static_cast<size_t>(random() % 100 + 1), aXml.size() - pos);
+				reader.parse(aXml.data() + pos, len);
+				pos += len;
+			}
+		}
+
+		if (strings.events != views.events) {
+			std::cout << "FAILED: the string and view callbacks received different events" << std::endl;
+			errors++;
+		}
+
+		if (views.events != chunked.events) {
+			std::cout << "FAILED: chunked parsing produced different events" << std::endl;
+			errors++;
+		}
+	}
+
+	LoadResult stringResult;
+	auto stringTime = measure([&] {
+		StringLoader loader;
+		SimpleXMLReader(&loader).parse(aXml);
+		stringResult = loader;
+	});
+
+	LoadResult viewResult;
+	auto viewTime = measure([&] {
+		ViewLoader loader;
+		SimpleXMLReader(&loader).parse(aXml);
+		viewResult = loader;
+	});
+
+	if (stringResult.items != viewResult.items || stringResult.totalSize != viewResult.totalSize) {
+		std::cout << "FAILED: the loaders read different content" << std::endl;
+		errors++;
+	}
+
+	auto mbps = [&](double aTime) { return static_cast<double>(aXml.size()) / aTime / (1024 * 1024); };
+	std::cout << "string attributes: " << stringTime * 1000 << " ms (" << mbps(stringTime) << " MiB/s), "
+		<< "attribute views: " << viewTime * 1000 << " ms (" << mbps(viewTime) << " MiB/s)" << std::endl;
+
+	return errors;
+}
+
+int main(int argc, char* argv[]) {
+	int errors = 0;
+
+	try {
+		if (argc < 2) {
+			errors += test("Generated list", generateList());
+		}
+
+		for (int i = 1; i < argc; ++i) {
+			errors += test(argv[i], readList(argv[i]));
+		}
+	} catch (const Exception& e) {
+		std::cout << "FAILED: " << e.getError() << std::endl;
+		return 1;
+	}
+
+	std::cout << (errors == 0 ? "All parsers produced the same events" : Util::toString(errors) + " errors") << std::endl;
+	return errors == 0 ? 0 : 1;
+}
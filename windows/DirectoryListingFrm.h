@@ -312,7 +312,7 @@ private:
 
 		int getImageIndex() const;
 		DupeType getDupe() const { return type == DIRECTORY ? dir->getDupe() : file->getDupe(); }
-		const string& getName() const { return type == DIRECTORY ? dir->getName() : file->getName(); }
+		string getName() const { return type == DIRECTORY ? dir->getName() : file->getName(); }
 		string getAdcPath() const { return type == DIRECTORY ? dir->getAdcPath() : file->getAdcPath(); }
 		bool isAdl() const { return type == DIRECTORY ? dir->getAdls() : file->getAdls(); }
 
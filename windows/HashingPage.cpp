@@ -64,7 +64,7 @@ LRESULT HashingPage::onInitDialog(UINT /*uMsg*/, WPARAM /*wParam*/, LPARAM /*lPa
 
 	//hashing
 	setMinMax(IDC_HASH_SPIN, 0, 9999);
-	setMinMax(IDC_VOL_HASHERS_SPIN, 1, 30);
+	setMinMax(IDC_VOL_HASHERS_SPIN, 0, 30);
 	setMinMax(IDC_HASHING_THREADS_SPIN, 1, 50);
 
 	CheckDlgButton(IDC_REPAIR_HASHDB, HashManager::getInstance()->isRepairScheduled());